@@ -24,6 +24,7 @@ requires+=(
 	gobject-introspection
 	intltool
 	itstool
+	libarchive
 	libayatana-appindicator
 	libxss
 	libgtop
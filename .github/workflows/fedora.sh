@@ -28,6 +28,7 @@ requires+=(
 	iso-codes-devel
 	itstool
 	libappindicator-gtk3-devel
+	libarchive-devel
 	libSM-devel
 	libXScrnSaver-devel
 	libcanberra-devel
@@ -924,21 +924,12 @@ reload_wallpapers (AppearanceData *data)
   gtk_tree_model_foreach (data->wp_model, (GtkTreeModelForeachFunc)reload_item, data);
 }
 
-static gboolean
-wp_load_stuffs (void *user_data)
+static void
+wp_select_current (AppearanceData *data)
 {
-  AppearanceData *data;
   gchar *imagepath, *uri, *style;
   MateWPItem *item;
 
-  data = (AppearanceData *) user_data;
-
-  compute_thumbnail_sizes (data);
-
-  mate_wp_xml_load_list (data);
-  g_hash_table_foreach (data->wp_hash, (GHFunc) wp_props_load_wallpaper,
-                        data);
-
   style = g_settings_get_string (data->wp_settings,
                                    WP_OPTIONS_KEY);
   if (style == NULL)
@@ -1018,6 +1009,36 @@ wp_load_stuffs (void *user_data)
     wp_add_images (data, data->wp_uris);
     data->wp_uris = NULL;
   }
+}
+
+static void
+wp_items_loaded (AppearanceData *data,
+                 GList *items,
+                 gboolean finished)
+{
+  GList *l;
+
+  for (l = items; l != NULL; l = l->next)
+  {
+    MateWPItem *item = l->data;
+
+    wp_props_load_wallpaper (item->filename, item, data);
+  }
+
+  if (finished)
+    wp_select_current (data);
+}
+
+static gboolean
+wp_load_stuffs (void *user_data)
+{
+  AppearanceData *data;
+
+  data = (AppearanceData *) user_data;
+
+  compute_thumbnail_sizes (data);
+
+  mate_wp_xml_load_list (data, wp_items_loaded);
 
   return FALSE;
 }
@@ -1231,6 +1252,7 @@ desktop_init (AppearanceData *data,
   g_free (url);
 
   data->wp_hash = g_hash_table_new (g_str_hash, g_str_equal);
+  data->wp_cancellable = NULL;
 
   g_signal_connect (data->wp_settings,
                            "changed::" WP_FILE_KEY,
@@ -36,16 +36,19 @@
 #define GSETTINGS_KEY      "GSETTINGS_KEY"
 #define THEME_DATA         "THEME_DATA"
 
-typedef void (* ThumbnailGenFunc) (void               *type,
-				   ThemeThumbnailFunc  theme,
-				   AppearanceData     *data,
-				   GDestroyNotify     *destroy);
+/* number of cached thumbnails loaded, or thumbnails requested, per idle */
+#define THUMBNAIL_BATCH_SIZE 4
 
 typedef struct {
   AppearanceData *data;
   GdkPixbuf *thumbnail;
 } ThemeConvData;
 
+typedef struct {
+  gchar *name;
+  GdkPixbuf *default_thumb;
+} ThumbnailRequest;
+
 static void update_message_area (AppearanceData *data);
 static void create_thumbnail (const gchar *name, GdkPixbuf *default_thumb, AppearanceData *data);
 
@@ -768,11 +771,50 @@ update_thumbnail_in_treeview (const gchar *tv_name,
   }
 }
 
+static GdkPixbuf *
+lookup_cached_thumbnail (ThemeType type, MateThemeCommonInfo *theme, AppearanceData *data)
+{
+  GdkPixbuf *pixbuf;
+  gchar *scheme = NULL;
+  gchar *font;
+
+  if (type == THEME_TYPE_GTK)
+    scheme = gtkrc_get_color_scheme_for_theme (theme->name);
+  font = g_settings_get_string (data->interface_settings, GTK_FONT_KEY);
+
+  pixbuf = theme_thumbnail_cache_lookup (type, theme->path, scheme, font);
+  g_free (scheme);
+  g_free (font);
+
+  return pixbuf;
+}
+
+static void
+save_cached_thumbnail (ThemeType type, MateThemeCommonInfo *theme, GdkPixbuf *pixbuf, AppearanceData *data)
+{
+  gchar *scheme = NULL;
+  gchar *font;
+
+  if (theme == NULL || pixbuf == NULL)
+    return;
+
+  if (type == THEME_TYPE_GTK)
+    scheme = gtkrc_get_color_scheme_for_theme (theme->name);
+  font = g_settings_get_string (data->interface_settings, GTK_FONT_KEY);
+
+  theme_thumbnail_cache_save (pixbuf, type, theme->path, scheme, font);
+  g_free (scheme);
+  g_free (font);
+}
+
 static void
 gtk_theme_thumbnail_cb (GdkPixbuf *pixbuf,
                         gchar *theme_name,
                         AppearanceData *data)
 {
+  save_cached_thumbnail (THEME_TYPE_GTK,
+                         (MateThemeCommonInfo *) mate_theme_info_find (theme_name),
+                         pixbuf, data);
   update_thumbnail_in_treeview ("gtk_themes_list", theme_name, pixbuf, data);
 }
 
@@ -781,6 +823,9 @@ marco_theme_thumbnail_cb (GdkPixbuf *pixbuf,
                              gchar *theme_name,
                              AppearanceData *data)
 {
+  save_cached_thumbnail (THEME_TYPE_WINDOW,
+                         (MateThemeCommonInfo *) mate_theme_info_find (theme_name),
+                         pixbuf, data);
   update_thumbnail_in_treeview ("window_themes_list", theme_name, pixbuf, data);
 }
 
@@ -789,9 +834,47 @@ icon_theme_thumbnail_cb (GdkPixbuf *pixbuf,
                          gchar *theme_name,
                          AppearanceData *data)
 {
+  save_cached_thumbnail (THEME_TYPE_ICON,
+                         (MateThemeCommonInfo *) mate_theme_icon_info_find (theme_name),
+                         pixbuf, data);
   update_thumbnail_in_treeview ("icon_themes_list", theme_name, pixbuf, data);
 }
 
+/* Shows the cached thumbnail of a theme if there is one, and renders it
+ * otherwise. */
+static void
+request_thumbnail (ThemeType type, MateThemeCommonInfo *theme, AppearanceData *data)
+{
+  GdkPixbuf *pixbuf;
+
+  pixbuf = lookup_cached_thumbnail (type, theme, data);
+
+  if (pixbuf != NULL) {
+    const gchar *tv_name;
+
+    if (type == THEME_TYPE_GTK)
+      tv_name = "gtk_themes_list";
+    else if (type == THEME_TYPE_WINDOW)
+      tv_name = "window_themes_list";
+    else
+      tv_name = "icon_themes_list";
+
+    update_thumbnail_in_treeview (tv_name, theme->name, pixbuf, data);
+    g_object_unref (pixbuf);
+    return;
+  }
+
+  if (type == THEME_TYPE_GTK)
+    generate_gtk_theme_thumbnail_async ((MateThemeInfo *) theme,
+        (ThemeThumbnailFunc) gtk_theme_thumbnail_cb, data, NULL);
+  else if (type == THEME_TYPE_WINDOW)
+    generate_marco_theme_thumbnail_async ((MateThemeInfo *) theme,
+        (ThemeThumbnailFunc) marco_theme_thumbnail_cb, data, NULL);
+  else if (type == THEME_TYPE_ICON)
+    generate_icon_theme_thumbnail_async ((MateThemeIconInfo *) theme,
+        (ThemeThumbnailFunc) icon_theme_thumbnail_cb, data, NULL);
+}
+
 static void
 create_thumbnail (const gchar *name, GdkPixbuf *default_thumb, AppearanceData *data)
 {
@@ -799,26 +882,71 @@ create_thumbnail (const gchar *name, GdkPixbuf *default_thumb, AppearanceData *d
     MateThemeIconInfo *info;
     info = mate_theme_icon_info_find (name);
     if (info != NULL) {
-      generate_icon_theme_thumbnail_async (info,
-          (ThemeThumbnailFunc) icon_theme_thumbnail_cb, data, NULL);
+      request_thumbnail (THEME_TYPE_ICON, (MateThemeCommonInfo *) info, data);
     }
   } else if (default_thumb == data->gtk_theme_icon) {
     MateThemeInfo *info;
     info = mate_theme_info_find (name);
     if (info != NULL && info->has_gtk) {
-      generate_gtk_theme_thumbnail_async (info,
-          (ThemeThumbnailFunc) gtk_theme_thumbnail_cb, data, NULL);
+      request_thumbnail (THEME_TYPE_GTK, (MateThemeCommonInfo *) info, data);
     }
   } else if (default_thumb == data->window_theme_icon) {
     MateThemeInfo *info;
     info = mate_theme_info_find (name);
     if (info != NULL && info->has_marco) {
-      generate_marco_theme_thumbnail_async (info,
-          (ThemeThumbnailFunc) marco_theme_thumbnail_cb, data, NULL);
+      request_thumbnail (THEME_TYPE_WINDOW, (MateThemeCommonInfo *) info, data);
     }
   }
 }
 
+static void
+thumbnail_request_free (ThumbnailRequest *request)
+{
+  g_free (request->name);
+  g_free (request);
+}
+
+/* Loads or renders the thumbnails of the themes listed by prepare_list, a
+ * few at a time, so that the lists show up before all of them are read. */
+static gboolean
+thumbnail_queue_idle_cb (AppearanceData *data)
+{
+  gint i;
+
+  /* clean the cache before the first thumbnails are saved in it */
+  theme_thumbnail_cache_prune ();
+
+  for (i = 0; i < THUMBNAIL_BATCH_SIZE; i++) {
+    ThumbnailRequest *request = g_queue_pop_head (data->thumbnail_queue);
+
+    if (request == NULL)
+      break;
+
+    create_thumbnail (request->name, request->default_thumb, data);
+    thumbnail_request_free (request);
+  }
+
+  if (!g_queue_is_empty (data->thumbnail_queue))
+    return G_SOURCE_CONTINUE;
+
+  data->thumbnail_idle_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+static void
+queue_thumbnail (const gchar *name, GdkPixbuf *default_thumb, AppearanceData *data)
+{
+  ThumbnailRequest *request;
+
+  request = g_new (ThumbnailRequest, 1);
+  request->name = g_strdup (name);
+  request->default_thumb = default_thumb;
+  g_queue_push_tail (data->thumbnail_queue, request);
+
+  if (data->thumbnail_idle_id == 0)
+    data->thumbnail_idle_id = g_idle_add ((GSourceFunc) thumbnail_queue_idle_cb, data);
+}
+
 static void
 changed_on_disk_cb (MateThemeCommonInfo *theme,
 		    MateThemeChangeType  change_type,
@@ -841,8 +969,7 @@ changed_on_disk_cb (MateThemeCommonInfo *theme,
         else if (change_type == MATE_THEME_CHANGE_CHANGED)
           update_in_treeview ("gtk_themes_list", info->name, info->name, data);
 
-        generate_gtk_theme_thumbnail_async (info,
-            (ThemeThumbnailFunc) gtk_theme_thumbnail_cb, data, NULL);
+        request_thumbnail (THEME_TYPE_GTK, theme, data);
       }
 
       if (element_type & MATE_THEME_MARCO) {
@@ -851,8 +978,7 @@ changed_on_disk_cb (MateThemeCommonInfo *theme,
         else if (change_type == MATE_THEME_CHANGE_CHANGED)
           update_in_treeview ("window_themes_list", info->name, info->name, data);
 
-        generate_marco_theme_thumbnail_async (info,
-            (ThemeThumbnailFunc) marco_theme_thumbnail_cb, data, NULL);
+        request_thumbnail (THEME_TYPE_WINDOW, theme, data);
       }
     }
 
@@ -867,8 +993,7 @@ changed_on_disk_cb (MateThemeCommonInfo *theme,
       else if (change_type == MATE_THEME_CHANGE_CHANGED)
         update_in_treeview ("icon_themes_list", info->name, info->readable_name, data);
 
-      generate_icon_theme_thumbnail_async (info,
-          (ThemeThumbnailFunc) icon_theme_thumbnail_cb, data, NULL);
+      request_thumbnail (THEME_TYPE_ICON, theme, data);
     }
 
   } else if (theme->type == MATE_THEME_TYPE_CURSOR) {
@@ -895,8 +1020,6 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
   GtkTreeModel *sort_model;
   GdkPixbuf *thumbnail;
   const gchar *key;
-  ThumbnailGenFunc generator;
-  ThemeThumbnailFunc thumb_cb;
   ThemeConvData *conv_data;
   GSettings *settings;
 
@@ -907,8 +1030,6 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
       thumbnail = data->gtk_theme_icon;
       settings = data->interface_settings;
       key = GTK_THEME_KEY;
-      generator = (ThumbnailGenFunc) generate_gtk_theme_thumbnail_async;
-      thumb_cb = (ThemeThumbnailFunc) gtk_theme_thumbnail_cb;
       break;
 
     case THEME_TYPE_WINDOW:
@@ -916,8 +1037,6 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
       thumbnail = data->window_theme_icon;
       settings = data->marco_settings;
       key = MARCO_THEME_KEY;
-      generator = (ThumbnailGenFunc) generate_marco_theme_thumbnail_async;
-      thumb_cb = (ThemeThumbnailFunc) marco_theme_thumbnail_cb;
       break;
 
     case THEME_TYPE_ICON:
@@ -925,8 +1044,6 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
       thumbnail = data->icon_theme_icon;
       settings = data->interface_settings;
       key = ICON_THEME_KEY;
-      generator = (ThumbnailGenFunc) generate_icon_theme_thumbnail_async;
-      thumb_cb = (ThemeThumbnailFunc) icon_theme_thumbnail_cb;
       break;
 
     case THEME_TYPE_CURSOR:
@@ -934,8 +1051,6 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
       thumbnail = NULL;
       settings = data->mouse_settings;
       key = CURSOR_THEME_KEY;
-      generator = NULL;
-      thumb_cb = NULL;
       break;
 
     default:
@@ -950,11 +1065,10 @@ prepare_list (AppearanceData *data, GtkWidget *list, ThemeType type, GCallback c
     MateThemeCommonInfo *theme = (MateThemeCommonInfo *) l->data;
     GtkTreeIter i;
 
-    if (type == THEME_TYPE_CURSOR) {
+    if (type == THEME_TYPE_CURSOR)
       thumbnail = ((MateThemeCursorInfo *) theme)->thumbnail;
-    } else {
-      generator (theme, thumb_cb, data, NULL);
-    }
+    else
+      queue_thumbnail (theme->name, thumbnail, data);
 
     gtk_list_store_insert_with_values (store, &i, 0,
                                        COL_LABEL, theme->readable_name,
@@ -1047,6 +1161,8 @@ style_init (AppearanceData *data)
   data->style_message_area = NULL;
   data->style_message_label = NULL;
   data->style_install_button = NULL;
+  data->thumbnail_queue = g_queue_new ();
+  data->thumbnail_idle_id = 0;
 
   w = appearance_capplet_get_widget (data, "theme_details");
   g_signal_connect (w, "response", (GCallback) style_response_cb, NULL);
@@ -1104,6 +1220,10 @@ style_init (AppearanceData *data)
 void
 style_shutdown (AppearanceData *data)
 {
+  if (data->thumbnail_idle_id != 0)
+    g_source_remove (data->thumbnail_idle_id);
+  if (data->thumbnail_queue)
+    g_queue_free_full (data->thumbnail_queue, (GDestroyNotify) thumbnail_request_free);
   if (data->gtk_theme_icon)
     g_object_unref (data->gtk_theme_icon);
   if (data->window_theme_icon)
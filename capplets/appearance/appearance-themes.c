@@ -159,6 +159,40 @@ static void theme_thumbnail_generate(MateThemeMetaInfo* info, AppearanceData* da
 	}
 }
 
+/* Let the thumbnails of the rows on screen jump the factory queue */
+static void
+theme_thumbnail_prioritize_visible (GtkIconView *icon_view)
+{
+  GtkTreePath *start, *end;
+  GtkTreeModel *model;
+
+  if (!gtk_icon_view_get_visible_range (icon_view, &start, &end))
+    return;
+
+  model = gtk_icon_view_get_model (icon_view);
+
+  /* go bottom-up, so that the topmost row ends up first in line */
+  do {
+    GtkTreeIter iter;
+    gchar *name;
+
+    if (gtk_tree_model_get_iter (model, &iter, end)) {
+      gtk_tree_model_get (model, &iter, COL_NAME, &name, -1);
+      theme_thumbnail_prioritize ((ThemeThumbnailFunc) theme_thumbnail_done_cb, name);
+      g_free (name);
+    }
+  } while (gtk_tree_path_compare (start, end) < 0 && gtk_tree_path_prev (end));
+
+  gtk_tree_path_free (start);
+  gtk_tree_path_free (end);
+}
+
+static void
+theme_list_scrolled_cb (GtkAdjustment *adjustment, GtkIconView *icon_view)
+{
+  theme_thumbnail_prioritize_visible (icon_view);
+}
+
 static void theme_changed_on_disk_cb(MateThemeCommonInfo* theme, MateThemeChangeType change_type, MateThemeElement element_type, AppearanceData* data)
 {
 	if (theme->type == MATE_THEME_TYPE_METATHEME)
@@ -981,6 +1015,7 @@ void themes_init(AppearanceData* data)
   GtkTreeModel *sort_model;
   MateThemeMetaInfo *meta_theme = NULL;
   GtkIconView *icon_view;
+  GtkAdjustment *adjustment;
   GtkCellRenderer *renderer;
   GtkSettings *settings;
   char *url;
@@ -1068,6 +1103,10 @@ void themes_init(AppearanceData* data)
   g_signal_connect (icon_view, "selection-changed", (GCallback) theme_selection_changed_cb, data);
   g_signal_connect_after (icon_view, "realize", (GCallback) theme_select_name, meta_theme->name);
 
+  adjustment = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (icon_view));
+  g_signal_connect (adjustment, "value-changed", (GCallback) theme_list_scrolled_cb, icon_view);
+  g_signal_connect (adjustment, "changed", (GCallback) theme_list_scrolled_cb, icon_view);
+
   w = appearance_capplet_get_widget (data, "theme_install");
   g_signal_connect (w, "clicked", (GCallback) theme_install_cb, data);
 
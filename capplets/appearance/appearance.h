@@ -117,6 +117,8 @@ typedef struct {
 	GtkFileChooser* wp_filesel;
 	GtkWidget* wp_image;
 	GSList* wp_uris;
+	/* set while the wallpaper list is being read */
+	GCancellable* wp_cancellable;
 	gint frame;
 	gint thumb_width;
 	gint thumb_height;
@@ -151,6 +153,8 @@ typedef struct {
 	GtkWidget* style_message_area;
 	GtkWidget* style_message_label;
 	GtkWidget* style_install_button;
+	GQueue* thumbnail_queue;
+	guint thumbnail_idle_id;
 } AppearanceData;
 
 #define appearance_capplet_get_widget(x, y) (GtkWidget*) gtk_builder_get_object(x->ui, y)
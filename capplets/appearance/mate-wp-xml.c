@@ -21,7 +21,9 @@
 #include "appearance.h"
 #include "mate-wp-xml.h"
 #include "mate-wp-item.h"
+#include "cache-util.h"
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <libxml/parser.h>
 #include <errno.h>
@@ -67,7 +69,187 @@ static void mate_wp_xml_set_bool(const xmlNode* parent, const xmlChar* prop_name
 	}
 }
 
-static void mate_wp_load_legacy(AppearanceData* data)
+/* A wallpaper as read from one of the lists, before it becomes a
+ * MateWPItem. Options and shading are -1 and the colors NULL when the list
+ * does not give them; the current settings fill them in on the main thread.
+ */
+typedef struct {
+	char* filename;
+	char* name;
+	gint options;
+	gint shade_type;
+	char* pcolor;
+	char* scolor;
+	char* artist;
+	gboolean deleted;
+	/* from the GNOME 2 list, which only has file names */
+	gboolean legacy;
+	MateWPInfo* fileinfo;
+} MateWPXmlEntry;
+
+static MateWPXmlEntry* mate_wp_xml_entry_new(void)
+{
+	MateWPXmlEntry* entry = g_new0(MateWPXmlEntry, 1);
+
+	entry->options = -1;
+	entry->shade_type = -1;
+
+	return entry;
+}
+
+static void mate_wp_xml_entry_free(MateWPXmlEntry* entry)
+{
+	g_free(entry->filename);
+	g_free(entry->name);
+	g_free(entry->pcolor);
+	g_free(entry->scolor);
+	g_free(entry->artist);
+	mate_wp_info_free(entry->fileinfo);
+	g_free(entry);
+}
+
+/* Adds the entry unless one for the same file came first. */
+static void mate_wp_xml_entry_add(GPtrArray* entries, GHashTable* seen, MateWPXmlEntry* entry)
+{
+	if (seen != NULL)
+	{
+		if (g_hash_table_contains(seen, entry->filename))
+		{
+			mate_wp_xml_entry_free(entry);
+			return;
+		}
+
+		g_hash_table_add(seen, entry->filename);
+	}
+
+	g_ptr_array_add(entries, entry);
+}
+
+/* Checks that the wallpaper is still there and reads its file info; this
+ * does I/O, and is safe to call from a thread.
+ */
+static gboolean mate_wp_xml_entry_load_info(MateWPXmlEntry* entry, MateDesktopThumbnailFactory* thumbs)
+{
+	if (strcmp(entry->filename, "(none)") != 0 && !g_file_test(entry->filename, G_FILE_TEST_EXISTS))
+	{
+		return FALSE;
+	}
+
+	entry->fileinfo = mate_wp_info_new(entry->filename, thumbs);
+
+	if (entry->fileinfo == NULL)
+	{
+		return FALSE;
+	}
+
+	/* The GNOME 2 list has any file, and no names */
+	if (entry->legacy)
+	{
+		const char* mime_type = entry->fileinfo->mime_type;
+
+		if (mime_type == NULL ||
+		    (!g_str_has_prefix(mime_type, "image/") && strcmp(mime_type, "application/xml") != 0))
+		{
+			return FALSE;
+		}
+
+		if (g_utf8_validate(entry->fileinfo->name, -1, NULL))
+		{
+			entry->name = g_strdup(entry->fileinfo->name);
+		}
+		else
+		{
+			entry->name = g_filename_to_utf8(entry->fileinfo->name, -1, NULL, NULL, NULL);
+		}
+	}
+
+	return TRUE;
+}
+
+static MateWPItem* mate_wp_xml_entry_to_item(AppearanceData* data, MateWPXmlEntry* entry)
+{
+	MateWPItem* wp;
+	char* pcolor;
+	char* scolor;
+	GdkRGBA color1;
+	GdkRGBA color2;
+
+	/* Make sure we don't already have this one */
+	if (g_hash_table_lookup(data->wp_hash, entry->filename) != NULL)
+	{
+		return NULL;
+	}
+
+	wp = g_new0(MateWPItem, 1);
+
+	wp->filename = g_strdup(entry->filename);
+	wp->deleted = entry->deleted;
+	wp->fileinfo = entry->fileinfo;
+	entry->fileinfo = NULL;
+
+	if (entry->name == NULL || !strcmp(wp->filename, "(none)"))
+	{
+		wp->name = g_strdup(wp->fileinfo->name);
+	}
+	else
+	{
+		wp->name = g_strdup(entry->name);
+	}
+
+	if (entry->options != -1)
+	{
+		wp->options = entry->options;
+	}
+	else
+	{
+		wp->options = g_settings_get_enum(data->wp_settings, WP_OPTIONS_KEY);
+	}
+
+	if (entry->shade_type != -1)
+	{
+		wp->shade_type = entry->shade_type;
+	}
+	else
+	{
+		wp->shade_type = g_settings_get_enum(data->wp_settings, WP_SHADING_KEY);
+	}
+
+	if (entry->pcolor != NULL)
+	{
+		pcolor = g_strdup(entry->pcolor);
+	}
+	else
+	{
+		pcolor = g_settings_get_string(data->wp_settings, WP_PCOLOR_KEY);
+	}
+
+	if (entry->scolor != NULL)
+	{
+		scolor = g_strdup(entry->scolor);
+	}
+	else
+	{
+		scolor = g_settings_get_string(data->wp_settings, WP_SCOLOR_KEY);
+	}
+
+	wp->artist = g_strdup(entry->artist != NULL ? entry->artist : "(none)");
+
+	gdk_rgba_parse(&color1, pcolor);
+	gdk_rgba_parse(&color2, scolor);
+	g_free(pcolor);
+	g_free(scolor);
+
+	wp->pcolor = gdk_rgba_copy(&color1);
+	wp->scolor = gdk_rgba_copy(&color2);
+
+	mate_wp_item_ensure_mate_bg(wp);
+	mate_wp_item_update_description(wp);
+	g_hash_table_insert(data->wp_hash, wp->filename, wp);
+
+	return wp;
+}
+
+static void mate_wp_load_legacy(GPtrArray* entries, GHashTable* seen)
 {
 	/* Legacy of GNOME2
 	 * ~/.gnome2/wallpapers.list */
@@ -83,16 +265,14 @@ static void mate_wp_load_legacy(AppearanceData* data)
 
 			while (fgets(foo, 4096, fp))
 			{
-				MateWPItem * item;
+				MateWPXmlEntry* entry;
 
 				if (foo[strlen(foo) - 1] == '\n')
 				{
 					foo[strlen(foo) - 1] = '\0';
 				}
 
-				item = g_hash_table_lookup(data->wp_hash, foo);
-
-				if (item != NULL)
+				if (g_hash_table_contains(seen, foo))
 				{
 					continue;
 				}
@@ -102,12 +282,10 @@ static void mate_wp_load_legacy(AppearanceData* data)
 					continue;
 				}
 
-				item = mate_wp_item_new(foo, data->wp_hash, data->thumb_factory);
-
-				if (item != NULL && item->fileinfo == NULL)
-				{
-					mate_wp_item_free(item);
-				}
+				entry = mate_wp_xml_entry_new();
+				entry->filename = g_strdup(foo);
+				entry->legacy = TRUE;
+				mate_wp_xml_entry_add(entries, seen, entry);
 			}
 
 			fclose(fp);
@@ -118,7 +296,10 @@ static void mate_wp_load_legacy(AppearanceData* data)
 	g_free(filename);
 }
 
-static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
+/* Reads the wallpapers of one list into entries. Only libxml and plain file
+ * tests are used, so this can run in a thread.
+ */
+static void mate_wp_xml_parse(const char* filename, const char* const* syslangs, GPtrArray* entries, GHashTable* seen)
 {
 	xmlDoc* wplist;
 	xmlNode* root;
@@ -126,11 +307,8 @@ static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
 	xmlNode* wpa;
 	xmlChar* nodelang;
 #ifdef ENABLE_NLS
-	const char* const* syslangs;
 	gint i;
 #endif /* ENABLE_NLS */
-	GdkRGBA color1;
-	GdkRGBA color2;
 
 	wplist = xmlParseFile(filename);
 
@@ -139,21 +317,15 @@ static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
 		return;
 	}
 
-#ifdef ENABLE_NLS
-	syslangs = g_get_language_names();
-#endif /* ENABLE_NLS */
-
 	root = xmlDocGetRootElement(wplist);
 
 	for (list = root->children; list != NULL; list = list->next)
 	{
 		if (!strcmp((char*) list->name, "wallpaper"))
 		{
-			MateWPItem * wp;
-			char *pcolor = NULL, *scolor = NULL;
-			gboolean have_scale = FALSE, have_shade = FALSE, have_artist = FALSE;
+			MateWPXmlEntry* wp;
 
-			wp = g_new0(MateWPItem, 1);
+			wp = mate_wp_xml_entry_new();
 
 			wp->deleted = mate_wp_xml_get_bool(list, "deleted");
 
@@ -226,7 +398,6 @@ static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
 					if (wpa->last != NULL)
 					{
 						wp->options = wp_item_string_to_option(g_strstrip ((char *)wpa->last->content));
-						have_scale = TRUE;
 					}
 				}
 				else if (!strcmp ((char*) wpa->name, "shade_type"))
@@ -234,29 +405,30 @@ static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
 					if (wpa->last != NULL)
 					{
 						wp->shade_type = wp_item_string_to_shading(g_strstrip ((char *)wpa->last->content));
-						have_shade = TRUE;
 					}
 				}
 				else if (!strcmp ((char*) wpa->name, "pcolor"))
 				{
 					if (wpa->last != NULL)
 					{
-						pcolor = g_strdup(g_strstrip ((char *)wpa->last->content));
+						g_free(wp->pcolor);
+						wp->pcolor = g_strdup(g_strstrip ((char *)wpa->last->content));
 					}
 				}
 				else if (!strcmp ((char*) wpa->name, "scolor"))
 				{
 					if (wpa->last != NULL)
 					{
-						scolor = g_strdup(g_strstrip ((char *)wpa->last->content));
+						g_free(wp->scolor);
+						wp->scolor = g_strdup(g_strstrip ((char *)wpa->last->content));
 					}
 				}
 				else if (!strcmp ((char*) wpa->name, "artist"))
 				{
 					if (wpa->last != NULL)
 					{
+						g_free(wp->artist);
 						wp->artist = g_strdup (g_strstrip ((char *)wpa->last->content));
-						have_artist = TRUE;
 					}
 				}
 				else if (!strcmp ((char*) wpa->name, "text"))
@@ -269,73 +441,40 @@ static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
 				}
 			}
 
-			/* Make sure we don't already have this one and that filename exists */
-			if (wp->filename == NULL || g_hash_table_lookup (data->wp_hash, wp->filename) != NULL)
+			/* Make sure the filename is there */
+			if (wp->filename == NULL)
 			{
-
-				mate_wp_item_free (wp);
-				g_free (pcolor);
-				g_free (scolor);
+				mate_wp_xml_entry_free(wp);
 				continue;
 			}
 
-			/* Verify the colors and alloc some GdkRGBA here */
-			if (!have_scale)
-			{
-				wp->options = g_settings_get_enum(data->wp_settings, WP_OPTIONS_KEY);
-			}
-
-			if (!have_shade)
-			{
-				wp->shade_type = g_settings_get_enum(data->wp_settings, WP_SHADING_KEY);
-			}
-
-			if (pcolor == NULL)
-			{
-				pcolor = g_settings_get_string(data->wp_settings, WP_PCOLOR_KEY);
-			}
-
-			if (scolor == NULL)
-			{
-				scolor = g_settings_get_string (data->wp_settings, WP_SCOLOR_KEY);
-			}
+			mate_wp_xml_entry_add(entries, seen, wp);
+		}
+	}
 
-			if (!have_artist)
-			{
-				wp->artist = g_strdup ("(none)");
-			}
+	xmlFreeDoc(wplist);
+}
 
-			gdk_rgba_parse(&color1, pcolor);
-			gdk_rgba_parse(&color2, scolor);
-			g_free(pcolor);
-			g_free(scolor);
+static void mate_wp_xml_load_xml(AppearanceData* data, const char* filename)
+{
+	GPtrArray* entries;
+	guint i;
 
-			wp->pcolor = gdk_rgba_copy(&color1);
-			wp->scolor = gdk_rgba_copy(&color2);
+	entries = g_ptr_array_new_with_free_func((GDestroyNotify) mate_wp_xml_entry_free);
+	mate_wp_xml_parse(filename, g_get_language_names(), entries, NULL);
 
-			if ((wp->filename != NULL && g_file_test (wp->filename, G_FILE_TEST_EXISTS)) || !strcmp (wp->filename, "(none)"))
-			{
-				wp->fileinfo = mate_wp_info_new(wp->filename, data->thumb_factory);
-
-				if (wp->name == NULL || !strcmp(wp->filename, "(none)"))
-				{
-					g_free (wp->name);
-					wp->name = g_strdup (wp->fileinfo->name);
-				}
+	for (i = 0; i < entries->len; i++)
+	{
+		MateWPXmlEntry* entry = g_ptr_array_index(entries, i);
 
-				mate_wp_item_ensure_mate_bg (wp);
-				mate_wp_item_update_description (wp);
-				g_hash_table_insert (data->wp_hash, wp->filename, wp);
-			}
-			else
-			{
-				mate_wp_item_free(wp);
-				wp = NULL;
-			}
+		if (g_hash_table_lookup(data->wp_hash, entry->filename) == NULL &&
+		    mate_wp_xml_entry_load_info(entry, data->thumb_factory))
+		{
+			mate_wp_xml_entry_to_item(data, entry);
 		}
 	}
 
-	xmlFreeDoc(wplist);
+	g_ptr_array_unref(entries);
 }
 
 static void mate_wp_file_changed(GFileMonitor* monitor, GFile* file, GFile* other_file, GFileMonitorEvent event_type, AppearanceData* data)
@@ -373,18 +512,34 @@ static void mate_wp_xml_add_monitor(GFile* directory, AppearanceData* data)
 	g_signal_connect(monitor, "changed", G_CALLBACK(mate_wp_file_changed), data);
 }
 
-static void mate_wp_xml_load_from_dir(const char* path, AppearanceData* data)
+/* A list whose path can't go in the cache gets a stamp that never matches */
+#define MATE_WP_XML_STAMP_INVALID -2
+
+static void mate_wp_xml_add_stamp(GVariantBuilder* stamps, const char* path)
+{
+	GStatBuf buf;
+
+	if (!cache_util_string_valid(path))
+	{
+		g_variant_builder_add(stamps, "(sxx)", "", (gint64) MATE_WP_XML_STAMP_INVALID, (gint64) MATE_WP_XML_STAMP_INVALID);
+	}
+	else if (g_stat(path, &buf) == 0)
+	{
+		g_variant_builder_add(stamps, "(sxx)", path, (gint64) buf.st_mtime, (gint64) buf.st_size);
+	}
+	else
+	{
+		g_variant_builder_add(stamps, "(sxx)", path, (gint64) -1, (gint64) -1);
+	}
+}
+
+static void mate_wp_xml_load_from_dir(const char* path, const char* const* syslangs, GPtrArray* entries, GHashTable* seen, GVariantBuilder* stamps)
 {
 	GFile* directory;
 	GFileEnumerator* enumerator;
 	GError* error = NULL;
 	GFileInfo* info;
 
-	if (!g_file_test(path, G_FILE_TEST_IS_DIR))
-	{
-		return;
-	}
-
 	directory = g_file_new_for_path(path);
 	enumerator = g_file_enumerate_children(
 		directory,
@@ -408,60 +563,459 @@ static void mate_wp_xml_load_from_dir(const char* path, AppearanceData* data)
 
 		g_object_unref(info);
 
-		mate_wp_xml_load_xml(data, fullpath);
+		mate_wp_xml_add_stamp(stamps, fullpath);
+		mate_wp_xml_parse(fullpath, syslangs, entries, seen);
 		g_free(fullpath);
 	}
 
 	g_file_enumerator_close(enumerator, NULL, NULL);
+	g_object_unref(enumerator);
+	g_object_unref(directory);
+}
 
-	mate_wp_xml_add_monitor(directory, data);
+/* The user's own list: the one mate_wp_xml_save_list() writes, or the one
+ * older versions did. Returns NULL if there is neither.
+ */
+static char* mate_wp_xml_get_user_list(void)
+{
+	char* filename;
 
-	g_object_unref(directory);
+	filename = g_build_filename(g_get_user_config_dir(), "mate", "backgrounds.xml", NULL);
+
+	if (!g_file_test(filename, G_FILE_TEST_EXISTS))
+	{
+		g_free(filename);
+		filename = g_build_filename(g_get_user_config_dir(), "mate", "wp-list.xml", NULL);
+	}
+
+	if (!g_file_test(filename, G_FILE_TEST_EXISTS))
+	{
+		g_free(filename);
+		filename = NULL;
+	}
+
+	return filename;
 }
 
-void mate_wp_xml_load_list(AppearanceData* data)
+/* The directories of lists to read after the user's list, in order.
+ * Earlier lists win.
+ */
+static char** mate_wp_xml_get_sources(void)
 {
 	const char* const* system_data_dirs;
-	char* datadir;
-	char* wpdbfile;
+	GPtrArray* sources;
 	gint i;
 
-		wpdbfile = g_build_filename(g_get_user_config_dir(), "mate", "backgrounds.xml", NULL);
+	sources = g_ptr_array_new();
+
+	g_ptr_array_add(sources, g_build_filename(g_get_user_data_dir(), "mate-background-properties", NULL));
+
+	system_data_dirs = g_get_system_data_dirs();
 
-	if (g_file_test(wpdbfile, G_FILE_TEST_EXISTS))
+	for (i = 0; system_data_dirs[i]; i++)
 	{
-		mate_wp_xml_load_xml(data, wpdbfile);
+		g_ptr_array_add(sources, g_build_filename(system_data_dirs[i], "mate-background-properties", NULL));
 	}
-	else
+
+	g_ptr_array_add(sources, g_strdup(WALLPAPER_DATADIR));
+	g_ptr_array_add(sources, NULL);
+
+	return (char**) g_ptr_array_free(sources, FALSE);
+}
+
+static GPtrArray* mate_wp_xml_load_sources(char** sources, const char* const* syslangs, GVariantBuilder* stamps)
+{
+	GPtrArray* entries;
+	GHashTable* seen;
+	gint i;
+
+	entries = g_ptr_array_new_with_free_func((GDestroyNotify) mate_wp_xml_entry_free);
+	seen = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (i = 0; sources[i]; i++)
+	{
+		mate_wp_xml_add_stamp(stamps, sources[i]);
+
+		if (g_file_test(sources[i], G_FILE_TEST_IS_DIR))
+		{
+			mate_wp_xml_load_from_dir(sources[i], syslangs, entries, seen, stamps);
+		}
+	}
+
+	g_hash_table_destroy(seen);
+
+	return entries;
+}
+
+/* Catalogue cache
+ *
+ * The merged result of reading the list directories is kept in the user
+ * cache dir, along with the modification time and size of every list and
+ * list directory read. Adding or removing a list changes its directory,
+ * so the cache is used as long as none of those changed, and the sources
+ * and languages are the same. The user's own list is rewritten each time
+ * the capplet closes, so it is left out, and read on every load.
+ */
+#define MATE_WP_XML_CACHE_VERSION 3
+#define MATE_WP_XML_CACHE_ENTRY_TYPE "(smsiimsmsmsb)"
+#define MATE_WP_XML_CACHE_TYPE "(sasa(sxx)a" MATE_WP_XML_CACHE_ENTRY_TYPE ")"
+
+static gboolean mate_wp_xml_cache_check_stamps(GVariant* stamps)
+{
+	GVariantIter iter;
+	const char* path;
+	gint64 mtime;
+	gint64 size;
+
+	g_variant_iter_init(&iter, stamps);
+
+	while (g_variant_iter_next(&iter, "(&sxx)", &path, &mtime, &size))
 	{
-		g_free (wpdbfile);
+		GStatBuf buf;
 
-			wpdbfile = g_build_filename(g_get_user_config_dir(), "mate", "wp-list.xml", NULL);
+		if (mtime == MATE_WP_XML_STAMP_INVALID)
+		{
+			return FALSE;
+		}
 
-		if (g_file_test(wpdbfile, G_FILE_TEST_EXISTS))
+		if (g_stat(path, &buf) != 0)
+		{
+			if (mtime != -1)
+			{
+				return FALSE;
+			}
+		}
+		else if ((gint64) buf.st_mtime != mtime || (gint64) buf.st_size != size)
 		{
-			mate_wp_xml_load_xml(data, wpdbfile);
+			return FALSE;
 		}
 	}
 
-	g_free (wpdbfile);
+	return TRUE;
+}
 
-	datadir = g_build_filename(g_get_user_data_dir(), "mate-background-properties", NULL);
-	mate_wp_xml_load_from_dir(datadir, data);
-	g_free(datadir);
+static gboolean mate_wp_xml_cache_strings_valid(char** sources, const char* languages)
+{
+	gint i;
 
-	system_data_dirs = g_get_system_data_dirs();
+	for (i = 0; sources[i]; i++)
+	{
+		if (!cache_util_string_valid(sources[i]))
+		{
+			return FALSE;
+		}
+	}
 
-	for (i = 0; system_data_dirs[i]; i++)
+	return cache_util_string_valid(languages);
+}
+
+static GPtrArray* mate_wp_xml_cache_load(char** sources, const char* languages)
+{
+	GPtrArray* entries = NULL;
+	GVariant* root;
+	GVariant* stamps;
+	GVariant* items;
+	const char* cached_languages;
+	const char** cached_sources;
+
+	if (!mate_wp_xml_cache_strings_valid(sources, languages))
+	{
+		return NULL;
+	}
+
+	root = cache_util_load("wallpapers.cache", G_VARIANT_TYPE(MATE_WP_XML_CACHE_TYPE), MATE_WP_XML_CACHE_VERSION);
+
+	if (root == NULL)
 	{
-		datadir = g_build_filename(system_data_dirs[i], "mate-background-properties", NULL);
-		mate_wp_xml_load_from_dir(datadir, data);
-		g_free (datadir);
+		return NULL;
 	}
 
-	mate_wp_xml_load_from_dir(WALLPAPER_DATADIR, data);
+	g_variant_get(root, "(&s^a&s@a(sxx)@a" MATE_WP_XML_CACHE_ENTRY_TYPE ")",
+	              &cached_languages, &cached_sources, &stamps, &items);
+
+	if (strcmp(cached_languages, languages) == 0 &&
+	    g_strv_equal((const char* const*) sources, cached_sources) &&
+	    mate_wp_xml_cache_check_stamps(stamps))
+	{
+		GVariantIter iter;
+		const char* path;
+		const char* name;
+		gint32 options;
+		gint32 shade_type;
+		const char* pcolor;
+		const char* scolor;
+		const char* artist;
+		gboolean deleted;
+
+		entries = g_ptr_array_new_with_free_func((GDestroyNotify) mate_wp_xml_entry_free);
+
+		g_variant_iter_init(&iter, items);
 
-	mate_wp_load_legacy(data);
+		while (g_variant_iter_next(&iter, "(&sm&siim&sm&sm&sb)", &path, &name, &options, &shade_type, &pcolor, &scolor, &artist, &deleted))
+		{
+			MateWPXmlEntry* entry = mate_wp_xml_entry_new();
+
+			entry->filename = g_strdup(path);
+			entry->name = g_strdup(name);
+			entry->options = options;
+			entry->shade_type = shade_type;
+			entry->pcolor = g_strdup(pcolor);
+			entry->scolor = g_strdup(scolor);
+			entry->artist = g_strdup(artist);
+			entry->deleted = deleted;
+
+			g_ptr_array_add(entries, entry);
+		}
+	}
+
+	g_free(cached_sources);
+	g_variant_unref(stamps);
+	g_variant_unref(items);
+	g_variant_unref(root);
+
+	return entries;
+}
+
+static void mate_wp_xml_cache_save(char** sources, const char* languages, GVariant* stamps, GPtrArray* entries)
+{
+	GVariantBuilder items;
+	guint i;
+
+	if (!mate_wp_xml_cache_strings_valid(sources, languages))
+	{
+		g_variant_unref(g_variant_ref_sink(stamps));
+		return;
+	}
+
+	g_variant_builder_init(&items, G_VARIANT_TYPE("a" MATE_WP_XML_CACHE_ENTRY_TYPE));
+
+	for (i = 0; i < entries->len; i++)
+	{
+		MateWPXmlEntry* entry = g_ptr_array_index(entries, i);
+
+		g_variant_builder_add(&items, MATE_WP_XML_CACHE_ENTRY_TYPE,
+		                      entry->filename, entry->name,
+		                      entry->options, entry->shade_type,
+		                      entry->pcolor, entry->scolor, entry->artist,
+		                      entry->deleted);
+	}
+
+	cache_util_save("wallpapers.cache", MATE_WP_XML_CACHE_VERSION,
+	                g_variant_new("(s^as@a(sxx)@a" MATE_WP_XML_CACHE_ENTRY_TYPE ")",
+	                              languages, sources, stamps,
+	                              g_variant_builder_end(&items)));
+}
+
+/* The lists are read in a thread, and the wallpapers handed to the main
+ * thread in small batches, so the view fills in while the rest is read.
+ */
+#define MATE_WP_XML_BATCH_SIZE 16
+
+typedef struct {
+	AppearanceData* data;
+	MateWPXmlLoadFunc func;
+	GCancellable* cancellable;
+	MateDesktopThumbnailFactory* thumb_factory;
+	char** syslangs;
+	/* list directories found, monitored once the load is done */
+	GPtrArray* dirs;
+} MateWPXmlLoad;
+
+typedef struct {
+	MateWPXmlLoad* load;
+	GPtrArray* entries;
+	gboolean last;
+} MateWPXmlBatch;
+
+static void mate_wp_xml_load_free(MateWPXmlLoad* load)
+{
+	g_object_unref(load->cancellable);
+	g_object_unref(load->thumb_factory);
+	g_strfreev(load->syslangs);
+	g_ptr_array_unref(load->dirs);
+	g_free(load);
+}
+
+static gboolean mate_wp_xml_batch_loaded(gpointer user_data)
+{
+	MateWPXmlBatch* batch = user_data;
+	MateWPXmlLoad* load = batch->load;
+
+	if (!g_cancellable_is_cancelled(load->cancellable))
+	{
+		AppearanceData* data = load->data;
+		GList* items = NULL;
+		guint i;
+
+		for (i = 0; i < batch->entries->len; i++)
+		{
+			MateWPItem* item = mate_wp_xml_entry_to_item(data, g_ptr_array_index(batch->entries, i));
+
+			if (item != NULL)
+			{
+				items = g_list_prepend(items, item);
+			}
+		}
+
+		if (batch->last)
+		{
+			for (i = 0; i < load->dirs->len; i++)
+			{
+				GFile* directory = g_file_new_for_path(g_ptr_array_index(load->dirs, i));
+
+				mate_wp_xml_add_monitor(directory, data);
+				g_object_unref(directory);
+			}
+
+			g_clear_object(&data->wp_cancellable);
+		}
+
+		items = g_list_reverse(items);
+		load->func(data, items, batch->last);
+		g_list_free(items);
+	}
+
+	if (batch->last)
+	{
+		mate_wp_xml_load_free(load);
+	}
+
+	g_ptr_array_unref(batch->entries);
+	g_free(batch);
+
+	return FALSE;
+}
+
+static void mate_wp_xml_post_batch(MateWPXmlLoad* load, GPtrArray* entries, gboolean last)
+{
+	MateWPXmlBatch* batch = g_new0(MateWPXmlBatch, 1);
+
+	batch->load = load;
+	batch->entries = entries;
+	batch->last = last;
+
+	g_main_context_invoke(NULL, mate_wp_xml_batch_loaded, batch);
+}
+
+static void mate_wp_xml_load_thread(GTask* task, gpointer source_object, gpointer task_data, GCancellable* cancellable)
+{
+	MateWPXmlLoad* load = task_data;
+	const char* const* syslangs = (const char* const*) load->syslangs;
+	MateWPXmlEntry** list;
+	GPtrArray* entries;
+	GPtrArray* listed;
+	GPtrArray* batch;
+	GHashTable* seen;
+	char** sources;
+	char* user_list;
+	char* languages;
+	guint n_entries;
+	guint i;
+
+	sources = mate_wp_xml_get_sources();
+	languages = g_strjoinv(":", load->syslangs);
+
+	entries = g_ptr_array_new_with_free_func((GDestroyNotify) mate_wp_xml_entry_free);
+	seen = g_hash_table_new(g_str_hash, g_str_equal);
+
+	user_list = mate_wp_xml_get_user_list();
+
+	if (user_list != NULL)
+	{
+		mate_wp_xml_parse(user_list, syslangs, entries, seen);
+		g_free(user_list);
+	}
+
+	listed = mate_wp_xml_cache_load(sources, languages);
+
+	if (listed == NULL)
+	{
+		GVariantBuilder stamps;
+
+		g_variant_builder_init(&stamps, G_VARIANT_TYPE("a(sxx)"));
+		listed = mate_wp_xml_load_sources(sources, syslangs, &stamps);
+		mate_wp_xml_cache_save(sources, languages, g_variant_builder_end(&stamps), listed);
+	}
+
+	list = (MateWPXmlEntry**) g_ptr_array_steal(listed, &n_entries);
+	g_ptr_array_unref(listed);
+
+	for (i = 0; i < n_entries; i++)
+	{
+		mate_wp_xml_entry_add(entries, seen, list[i]);
+	}
+
+	g_free(list);
+
+	for (i = 0; sources[i]; i++)
+	{
+		if (g_file_test(sources[i], G_FILE_TEST_IS_DIR))
+		{
+			g_ptr_array_add(load->dirs, g_strdup(sources[i]));
+		}
+	}
+
+	mate_wp_load_legacy(entries, seen);
+	g_hash_table_destroy(seen);
+
+	list = (MateWPXmlEntry**) g_ptr_array_steal(entries, &n_entries);
+	g_ptr_array_unref(entries);
+
+	batch = g_ptr_array_new_with_free_func((GDestroyNotify) mate_wp_xml_entry_free);
+
+	for (i = 0; i < n_entries; i++)
+	{
+		MateWPXmlEntry* entry = list[i];
+
+		if (g_cancellable_is_cancelled(cancellable) ||
+		    !mate_wp_xml_entry_load_info(entry, load->thumb_factory))
+		{
+			mate_wp_xml_entry_free(entry);
+			continue;
+		}
+
+		g_ptr_array_add(batch, entry);
+
+		if (batch->len == MATE_WP_XML_BATCH_SIZE)
+		{
+			mate_wp_xml_post_batch(load, batch, FALSE);
+			batch = g_ptr_array_new_with_free_func((GDestroyNotify) mate_wp_xml_entry_free);
+		}
+	}
+
+	mate_wp_xml_post_batch(load, batch, TRUE);
+
+	g_free(list);
+	g_free(languages);
+	g_strfreev(sources);
+
+	g_task_return_boolean(task, TRUE);
+}
+
+void mate_wp_xml_load_list(AppearanceData* data, MateWPXmlLoadFunc func)
+{
+	MateWPXmlLoad* load;
+	GTask* task;
+
+	g_return_if_fail(data->wp_cancellable == NULL);
+
+	/* libxml has to be set up before it is used from a thread */
+	xmlInitParser();
+
+	data->wp_cancellable = g_cancellable_new();
+
+	load = g_new0(MateWPXmlLoad, 1);
+	load->data = data;
+	load->func = func;
+	load->cancellable = g_object_ref(data->wp_cancellable);
+	load->thumb_factory = g_object_ref(data->thumb_factory);
+	load->syslangs = g_strdupv((char**) g_get_language_names());
+	load->dirs = g_ptr_array_new_with_free_func(g_free);
+
+	task = g_task_new(NULL, load->cancellable, NULL, NULL);
+	g_task_set_task_data(task, load, NULL);
+	g_task_run_in_thread(task, mate_wp_xml_load_thread);
+	g_object_unref(task);
 }
 
 static void mate_wp_list_flatten(const char* key, MateWPItem* item, GSList** list)
@@ -483,6 +1037,16 @@ void mate_wp_xml_save_list(AppearanceData* data)
 	g_hash_table_destroy(data->wp_hash);
 	list = g_slist_reverse(list);
 
+	if (data->wp_cancellable != NULL)
+	{
+		/* Still loading, so this is only part of the list; keep the
+		 * saved one as it is. */
+		g_cancellable_cancel(data->wp_cancellable);
+		g_clear_object(&data->wp_cancellable);
+		g_slist_free_full(list, (GDestroyNotify) mate_wp_item_free);
+		return;
+	}
+
 	xmlKeepBlanksDefault(0);
 
 	wplist = xmlNewDoc((xmlChar*) "1.0");
@@ -21,7 +21,11 @@
 #ifndef _MATE_WP_XML_H_
 #define _MATE_WP_XML_H_
 
-void mate_wp_xml_load_list(AppearanceData* data);
+/* Called on the main thread with each batch of items added to data->wp_hash,
+ * and once more with finished set when the whole list is in. */
+typedef void (*MateWPXmlLoadFunc)(AppearanceData* data, GList* items, gboolean finished);
+
+void mate_wp_xml_load_list(AppearanceData* data, MateWPXmlLoadFunc func);
 void mate_wp_xml_save_list(AppearanceData* data);
 
 #endif
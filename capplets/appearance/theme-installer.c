@@ -29,6 +29,13 @@
 #include <glib/gstdio.h>
 #include <unistd.h>
 
+#if HAVE_LIBARCHIVE
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <archive.h>
+#include <archive_entry.h>
+#endif
+
 #include "capplet-util.h"
 #include "file-transfer-dialog.h"
 #include "theme-installer.h"
@@ -70,44 +77,59 @@ cleanup_tmp_dir (GTask        *task G_GNUC_UNUSED,
 	g_object_unref (directory);
 }
 
-static int
-file_theme_type (const gchar *dir)
-{
-	gchar *filename = NULL;
-	gboolean exists;
-
-	if (!dir)
-		return THEME_INVALID;
+/* What file_theme_type() looks for in a theme directory. It is either
+ * read from the disk, or gathered from the entries of a theme archive
+ * while they are extracted. */
+typedef struct {
+	gboolean has_index;
+	gboolean index_is_icon_theme;
+	gboolean index_has_directories;
+	gboolean index_is_metatheme;
+	gboolean has_gtkrc;
+	gboolean has_marco_theme;
+	gboolean has_cursors;
+	gboolean has_configure;
+} ThemeContents;
+
+/* A top-level directory of a theme archive */
+typedef struct {
+	ThemeContents theme;
+	/* the icon theme a MATE theme may carry in its icons directory */
+	ThemeContents icons;
+} ArchiveTheme;
 
-	filename = g_build_filename (dir, "index.theme", NULL);
-	exists = g_file_test (filename, G_FILE_TEST_IS_REGULAR);
-
-	if (exists) {
-		GPatternSpec *pattern;
-		gchar *file_contents = NULL;
-		gsize file_size;
-		gboolean match;
+static gboolean
+contents_match (const gchar *contents,
+		const gchar *pattern_string)
+{
+	GPatternSpec *pattern;
+	gboolean match;
 
-		g_file_get_contents (filename, &file_contents, &file_size, NULL);
-		g_free (filename);
+	pattern = g_pattern_spec_new (pattern_string);
+	match = g_pattern_spec_match_string (pattern, contents);
+	g_pattern_spec_free (pattern);
 
-		pattern = g_pattern_spec_new ("*[Icon Theme]*");
-		match = g_pattern_spec_match_string (pattern, file_contents);
-		g_pattern_spec_free (pattern);
+	return match;
+}
 
-		if (match) {
-			pattern = g_pattern_spec_new ("*Directories=*");
-			match = g_pattern_spec_match_string (pattern, file_contents);
-			g_pattern_spec_free (pattern);
-			g_free (file_contents);
+static void
+theme_contents_read_index (ThemeContents *contents,
+			   const gchar   *index)
+{
+	contents->has_index = TRUE;
+	contents->index_is_icon_theme = contents_match (index, "*[Icon Theme]*");
+	contents->index_has_directories = contents_match (index, "*Directories=*");
+	contents->index_is_metatheme = contents_match (index, "*[X-GNOME-Metatheme]*");
+}
 
-			if (match) {
+static int
+theme_contents_get_type (const ThemeContents *contents)
+{
+	if (contents->has_index) {
+		if (contents->index_is_icon_theme) {
+			if (contents->index_has_directories) {
 				/* check if we have a cursor, too */
-				filename = g_build_filename (dir, "cursors", NULL);
-				exists = g_file_test (filename, G_FILE_TEST_IS_DIR);
-				g_free (filename);
-
-				if (exists)
+				if (contents->has_cursors)
 					return THEME_ICON_CURSOR;
 				else
 					return THEME_ICON;
@@ -115,55 +137,92 @@ file_theme_type (const gchar *dir)
 			return THEME_CURSOR;
 		}
 
-		pattern = g_pattern_spec_new ("*[X-GNOME-Metatheme]*");
-		match = g_pattern_spec_match_string (pattern, file_contents);
-		g_pattern_spec_free (pattern);
-		g_free (file_contents);
-
-		if (match)
+		if (contents->index_is_metatheme)
 			return THEME_MATE;
-	} else {
-		g_free (filename);
 	}
 
-	filename = g_build_filename (dir, "gtk-2.0", "gtkrc", NULL);
-	exists = g_file_test (filename, G_FILE_TEST_IS_REGULAR);
-	g_free (filename);
-
-	if (exists)
+	if (contents->has_gtkrc)
 		return THEME_GTK;
 
-	filename = g_build_filename (dir, "metacity-1", "metacity-theme-2.xml", NULL);
-	exists = g_file_test (filename, G_FILE_TEST_IS_REGULAR);
+	if (contents->has_marco_theme)
+		return THEME_MARCO;
+
+	/* cursor themes don't necessarily have an index.theme */
+	if (contents->has_cursors)
+		return THEME_CURSOR;
+
+	if (contents->has_configure)
+		return THEME_ENGINE;
+
+	return THEME_INVALID;
+}
+
+static int
+file_theme_type (const gchar *dir)
+{
+	ThemeContents contents = { 0 };
+	gchar *filename = NULL;
+
+	if (!dir)
+		return THEME_INVALID;
+
+	filename = g_build_filename (dir, "index.theme", NULL);
+	if (g_file_test (filename, G_FILE_TEST_IS_REGULAR)) {
+		gchar *file_contents = NULL;
+
+		g_file_get_contents (filename, &file_contents, NULL, NULL);
+		theme_contents_read_index (&contents, file_contents ? file_contents : "");
+		g_free (file_contents);
+	}
 	g_free (filename);
 
-	if (exists)
-		return THEME_MARCO;
+	filename = g_build_filename (dir, "gtk-2.0", "gtkrc", NULL);
+	contents.has_gtkrc = g_file_test (filename, G_FILE_TEST_IS_REGULAR);
+	g_free (filename);
 
-	filename = g_build_filename (dir, "metacity-1", "metacity-theme-1.xml", NULL);
-	exists = g_file_test (filename, G_FILE_TEST_IS_REGULAR);
+	filename = g_build_filename (dir, "metacity-1", "metacity-theme-2.xml", NULL);
+	contents.has_marco_theme = g_file_test (filename, G_FILE_TEST_IS_REGULAR);
 	g_free (filename);
 
-	if (exists)
-		return THEME_MARCO;
+	if (!contents.has_marco_theme) {
+		filename = g_build_filename (dir, "metacity-1", "metacity-theme-1.xml", NULL);
+		contents.has_marco_theme = g_file_test (filename, G_FILE_TEST_IS_REGULAR);
+		g_free (filename);
+	}
 
-	/* cursor themes don't necessarily have an index.theme */
 	filename = g_build_filename (dir, "cursors", NULL);
-	exists = g_file_test (filename, G_FILE_TEST_IS_DIR);
+	contents.has_cursors = g_file_test (filename, G_FILE_TEST_IS_DIR);
 	g_free (filename);
 
-	if (exists)
-		return THEME_CURSOR;
-
 	filename = g_build_filename (dir, "configure", NULL);
-	exists = g_file_test (filename, G_FILE_TEST_IS_EXECUTABLE);
+	contents.has_configure = g_file_test (filename, G_FILE_TEST_IS_EXECUTABLE);
 	g_free (filename);
 
-	if (exists)
-		return THEME_ENGINE;
+	return theme_contents_get_type (&contents);
+}
 
-	return THEME_INVALID;
+#if HAVE_LIBARCHIVE
+/* Records an archive entry at @path, relative to the theme directory.
+ * index.theme is read separately, see theme_contents_read_index(). */
+static void
+theme_contents_add_entry (ThemeContents *contents,
+			  const gchar   *path,
+			  gboolean       is_dir,
+			  gboolean       is_executable)
+{
+	if ((is_dir && g_str_equal (path, "cursors")) || g_str_has_prefix (path, "cursors/"))
+		contents->has_cursors = TRUE;
+	else if (is_dir)
+		return;
+	else if (g_str_equal (path, "gtk-2.0/gtkrc"))
+		contents->has_gtkrc = TRUE;
+	else if (g_str_equal (path, "metacity-1/metacity-theme-2.xml")
+		 || g_str_equal (path, "metacity-1/metacity-theme-1.xml"))
+		contents->has_marco_theme = TRUE;
+	else if (g_str_equal (path, "configure") && is_executable)
+		contents->has_configure = TRUE;
 }
+#endif
 
 static void
 transfer_cancel_cb (GtkWidget *dialog,
@@ -179,6 +238,7 @@ transfer_cancel_cb (GtkWidget *dialog,
 	gtk_widget_destroy (dialog);
 }
 
+#if !HAVE_LIBARCHIVE
 static void
 missing_utility_message_dialog (GtkWindow *parent,
 				const gchar *utility)
@@ -193,81 +253,336 @@ missing_utility_message_dialog (GtkWindow *parent,
 	gtk_dialog_run (GTK_DIALOG (dialog));
 	gtk_widget_destroy (dialog);
 }
+#endif
 
-/* this works around problems when doing fork/exec in a threaded app
- * with some locks being held/waited on in different threads.
- *
- * we do the idle callback so that the async xfer has finished and
- * cleaned up its vfs job.  otherwise it seems the slave thread gets
- * woken up and it removes itself from the job queue before it is
- * supposed to.  very strange.
- *
- * see bugzilla.gnome.org #86141 for details
- */
+/* Theme archives are extracted on a worker thread, so that big icon
+ * themes don't freeze the capplet, with a progress dialog that lets the
+ * user cancel. With libarchive they are read in-process, and the theme
+ * types are worked out from the entries as they stream by. Otherwise
+ * the archive is piped from the decompressor to tar, and the types are
+ * looked up on the disk afterwards. */
+typedef struct {
+	GtkWindow    *parent;
+	gchar        *archive;
+	gchar        *tmp_dir;
+	gint          filetype;
+	gchar        *command;
+	/* ArchiveTheme by top-level directory, filled by the worker */
+	GHashTable   *themes;
+	/* thousandths of the archive read, updated by the worker */
+	gint          progress;
+	GCancellable *cancellable;
+	GtkWidget    *dialog;
+	GtkWidget    *progress_bar;
+	guint         progress_id;
+} ExtractData;
+
+static void
+extract_data_free (ExtractData *data)
+{
+	g_free (data->archive);
+	g_free (data->tmp_dir);
+	g_free (data->command);
+	if (data->themes)
+		g_hash_table_unref (data->themes);
+	g_object_unref (data->cancellable);
+	g_free (data);
+}
+
+#if HAVE_LIBARCHIVE
+static void
+set_archive_error (GError        **error,
+		   struct archive *a)
+{
+	g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     archive_error_string (a) ? archive_error_string (a)
+						      : _("There was a problem while extracting the theme."));
+}
+
+/* Archive members are often stored as "./name" */
+static const gchar *
+strip_archive_path (const gchar *path)
+{
+	while (TRUE) {
+		if (g_str_has_prefix (path, "./"))
+			path += 2;
+		else if (*path == '/')
+			path++;
+		else
+			return path;
+	}
+}
+
+/* Whether a member path could point outside of the directory it is
+ * extracted to.  ARCHIVE_EXTRACT_SECURE_NODOTDOT checks this too, but didn't
+ * for hardlink targets before libarchive 3.2.2 (CVE-2016-5418). */
 static gboolean
-process_local_theme_tgz_tbz (GtkWindow *parent,
-			     const gchar *util,
-			     const gchar *tmp_dir,
-			     const gchar *archive)
+archive_path_escapes (const gchar *path)
 {
-	gboolean rc;
+	gchar **components;
+	gboolean escapes = FALSE;
+	gint i;
+
+	components = g_strsplit (path, "/", -1);
+	for (i = 0; components[i] != NULL && !escapes; i++)
+		escapes = g_str_equal (components[i], "..");
+	g_strfreev (components);
+
+	return escapes;
+}
+
+static gboolean
+extract_archive_entry (ExtractData          *data,
+		       const gchar          *root,
+		       struct archive       *a,
+		       struct archive       *ext,
+		       struct archive_entry *entry,
+		       gint64                size,
+		       GCancellable         *cancellable,
+		       GError              **error)
+{
+	const gchar *link;
+	gchar *path, *target, *name, *relative;
+	ArchiveTheme *theme = NULL;
+	GString *index = NULL;
+	ThemeContents *index_contents = NULL;
+	const void *buf;
+	size_t len;
+	int64_t offset;
+	int r;
+
+	if (archive_entry_pathname (entry) == NULL
+	    || *strip_archive_path (archive_entry_pathname (entry)) == '\0') {
+		archive_read_data_skip (a);
+		return TRUE;
+	}
+
+	link = archive_entry_hardlink (entry);
+	if (archive_path_escapes (archive_entry_pathname (entry))
+	    || (link != NULL && archive_path_escapes (link))) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME,
+			     _("The theme archive contains an invalid file name: %s"),
+			     link != NULL ? link : archive_entry_pathname (entry));
+		return FALSE;
+	}
+
+	/* the entry owns its pathname, which is about to change */
+	path = g_strdup (strip_archive_path (archive_entry_pathname (entry)));
+
+	/* Everything goes below the temporary directory */
+	target = g_build_filename (root, path, NULL);
+	archive_entry_set_pathname (entry, target);
+	g_free (target);
+
+	link = archive_entry_hardlink (entry);
+	if (link != NULL) {
+		target = g_build_filename (root, strip_archive_path (link), NULL);
+		archive_entry_set_hardlink (entry, target);
+		g_free (target);
+	}
+
+	/* Note what file_theme_type() would look for */
+	relative = strchr (path, '/');
+	if (relative != NULL || archive_entry_filetype (entry) == AE_IFDIR) {
+		gboolean is_dir, is_executable;
+
+		name = relative ? g_strndup (path, relative - path) : g_strdup (path);
+		relative = g_strdup (relative ? relative + 1 : "");
+		if (g_str_has_suffix (relative, "/"))
+			relative[strlen (relative) - 1] = '\0';
+
+		theme = g_hash_table_lookup (data->themes, name);
+		if (theme == NULL) {
+			theme = g_new0 (ArchiveTheme, 1);
+			g_hash_table_insert (data->themes, name, theme);
+		} else {
+			g_free (name);
+		}
+
+		is_dir = archive_entry_filetype (entry) == AE_IFDIR;
+		is_executable = (archive_entry_perm (entry) & S_IXUSR) != 0;
+
+		theme_contents_add_entry (&theme->theme, relative, is_dir, is_executable);
+		if (g_str_has_prefix (relative, "icons/"))
+			theme_contents_add_entry (&theme->icons, relative + strlen ("icons/"),
+						  is_dir, is_executable);
+
+		if (!is_dir && g_str_equal (relative, "index.theme"))
+			index_contents = &theme->theme;
+		else if (!is_dir && g_str_equal (relative, "icons/index.theme"))
+			index_contents = &theme->icons;
+
+		g_free (relative);
+	}
+
+	if (index_contents != NULL)
+		index = g_string_new (NULL);
+
+	r = archive_write_header (ext, entry);
+	if (r < ARCHIVE_WARN) {
+		set_archive_error (error, ext);
+		goto out;
+	}
+
+	while ((r = archive_read_data_block (a, &buf, &len, &offset)) == ARCHIVE_OK) {
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			goto out;
+
+		if (archive_write_data_block (ext, buf, len, offset) < ARCHIVE_WARN) {
+			set_archive_error (error, ext);
+			goto out;
+		}
+
+		if (index != NULL)
+			g_string_append_len (index, buf, len);
+
+		if (size > 0)
+			g_atomic_int_set (&data->progress,
+					  (gint) MIN (archive_filter_bytes (a, -1) * 1000 / size, 1000));
+	}
+
+	if (r != ARCHIVE_EOF) {
+		set_archive_error (error, a);
+		goto out;
+	}
+
+	if (archive_write_finish_entry (ext) < ARCHIVE_WARN) {
+		set_archive_error (error, ext);
+		goto out;
+	}
+
+	if (index != NULL)
+		theme_contents_read_index (index_contents, index->str);
+
+out:
+	if (index != NULL)
+		g_string_free (index, TRUE);
+	g_free (path);
+
+	return error == NULL || *error == NULL;
+}
+
+static void
+extract_archive_thread (GTask        *task,
+			gpointer      source_object G_GNUC_UNUSED,
+			gpointer      task_data,
+			GCancellable *cancellable)
+{
+	ExtractData *data = task_data;
+	struct archive *a, *ext;
+	struct archive_entry *entry;
+	GStatBuf buf;
+	gint64 size = 0;
+	gchar *root;
+	GError *error = NULL;
+	int r;
+
+	if (g_stat (data->archive, &buf) == 0)
+		size = buf.st_size;
+
+	/* libarchive refuses to extract through symlinks, including one
+	 * in front of ~/.themes */
+	root = realpath (data->tmp_dir, NULL);
+	if (root == NULL)
+		root = strdup (data->tmp_dir);
+
+	a = archive_read_new ();
+	if (data->filetype == TARGZ)
+		archive_read_support_filter_gzip (a);
+	else if (data->filetype == TARBZ)
+		archive_read_support_filter_bzip2 (a);
+	else if (data->filetype == TARXZ)
+		archive_read_support_filter_xz (a);
+	archive_read_support_format_tar (a);
+
+	ext = archive_write_disk_new ();
+	archive_write_disk_set_options (ext,
+					ARCHIVE_EXTRACT_TIME |
+					ARCHIVE_EXTRACT_PERM |
+					ARCHIVE_EXTRACT_SECURE_SYMLINKS |
+					ARCHIVE_EXTRACT_SECURE_NODOTDOT);
+
+	if (archive_read_open_filename (a, data->archive, 64 * 1024) != ARCHIVE_OK) {
+		set_archive_error (&error, a);
+	} else {
+		while (error == NULL) {
+			r = archive_read_next_header (a, &entry);
+			if (r == ARCHIVE_EOF)
+				break;
+
+			if (r < ARCHIVE_WARN)
+				set_archive_error (&error, a);
+			else if (!g_cancellable_set_error_if_cancelled (cancellable, &error))
+				extract_archive_entry (data, root, a, ext, entry, size, cancellable, &error);
+		}
+	}
+
+	archive_read_free (a);
+	archive_write_free (ext);
+	free (root);
+
+	if (error != NULL)
+		g_task_return_error (task, error);
+	else
+		g_task_return_boolean (task, TRUE);
+}
+#else
+static void
+extract_archive_thread (GTask        *task,
+			gpointer      source_object G_GNUC_UNUSED,
+			gpointer      task_data,
+			GCancellable *cancellable G_GNUC_UNUSED)
+{
+	ExtractData *data = task_data;
+	GError *error = NULL;
 	int status;
+
+	/* tar can't be stopped half way, a cancelled extraction is
+	 * discarded once it is over */
+	if (!g_spawn_command_line_sync (data->command, NULL, NULL, &status, &error)) {
+		g_task_return_error (task, error);
+		return;
+	}
+
+	if (g_task_return_error_if_cancelled (task))
+		return;
+
+	if (status != 0)
+		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+					 "%s", _("There was a problem while extracting the theme."));
+	else
+		g_task_return_boolean (task, TRUE);
+}
+
+static gchar *
+get_extract_command (GtkWindow *parent,
+		     const gchar *util,
+		     const gchar *tmp_dir,
+		     const gchar *archive)
+{
 	gchar *command, *filename, *zip, *tar;
 
 	if (!(zip = g_find_program_in_path (util))) {
 		missing_utility_message_dialog (parent, util);
-		return FALSE;
+		return NULL;
 	}
 	if (!(tar = g_find_program_in_path ("tar"))) {
 		missing_utility_message_dialog (parent, "tar");
 		g_free (zip);
-		return FALSE;
+		return NULL;
 	}
 
 	filename = g_shell_quote (archive);
 
-	/* this should be something more clever and nonblocking */
 	command = g_strdup_printf ("sh -c 'cd \"%s\"; %s -d -c < \"%s\" | %s xf - '",
 				   tmp_dir, zip, filename, tar);
 	g_free (zip);
 	g_free (tar);
 	g_free (filename);
 
-	rc = (g_spawn_command_line_sync (command, NULL, NULL, &status, NULL) && status == 0);
-	g_free (command);
-
-	if (rc == FALSE) {
-		GtkWidget *dialog;
-
-		dialog = gtk_message_dialog_new (parent,
-						 GTK_DIALOG_MODAL,
-						 GTK_MESSAGE_ERROR,
-						 GTK_BUTTONS_OK,
-						 _("Cannot install theme"));
-		gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (dialog),
-							  _("There was a problem while extracting the theme."));
-		gtk_dialog_run (GTK_DIALOG (dialog));
-		gtk_widget_destroy (dialog);
-	}
-
-	return rc;
-}
-
-static gboolean
-process_local_theme_archive (GtkWindow *parent,
-			     gint filetype,
-			     const gchar *tmp_dir,
-			     const gchar *archive)
-{
-	if (filetype == TARGZ)
-		return process_local_theme_tgz_tbz (parent, "gzip", tmp_dir, archive);
-	else if (filetype == TARBZ)
-		return process_local_theme_tgz_tbz (parent, "bzip2", tmp_dir, archive);
-	else if (filetype == TARXZ)
-		return process_local_theme_tgz_tbz (parent, "xz", tmp_dir, archive);
-	else
-		return FALSE;
+	return command;
 }
+#endif
 
 static void
 invalid_theme_dialog (GtkWindow *parent,
@@ -296,6 +611,7 @@ static gboolean
 mate_theme_install_real (GtkWindow *parent,
 			  const gchar *tmp_dir,
 			  const gchar *theme_name,
+			  const ArchiveTheme *contents,
 			  gboolean ask_user)
 {
 	gboolean success = TRUE;
@@ -306,7 +622,10 @@ mate_theme_install_real (GtkWindow *parent,
 	gchar *target_dir = NULL;
 
 	/* What type of theme is it? */
-	theme_type = file_theme_type (tmp_dir);
+	if (contents != NULL)
+		theme_type = theme_contents_get_type (&contents->theme);
+	else
+		theme_type = file_theme_type (tmp_dir);
 	switch (theme_type) {
 	case THEME_ICON:
 	case THEME_CURSOR:
@@ -337,7 +656,8 @@ mate_theme_install_real (GtkWindow *parent,
 		path = g_build_path (G_DIR_SEPARATOR_S,
 				     tmp_dir, "icons", NULL);
 		if (g_file_test (path, G_FILE_TEST_IS_DIR)
-		    && (file_theme_type (path) == THEME_ICON)) {
+		    && ((contents ? theme_contents_get_type (&contents->icons)
+				  : file_theme_type (path)) == THEME_ICON)) {
 			gchar *new_path, *update_icon_cache;
 			GFile *new_file;
 			GFile *src_file;
@@ -563,6 +883,189 @@ theme_cleanup_tmp_dir (char *tmp_dir)
 	g_object_unref (task);
 }
 
+/* Installs what extract_theme_archive() unpacked into @tmp_dir, each
+ * top-level directory being a theme. */
+static void
+install_extracted_themes (GtkWindow   *parent,
+			  const gchar *tmp_dir,
+			  const gchar *archive,
+			  GHashTable  *themes)
+{
+	GtkWidget *dialog;
+	GDir *dir;
+	const gchar *name;
+	gboolean ok;
+	gint n_themes;
+	GFile *todelete;
+
+	if ((dir = g_dir_open (tmp_dir, 0, NULL)) == NULL)
+		return;
+
+	todelete = g_file_new_for_path (archive);
+	g_file_delete (todelete, NULL, NULL);
+	g_object_unref (todelete);
+
+	/* See whether we have multiple themes to install. If so,
+	 * we won't ask the user whether to apply the new theme
+	 * after installation. */
+	n_themes = 0;
+	for (name = g_dir_read_name (dir);
+	     name && n_themes <= 1;
+	     name = g_dir_read_name (dir)) {
+		gchar *theme_dir;
+
+		theme_dir = g_build_filename (tmp_dir, name, NULL);
+
+		if (g_file_test (theme_dir, G_FILE_TEST_IS_DIR))
+			++n_themes;
+
+		g_free (theme_dir);
+	}
+	g_dir_rewind (dir);
+
+	ok = TRUE;
+	for (name = g_dir_read_name (dir); name && ok;
+	     name = g_dir_read_name (dir)) {
+		gchar *theme_dir;
+
+		theme_dir = g_build_filename (tmp_dir, name, NULL);
+
+		if (g_file_test (theme_dir, G_FILE_TEST_IS_DIR))
+			ok = mate_theme_install_real (parent,
+						       theme_dir,
+						       name,
+						       themes ? g_hash_table_lookup (themes, name) : NULL,
+						       n_themes == 1);
+
+		g_free (theme_dir);
+	}
+	g_dir_close (dir);
+
+	if (ok && n_themes > 1) {
+		dialog = gtk_message_dialog_new (parent,
+						 GTK_DIALOG_MODAL,
+						 GTK_MESSAGE_INFO,
+						 GTK_BUTTONS_OK,
+						 _("New themes have been successfully installed."));
+		gtk_dialog_run (GTK_DIALOG (dialog));
+		gtk_widget_destroy (dialog);
+	}
+}
+
+static gboolean
+extract_progress_cb (ExtractData *data)
+{
+	gint progress = g_atomic_int_get (&data->progress);
+
+	if (progress > 0)
+		gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (data->progress_bar),
+					       progress / 1000.0);
+	else
+		gtk_progress_bar_pulse (GTK_PROGRESS_BAR (data->progress_bar));
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+extract_response_cb (GtkDialog   *dialog G_GNUC_UNUSED,
+		     gint         response_id G_GNUC_UNUSED,
+		     ExtractData *data)
+{
+	g_cancellable_cancel (data->cancellable);
+	gtk_widget_set_sensitive (data->dialog, FALSE);
+}
+
+static void
+extract_done_cb (GObject      *source_object G_GNUC_UNUSED,
+		 GAsyncResult *result,
+		 gpointer      user_data)
+{
+	ExtractData *data = g_task_get_task_data (G_TASK (result));
+	GError *error = NULL;
+
+	g_source_remove (data->progress_id);
+	gtk_widget_destroy (data->dialog);
+
+	if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			GtkWidget *dialog;
+
+			g_warning ("Error while extracting `%s': %s", data->archive, error->message);
+
+			dialog = gtk_message_dialog_new (data->parent,
+							 GTK_DIALOG_MODAL,
+							 GTK_MESSAGE_ERROR,
+							 GTK_BUTTONS_OK,
+							 _("Cannot install theme"));
+			gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (dialog),
+								  _("There was a problem while extracting the theme."));
+			gtk_dialog_run (GTK_DIALOG (dialog));
+			gtk_widget_destroy (dialog);
+		}
+		g_error_free (error);
+	} else {
+		install_extracted_themes (data->parent, data->tmp_dir, data->archive, data->themes);
+	}
+
+	theme_cleanup_tmp_dir (g_strdup (data->tmp_dir));
+}
+
+/* Unpacks @archive into @tmp_dir, which is taken over, and installs the
+ * themes found in it once done. */
+static void
+extract_theme_archive (GtkWindow   *parent,
+		       gint         filetype,
+		       gchar       *tmp_dir,
+		       const gchar *archive)
+{
+	ExtractData *data;
+	GtkWidget *area;
+	GTask *task;
+
+	data = g_new0 (ExtractData, 1);
+	data->parent = parent;
+	data->archive = g_strdup (archive);
+	data->filetype = filetype;
+	data->tmp_dir = tmp_dir;
+	data->cancellable = g_cancellable_new ();
+
+#if HAVE_LIBARCHIVE
+	data->themes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+#else
+	if (filetype == TARGZ)
+		data->command = get_extract_command (parent, "gzip", tmp_dir, archive);
+	else if (filetype == TARBZ)
+		data->command = get_extract_command (parent, "bzip2", tmp_dir, archive);
+	else if (filetype == TARXZ)
+		data->command = get_extract_command (parent, "xz", tmp_dir, archive);
+
+	if (data->command == NULL) {
+		theme_cleanup_tmp_dir (g_strdup (tmp_dir));
+		extract_data_free (data);
+		return;
+	}
+#endif
+
+	data->dialog = gtk_message_dialog_new (parent,
+					       GTK_DIALOG_MODAL,
+					       GTK_MESSAGE_OTHER,
+					       GTK_BUTTONS_CANCEL,
+					       _("Extracting theme"));
+	area = gtk_message_dialog_get_message_area (GTK_MESSAGE_DIALOG (data->dialog));
+	data->progress_bar = gtk_progress_bar_new ();
+	gtk_box_pack_start (GTK_BOX (area), data->progress_bar, FALSE, FALSE, 0);
+	g_signal_connect (data->dialog, "response",
+			  G_CALLBACK (extract_response_cb), data);
+	gtk_widget_show_all (data->dialog);
+
+	data->progress_id = g_timeout_add (100, (GSourceFunc) extract_progress_cb, data);
+
+	task = g_task_new (NULL, data->cancellable, extract_done_cb, NULL);
+	g_task_set_task_data (task, data, (GDestroyNotify) extract_data_free);
+	g_task_run_in_thread (task, extract_archive_thread);
+	g_object_unref (task);
+}
+
 static void
 process_local_theme (GtkWindow  *parent,
 		     const char *path)
@@ -593,16 +1096,12 @@ process_local_theme (GtkWindow  *parent,
 		mate_theme_install_real (parent,
 					  path,
 					  name,
+					  NULL,
 					  TRUE);
 		g_free (name);
 	} else {
 		/* Create a temp directory and uncompress file there */
-		GDir *dir;
-		const gchar *name;
 		gchar *tmp_dir;
-		gboolean ok;
-		gint n_themes;
-		GFile *todelete;
 
 		tmp_dir = g_strdup_printf ("%s/.themes/.theme-%u",
 					   g_get_home_dir (),
@@ -620,61 +1119,7 @@ process_local_theme (GtkWindow  *parent,
 			return;
 		}
 
-		if (!process_local_theme_archive (parent, filetype, tmp_dir, path)
-		    || ((dir = g_dir_open (tmp_dir, 0, NULL)) == NULL)) {
-			theme_cleanup_tmp_dir (tmp_dir);
-			return;
-		}
-
-		todelete = g_file_new_for_path (path);
-		g_file_delete (todelete, NULL, NULL);
-		g_object_unref (todelete);
-
-		/* See whether we have multiple themes to install. If so,
-		 * we won't ask the user whether to apply the new theme
-		 * after installation. */
-		n_themes = 0;
-		for (name = g_dir_read_name (dir);
-		     name && n_themes <= 1;
-		     name = g_dir_read_name (dir)) {
-			gchar *theme_dir;
-
-			theme_dir = g_build_filename (tmp_dir, name, NULL);
-
-			if (g_file_test (theme_dir, G_FILE_TEST_IS_DIR))
-				++n_themes;
-
-			g_free (theme_dir);
-		}
-		g_dir_rewind (dir);
-
-		ok = TRUE;
-		for (name = g_dir_read_name (dir); name && ok;
-		     name = g_dir_read_name (dir)) {
-			gchar *theme_dir;
-
-			theme_dir = g_build_filename (tmp_dir, name, NULL);
-
-			if (g_file_test (theme_dir, G_FILE_TEST_IS_DIR))
-				ok = mate_theme_install_real (parent,
-							       theme_dir,
-							       name,
-							       n_themes == 1);
-
-			g_free (theme_dir);
-		}
-		g_dir_close (dir);
-
-		if (ok && n_themes > 1) {
-			dialog = gtk_message_dialog_new (parent,
-							 GTK_DIALOG_MODAL,
-							 GTK_MESSAGE_INFO,
-							 GTK_BUTTONS_OK,
-							 _("New themes have been successfully installed."));
-			gtk_dialog_run (GTK_DIALOG (dialog));
-			gtk_widget_destroy (dialog);
-		}
-		theme_cleanup_tmp_dir (tmp_dir);
+		extract_theme_archive (parent, filetype, tmp_dir, path);
 	}
 }
 
@@ -23,6 +23,8 @@
 
 #include <string.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
 
 #include "capplet-util.h"
 #include "theme-util.h"
@@ -185,6 +187,380 @@ gboolean theme_find_in_model (GtkTreeModel *model, const gchar *name, GtkTreeIte
   return FALSE;
 }
 
+/* Thumbnail cache
+ *
+ * Rendered thumbnails are stored as PNGs under the user cache dir.  Their
+ * names are made of a hash of the theme type and path, and a hash of the
+ * rest of what goes into rendering them: the mtime of the files that define
+ * the theme, the color scheme, the font and the UI language of the button
+ * labels and, for icon themes, the themes it inherits from.  A changed
+ * theme thus simply misses the cache.
+ *
+ * The cache dir is scanned once per run, by theme_thumbnail_cache_prune(),
+ * which removes the thumbnails of the themes that are no longer installed
+ * and keeps the names of the others, so that saving a new thumbnail for a
+ * theme can remove its old one without scanning the dir again.
+ */
+
+#define THEME_THUMBNAIL_CACHE_VERSION 3
+#define THEME_THUMBNAIL_CACHE_MAX_DEPTH 8
+
+static gint64 theme_thumbnail_cache_get_mtime (ThemeType type, const gchar *path)
+{
+  static const gchar *gtk_files[] = { "gtk-2.0/gtkrc", "gtk-3.0/gtk.css", NULL };
+  static const gchar *marco_files[] = { "metacity-1/metacity-theme-1.xml",
+                                        "metacity-1/metacity-theme-2.xml",
+                                        "metacity-1/metacity-theme-3.xml", NULL };
+  const gchar **files = NULL;
+  gchar *dir;
+  GStatBuf buf;
+  gint64 mtime;
+
+  if (g_stat (path, &buf) != 0)
+    return -1;
+
+  mtime = buf.st_mtime;
+
+  switch (type) {
+    case THEME_TYPE_GTK:
+      files = gtk_files;
+      dir = g_strdup (path);
+      break;
+
+    case THEME_TYPE_WINDOW:
+      files = marco_files;
+      dir = g_strdup (path);
+      break;
+
+    default:
+      /* path is the index.theme file, also look at the theme dir */
+      dir = g_path_get_dirname (path);
+      if (g_stat (dir, &buf) == 0)
+        mtime = MAX (mtime, (gint64) buf.st_mtime);
+      break;
+  }
+
+  for (; files && *files; files++) {
+    gchar *file = g_build_filename (dir, *files, NULL);
+
+    if (g_stat (file, &buf) == 0)
+      mtime = MAX (mtime, (gint64) buf.st_mtime);
+    g_free (file);
+  }
+
+  g_free (dir);
+
+  return mtime;
+}
+
+/* Icons missing from an icon theme are looked up in the themes it inherits
+ * from, and last in hicolor, so those go into the key as well. */
+static void theme_thumbnail_cache_add_inherited (GString *key, const gchar *path, GHashTable *seen, gint depth)
+{
+  GKeyFile *keyfile;
+  gchar **parents;
+  gint i;
+
+  if (depth > THEME_THUMBNAIL_CACHE_MAX_DEPTH)
+    return;
+
+  keyfile = g_key_file_new ();
+  if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL)) {
+    g_key_file_free (keyfile);
+    return;
+  }
+
+  parents = g_key_file_get_string_list (keyfile, "Icon Theme", "Inherits", NULL, NULL);
+  g_key_file_free (keyfile);
+
+  for (i = 0; parents && parents[i]; i++) {
+    MateThemeIconInfo *parent;
+    gchar *name = g_strstrip (parents[i]);
+
+    if (*name == '\0' || g_hash_table_contains (seen, name))
+      continue;
+    g_hash_table_add (seen, g_strdup (name));
+
+    parent = mate_theme_icon_info_find (name);
+    if (parent == NULL || parent->path == NULL) {
+      g_string_append_printf (key, "\n%s", name);
+      continue;
+    }
+
+    g_string_append_printf (key, "\n%s:%" G_GINT64_FORMAT, parent->path,
+                            theme_thumbnail_cache_get_mtime (THEME_TYPE_ICON, parent->path));
+    theme_thumbnail_cache_add_inherited (key, parent->path, seen, depth + 1);
+  }
+
+  g_strfreev (parents);
+}
+
+static gchar *theme_thumbnail_cache_get_dirname (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "mate-control-center",
+                           "theme-thumbnails", NULL);
+}
+
+/* The prefix all the thumbnails of one theme share */
+static gchar *theme_thumbnail_cache_get_prefix (ThemeType type, const gchar *path)
+{
+  gchar *key, *hash, *prefix;
+
+  key = g_strdup_printf ("%d\n%d\n%s", THEME_THUMBNAIL_CACHE_VERSION, type, path);
+  hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+  prefix = g_strconcat (hash, "-", NULL);
+
+  g_free (hash);
+  g_free (key);
+
+  return prefix;
+}
+
+static gchar *theme_thumbnail_cache_get_filename (ThemeType type, const gchar *path, const gchar *color_scheme, const gchar *font)
+{
+  GString *key;
+  gchar *dirname, *prefix, *hash, *basename, *filename, *languages;
+  gint64 mtime;
+
+  if (path == NULL)
+    return NULL;
+
+  mtime = theme_thumbnail_cache_get_mtime (type, path);
+  if (mtime < 0)
+    return NULL;
+
+  languages = g_strjoinv (":", (gchar **) g_get_language_names ());
+  key = g_string_new (NULL);
+  g_string_append_printf (key, "%" G_GINT64_FORMAT "\n%s\n%s\n%s", mtime,
+                          color_scheme ? color_scheme : "",
+                          font ? font : "", languages);
+  g_free (languages);
+
+  if (type == THEME_TYPE_ICON) {
+    GHashTable *seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    theme_thumbnail_cache_add_inherited (key, path, seen, 0);
+    if (!g_hash_table_contains (seen, "hicolor")) {
+      MateThemeIconInfo *hicolor = mate_theme_icon_info_find ("hicolor");
+
+      if (hicolor != NULL && hicolor->path != NULL && strcmp (hicolor->path, path) != 0)
+        g_string_append_printf (key, "\n%s:%" G_GINT64_FORMAT, hicolor->path,
+                                theme_thumbnail_cache_get_mtime (THEME_TYPE_ICON, hicolor->path));
+    }
+    g_hash_table_destroy (seen);
+  }
+
+  prefix = theme_thumbnail_cache_get_prefix (type, path);
+  hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key->str, key->len);
+  basename = g_strconcat (prefix, hash, ".png", NULL);
+  dirname = theme_thumbnail_cache_get_dirname ();
+  filename = g_build_filename (dirname, basename, NULL);
+
+  g_free (dirname);
+  g_free (basename);
+  g_free (hash);
+  g_free (prefix);
+  g_string_free (key, TRUE);
+
+  return filename;
+}
+
+/* The names of the thumbnails in the cache dir, as GPtrArrays by prefix */
+static GHashTable *thumbnail_files = NULL;
+
+static void theme_thumbnail_cache_add_prefix (GHashTable *prefixes, ThemeType type, GList *themes)
+{
+  GList *l;
+
+  for (l = themes; l != NULL; l = l->next) {
+    MateThemeCommonInfo *theme = l->data;
+
+    if (theme->path != NULL)
+      g_hash_table_add (prefixes, theme_thumbnail_cache_get_prefix (type, theme->path));
+  }
+
+  g_list_free (themes);
+}
+
+static void theme_thumbnail_cache_unlink (const gchar *dirname, const gchar *name)
+{
+  gchar *filename = g_build_filename (dirname, name, NULL);
+
+  g_unlink (filename);
+  g_free (filename);
+}
+
+void theme_thumbnail_cache_prune (void)
+{
+  GHashTable *prefixes;
+  GHashTableIter iter;
+  GPtrArray *names;
+  GDir *dir;
+  gchar *dirname;
+  const gchar *name;
+
+  if (thumbnail_files != NULL)
+    return;
+
+  thumbnail_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify) g_ptr_array_unref);
+
+  dirname = theme_thumbnail_cache_get_dirname ();
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir == NULL) {
+    g_free (dirname);
+    return;
+  }
+
+  prefixes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  theme_thumbnail_cache_add_prefix (prefixes, THEME_TYPE_GTK,
+                                    mate_theme_info_find_by_type (MATE_THEME_GTK_2));
+  theme_thumbnail_cache_add_prefix (prefixes, THEME_TYPE_WINDOW,
+                                    mate_theme_info_find_by_type (MATE_THEME_MARCO));
+  theme_thumbnail_cache_add_prefix (prefixes, THEME_TYPE_ICON,
+                                    mate_theme_icon_info_find_all ());
+
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    const gchar *dash;
+    gchar *prefix;
+
+    if (!g_str_has_suffix (name, ".png"))
+      continue;
+
+    /* names of older versions of the cache have no dash */
+    dash = strchr (name, '-');
+    prefix = dash ? g_strndup (name, dash - name + 1) : NULL;
+
+    if (prefix == NULL || !g_hash_table_contains (prefixes, prefix)) {
+      theme_thumbnail_cache_unlink (dirname, name);
+      g_free (prefix);
+      continue;
+    }
+
+    names = g_hash_table_lookup (thumbnail_files, prefix);
+    if (names == NULL) {
+      names = g_ptr_array_new_with_free_func (g_free);
+      g_hash_table_insert (thumbnail_files, prefix, names);
+    } else {
+      g_free (prefix);
+    }
+    g_ptr_array_add (names, g_strdup (name));
+  }
+
+  g_dir_close (dir);
+
+  /* a theme with several thumbnails changed while its new thumbnail was
+   * saved by a run that hadn't scanned the dir; the newest one is current */
+  g_hash_table_iter_init (&iter, thumbnail_files);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &names)) {
+    gint64 newest_mtime = G_MININT64;
+    guint i, newest = 0;
+
+    if (names->len < 2)
+      continue;
+
+    for (i = 0; i < names->len; i++) {
+      gchar *filename = g_build_filename (dirname, g_ptr_array_index (names, i), NULL);
+      GStatBuf buf;
+
+      if (g_stat (filename, &buf) == 0 && (gint64) buf.st_mtime > newest_mtime) {
+        newest_mtime = buf.st_mtime;
+        newest = i;
+      }
+      g_free (filename);
+    }
+
+    for (i = names->len; i-- > 0; ) {
+      if (i != newest) {
+        theme_thumbnail_cache_unlink (dirname, g_ptr_array_index (names, i));
+        g_ptr_array_remove_index (names, i);
+      }
+    }
+  }
+
+  g_hash_table_destroy (prefixes);
+  g_free (dirname);
+}
+
+/* Removes the other thumbnails of the theme that the one just saved replaces */
+static void theme_thumbnail_cache_replace (ThemeType type, const gchar *path, const gchar *filename)
+{
+  GPtrArray *names;
+  gchar *dirname, *prefix, *current;
+  guint i;
+
+  if (thumbnail_files == NULL)
+    return;
+
+  prefix = theme_thumbnail_cache_get_prefix (type, path);
+  current = g_path_get_basename (filename);
+  dirname = g_path_get_dirname (filename);
+
+  names = g_hash_table_lookup (thumbnail_files, prefix);
+  if (names == NULL) {
+    names = g_ptr_array_new_with_free_func (g_free);
+    g_hash_table_insert (thumbnail_files, prefix, names);
+  } else {
+    g_free (prefix);
+  }
+
+  for (i = 0; i < names->len; i++) {
+    if (strcmp (g_ptr_array_index (names, i), current) != 0)
+      theme_thumbnail_cache_unlink (dirname, g_ptr_array_index (names, i));
+  }
+
+  g_ptr_array_set_size (names, 0);
+  g_ptr_array_add (names, current);
+
+  g_free (dirname);
+}
+
+GdkPixbuf *theme_thumbnail_cache_lookup (ThemeType type, const gchar *path, const gchar *color_scheme, const gchar *font)
+{
+  GdkPixbuf *pixbuf;
+  gchar *filename;
+
+  filename = theme_thumbnail_cache_get_filename (type, path, color_scheme, font);
+  if (filename == NULL)
+    return NULL;
+
+  pixbuf = gdk_pixbuf_new_from_file (filename, NULL);
+  g_free (filename);
+
+  return pixbuf;
+}
+
+void theme_thumbnail_cache_save (GdkPixbuf *pixbuf, ThemeType type, const gchar *path, const gchar *color_scheme, const gchar *font)
+{
+  gchar *filename, *dirname, *tmpname;
+  GError *error = NULL;
+
+  filename = theme_thumbnail_cache_get_filename (type, path, color_scheme, font);
+  if (filename == NULL)
+    return;
+
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  /* write under a temporary name, so lookups never see partial files */
+  tmpname = g_strdup_printf ("%s.%d", filename, (int) getpid ());
+
+  if (gdk_pixbuf_save (pixbuf, tmpname, "png", &error, NULL)) {
+    if (g_rename (tmpname, filename) != 0)
+      g_unlink (tmpname);
+    else
+      theme_thumbnail_cache_replace (type, path, filename);
+  } else {
+    g_warning ("Could not save theme thumbnail %s: %s", filename, error->message);
+    g_error_free (error);
+    g_unlink (tmpname);
+  }
+
+  g_free (tmpname);
+  g_free (filename);
+}
+
 gboolean packagekit_available (void)
 {
   GDBusConnection *connection;
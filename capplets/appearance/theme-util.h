@@ -42,6 +42,10 @@ gboolean theme_delete(const gchar* name, ThemeType type);
 gboolean theme_model_iter_last(GtkTreeModel* model, GtkTreeIter* iter);
 gboolean theme_find_in_model(GtkTreeModel* model, const gchar* name, GtkTreeIter* iter);
 
+GdkPixbuf* theme_thumbnail_cache_lookup(ThemeType type, const gchar* path, const gchar* color_scheme, const gchar* font);
+void theme_thumbnail_cache_save(GdkPixbuf* pixbuf, ThemeType type, const gchar* path, const gchar* color_scheme, const gchar* font);
+void theme_thumbnail_cache_prune(void);
+
 void theme_install_file(GtkWindow* parent, const gchar* path);
 gboolean packagekit_available(void);
 
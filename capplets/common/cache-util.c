@@ -0,0 +1,152 @@
+/*
+ * cache-util.c: helper API for the files in the user cache dir
+ *
+ * Copyright (C) 2026 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+
+#include <glib/gstdio.h>
+
+#include "cache-util.h"
+
+/* The caches are kept in mate-control-center under the user cache dir.
+ * Those made of a GVariant are stored as a (uv) of a format version and
+ * the contents; they are mapped and read in place, and are trusted no
+ * more than any other file. */
+#define CACHE_UTIL_TYPE "(uv)"
+
+/* Returns the path of the cache file @name, which may be in a subdir */
+gchar *
+cache_util_get_filename (const gchar *name)
+{
+    return g_build_filename (g_get_user_cache_dir (), "mate-control-center",
+                             name, NULL);
+}
+
+/* Returns the contents of the cache file @name, mapped, or NULL */
+GBytes *
+cache_util_load_bytes (const gchar *name)
+{
+    GMappedFile *mapped;
+    GBytes *bytes;
+    gchar *filename;
+
+    filename = cache_util_get_filename (name);
+    mapped = g_mapped_file_new (filename, FALSE, NULL);
+    g_free (filename);
+
+    if (mapped == NULL)
+        return NULL;
+
+    bytes = g_mapped_file_get_bytes (mapped);
+    g_mapped_file_unref (mapped);
+
+    return bytes;
+}
+
+/* Replaces the cache file @name. Failing to is not an error, the cache
+ * is just rebuilt the next time. */
+gboolean
+cache_util_save_bytes (const gchar  *name,
+                       gconstpointer data,
+                       gsize         size)
+{
+    gchar *filename, *dirname;
+    GError *error = NULL;
+    gboolean success = TRUE;
+
+    filename = cache_util_get_filename (name);
+    dirname = g_path_get_dirname (filename);
+
+    if (g_mkdir_with_parents (dirname, 0700) != 0 ||
+        !g_file_set_contents (filename, data, size, &error))
+    {
+        g_debug ("Can't write cache %s: %s", filename,
+                 error ? error->message : g_strerror (errno));
+        g_clear_error (&error);
+        success = FALSE;
+    }
+
+    g_free (dirname);
+    g_free (filename);
+
+    return success;
+}
+
+/* Returns the contents of the cache file @name, if it was saved with the
+ * same @version and they are a @type, or NULL */
+GVariant *
+cache_util_load (const gchar        *name,
+                 const GVariantType *type,
+                 guint32             version)
+{
+    GBytes *bytes;
+    GVariant *root, *boxed, *contents;
+    guint32 cached_version;
+
+    bytes = cache_util_load_bytes (name);
+    if (bytes == NULL)
+        return NULL;
+
+    root = g_variant_new_from_bytes (G_VARIANT_TYPE (CACHE_UTIL_TYPE), bytes, FALSE);
+    g_variant_ref_sink (root);
+    g_bytes_unref (bytes);
+
+    g_variant_get (root, "(u@v)", &cached_version, &boxed);
+    contents = g_variant_get_variant (boxed);
+
+    if (cached_version != version || !g_variant_is_of_type (contents, type))
+        g_clear_pointer (&contents, g_variant_unref);
+
+    g_variant_unref (boxed);
+    g_variant_unref (root);
+
+    return contents;
+}
+
+/* Saves @contents, which is sunk if floating, in the cache file @name */
+gboolean
+cache_util_save (const gchar *name,
+                 guint32      version,
+                 GVariant    *contents)
+{
+    GVariant *root;
+    gboolean success;
+
+    root = g_variant_new (CACHE_UTIL_TYPE, version, contents);
+    g_variant_ref_sink (root);
+
+    success = cache_util_save_bytes (name,
+                                     g_variant_get_data (root),
+                                     g_variant_get_size (root));
+
+    g_variant_unref (root);
+
+    return success;
+}
+
+/* Strings go into the caches as GVariant strings, which must be UTF-8;
+ * names and paths that aren't can't be cached. */
+gboolean
+cache_util_string_valid (const gchar *str)
+{
+    return str == NULL || g_utf8_validate (str, -1, NULL);
+}
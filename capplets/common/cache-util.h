@@ -0,0 +1,47 @@
+/*
+ * cache-util.h: helper API for the files in the user cache dir
+ *
+ * Copyright (C) 2026 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CACHE_UTIL_H__
+#define __CACHE_UTIL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gchar    *cache_util_get_filename (const gchar *name);
+
+GBytes   *cache_util_load_bytes   (const gchar *name);
+
+gboolean  cache_util_save_bytes   (const gchar  *name,
+                                   gconstpointer data,
+                                   gsize         size);
+
+GVariant *cache_util_load         (const gchar        *name,
+                                   const GVariantType *type,
+                                   guint32             version);
+
+gboolean  cache_util_save         (const gchar *name,
+                                   guint32      version,
+                                   GVariant    *contents);
+
+gboolean  cache_util_string_valid (const gchar *str);
+
+G_END_DECLS
+
+#endif /* __CACHE_UTIL_H__ */
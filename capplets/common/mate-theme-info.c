@@ -32,10 +32,12 @@
 #include <gtk/gtk.h>
 #include <gdk/gdkx.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <libmate-desktop/mate-desktop-item.h>
 #include "mate-theme-info.h"
 #include "gtkrc-utils.h"
+#include "cache-util.h"
 
 #include <X11/Xcursor/Xcursor.h>
 
@@ -697,25 +699,15 @@ handle_change_signal (gpointer             data,
 #endif
 }
 
-/* index_uri should point to the gtkrc file that was modified */
 static void
-update_theme_index (GFile            *index_uri,
-                    MateThemeElement  key_element,
-                    gint              priority)
+install_theme_element (GFile            *common_theme_dir_uri,
+                       MateThemeElement  key_element,
+                       gint              priority,
+                       gboolean          theme_exists)
 {
-  gboolean theme_exists;
   MateThemeInfo *theme_info;
-  GFile *parent;
-  GFile *common_theme_dir_uri;
   gchar *common_theme_dir;
 
-  /* First, we determine the new state of the file.  We do no more
-   * sophisticated a test than "files exists and is a file" */
-  theme_exists = (get_file_type (index_uri) == G_FILE_TYPE_REGULAR);
-
-  /* Next, we see what currently exists */
-  parent = g_file_get_parent (index_uri);
-  common_theme_dir_uri = g_file_get_parent (parent);
   common_theme_dir = g_file_get_path (common_theme_dir_uri);
 
   theme_info = g_hash_table_lookup (theme_hash_by_uri, common_theme_dir);
@@ -770,6 +762,28 @@ update_theme_index (GFile            *index_uri,
   }
 
   g_free (common_theme_dir);
+}
+
+/* index_uri should point to the gtkrc file that was modified */
+static void
+update_theme_index (GFile            *index_uri,
+                    MateThemeElement  key_element,
+                    gint              priority)
+{
+  gboolean theme_exists;
+  GFile *parent;
+  GFile *common_theme_dir_uri;
+
+  /* First, we determine the new state of the file.  We do no more
+   * sophisticated a test than "files exists and is a file" */
+  theme_exists = (get_file_type (index_uri) == G_FILE_TYPE_REGULAR);
+
+  /* Next, we see what currently exists */
+  parent = g_file_get_parent (index_uri);
+  common_theme_dir_uri = g_file_get_parent (parent);
+
+  install_theme_element (common_theme_dir_uri, key_element, priority, theme_exists);
+
   g_object_unref (parent);
   g_object_unref (common_theme_dir_uri);
 }
@@ -802,15 +816,13 @@ update_marco_index (GFile *marco_index_uri,
 }
 
 static void
-update_common_theme_dir_index (GFile          *theme_index_uri,
-                               MateThemeType   type,
-                               gint            priority)
+install_common_theme_info (MateThemeCommonInfo *theme_info,
+                           const gchar         *common_theme_dir,
+                           MateThemeType        type,
+                           gint                 priority)
 {
   gboolean theme_exists;
-  MateThemeCommonInfo *theme_info = NULL;
   MateThemeCommonInfo *old_theme_info;
-  GFile *common_theme_dir_uri;
-  gchar *common_theme_dir;
   GHashTable *hash_by_uri;
   GHashTable *hash_by_name;
 
@@ -825,24 +837,6 @@ update_common_theme_dir_index (GFile          *theme_index_uri,
     hash_by_name = meta_theme_hash_by_name;
   }
 
-  if (type != MATE_THEME_TYPE_CURSOR) {
-    /* First, we determine the new state of the file. */
-    if (get_file_type (theme_index_uri) == G_FILE_TYPE_REGULAR) {
-      /* It's an interesting file. Let's try to load it. */
-      if (type == MATE_THEME_TYPE_ICON)
-        theme_info = (MateThemeCommonInfo *) read_icon_theme (theme_index_uri);
-      else
-        theme_info = (MateThemeCommonInfo *) mate_theme_read_meta_theme (theme_index_uri);
-    } else {
-      theme_info = NULL;
-    }
-
-  }
-  /* cursor themes don't necessarily have an index file, so try those in any case */
-  else {
-    theme_info = (MateThemeCommonInfo *) read_cursor_theme (theme_index_uri);
-  }
-
   if (theme_info) {
     theme_info->priority = priority;
     theme_exists = TRUE;
@@ -850,11 +844,6 @@ update_common_theme_dir_index (GFile          *theme_index_uri,
     theme_exists = FALSE;
   }
 
-  /* Next, we see what currently exists */
-  common_theme_dir_uri = g_file_get_parent (theme_index_uri);
-  common_theme_dir = g_file_get_path (common_theme_dir_uri);
-  g_object_unref (common_theme_dir_uri);
-
   old_theme_info = (MateThemeCommonInfo *) g_hash_table_lookup (hash_by_uri, common_theme_dir);
 
   if (old_theme_info == NULL) {
@@ -884,6 +873,41 @@ update_common_theme_dir_index (GFile          *theme_index_uri,
       theme_free (old_theme_info);
     }
   }
+}
+
+static void
+update_common_theme_dir_index (GFile          *theme_index_uri,
+                               MateThemeType   type,
+                               gint            priority)
+{
+  MateThemeCommonInfo *theme_info = NULL;
+  GFile *common_theme_dir_uri;
+  gchar *common_theme_dir;
+
+  if (type != MATE_THEME_TYPE_CURSOR) {
+    /* First, we determine the new state of the file. */
+    if (get_file_type (theme_index_uri) == G_FILE_TYPE_REGULAR) {
+      /* It's an interesting file. Let's try to load it. */
+      if (type == MATE_THEME_TYPE_ICON)
+        theme_info = (MateThemeCommonInfo *) read_icon_theme (theme_index_uri);
+      else
+        theme_info = (MateThemeCommonInfo *) mate_theme_read_meta_theme (theme_index_uri);
+    } else {
+      theme_info = NULL;
+    }
+
+  }
+  /* cursor themes don't necessarily have an index file, so try those in any case */
+  else {
+    theme_info = (MateThemeCommonInfo *) read_cursor_theme (theme_index_uri);
+  }
+
+  /* Next, we see what currently exists */
+  common_theme_dir_uri = g_file_get_parent (theme_index_uri);
+  common_theme_dir = g_file_get_path (common_theme_dir_uri);
+  g_object_unref (common_theme_dir_uri);
+
+  install_common_theme_info (theme_info, common_theme_dir, type, priority);
 
   g_free (common_theme_dir);
 }
@@ -915,6 +939,496 @@ update_cursor_theme_index (GFile *cursor_theme_index_uri,
                                  priority);
 }
 
+/* On-disk index cache
+ *
+ * Scanning a common_theme_dir means parsing its index.theme and probing a
+ * cursor theme at every size, which dominates mate_theme_init on systems
+ * with many themes.  The outcome of each scan is kept in a GVariant file in
+ * the user cache dir, keyed by the path of the common_theme_dir and a stamp
+ * derived from the mtimes of everything the scan looks at.  The file is
+ * mapped and indexed once at init; only directories whose stamp changed
+ * are scanned again, and the cache is rewritten if anything was.
+ *
+ * GVariant data is stored in host byte order, so a cache written on a
+ * machine of the other endianness fails the version check and is rebuilt.
+ */
+
+#define THEME_CACHE_VERSION      2
+#define THEME_CACHE_META_TYPE    "(a{ss}ub)"
+#define THEME_CACHE_FLAGS_TYPE   "(bbb)"
+#define THEME_CACHE_ICON_TYPE    "(sssb)"
+#define THEME_CACHE_CURSOR_TYPE  "(sssbaim(iiiay))"
+#define THEME_CACHE_ENTRY_TYPE   "(xm" THEME_CACHE_META_TYPE \
+                                   "m" THEME_CACHE_FLAGS_TYPE \
+                                   "m" THEME_CACHE_ICON_TYPE \
+                                   "m" THEME_CACHE_CURSOR_TYPE ")"
+#define THEME_CACHE_TYPE         "(sa{s" THEME_CACHE_ENTRY_TYPE "})"
+
+enum {
+  THEME_CACHE_ENTRY_STAMP,
+  THEME_CACHE_ENTRY_META,
+  THEME_CACHE_ENTRY_FLAGS,
+  THEME_CACHE_ENTRY_ICON,
+  THEME_CACHE_ENTRY_CURSOR
+};
+
+typedef struct {
+  GHashTable *old_entries;  /* path -> entry, as read from disk */
+  GHashTable *new_entries;  /* path -> entry, as seen by this scan */
+  gchar      *languages;
+  gboolean    dirty;
+} ThemeCache;
+
+/* Only set while mate_theme_init is running */
+static ThemeCache *theme_cache = NULL;
+
+static const struct {
+  const gchar *key;
+  gsize        offset;
+} meta_theme_cache_fields[] = {
+  { "path", G_STRUCT_OFFSET (MateThemeMetaInfo, path) },
+  { "name", G_STRUCT_OFFSET (MateThemeMetaInfo, name) },
+  { "readable-name", G_STRUCT_OFFSET (MateThemeMetaInfo, readable_name) },
+  { "comment", G_STRUCT_OFFSET (MateThemeMetaInfo, comment) },
+  { "icon-file", G_STRUCT_OFFSET (MateThemeMetaInfo, icon_file) },
+  { "gtk-theme", G_STRUCT_OFFSET (MateThemeMetaInfo, gtk_theme_name) },
+  { "gtk-color-scheme", G_STRUCT_OFFSET (MateThemeMetaInfo, gtk_color_scheme) },
+  { "marco-theme", G_STRUCT_OFFSET (MateThemeMetaInfo, marco_theme_name) },
+  { "icon-theme", G_STRUCT_OFFSET (MateThemeMetaInfo, icon_theme_name) },
+  { "notification-theme", G_STRUCT_OFFSET (MateThemeMetaInfo, notification_theme_name) },
+  { "sound-theme", G_STRUCT_OFFSET (MateThemeMetaInfo, sound_theme_name) },
+  { "cursor-theme", G_STRUCT_OFFSET (MateThemeMetaInfo, cursor_theme_name) },
+  { "application-font", G_STRUCT_OFFSET (MateThemeMetaInfo, application_font) },
+  { "documents-font", G_STRUCT_OFFSET (MateThemeMetaInfo, documents_font) },
+  { "desktop-font", G_STRUCT_OFFSET (MateThemeMetaInfo, desktop_font) },
+  { "windowtitle-font", G_STRUCT_OFFSET (MateThemeMetaInfo, windowtitle_font) },
+  { "monospace-font", G_STRUCT_OFFSET (MateThemeMetaInfo, monospace_font) },
+  { "background-image", G_STRUCT_OFFSET (MateThemeMetaInfo, background_image) }
+};
+
+/* Files and subdirs, relative to a common_theme_dir, whose state decides
+ * the outcome of scanning it */
+static const gchar *theme_dir_stamp_files[] = {
+  "index.theme",
+  "gtk-2.0",
+  "gtk-2.0/gtkrc",
+  "gtk-2.0-key",
+  "gtk-2.0-key/gtkrc",
+  "metacity-1",
+  "metacity-1/metacity-theme-1.xml",
+  "metacity-1/metacity-theme-2.xml",
+  NULL
+};
+
+static const gchar *icon_theme_dir_stamp_files[] = {
+  "index.theme",
+  "cursors",
+  NULL
+};
+
+static gint64
+theme_cache_get_stamp (const gchar         *common_theme_dir,
+                       const gchar * const *files)
+{
+  GStatBuf buf;
+  guint64 stamp;
+
+  if (g_stat (common_theme_dir, &buf) != 0)
+    return -1;
+
+  stamp = (guint64) buf.st_mtime;
+
+  for (; *files != NULL; files++) {
+    gchar *path;
+
+    path = g_build_filename (common_theme_dir, *files, NULL);
+    stamp *= 31;
+    if (g_stat (path, &buf) == 0)
+      stamp += (guint64) buf.st_mtime + 1;
+    g_free (path);
+  }
+
+  return (gint64) (stamp >> 1);
+}
+
+static GVariant *
+theme_cache_pack_meta (MateThemeMetaInfo *info)
+{
+  GVariantBuilder fields;
+  guint i;
+
+  g_variant_builder_init (&fields, G_VARIANT_TYPE ("a{ss}"));
+
+  for (i = 0; i < G_N_ELEMENTS (meta_theme_cache_fields); i++) {
+    const gchar *value;
+
+    value = G_STRUCT_MEMBER (gchar *, info, meta_theme_cache_fields[i].offset);
+    if (value == NULL)
+      continue;
+
+    if (!cache_util_string_valid (value)) {
+      g_variant_builder_clear (&fields);
+      return NULL;
+    }
+
+    g_variant_builder_add (&fields, "{ss}", meta_theme_cache_fields[i].key, value);
+  }
+
+  return g_variant_new ("(a{ss}ub)", &fields, info->cursor_size, info->hidden);
+}
+
+static MateThemeMetaInfo *
+theme_cache_unpack_meta (GVariant *variant)
+{
+  MateThemeMetaInfo *info;
+  GVariant *fields;
+  guint32 cursor_size;
+  gboolean hidden;
+  guint i;
+
+  g_variant_get (variant, "(@a{ss}ub)", &fields, &cursor_size, &hidden);
+
+  info = mate_theme_meta_info_new ();
+
+  for (i = 0; i < G_N_ELEMENTS (meta_theme_cache_fields); i++) {
+    const gchar *value;
+
+    if (g_variant_lookup (fields, meta_theme_cache_fields[i].key, "&s", &value))
+      G_STRUCT_MEMBER (gchar *, info, meta_theme_cache_fields[i].offset) = g_strdup (value);
+  }
+
+  info->cursor_size = cursor_size;
+  info->hidden = hidden;
+
+  g_variant_unref (fields);
+
+  return info;
+}
+
+static GVariant *
+theme_cache_pack_icon (MateThemeIconInfo *info)
+{
+  if (!cache_util_string_valid (info->path) ||
+      !cache_util_string_valid (info->name) ||
+      !cache_util_string_valid (info->readable_name))
+    return NULL;
+
+  return g_variant_new ("(sssb)",
+                        info->path ? info->path : "",
+                        info->name ? info->name : "",
+                        info->readable_name ? info->readable_name : "",
+                        info->hidden);
+}
+
+static MateThemeIconInfo *
+theme_cache_unpack_icon (GVariant *variant)
+{
+  MateThemeIconInfo *info;
+  gboolean hidden;
+
+  info = mate_theme_icon_info_new ();
+  g_variant_get (variant, "(sssb)",
+                 &info->path, &info->name, &info->readable_name, &hidden);
+  info->hidden = hidden;
+
+  return info;
+}
+
+static GVariant *
+theme_cache_pack_cursor (MateThemeCursorInfo *info)
+{
+  GVariant *sizes, *thumbnail = NULL;
+
+  if (!cache_util_string_valid (info->path) ||
+      !cache_util_string_valid (info->name) ||
+      !cache_util_string_valid (info->readable_name))
+    return NULL;
+
+  sizes = g_variant_new_fixed_array (G_VARIANT_TYPE_INT32,
+                                     info->sizes->data, info->sizes->len,
+                                     sizeof (gint32));
+
+  /* thumbnails always come from gdk_pixbuf_from_xcursor_image */
+  if (info->thumbnail != NULL) {
+    GVariant *pixels;
+
+    pixels = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                        gdk_pixbuf_read_pixels (info->thumbnail),
+                                        gdk_pixbuf_get_byte_length (info->thumbnail),
+                                        1);
+    thumbnail = g_variant_new ("(iii@ay)",
+                               gdk_pixbuf_get_width (info->thumbnail),
+                               gdk_pixbuf_get_height (info->thumbnail),
+                               gdk_pixbuf_get_rowstride (info->thumbnail),
+                               pixels);
+  }
+
+  return g_variant_new ("(sssb@ai@m(iiiay))",
+                        info->path ? info->path : "",
+                        info->name ? info->name : "",
+                        info->readable_name ? info->readable_name : "",
+                        info->hidden,
+                        sizes,
+                        g_variant_new_maybe (G_VARIANT_TYPE ("(iiiay)"), thumbnail));
+}
+
+static MateThemeCursorInfo *
+theme_cache_unpack_cursor (GVariant *variant)
+{
+  MateThemeCursorInfo *info;
+  GVariant *sizes, *maybe, *thumbnail;
+  gconstpointer data;
+  gboolean hidden;
+  gsize n_sizes;
+
+  info = mate_theme_cursor_info_new ();
+  g_variant_get (variant, "(sssb@ai@m(iiiay))",
+                 &info->path, &info->name, &info->readable_name, &hidden,
+                 &sizes, &maybe);
+  info->hidden = hidden;
+
+  thumbnail = g_variant_get_maybe (maybe);
+  g_variant_unref (maybe);
+
+  data = g_variant_get_fixed_array (sizes, &n_sizes, sizeof (gint32));
+  info->sizes = g_array_sized_new (FALSE, FALSE, sizeof (gint), n_sizes);
+  g_array_append_vals (info->sizes, data, n_sizes);
+  g_variant_unref (sizes);
+
+  if (thumbnail != NULL) {
+    GVariant *pixels;
+    GBytes *bytes;
+    gint width, height, rowstride;
+
+    g_variant_get (thumbnail, "(iii@ay)", &width, &height, &rowstride, &pixels);
+    bytes = g_variant_get_data_as_bytes (pixels);
+
+    if (width > 0 && height > 0 && rowstride >= width * 4 &&
+        g_bytes_get_size (bytes) >= (gsize) rowstride * height)
+      info->thumbnail = gdk_pixbuf_new_from_bytes (bytes, GDK_COLORSPACE_RGB,
+                                                   TRUE, 8, width, height,
+                                                   rowstride);
+
+    g_bytes_unref (bytes);
+    g_variant_unref (pixels);
+    g_variant_unref (thumbnail);
+  }
+
+  return info;
+}
+
+static GVariant *
+theme_cache_get_entry_member (GVariant *entry,
+                              gsize     index)
+{
+  GVariant *maybe, *value;
+
+  maybe = g_variant_get_child_value (entry, index);
+  value = g_variant_get_maybe (maybe);
+  g_variant_unref (maybe);
+
+  return value;
+}
+
+static void
+theme_cache_load (void)
+{
+  GVariant *root;
+
+  theme_cache = g_new0 (ThemeCache, 1);
+  theme_cache->old_entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, (GDestroyNotify) g_variant_unref);
+  theme_cache->new_entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, (GDestroyNotify) g_variant_unref);
+  theme_cache->languages = g_strjoinv (":", (gchar **) g_get_language_names ());
+
+  root = cache_util_load ("theme-index.cache", G_VARIANT_TYPE (THEME_CACHE_TYPE),
+                          THEME_CACHE_VERSION);
+
+  if (root != NULL) {
+    GVariant *entries;
+    const gchar *languages;
+
+    g_variant_get (root, "(&s@a{s" THEME_CACHE_ENTRY_TYPE "})",
+                   &languages, &entries);
+
+    if (strcmp (languages, theme_cache->languages) == 0) {
+      GVariantIter iter;
+      GVariant *entry;
+      gchar *path;
+
+      g_variant_iter_init (&iter, entries);
+      while (g_variant_iter_next (&iter, "{s@" THEME_CACHE_ENTRY_TYPE "}", &path, &entry))
+        g_hash_table_insert (theme_cache->old_entries, path, entry);
+    }
+
+    g_variant_unref (entries);
+    g_variant_unref (root);
+  }
+}
+
+static void
+theme_cache_save (void)
+{
+  GVariantBuilder entries;
+  GHashTableIter iter;
+  gpointer path, entry;
+
+  g_variant_builder_init (&entries, G_VARIANT_TYPE ("a{s" THEME_CACHE_ENTRY_TYPE "}"));
+
+  g_hash_table_iter_init (&iter, theme_cache->new_entries);
+  while (g_hash_table_iter_next (&iter, &path, &entry))
+    g_variant_builder_add (&entries, "{s@" THEME_CACHE_ENTRY_TYPE "}", path, entry);
+
+  cache_util_save ("theme-index.cache", THEME_CACHE_VERSION,
+                   g_variant_new ("(s@a{s" THEME_CACHE_ENTRY_TYPE "})",
+                                  theme_cache->languages,
+                                  g_variant_builder_end (&entries)));
+}
+
+static void
+theme_cache_free (void)
+{
+  if (theme_cache->dirty ||
+      g_hash_table_size (theme_cache->old_entries) != g_hash_table_size (theme_cache->new_entries))
+    theme_cache_save ();
+
+  g_hash_table_destroy (theme_cache->old_entries);
+  g_hash_table_destroy (theme_cache->new_entries);
+  g_free (theme_cache->languages);
+  g_free (theme_cache);
+  theme_cache = NULL;
+}
+
+/* Installs the themes recorded for common_theme_dir, as if it had been
+ * scanned.  Returns FALSE if there is no up-to-date entry for it. */
+static gboolean
+theme_cache_restore (const gchar *common_theme_dir,
+                     gint64       stamp,
+                     gboolean     icon_theme,
+                     gint         priority)
+{
+  GVariant *entry, *member, *stamp_variant;
+  gint64 entry_stamp;
+
+  entry = g_hash_table_lookup (theme_cache->old_entries, common_theme_dir);
+  if (entry == NULL)
+    return FALSE;
+
+  stamp_variant = g_variant_get_child_value (entry, THEME_CACHE_ENTRY_STAMP);
+  entry_stamp = g_variant_get_int64 (stamp_variant);
+  g_variant_unref (stamp_variant);
+
+  if (stamp < 0 || entry_stamp != stamp)
+    return FALSE;
+
+  if (!icon_theme) {
+    GFile *common_theme_dir_uri;
+
+    member = theme_cache_get_entry_member (entry, THEME_CACHE_ENTRY_META);
+    if (member != NULL) {
+      install_common_theme_info ((MateThemeCommonInfo *) theme_cache_unpack_meta (member),
+                                 common_theme_dir, MATE_THEME_TYPE_METATHEME, priority);
+      g_variant_unref (member);
+    }
+
+    member = theme_cache_get_entry_member (entry, THEME_CACHE_ENTRY_FLAGS);
+    if (member != NULL) {
+      gboolean has_gtk, has_keybinding, has_marco;
+
+      g_variant_get (member, "(bbb)", &has_gtk, &has_keybinding, &has_marco);
+      common_theme_dir_uri = g_file_new_for_path (common_theme_dir);
+      if (has_gtk)
+        install_theme_element (common_theme_dir_uri, MATE_THEME_GTK_2, priority, TRUE);
+      if (has_keybinding)
+        install_theme_element (common_theme_dir_uri, MATE_THEME_GTK_2_KEYBINDING, priority, TRUE);
+      if (has_marco)
+        install_theme_element (common_theme_dir_uri, MATE_THEME_MARCO, priority, TRUE);
+      g_object_unref (common_theme_dir_uri);
+      g_variant_unref (member);
+    }
+  } else {
+    member = theme_cache_get_entry_member (entry, THEME_CACHE_ENTRY_ICON);
+    if (member != NULL) {
+      install_common_theme_info ((MateThemeCommonInfo *) theme_cache_unpack_icon (member),
+                                 common_theme_dir, MATE_THEME_TYPE_ICON, priority);
+      g_variant_unref (member);
+    }
+
+    member = theme_cache_get_entry_member (entry, THEME_CACHE_ENTRY_CURSOR);
+    if (member != NULL) {
+      install_common_theme_info ((MateThemeCommonInfo *) theme_cache_unpack_cursor (member),
+                                 common_theme_dir, MATE_THEME_TYPE_CURSOR, priority);
+      g_variant_unref (member);
+    }
+  }
+
+  g_hash_table_insert (theme_cache->new_entries,
+                       g_strdup (common_theme_dir),
+                       g_variant_ref (entry));
+
+  return TRUE;
+}
+
+/* Records what a fresh scan of common_theme_dir found */
+static void
+theme_cache_record (const gchar *common_theme_dir,
+                    gint64       stamp,
+                    gboolean     icon_theme)
+{
+  GVariant *meta = NULL, *flags = NULL, *icon = NULL, *cursor = NULL;
+  GVariant *entry;
+
+  theme_cache->dirty = TRUE;
+
+  if (stamp < 0 || !cache_util_string_valid (common_theme_dir))
+    return;
+
+  if (!icon_theme) {
+    MateThemeMetaInfo *meta_info;
+    MateThemeInfo *theme_info;
+
+    meta_info = g_hash_table_lookup (meta_theme_hash_by_uri, common_theme_dir);
+    if (meta_info != NULL && (meta = theme_cache_pack_meta (meta_info)) == NULL)
+      return;
+
+    theme_info = g_hash_table_lookup (theme_hash_by_uri, common_theme_dir);
+    if (theme_info != NULL)
+      flags = g_variant_new ("(bbb)",
+                             (gboolean) theme_info->has_gtk,
+                             (gboolean) theme_info->has_keybinding,
+                             (gboolean) theme_info->has_marco);
+  } else {
+    MateThemeIconInfo *icon_info;
+    MateThemeCursorInfo *cursor_info;
+
+    icon_info = g_hash_table_lookup (icon_theme_hash_by_uri, common_theme_dir);
+    if (icon_info != NULL && (icon = theme_cache_pack_icon (icon_info)) == NULL)
+      return;
+
+    cursor_info = g_hash_table_lookup (cursor_theme_hash_by_uri, common_theme_dir);
+    if (cursor_info != NULL && (cursor = theme_cache_pack_cursor (cursor_info)) == NULL) {
+      if (icon != NULL)
+        g_variant_unref (g_variant_ref_sink (icon));
+      return;
+    }
+  }
+
+  entry = g_variant_new ("(x@m" THEME_CACHE_META_TYPE
+                         "@m" THEME_CACHE_FLAGS_TYPE
+                         "@m" THEME_CACHE_ICON_TYPE
+                         "@m" THEME_CACHE_CURSOR_TYPE ")",
+                         stamp,
+                         g_variant_new_maybe (G_VARIANT_TYPE (THEME_CACHE_META_TYPE), meta),
+                         g_variant_new_maybe (G_VARIANT_TYPE (THEME_CACHE_FLAGS_TYPE), flags),
+                         g_variant_new_maybe (G_VARIANT_TYPE (THEME_CACHE_ICON_TYPE), icon),
+                         g_variant_new_maybe (G_VARIANT_TYPE (THEME_CACHE_CURSOR_TYPE), cursor));
+
+  g_hash_table_insert (theme_cache->new_entries,
+                       g_strdup (common_theme_dir),
+                       g_variant_ref_sink (entry));
+}
+
 static void
 gtk2_dir_changed (GFileMonitor              *monitor,
                   GFile                     *file,
@@ -1024,18 +1538,109 @@ common_icon_theme_dir_changed (GFileMonitor                  *monitor,
   g_free (affected_file);
 }
 
+/* Scan a common_theme_dir for a metatheme and gtk-2/keybinding/marco themes */
+static void
+scan_common_theme_dir (GFile *theme_dir_uri,
+                       gint   priority)
+{
+  GFile *uri, *subdir;
+
+  uri = g_file_get_child (theme_dir_uri, "index.theme");
+  update_meta_theme_index (uri, priority);
+  g_object_unref (uri);
+
+  /* gtk-2 theme subdir */
+  subdir = g_file_get_child (theme_dir_uri, "gtk-2.0");
+  uri = g_file_get_child (subdir, "gtkrc");
+  if (g_file_query_exists (uri, NULL)) {
+    update_gtk2_index (uri, priority);
+  }
+  g_object_unref (uri);
+  g_object_unref (subdir);
+
+  /* keybinding theme subdir */
+  subdir = g_file_get_child (theme_dir_uri, "gtk-2.0-key");
+  uri = g_file_get_child (subdir, "gtkrc");
+  if (g_file_query_exists (uri, NULL)) {
+    update_keybinding_index (uri, priority);
+  }
+  g_object_unref (uri);
+  g_object_unref (subdir);
+
+  /* marco theme subdir */
+  subdir = g_file_get_child (theme_dir_uri, "metacity-1");
+  uri = g_file_get_child (subdir, "metacity-theme-2.xml");
+  if (g_file_query_exists (uri, NULL)) {
+    update_marco_index (uri, priority);
+  }
+  else {
+    g_object_unref (uri);
+    uri = g_file_get_child (subdir, "metacity-theme-1.xml");
+    if (g_file_query_exists (uri, NULL)) {
+      update_marco_index (uri, priority);
+    }
+  }
+  g_object_unref (uri);
+  g_object_unref (subdir);
+}
+
+/* Scan a common_icon_theme_dir for an icon theme and a cursor theme */
+static void
+scan_common_icon_theme_dir (GFile *theme_dir_uri,
+                            gint   priority)
+{
+  GFile *index_uri;
+
+  index_uri = g_file_get_child (theme_dir_uri, "index.theme");
+  update_icon_theme_index (index_uri, priority);
+  update_cursor_theme_index (index_uri, priority);
+  g_object_unref (index_uri);
+}
+
+/* Load the themes of a common_theme_dir, from the index cache if we are
+ * initializing and it has an up-to-date entry, from disk otherwise. */
+static void
+load_common_theme_dir (GFile    *theme_dir_uri,
+                       gboolean  icon_theme,
+                       gint      priority)
+{
+  gchar *common_theme_dir;
+  gint64 stamp;
+
+  if (theme_cache == NULL) {
+    if (icon_theme)
+      scan_common_icon_theme_dir (theme_dir_uri, priority);
+    else
+      scan_common_theme_dir (theme_dir_uri, priority);
+    return;
+  }
+
+  common_theme_dir = g_file_get_path (theme_dir_uri);
+  stamp = theme_cache_get_stamp (common_theme_dir,
+                                 icon_theme ? icon_theme_dir_stamp_files
+                                            : theme_dir_stamp_files);
+
+  if (!theme_cache_restore (common_theme_dir, stamp, icon_theme, priority)) {
+    if (icon_theme)
+      scan_common_icon_theme_dir (theme_dir_uri, priority);
+    else
+      scan_common_theme_dir (theme_dir_uri, priority);
+    theme_cache_record (common_theme_dir, stamp, icon_theme);
+  }
+
+  g_free (common_theme_dir);
+}
+
 /* Add a monitor to a common_theme_dir. */
 static gboolean
 add_common_theme_dir_monitor (GFile                      *theme_dir_uri,
                               CommonThemeDirMonitorData  *monitor_data,
                               GError                    **error)
 {
-  GFile *uri, *subdir;
+  GFile *subdir;
   GFileMonitor *monitor;
 
-  uri = g_file_get_child (theme_dir_uri, "index.theme");
-  update_meta_theme_index (uri, monitor_data->priority);
-  g_object_unref (uri);
+  load_common_theme_dir (theme_dir_uri, FALSE, monitor_data->priority);
 
   /* Add the handle for this directory */
   monitor = g_file_monitor_file (theme_dir_uri, G_FILE_MONITOR_NONE, NULL, NULL);
@@ -1050,12 +1655,6 @@ add_common_theme_dir_monitor (GFile                      *theme_dir_uri,
 
   /* gtk-2 theme subdir */
   subdir = g_file_get_child (theme_dir_uri, "gtk-2.0");
-  uri = g_file_get_child (subdir, "gtkrc");
-  if (g_file_query_exists (uri, NULL)) {
-    update_gtk2_index (uri, monitor_data->priority);
-  }
-  g_object_unref (uri);
-
   monitor = g_file_monitor_directory (subdir, G_FILE_MONITOR_NONE, NULL, NULL);
   if (monitor != NULL) {
     g_signal_connect (monitor, "changed",
@@ -1067,12 +1666,6 @@ add_common_theme_dir_monitor (GFile                      *theme_dir_uri,
 
   /* keybinding theme subdir */
   subdir = g_file_get_child (theme_dir_uri, "gtk-2.0-key");
-  uri = g_file_get_child (subdir, "gtkrc");
-  if (g_file_query_exists (uri, NULL)) {
-    update_keybinding_index (uri, monitor_data->priority);
-  }
-  g_object_unref (uri);
-
   monitor = g_file_monitor_directory (subdir, G_FILE_MONITOR_NONE, NULL, NULL);
   if (monitor != NULL) {
     g_signal_connect (monitor, "changed",
@@ -1084,19 +1677,6 @@ add_common_theme_dir_monitor (GFile                      *theme_dir_uri,
 
   /* marco theme subdir */
   subdir = g_file_get_child (theme_dir_uri, "metacity-1");
-  uri = g_file_get_child (subdir, "metacity-theme-2.xml");
-  if (g_file_query_exists (uri, NULL)) {
-    update_marco_index (uri, monitor_data->priority);
-  }
-  else {
-    g_object_unref (uri);
-    uri = g_file_get_child (subdir, "metacity-theme-1.xml");
-    if (g_file_query_exists (uri, NULL)) {
-      update_marco_index (uri, monitor_data->priority);
-    }
-  }
-  g_object_unref (uri);
-
   monitor = g_file_monitor_directory (subdir, G_FILE_MONITOR_NONE, NULL, NULL);
   if (monitor != NULL) {
     g_signal_connect (monitor, "changed",
@@ -1114,15 +1694,11 @@ add_common_icon_theme_dir_monitor (GFile                          *theme_dir_uri
                                    CommonIconThemeDirMonitorData  *monitor_data,
                                    GError                        **error)
 {
-  GFile *index_uri;
   GFileMonitor *monitor;
 
-  /* Add the handle for this directory */
-  index_uri = g_file_get_child (theme_dir_uri, "index.theme");
-  update_icon_theme_index (index_uri, monitor_data->priority);
-  update_cursor_theme_index (index_uri, monitor_data->priority);
-  g_object_unref (index_uri);
+  load_common_theme_dir (theme_dir_uri, TRUE, monitor_data->priority);
 
+  /* Add the handle for this directory */
   monitor = g_file_monitor_file (theme_dir_uri, G_FILE_MONITOR_NONE, NULL, NULL);
   if (monitor == NULL)
     return FALSE;
@@ -1815,6 +2391,8 @@ mate_theme_init ()
   theme_hash_by_uri = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
   theme_hash_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
+  theme_cache_load ();
+
   /* Add all the toplevel theme dirs following the XDG Base Directory Specification */
   dirs = g_get_system_data_dirs ();
   if (dirs != NULL)
@@ -1859,6 +2437,8 @@ mate_theme_init ()
     g_object_unref (top_theme_dir);
   }
 
+  theme_cache_free ();
+
   /* make sure we have the default theme */
   if (!mate_theme_cursor_info_find ("default"))
     add_default_cursor_theme ();
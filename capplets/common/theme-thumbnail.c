@@ -1,6 +1,12 @@
+#define _GNU_SOURCE /* memfd_create */
 #include <config.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <marco-private/util.h>
 #include <marco-private/theme.h>
 #include <marco-private/theme-parser.h>
@@ -20,29 +26,45 @@
 #include "capplet-util.h"
 
 typedef struct {
-	gboolean set;
-	gint thumbnail_width;
-	gint thumbnail_height;
-	GByteArray* data;
+	gchar* thumbnail_type;
 	gchar* theme_name;
+	gchar* gtk_theme_name;
+	gchar* gtk_color_scheme;
+	gchar* marco_theme_name;
+	gchar* icon_theme_name;
+	gchar* application_font;
 	ThemeThumbnailFunc func;
 	gpointer user_data;
 	GDestroyNotify destroy;
-	GIOChannel* channel;
-	guint watch_id;
-} ThemeThumbnailAsyncData;
+	guint priority;
+	guint serial;
+} ThemeThumbnailRequest;
 
-static ThemeThumbnailAsyncData async_data;
+/* One forked factory process.  The fds are -1 once it has gone away. */
+typedef struct {
+	int to_factory_fd;
+	int from_factory_fd;
+	guint watch_id;
+	ThemeThumbnailRequest* request;
+} ThemeThumbnailWorker;
 
 /* Protocol */
 
 /* Our protocol is pretty simple.  The parent process will write several strings
  * (separated by a '\000'). They are the widget theme, the wm theme, the icon
- * theme, etc.  Then, it will wait for the child to write back the data.  The
- * parent expects ICON_SIZE_WIDTH * ICON_SIZE_HEIGHT * 4 bytes of information.
+ * theme, etc.  Then, it will wait for the child to write back a
+ * ThumbnailHeader.  Unless the thumbnail is empty, the header carries a shared
+ * memory file descriptor (SCM_RIGHTS) holding height * rowstride bytes of
+ * RGBA pixels, which the parent maps and wraps in a pixbuf without copying.
  * After that, the child is ready for the next theme to render.
  */
 
+typedef struct {
+	gint width;
+	gint height;
+	gint rowstride;
+} ThumbnailHeader;
+
 enum {
 	READY_FOR_THEME,
 	READING_TYPE,
@@ -64,18 +86,22 @@ typedef struct {
 	GByteArray* application_font;
 } ThemeThumbnailData;
 
-typedef struct {
-	gchar* thumbnail_type;
-	gpointer theme_info;
-	ThemeThumbnailFunc func;
-	gpointer user_data;
-	GDestroyNotify destroy;
-} ThemeQueueItem;
+/* The factory is a pool of worker processes, each rendering one thumbnail at
+ * a time.  Requests wait in pending_requests, ordered by priority and then by
+ * arrival, until a worker is free.  theme_thumbnail_prioritize() raises the
+ * priority of requests above everything queued so far. */
+#define MAX_THUMBNAIL_WORKERS 4
+
+static ThemeThumbnailWorker* workers = NULL;
+static guint n_workers = 0;
 
-static GList* theme_queue = NULL;
+static GSequence* pending_requests = NULL;
+static guint request_serial = 0;
+static guint request_boost = 0;
 
-static int pipe_to_factory_fd[2];
-static int pipe_from_factory_fd[2];
+/* In a worker, the end of the socketpair replies are written to.  It is a
+ * socketpair rather than a pipe so that it can carry file descriptors. */
+static int factory_reply_fd = -1;
 
 #define THUMBNAIL_TYPE_META     "meta"
 #define THUMBNAIL_TYPE_GTK      "gtk"
@@ -422,6 +448,233 @@ create_icon_theme_pixbuf (ThemeThumbnailData *theme_thumbnail_data)
   return create_folder_icon ((char *) theme_thumbnail_data->icon_theme_name->data);
 }
 
+static int
+thumbnail_shm_open (void)
+{
+#ifdef HAVE_MEMFD_CREATE
+  return memfd_create ("mate-theme-thumbnail", MFD_CLOEXEC);
+#else
+  gchar *name;
+  int fd;
+
+  name = g_strdup_printf ("/mate-theme-thumbnail-%d-%u", (int) getpid (), g_random_int ());
+  fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd != -1)
+    shm_unlink (name);
+  g_free (name);
+
+  return fd;
+#endif
+}
+
+/* Copies the pixbuf into a new shared memory file and fills in the header
+ * describing it.  Returns -1 if that is not possible. */
+static int
+thumbnail_shm_new (GdkPixbuf       *pixbuf,
+                   ThumbnailHeader *header)
+{
+  GdkPixbuf *rgba;
+  const guchar *src;
+  guchar *dest;
+  gsize size;
+  gint i, src_rowstride;
+  int fd;
+
+  if (gdk_pixbuf_get_has_alpha (pixbuf))
+    rgba = g_object_ref (pixbuf);
+  else
+    rgba = gdk_pixbuf_add_alpha (pixbuf, FALSE, 0, 0, 0);
+
+  header->width = gdk_pixbuf_get_width (rgba);
+  header->height = gdk_pixbuf_get_height (rgba);
+  header->rowstride = header->width * 4;
+  size = (gsize) header->rowstride * header->height;
+
+  fd = thumbnail_shm_open ();
+  if (fd == -1)
+    goto error;
+
+  if (ftruncate (fd, size) == -1)
+    goto error;
+
+  dest = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (dest == MAP_FAILED)
+    goto error;
+
+  src = gdk_pixbuf_read_pixels (rgba);
+  src_rowstride = gdk_pixbuf_get_rowstride (rgba);
+  for (i = 0; i < header->height; i++)
+    memcpy (dest + header->rowstride * i, src + src_rowstride * i, header->rowstride);
+
+  munmap (dest, size);
+  g_object_unref (rgba);
+
+  return fd;
+
+error:
+  perror ("shared memory error");
+  if (fd != -1)
+    close (fd);
+  g_object_unref (rgba);
+  header->width = header->height = header->rowstride = 0;
+  return -1;
+}
+
+static void
+thumbnail_shm_free (guchar   *pixels,
+                    gpointer  size)
+{
+  munmap (pixels, GPOINTER_TO_SIZE (size));
+}
+
+/* Maps the shared memory file described by header as a pixbuf.  The mapping
+ * is private, so consumers may scribble on the pixels. */
+static GdkPixbuf *
+thumbnail_shm_get_pixbuf (const ThumbnailHeader *header,
+                          int                    fd)
+{
+  GdkPixbuf *pixbuf;
+  struct stat buf;
+  guchar *pixels;
+  gsize size;
+
+  if (header->width <= 0 || header->height <= 0 ||
+      header->rowstride < header->width * 4)
+    return NULL;
+
+  size = (gsize) header->rowstride * header->height;
+  if (fstat (fd, &buf) == -1 || (gsize) buf.st_size < size)
+    return NULL;
+
+  pixels = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (pixels == MAP_FAILED)
+    return NULL;
+
+  pixbuf = gdk_pixbuf_new_from_data (pixels, GDK_COLORSPACE_RGB, TRUE, 8,
+                                     header->width, header->height,
+                                     header->rowstride,
+                                     thumbnail_shm_free,
+                                     GSIZE_TO_POINTER (size));
+  if (pixbuf == NULL)
+    munmap (pixels, size);
+
+  return pixbuf;
+}
+
+static void
+send_thumbnail_header (int                    socket_fd,
+                       const ThumbnailHeader *header,
+                       int                    shm_fd)
+{
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  ssize_t ret;
+
+  memset (&msg, 0, sizeof (msg));
+  iov.iov_base = (gpointer) header;
+  iov.iov_len = sizeof (ThumbnailHeader);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (shm_fd != -1)
+  {
+    struct cmsghdr *cmsg;
+
+    memset (&control, 0, sizeof (control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+    memcpy (CMSG_DATA (cmsg), &shm_fd, sizeof (int));
+  }
+
+  do
+    ret = sendmsg (socket_fd, &msg, 0);
+  while (ret == -1 && errno == EINTR);
+
+  if (ret == -1)
+    perror ("write error");
+}
+
+/* Reads a whole ThumbnailHeader and the descriptor that came with it, if
+ * any.  Returns FALSE on EOF or error. */
+static gboolean
+receive_thumbnail_header (int              socket_fd,
+                          ThumbnailHeader *header,
+                          int             *shm_fd)
+{
+  gsize received = 0;
+
+  *shm_fd = -1;
+
+  while (received < sizeof (ThumbnailHeader))
+  {
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE (sizeof (int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t ret;
+
+    memset (&msg, 0, sizeof (msg));
+    iov.iov_base = ((guint8 *) header) + received;
+    iov.iov_len = sizeof (ThumbnailHeader) - received;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+
+    ret = recvmsg (socket_fd, &msg, 0);
+
+    if (ret == 0)
+      goto error;
+
+    if (ret == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        struct pollfd pfd = { socket_fd, POLLIN, 0 };
+        poll (&pfd, 1, -1);
+      }
+      else if (errno != EINTR)
+        goto error;
+
+      continue;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      {
+        if (*shm_fd != -1)
+          close (*shm_fd);
+        memcpy (shm_fd, CMSG_DATA (cmsg), sizeof (int));
+      }
+    }
+
+    received += ret;
+  }
+
+  return TRUE;
+
+error:
+  if (*shm_fd != -1)
+  {
+    close (*shm_fd);
+    *shm_fd = -1;
+  }
+  return FALSE;
+}
+
 static void
 handle_bytes (const guint8       *buffer,
               gint                bytes_read,
@@ -566,9 +819,8 @@ message_from_capplet (GIOChannel   *source,
       if (theme_thumbnail_data->status == WRITING_PIXBUF_DATA)
       {
         GdkPixbuf *pixbuf = NULL;
-        gint i, rowstride;
-        guchar *pixels;
-        gint width, height;
+        ThumbnailHeader header = { 0, 0, 0 };
+        int shm_fd = -1;
         const gchar *type = (const gchar *) theme_thumbnail_data->type->data;
 
         if (!strcmp (type, THUMBNAIL_TYPE_META))
@@ -582,29 +834,13 @@ message_from_capplet (GIOChannel   *source,
         else
           g_assert_not_reached ();
 
-        if (pixbuf == NULL) {
-          width = height = rowstride = 0;
-          pixels = NULL;
-        } else {
-          width = gdk_pixbuf_get_width (pixbuf);
-          height = gdk_pixbuf_get_height (pixbuf);
-          rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-          pixels = gdk_pixbuf_get_pixels (pixbuf);
-        }
+        if (pixbuf != NULL)
+          shm_fd = thumbnail_shm_new (pixbuf, &header);
 
-        /* Write the pixbuf's size */
+        send_thumbnail_header (factory_reply_fd, &header, shm_fd);
 
-        if (write (pipe_from_factory_fd[1], &width, sizeof (width)) == -1)
-          perror ("write error");
-
-        if (write (pipe_from_factory_fd[1], &height, sizeof (height)) == -1)
-          perror ("write error");
-
-        for (i = 0; i < height; i++)
-        {
-          if (write (pipe_from_factory_fd[1], pixels + rowstride * i, width * gdk_pixbuf_get_n_channels (pixbuf)) == -1)
-            perror ("write error");
-        }
+        if (shm_fd != -1)
+          close (shm_fd);
 
         if (pixbuf)
           g_object_unref (pixbuf);
@@ -633,251 +869,266 @@ message_from_capplet (GIOChannel   *source,
 }
 
 static void
-generate_next_in_queue (void)
-{
-  ThemeQueueItem *item;
-
-  if (theme_queue == NULL)
-    return;
-
-  item = theme_queue->data;
-  theme_queue = g_list_delete_link (theme_queue, g_list_first (theme_queue));
-
-  if (!strcmp (item->thumbnail_type, THUMBNAIL_TYPE_META))
-    generate_meta_theme_thumbnail_async ((MateThemeMetaInfo *) item->theme_info,
-                                         item->func,
-                                         item->user_data,
-                                         item->destroy);
-  else if (!strcmp (item->thumbnail_type, THUMBNAIL_TYPE_GTK))
-    generate_gtk_theme_thumbnail_async ((MateThemeInfo *) item->theme_info,
-                                        item->func,
-                                        item->user_data,
-                                        item->destroy);
-  else if (!strcmp (item->thumbnail_type, THUMBNAIL_TYPE_MARCO))
-    generate_marco_theme_thumbnail_async ((MateThemeInfo *) item->theme_info,
-                                             item->func,
-                                             item->user_data,
-                                             item->destroy);
-  else if (!strcmp (item->thumbnail_type, THUMBNAIL_TYPE_ICON))
-    generate_icon_theme_thumbnail_async ((MateThemeIconInfo *) item->theme_info,
-                                         item->func,
-                                         item->user_data,
-                                         item->destroy);
-
-  g_free (item);
-}
-
-static gboolean
-message_from_child (GIOChannel   *source,
-                    GIOCondition  condition,
-                    gpointer      data)
-{
-  gchar buffer[1024];
-  GIOStatus status;
-  gsize bytes_read;
-
-  if (async_data.set == FALSE)
-    return TRUE;
-
-  if (condition == G_IO_HUP)
-    return FALSE;
-
-  status = g_io_channel_read_chars (source,
-                                    buffer,
-                                    1024,
-                                    &bytes_read,
-                                    NULL);
-  switch (status)
-  {
-    case G_IO_STATUS_NORMAL:
-      g_byte_array_append (async_data.data, (guchar *) buffer, bytes_read);
-
-      if (async_data.thumbnail_width == -1 && async_data.data->len >= 2 * sizeof (gint))
-      {
-        async_data.thumbnail_width = *((gint *) async_data.data->data);
-        async_data.thumbnail_height = *(((gint *) async_data.data->data) + 1);
-        g_byte_array_remove_range (async_data.data, 0, 2 * sizeof (gint));
-      }
-
-      if (async_data.thumbnail_width >= 0 && async_data.data->len == async_data.thumbnail_width * async_data.thumbnail_height * 4)
-      {
-        GdkPixbuf *pixbuf = NULL;
-
-        if (async_data.thumbnail_width > 0) {
-          gchar *pixels;
-          gint i, rowstride;
-
-          pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, async_data.thumbnail_width, async_data.thumbnail_height);
-          pixels = (gchar *) gdk_pixbuf_get_pixels (pixbuf);
-          rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-
-          for (i = 0; i < async_data.thumbnail_height; ++i)
-            memcpy (pixels + rowstride * i, async_data.data->data + 4 * async_data.thumbnail_width * i, async_data.thumbnail_width * 4);
-        }
-
-        /* callback function needs to ref the pixbuf if it wants to keep it */
-        (* async_data.func) (pixbuf, async_data.theme_name, async_data.user_data);
-
-        if (async_data.destroy)
-          (* async_data.destroy) (async_data.user_data);
-
-        if (pixbuf)
-          g_object_unref (pixbuf);
-
-        /* Clean up async_data */
-        g_free (async_data.theme_name);
-        g_source_remove (async_data.watch_id);
-        g_io_channel_unref (async_data.channel);
-
-        /* reset async_data */
-        async_data.thumbnail_width = -1;
-        async_data.thumbnail_height = -1;
-        async_data.theme_name = NULL;
-        async_data.channel = NULL;
-        async_data.func = NULL;
-        async_data.user_data = NULL;
-        async_data.destroy = NULL;
-        async_data.set = FALSE;
-        g_byte_array_set_size (async_data.data, 0);
-
-        generate_next_in_queue ();
-      }
-      return TRUE;
-
-    case G_IO_STATUS_AGAIN:
-      return TRUE;
-
-    case G_IO_STATUS_EOF:
-    case G_IO_STATUS_ERROR:
-      return FALSE;
-
-    default:
-      g_assert_not_reached ();
-  }
-
-  return TRUE;
-}
-
-static void
-send_thumbnail_request (gchar *thumbnail_type,
+send_thumbnail_request (int    fd,
+                        gchar *thumbnail_type,
                         gchar *gtk_theme_name,
                         gchar *gtk_color_scheme,
                         gchar *marco_theme_name,
                         gchar *icon_theme_name,
                         gchar *application_font)
 {
-  if (write (pipe_to_factory_fd[1], thumbnail_type, strlen (thumbnail_type) + 1) == -1)
+  if (write (fd, thumbnail_type, strlen (thumbnail_type) + 1) == -1)
     perror ("write error");
 
   if (gtk_theme_name)
   {
-    if (write (pipe_to_factory_fd[1], gtk_theme_name, strlen (gtk_theme_name) + 1) == -1)
+    if (write (fd, gtk_theme_name, strlen (gtk_theme_name) + 1) == -1)
       perror ("write error");
   }
   else
   {
-    if (write (pipe_to_factory_fd[1], "", 1) == -1)
+    if (write (fd, "", 1) == -1)
       perror ("write error");
   }
 
   if (gtk_color_scheme)
   {
-    if (write (pipe_to_factory_fd[1], gtk_color_scheme, strlen (gtk_color_scheme) + 1) == -1)
+    if (write (fd, gtk_color_scheme, strlen (gtk_color_scheme) + 1) == -1)
       perror ("write error");
   }
   else
   {
-    if (write (pipe_to_factory_fd[1], "", 1) == -1)
+    if (write (fd, "", 1) == -1)
       perror ("write error");
   }
 
   if (marco_theme_name)
   {
-    if (write (pipe_to_factory_fd[1], marco_theme_name, strlen (marco_theme_name) + 1) == -1)
+    if (write (fd, marco_theme_name, strlen (marco_theme_name) + 1) == -1)
       perror ("write error");
   }
   else
   {
-    if (write (pipe_to_factory_fd[1], "", 1) == -1)
+    if (write (fd, "", 1) == -1)
       perror ("write error");
   }
 
   if (icon_theme_name)
   {
-    if (write (pipe_to_factory_fd[1], icon_theme_name, strlen (icon_theme_name) + 1) == -1)
+    if (write (fd, icon_theme_name, strlen (icon_theme_name) + 1) == -1)
       perror ("write error");
   }
   else
   {
-    if (write (pipe_to_factory_fd[1], "", 1) == -1)
+    if (write (fd, "", 1) == -1)
       perror ("write error");
   }
 
   if (application_font)
   {
-    if (write (pipe_to_factory_fd[1], application_font, strlen (application_font) + 1) == -1)
+    if (write (fd, application_font, strlen (application_font) + 1) == -1)
       perror ("write error");
   }
   else
   {
-    if (write (pipe_to_factory_fd[1], "Sans 10", strlen ("Sans 10") + 1) == -1)
+    if (write (fd, "Sans 10", strlen ("Sans 10") + 1) == -1)
       perror ("write error");
   }
 }
 
-static GdkPixbuf *
-read_pixbuf (void)
+static ThemeThumbnailWorker *
+get_idle_worker (void)
 {
-  gint bytes_read, i, j = 0;
-  gint size[2];
-  GdkPixbuf *pixbuf;
-  gint rowstride;
-  guchar *pixels;
+  guint i;
 
-  do
+  for (i = 0; i < n_workers; i++)
   {
-    bytes_read = read (pipe_from_factory_fd[0], ((guint8*) size) + j, 2 * sizeof (gint));
-    if (bytes_read == 0)
-      goto eof;
-    j += bytes_read;
+    if (workers[i].to_factory_fd != -1 && workers[i].request == NULL)
+      return &workers[i];
   }
-  while (j < 2 * sizeof (gint));
 
-  if (size[0] <= 0 || size[1] <= 0)
-    return NULL;
+  return NULL;
+}
 
-  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, size[0], size[1]);
-  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
-  pixels = gdk_pixbuf_get_pixels (pixbuf);
+static gboolean
+have_workers (void)
+{
+  guint i;
+
+  for (i = 0; i < n_workers; i++)
+  {
+    if (workers[i].to_factory_fd != -1)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+worker_shutdown (ThemeThumbnailWorker *worker)
+{
+  if (worker->watch_id != 0)
+  {
+    g_source_remove (worker->watch_id);
+    worker->watch_id = 0;
+  }
+
+  close (worker->to_factory_fd);
+  worker->to_factory_fd = -1;
+  close (worker->from_factory_fd);
+  worker->from_factory_fd = -1;
+}
+
+static gint
+compare_requests (gconstpointer a,
+                  gconstpointer b,
+                  gpointer      user_data)
+{
+  const ThemeThumbnailRequest *request_a = a;
+  const ThemeThumbnailRequest *request_b = b;
+
+  if (request_a->priority != request_b->priority)
+    return request_a->priority > request_b->priority ? -1 : 1;
+
+  if (request_a->serial != request_b->serial)
+    return request_a->serial < request_b->serial ? -1 : 1;
+
+  return 0;
+}
 
-  for (i = 0; i < size[1]; i++)
+static void
+theme_thumbnail_request_finish (ThemeThumbnailRequest *request,
+                                GdkPixbuf             *pixbuf)
+{
+  /* callback function needs to ref the pixbuf if it wants to keep it */
+  (* request->func) (pixbuf, request->theme_name, request->user_data);
+
+  if (request->destroy)
+    (* request->destroy) (request->user_data);
+
+  g_free (request->thumbnail_type);
+  g_free (request->theme_name);
+  g_free (request->gtk_theme_name);
+  g_free (request->gtk_color_scheme);
+  g_free (request->marco_theme_name);
+  g_free (request->icon_theme_name);
+  g_free (request->application_font);
+  g_free (request);
+}
+
+/* Hand pending requests to idle workers, most urgent first */
+static void
+dispatch_requests (void)
+{
+  ThemeThumbnailWorker *worker;
+
+  while (!g_sequence_is_empty (pending_requests) &&
+         (worker = get_idle_worker ()) != NULL)
   {
-    j = 0;
+    GSequenceIter *first;
+    ThemeThumbnailRequest *request;
+
+    first = g_sequence_get_begin_iter (pending_requests);
+    request = g_sequence_get (first);
+    g_sequence_remove (first);
+
+    worker->request = request;
+    send_thumbnail_request (worker->to_factory_fd,
+                            request->thumbnail_type,
+                            request->gtk_theme_name,
+                            request->gtk_color_scheme,
+                            request->marco_theme_name,
+                            request->icon_theme_name,
+                            request->application_font);
+  }
 
-    do
+  /* nobody is left to render what is still queued */
+  if (!have_workers ())
+  {
+    while (!g_sequence_is_empty (pending_requests))
     {
-      bytes_read = read (pipe_from_factory_fd[0], pixels + rowstride * i + j, size[0] * gdk_pixbuf_get_n_channels (pixbuf) - j);
+      GSequenceIter *first;
+      ThemeThumbnailRequest *request;
 
-      if (bytes_read > 0)
-        j += bytes_read;
-      else if (bytes_read == 0)
-      {
-        g_object_unref (pixbuf);
-        goto eof;
-      }
+      first = g_sequence_get_begin_iter (pending_requests);
+      request = g_sequence_get (first);
+      g_sequence_remove (first);
+
+      theme_thumbnail_request_finish (request, NULL);
     }
-    while (j < size[0] * gdk_pixbuf_get_n_channels (pixbuf));
   }
+}
 
-  return pixbuf;
+static gboolean
+message_from_child (GIOChannel   *source,
+                    GIOCondition  condition,
+                    gpointer      data)
+{
+  ThemeThumbnailWorker *worker = data;
+  ThemeThumbnailRequest *request;
+  ThumbnailHeader header;
+  GdkPixbuf *pixbuf = NULL;
+  int shm_fd;
+
+  if (condition == G_IO_HUP ||
+      !receive_thumbnail_header (worker->from_factory_fd, &header, &shm_fd))
+  {
+    g_warning ("Thumbnail factory went away");
 
-eof:
-  g_warning ("Received EOF while reading thumbnail");
-  close (pipe_to_factory_fd[1]);
-  pipe_to_factory_fd[1] = 0;
-  close (pipe_from_factory_fd[0]);
-  pipe_from_factory_fd[0] = 0;
-  return NULL;
+    /* returning FALSE removes the watch */
+    worker->watch_id = 0;
+    worker_shutdown (worker);
+
+    request = worker->request;
+    worker->request = NULL;
+    if (request != NULL)
+      theme_thumbnail_request_finish (request, NULL);
+
+    dispatch_requests ();
+    return FALSE;
+  }
+
+  if (shm_fd != -1)
+  {
+    pixbuf = thumbnail_shm_get_pixbuf (&header, shm_fd);
+    close (shm_fd);
+  }
+
+  request = worker->request;
+  worker->request = NULL;
+
+  if (request != NULL)
+    theme_thumbnail_request_finish (request, pixbuf);
+
+  if (pixbuf)
+    g_object_unref (pixbuf);
+
+  dispatch_requests ();
+
+  return TRUE;
+}
+
+static GdkPixbuf *
+read_pixbuf (ThemeThumbnailWorker *worker)
+{
+  ThumbnailHeader header;
+  GdkPixbuf *pixbuf = NULL;
+  int shm_fd;
+
+  if (!receive_thumbnail_header (worker->from_factory_fd, &header, &shm_fd))
+  {
+    g_warning ("Received EOF while reading thumbnail");
+    worker_shutdown (worker);
+    return NULL;
+  }
+
+  if (shm_fd != -1)
+  {
+    pixbuf = thumbnail_shm_get_pixbuf (&header, shm_fd);
+    close (shm_fd);
+  }
+
+  return pixbuf;
 }
 
 static GdkPixbuf *
@@ -888,17 +1139,21 @@ generate_theme_thumbnail (gchar *thumbnail_type,
                           gchar *icon_theme_name,
                           gchar *application_font)
 {
-  if (async_data.set || !pipe_to_factory_fd[1] || !pipe_from_factory_fd[0])
+  ThemeThumbnailWorker *worker;
+
+  worker = get_idle_worker ();
+  if (worker == NULL)
     return NULL;
 
-  send_thumbnail_request (thumbnail_type,
+  send_thumbnail_request (worker->to_factory_fd,
+                          thumbnail_type,
                           gtk_theme_name,
                           gtk_color_scheme,
                           marco_theme_name,
                           icon_theme_name,
                           application_font);
 
-  return read_pixbuf ();
+  return read_pixbuf (worker);
 }
 
 GdkPixbuf *
@@ -950,24 +1205,11 @@ generate_icon_theme_thumbnail (MateThemeIconInfo *theme_info)
                                    NULL);
 }
 
-static void generate_theme_thumbnail_async(gpointer theme_info, gchar* theme_name, gchar* thumbnail_type, gchar* gtk_theme_name, gchar* gtk_color_scheme, gchar* marco_theme_name, gchar* icon_theme_name, gchar* application_font, ThemeThumbnailFunc func, gpointer user_data, GDestroyNotify destroy)
+static void generate_theme_thumbnail_async(gchar* theme_name, gchar* thumbnail_type, gchar* gtk_theme_name, gchar* gtk_color_scheme, gchar* marco_theme_name, gchar* icon_theme_name, gchar* application_font, ThemeThumbnailFunc func, gpointer user_data, GDestroyNotify destroy)
 {
-	if (async_data.set)
-	{
-		ThemeQueueItem* item = g_new0 (ThemeQueueItem, 1);
+	ThemeThumbnailRequest* request;
 
-		item->thumbnail_type = thumbnail_type;
-		item->theme_info = theme_info;
-		item->func = func;
-		item->user_data = user_data;
-		item->destroy = destroy;
-
-		theme_queue = g_list_append(theme_queue, item);
-
-		return;
-	}
-
-	if (!pipe_to_factory_fd[1] || !pipe_from_factory_fd[0])
+	if (!have_workers())
 	{
 		(*func)(NULL, theme_name, user_data);
 
@@ -979,25 +1221,23 @@ static void generate_theme_thumbnail_async(gpointer theme_info, gchar* theme_nam
 		return;
 	}
 
-	if (async_data.channel == NULL)
-	{
-		async_data.channel = g_io_channel_unix_new(pipe_from_factory_fd[0]);
-
-		g_io_channel_set_flags(async_data.channel, g_io_channel_get_flags (async_data.channel) | G_IO_FLAG_NONBLOCK, NULL);
-		g_io_channel_set_encoding(async_data.channel, NULL, NULL);
-
-		async_data.watch_id = g_io_add_watch(async_data.channel, G_IO_IN | G_IO_HUP, message_from_child, NULL);
-	}
-
-	async_data.set = TRUE;
-	async_data.thumbnail_width = -1;
-	async_data.thumbnail_height = -1;
-	async_data.theme_name = g_strdup(theme_name);
-	async_data.func = func;
-	async_data.user_data = user_data;
-	async_data.destroy = destroy;
-
-	send_thumbnail_request(thumbnail_type, gtk_theme_name, gtk_color_scheme, marco_theme_name, icon_theme_name, application_font);
+	request = g_new0(ThemeThumbnailRequest, 1);
+	request->thumbnail_type = g_strdup(thumbnail_type);
+	request->theme_name = g_strdup(theme_name);
+	request->gtk_theme_name = g_strdup(gtk_theme_name);
+	request->gtk_color_scheme = g_strdup(gtk_color_scheme);
+	request->marco_theme_name = g_strdup(marco_theme_name);
+	request->icon_theme_name = g_strdup(icon_theme_name);
+	request->application_font = g_strdup(application_font);
+	request->func = func;
+	request->user_data = user_data;
+	request->destroy = destroy;
+	request->priority = 0;
+	request->serial = request_serial++;
+
+	g_sequence_insert_sorted(pending_requests, request, compare_requests, NULL);
+
+	dispatch_requests();
 }
 
 void
@@ -1006,8 +1246,7 @@ generate_meta_theme_thumbnail_async (MateThemeMetaInfo *theme_info,
                                      gpointer            user_data,
                                      GDestroyNotify      destroy)
 {
-  generate_theme_thumbnail_async (theme_info,
-                                         theme_info->name,
+  generate_theme_thumbnail_async (theme_info->name,
                                          THUMBNAIL_TYPE_META,
                                          theme_info->gtk_theme_name,
                                          theme_info->gtk_color_scheme,
@@ -1021,7 +1260,7 @@ void generate_gtk_theme_thumbnail_async (MateThemeInfo* theme_info, ThemeThumbna
 {
 	gchar* scheme = gtkrc_get_color_scheme_for_theme(theme_info->name);
 
-	generate_theme_thumbnail_async(theme_info, theme_info->name, THUMBNAIL_TYPE_GTK, theme_info->name, scheme,  NULL, NULL, NULL, func, user_data, destroy);
+	generate_theme_thumbnail_async(theme_info->name, THUMBNAIL_TYPE_GTK, theme_info->name, scheme,  NULL, NULL, NULL, func, user_data, destroy);
 
 	g_free(scheme);
 }
@@ -1032,8 +1271,7 @@ generate_marco_theme_thumbnail_async (MateThemeInfo *theme_info,
                                          gpointer            user_data,
                                          GDestroyNotify      destroy)
 {
-  generate_theme_thumbnail_async (theme_info,
-                                         theme_info->name,
+  generate_theme_thumbnail_async (theme_info->name,
                                          THUMBNAIL_TYPE_MARCO,
                                          NULL,
                                          NULL,
@@ -1049,8 +1287,7 @@ generate_icon_theme_thumbnail_async (MateThemeIconInfo *theme_info,
                                      gpointer            user_data,
                                      GDestroyNotify      destroy)
 {
-  generate_theme_thumbnail_async (theme_info,
-                                         theme_info->name,
+  generate_theme_thumbnail_async (theme_info->name,
                                          THUMBNAIL_TYPE_ICON,
                                          NULL,
                                          NULL,
@@ -1060,57 +1297,132 @@ generate_icon_theme_thumbnail_async (MateThemeIconInfo *theme_info,
                                          func, user_data, destroy);
 }
 
+void
+theme_thumbnail_prioritize (ThemeThumbnailFunc  func,
+                            const gchar        *theme_name)
+{
+  GSequenceIter *iter, *next;
+  guint boost;
+
+  if (pending_requests == NULL)
+    return;
+
+  boost = ++request_boost;
+
+  for (iter = g_sequence_get_begin_iter (pending_requests);
+       !g_sequence_iter_is_end (iter);
+       iter = next)
+  {
+    ThemeThumbnailRequest *request = g_sequence_get (iter);
+
+    next = g_sequence_iter_next (iter);
+
+    if (request->func == func && !g_strcmp0 (request->theme_name, theme_name))
+    {
+      /* this moves it to the front, so we won't see it again */
+      request->priority = boost;
+      g_sequence_sort_changed (iter, compare_requests, NULL);
+    }
+  }
+}
+
 void
 theme_thumbnail_factory_init (int argc, char *argv[])
 {
-  gint child_pid;
+  guint i, j;
+
+  n_workers = CLAMP (g_get_num_processors (), 1, MAX_THUMBNAIL_WORKERS);
+  workers = g_new0 (ThemeThumbnailWorker, n_workers);
+
+  for (i = 0; i < n_workers; i++)
+  {
+    int pipe_to_factory_fd[2];
+    int pipe_from_factory_fd[2];
+    gint child_pid;
 
-  if (pipe (pipe_to_factory_fd) == -1)
-    perror ("pipe error");
+    workers[i].to_factory_fd = -1;
+    workers[i].from_factory_fd = -1;
 
-  if (pipe (pipe_from_factory_fd) == -1)
-    perror ("pipe error");
+    if (pipe (pipe_to_factory_fd) == -1)
+    {
+      perror ("pipe error");
+      continue;
+    }
 
-  child_pid = fork ();
-  if (child_pid == 0)
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, pipe_from_factory_fd) == -1)
+    {
+      perror ("socketpair error");
+      close (pipe_to_factory_fd[0]);
+      close (pipe_to_factory_fd[1]);
+      continue;
+    }
+
+    child_pid = fork ();
+    if (child_pid == 0)
+    {
+      ThemeThumbnailData data;
+      GIOChannel *channel;
+
+      /* Child.  Drop our copies of the parent's ends of the other workers'
+       * channels, or they would never see EOF when the capplet exits. */
+      for (j = 0; j < i; j++)
+      {
+        if (workers[j].to_factory_fd != -1)
+          close (workers[j].to_factory_fd);
+        if (workers[j].from_factory_fd != -1)
+          close (workers[j].from_factory_fd);
+      }
+
+      gtk_init (&argc, &argv);
+
+      close (pipe_to_factory_fd[1]);
+      close (pipe_from_factory_fd[0]);
+      factory_reply_fd = pipe_from_factory_fd[1];
+
+      data.status = READY_FOR_THEME;
+      data.type = g_byte_array_new ();
+      data.control_theme_name = g_byte_array_new ();
+      data.gtk_color_scheme = g_byte_array_new ();
+      data.wm_theme_name = g_byte_array_new ();
+      data.icon_theme_name = g_byte_array_new ();
+      data.application_font = g_byte_array_new ();
+
+      channel = g_io_channel_unix_new (pipe_to_factory_fd[0]);
+      g_io_channel_set_flags (channel, g_io_channel_get_flags (channel) |
+            G_IO_FLAG_NONBLOCK, NULL);
+      g_io_channel_set_encoding (channel, NULL, NULL);
+      g_io_add_watch (channel, G_IO_IN | G_IO_HUP, message_from_capplet, &data);
+      g_io_channel_unref (channel);
+
+      gtk_main ();
+      _exit (0);
+    }
+
+    g_assert (child_pid > 0);
+
+    /* Parent */
+    close (pipe_to_factory_fd[0]);
+    close (pipe_from_factory_fd[1]);
+
+    workers[i].to_factory_fd = pipe_to_factory_fd[1];
+    workers[i].from_factory_fd = pipe_from_factory_fd[0];
+  }
+
+  /* Only start watching once all workers are forked, so that none of them
+   * inherits the watches. */
+  for (i = 0; i < n_workers; i++)
   {
-    ThemeThumbnailData data;
     GIOChannel *channel;
 
-    /* Child */
-    gtk_init (&argc, &argv);
-
-    close (pipe_to_factory_fd[1]);
-    pipe_to_factory_fd[1] = 0;
-    close (pipe_from_factory_fd[0]);
-    pipe_from_factory_fd[0] = 0;
-
-    data.status = READY_FOR_THEME;
-    data.type = g_byte_array_new ();
-    data.control_theme_name = g_byte_array_new ();
-    data.gtk_color_scheme = g_byte_array_new ();
-    data.wm_theme_name = g_byte_array_new ();
-    data.icon_theme_name = g_byte_array_new ();
-    data.application_font = g_byte_array_new ();
-
-    channel = g_io_channel_unix_new (pipe_to_factory_fd[0]);
-    g_io_channel_set_flags (channel, g_io_channel_get_flags (channel) |
-          G_IO_FLAG_NONBLOCK, NULL);
+    if (workers[i].from_factory_fd == -1)
+      continue;
+
+    channel = g_io_channel_unix_new (workers[i].from_factory_fd);
     g_io_channel_set_encoding (channel, NULL, NULL);
-    g_io_add_watch (channel, G_IO_IN | G_IO_HUP, message_from_capplet, &data);
+    workers[i].watch_id = g_io_add_watch (channel, G_IO_IN | G_IO_HUP,
+                                          message_from_child, &workers[i]);
     g_io_channel_unref (channel);
-
-    gtk_main ();
-    _exit (0);
   }
 
-  g_assert (child_pid > 0);
-
-  /* Parent */
-  close (pipe_to_factory_fd[0]);
-  close (pipe_from_factory_fd[1]);
-
-  async_data.set = FALSE;
-  async_data.theme_name = NULL;
-  async_data.data = g_byte_array_new ();
+  pending_requests = g_sequence_new (NULL);
 }
@@ -31,6 +31,11 @@ void generate_icon_theme_thumbnail_async     (MateThemeIconInfo *theme_info,
                                               gpointer            data,
                                               GDestroyNotify      destroy);
 
+/* Move pending requests for theme_name made with func to the front of the
+ * queue, e.g. because the theme just scrolled into view. */
+void theme_thumbnail_prioritize              (ThemeThumbnailFunc  func,
+                                              const gchar        *theme_name);
+
 void theme_thumbnail_factory_init            (int                 argc,
                                               char               *argv[]);
 
@@ -43,6 +43,7 @@
 
 typedef struct App App;
 typedef struct GrabInfo GrabInfo;
+typedef struct CanvasLayout CanvasLayout;
 
 struct App
 {
@@ -72,6 +73,7 @@ struct App
     guint32         apply_button_clicked_timestamp;
 
     GtkWidget      *area;
+    CanvasLayout   *canvas_layout;
     gboolean	    ignore_gui_changes;
     GSettings	   *settings;
     GSettings	   *scale_settings;
@@ -97,6 +99,8 @@ static void on_rate_changed (GtkComboBox *box, gpointer data);
 static gboolean output_overlaps (MateRROutputInfo *output, MateRRConfig *config);
 static void select_current_output_from_dialog_position (App *app);
 static void monitor_on_off_toggled_cb (GtkToggleButton *toggle, gpointer data);
+static void invalidate_canvas_layout (App *app);
+static PangoLayout *get_display_name (App *app, MateRROutputInfo *output);
 static void apply_configuration_returned_cb (GObject *source_object, GAsyncResult *res, gpointer data);
 
 static void
@@ -146,6 +150,7 @@ on_screen_changed (MateRRScreen *scr,
 
     app->current_configuration = current;
     app->current_output = NULL;
+    invalidate_canvas_layout (app);
 
     if (app->labeler) {
 	mate_rr_labeler_hide (app->labeler);
@@ -861,6 +866,7 @@ on_rotation_changed (GtkComboBox *box, gpointer data)
     if (get_mode (app->rotation_combo, NULL, NULL, NULL, &rotation))
 	mate_rr_output_info_set_rotation (app->current_output, rotation);
 
+    invalidate_canvas_layout (app);
     foo_scroll_area_invalidate (FOO_SCROLL_AREA (app->area));
 }
 
@@ -933,6 +939,7 @@ monitor_on_off_toggled_cb (GtkToggleButton *toggle, gpointer data)
     if (is_on)
 	select_resolution_for_current_output (app); /* The refresh rate will be picked in rebuild_rate_combo() */
 
+    invalidate_canvas_layout (app);
     rebuild_gui (app);
     foo_scroll_area_invalidate (FOO_SCROLL_AREA (app->area));
 }
@@ -1015,6 +1022,7 @@ on_resolution_changed (GtkComboBox *box, gpointer data)
     }
 
     realign_outputs_after_resolution_change (app, app->current_output, old_width, old_height);
+    invalidate_canvas_layout (app);
 
     rebuild_rate_combo (app);
     rebuild_rotation_combo (app);
@@ -1106,6 +1114,7 @@ on_clone_changed (GtkWidget *box, gpointer data)
             lay_out_outputs_horizontally (app);
     }
 
+    invalidate_canvas_layout (app);
     rebuild_gui (app);
 }
 
@@ -1170,38 +1179,118 @@ list_connected_outputs (App   *app,
     return g_list_reverse (result);
 }
 
-static guint
-get_n_connected (App *app)
+/* What paint_output() needs to draw the connected outputs. Building it
+ * lists the outputs and lays out their names, so it is kept until the
+ * configuration, the font or the canvas size changes, instead of being
+ * redone for every output on every paint while a monitor is dragged.
+ * The positions of the outputs are not part of it.
+ */
+typedef struct
 {
-    GList *connected_outputs = list_connected_outputs (app, NULL, NULL);
-    guint n = g_list_length (connected_outputs);
+    MateRROutputInfo *output;
+    int               width, height;	/* rotated, see get_geometry() */
+    PangoLayout      *layout;
+    PangoRectangle    ink_extent;
+    PangoRectangle    log_extent;
+} OutputLayout;
+
+struct CanvasLayout
+{
+    MateRRConfig *configuration;
+    int           viewport_width;
+    int           viewport_height;
+    int           total_w, total_h;
+    double        scale;
+    GArray       *outputs;		/* OutputLayout */
+};
 
-    g_list_free (connected_outputs);
+static void
+invalidate_canvas_layout (App *app)
+{
+    CanvasLayout *canvas_layout = app->canvas_layout;
+    guint i;
 
-    return n;
+    if (!canvas_layout)
+	return;
+
+    for (i = 0; i < canvas_layout->outputs->len; ++i)
+	g_object_unref (g_array_index (canvas_layout->outputs, OutputLayout, i).layout);
+
+    g_array_free (canvas_layout->outputs, TRUE);
+    g_free (canvas_layout);
+
+    app->canvas_layout = NULL;
 }
 
-static double
-compute_scale (App *app)
+static CanvasLayout *
+get_canvas_layout (App *app)
 {
+    CanvasLayout *canvas_layout;
+    GdkRectangle viewport;
+    GList *connected_outputs, *list;
     int available_w, available_h;
-    int total_w, total_h;
     guint n_monitors;
-    GdkRectangle viewport;
-    GList *connected_outputs;
 
     foo_scroll_area_get_viewport (FOO_SCROLL_AREA (app->area), &viewport);
 
-    connected_outputs = list_connected_outputs (app, &total_w, &total_h);
+    canvas_layout = app->canvas_layout;
+    if (canvas_layout &&
+	canvas_layout->configuration == app->current_configuration &&
+	canvas_layout->viewport_width == viewport.width &&
+	canvas_layout->viewport_height == viewport.height)
+	return canvas_layout;
+
+    invalidate_canvas_layout (app);
+
+    canvas_layout = g_new0 (CanvasLayout, 1);
+    canvas_layout->configuration = app->current_configuration;
+    canvas_layout->viewport_width = viewport.width;
+    canvas_layout->viewport_height = viewport.height;
+    canvas_layout->outputs = g_array_new (FALSE, TRUE, sizeof (OutputLayout));
+
+    connected_outputs = list_connected_outputs (app, &canvas_layout->total_w, &canvas_layout->total_h);
 
-    n_monitors = g_list_length (connected_outputs);
+    for (list = connected_outputs; list != NULL; list = list->next)
+    {
+	OutputLayout output_layout;
+
+	output_layout.output = list->data;
+	get_geometry (output_layout.output, &output_layout.width, &output_layout.height);
+
+	output_layout.layout = get_display_name (app, output_layout.output);
+	layout_set_font (output_layout.layout, "Sans 12");
+	pango_layout_get_pixel_extents (output_layout.layout,
+					&output_layout.ink_extent,
+					&output_layout.log_extent);
+
+	g_array_append_val (canvas_layout->outputs, output_layout);
+    }
 
     g_list_free (connected_outputs);
 
+    n_monitors = canvas_layout->outputs->len;
+
     available_w = viewport.width  - 2 * MARGIN - ((int) n_monitors - 1) * SPACE;
     available_h = viewport.height - 2 * MARGIN - ((int) n_monitors - 1) * SPACE;
 
-    return MIN ((double)available_w / total_w, (double)available_h / total_h);
+    canvas_layout->scale = MIN ((double)available_w / canvas_layout->total_w,
+				(double)available_h / canvas_layout->total_h);
+
+    app->canvas_layout = canvas_layout;
+
+    return canvas_layout;
+}
+
+static guint
+get_n_connected (App *app)
+{
+    return get_canvas_layout (app)->outputs->len;
+}
+
+static double
+compute_scale (App *app)
+{
+    return get_canvas_layout (app)->scale;
 }
 
 typedef struct Edge
@@ -1213,8 +1302,6 @@ typedef struct Edge
 
 typedef struct Snap
 {
-    Edge *snapper;		/* Edge that should be snapped */
-    Edge *snappee;
     int dy, dx;
 } Snap;
 
@@ -1247,120 +1334,12 @@ list_edges_for_output (MateRROutputInfo *output, GArray *edges)
     add_edge (output, x + w, y, x + w, y + h, edges);
 }
 
-static void
-list_edges (MateRRConfig *config, GArray *edges)
-{
-    int i;
-    MateRROutputInfo **outputs = mate_rr_config_get_outputs (config);
-
-    for (i = 0; outputs[i]; ++i)
-    {
-	if (mate_rr_output_info_is_connected (outputs[i]))
-	    list_edges_for_output (outputs[i], edges);
-    }
-}
-
 static gboolean
 overlap (int s1, int e1, int s2, int e2)
 {
     return (!(e1 < s2 || s1 >= e2));
 }
 
-static gboolean
-horizontal_overlap (Edge *snapper, Edge *snappee)
-{
-    if (snapper->y1 != snapper->y2 || snappee->y1 != snappee->y2)
-	return FALSE;
-
-    return overlap (snapper->x1, snapper->x2, snappee->x1, snappee->x2);
-}
-
-static gboolean
-vertical_overlap (Edge *snapper, Edge *snappee)
-{
-    if (snapper->x1 != snapper->x2 || snappee->x1 != snappee->x2)
-	return FALSE;
-
-    return overlap (snapper->y1, snapper->y2, snappee->y1, snappee->y2);
-}
-
-static void
-add_snap (GArray *snaps, Snap snap)
-{
-    if (ABS (snap.dx) <= 200 || ABS (snap.dy) <= 200)
-	g_array_append_val (snaps, snap);
-}
-
-static void
-add_edge_snaps (Edge *snapper, Edge *snappee, GArray *snaps)
-{
-    Snap snap;
-
-    snap.snapper = snapper;
-    snap.snappee = snappee;
-
-    if (horizontal_overlap (snapper, snappee))
-    {
-	snap.dx = 0;
-	snap.dy = snappee->y1 - snapper->y1;
-
-	add_snap (snaps, snap);
-    }
-    else if (vertical_overlap (snapper, snappee))
-    {
-	snap.dy = 0;
-	snap.dx = snappee->x1 - snapper->x1;
-
-	add_snap (snaps, snap);
-    }
-
-    /* Corner snaps */
-    /* 1->1 */
-    snap.dx = snappee->x1 - snapper->x1;
-    snap.dy = snappee->y1 - snapper->y1;
-
-    add_snap (snaps, snap);
-
-    /* 1->2 */
-    snap.dx = snappee->x2 - snapper->x1;
-    snap.dy = snappee->y2 - snapper->y1;
-
-    add_snap (snaps, snap);
-
-    /* 2->2 */
-    snap.dx = snappee->x2 - snapper->x2;
-    snap.dy = snappee->y2 - snapper->y2;
-
-    add_snap (snaps, snap);
-
-    /* 2->1 */
-    snap.dx = snappee->x1 - snapper->x2;
-    snap.dy = snappee->y1 - snapper->y2;
-
-    add_snap (snaps, snap);
-}
-
-static void
-list_snaps (MateRROutputInfo *output, GArray *edges, GArray *snaps)
-{
-    guint i;
-
-    for (i = 0; i < edges->len; ++i) {
-        Edge *output_edge = &(g_array_index (edges, Edge, i));
-
-        if (output_edge->output == output) {
-            guint j;
-
-            for (j = 0; j < edges->len; ++j) {
-                Edge *edge = &(g_array_index (edges, Edge, j));
-
-                if (edge->output != output)
-		    add_edge_snaps (output_edge, edge, snaps);
-            }
-        }
-    }
-}
-
 #if 0
 static void
 print_edge (Edge *edge)
@@ -1456,27 +1435,359 @@ output_overlaps (MateRROutputInfo *output, MateRRConfig *config)
     return FALSE;
 }
 
-static gboolean
-mate_rr_config_is_aligned (MateRRConfig *config, GArray *edges)
+/* Edge index
+ *
+ * While an output is dragged the other outputs don't move, so their edges
+ * and corners are indexed once when the grab starts, sorted along each
+ * axis.  A motion event checks whether a snapped position leaves the
+ * layout aligned by querying the index rather than comparing every edge
+ * of the configuration with every other.  It also finds the snaps: the
+ * corners within SNAP_DISTANCE on either axis without going through all
+ * corners, and the parallel edges from the nearest one outwards, which
+ * stops at the first one that can't beat the best snap found so far.
+ */
+#define SNAP_DISTANCE 200
+
+typedef struct Corner
+{
+    int x, y;
+    gboolean is_start;		/* First point of an edge, see edges_align() */
+} Corner;
+
+typedef struct IndexedOutput
+{
+    GdkRectangle rect;
+    gboolean aligned;		/* With the outputs other than the dragged one */
+} IndexedOutput;
+
+typedef struct EdgeIndex
+{
+    GArray *outputs;		/* IndexedOutput */
+    GArray *horizontal;		/* Edge, by y then x */
+    GArray *vertical;		/* Edge, by x then y */
+    GArray *corners_by_x;	/* Corner, by x then y */
+    GArray *corners_by_y;	/* Corner, by y then x */
+    gboolean overlapping;	/* Some of the other outputs overlap */
+} EdgeIndex;
+
+/* Top, Bottom, Left, Right, like list_edges_for_output() */
+static void
+get_rect_edges (const GdkRectangle *rect, Edge edges[4])
 {
+    int x = rect->x, y = rect->y, w = rect->width, h = rect->height;
     int i;
-    gboolean result = TRUE;
+
+    edges[0].x1 = x;     edges[0].y1 = y;     edges[0].x2 = x + w; edges[0].y2 = y;
+    edges[1].x1 = x;     edges[1].y1 = y + h; edges[1].x2 = x + w; edges[1].y2 = y + h;
+    edges[2].x1 = x;     edges[2].y1 = y;     edges[2].x2 = x;     edges[2].y2 = y + h;
+    edges[3].x1 = x + w; edges[3].y1 = y;     edges[3].x2 = x + w; edges[3].y2 = y + h;
+
+    for (i = 0; i < 4; ++i)
+	edges[i].output = NULL;
+}
+
+/* The corners that start an edge are the top left one (top and left
+ * edges), the top right one (right edge) and the bottom left one (bottom
+ * edge).
+ */
+static void
+get_rect_corners (const GdkRectangle *rect, Corner corners[4])
+{
+    int x = rect->x, y = rect->y, w = rect->width, h = rect->height;
+
+    corners[0].x = x;     corners[0].y = y;     corners[0].is_start = TRUE;
+    corners[1].x = x + w; corners[1].y = y;     corners[1].is_start = TRUE;
+    corners[2].x = x;     corners[2].y = y + h; corners[2].is_start = TRUE;
+    corners[3].x = x + w; corners[3].y = y + h; corners[3].is_start = FALSE;
+}
+
+static gboolean
+rects_align (const GdkRectangle *rect1, const GdkRectangle *rect2)
+{
+    Edge edges1[4], edges2[4];
+    int i, j;
+
+    get_rect_edges (rect1, edges1);
+    get_rect_edges (rect2, edges2);
+
+    for (i = 0; i < 4; ++i)
+	for (j = 0; j < 4; ++j)
+	    if (edges_align (&edges1[i], &edges2[j]))
+		return TRUE;
+
+    return FALSE;
+}
+
+static int
+compare_horizontal_edges (gconstpointer v1, gconstpointer v2)
+{
+    const Edge *e1 = v1;
+    const Edge *e2 = v2;
+
+    if (e1->y1 != e2->y1)
+	return e1->y1 < e2->y1 ? -1 : 1;
+
+    return e1->x1 < e2->x1 ? -1 : (e1->x1 > e2->x1);
+}
+
+static int
+compare_vertical_edges (gconstpointer v1, gconstpointer v2)
+{
+    const Edge *e1 = v1;
+    const Edge *e2 = v2;
+
+    if (e1->x1 != e2->x1)
+	return e1->x1 < e2->x1 ? -1 : 1;
+
+    return e1->y1 < e2->y1 ? -1 : (e1->y1 > e2->y1);
+}
+
+static int
+compare_corners_by_x (gconstpointer v1, gconstpointer v2)
+{
+    const Corner *c1 = v1;
+    const Corner *c2 = v2;
+
+    if (c1->x != c2->x)
+	return c1->x < c2->x ? -1 : 1;
+
+    return c1->y < c2->y ? -1 : (c1->y > c2->y);
+}
+
+static int
+compare_corners_by_y (gconstpointer v1, gconstpointer v2)
+{
+    const Corner *c1 = v1;
+    const Corner *c2 = v2;
+
+    if (c1->y != c2->y)
+	return c1->y < c2->y ? -1 : 1;
+
+    return c1->x < c2->x ? -1 : (c1->x > c2->x);
+}
+
+/* Returns the position of the first edge at or after (@major, @minor),
+ * in an array of edges sorted by one of the compare_*_edges() functions.
+ */
+static guint
+edges_lower_bound (GArray *edges, gboolean vertical, int major, int minor)
+{
+    guint low = 0, high = edges->len;
+
+    while (low < high)
+    {
+	guint mid = low + (high - low) / 2;
+	Edge *e = &(g_array_index (edges, Edge, mid));
+	int e_major = vertical ? e->x1 : e->y1;
+	int e_minor = vertical ? e->y1 : e->x1;
+
+	if (e_major < major || (e_major == major && e_minor < minor))
+	    low = mid + 1;
+	else
+	    high = mid;
+    }
+
+    return low;
+}
+
+/* Same as edges_lower_bound(), for the corners */
+static guint
+corners_lower_bound (GArray *corners, gboolean by_x, int major, int minor)
+{
+    guint low = 0, high = corners->len;
+
+    while (low < high)
+    {
+	guint mid = low + (high - low) / 2;
+	Corner *c = &(g_array_index (corners, Corner, mid));
+	int c_major = by_x ? c->x : c->y;
+	int c_minor = by_x ? c->y : c->x;
+
+	if (c_major < major || (c_major == major && c_minor < minor))
+	    low = mid + 1;
+	else
+	    high = mid;
+    }
+
+    return low;
+}
+
+static EdgeIndex *
+edge_index_new (MateRRConfig *config, MateRROutputInfo *dragged)
+{
+    EdgeIndex *index;
     MateRROutputInfo **outputs;
+    GArray *edges;
+    guint i, j;
+
+    index = g_new0 (EdgeIndex, 1);
+    index->outputs = g_array_new (FALSE, FALSE, sizeof (IndexedOutput));
+    index->horizontal = g_array_new (FALSE, FALSE, sizeof (Edge));
+    index->vertical = g_array_new (FALSE, FALSE, sizeof (Edge));
+    index->corners_by_x = g_array_new (FALSE, FALSE, sizeof (Corner));
+    index->corners_by_y = g_array_new (FALSE, FALSE, sizeof (Corner));
+
+    edges = g_array_new (FALSE, FALSE, sizeof (Edge));
+
+    outputs = mate_rr_config_get_outputs (config);
+    for (i = 0; outputs[i]; ++i)
+    {
+	if (outputs[i] != dragged && mate_rr_output_info_is_connected (outputs[i]))
+	    list_edges_for_output (outputs[i], edges);
+    }
 
-    outputs = mate_rr_config_get_outputs(config);
     for (i = 0; outputs[i]; ++i)
     {
-	if (mate_rr_output_info_is_connected (outputs[i]))
+	IndexedOutput indexed;
+	Edge rect_edges[4];
+	Corner corners[4];
+
+	if (outputs[i] == dragged || !mate_rr_output_info_is_connected (outputs[i]))
+	    continue;
+
+	get_output_rect (outputs[i], &indexed.rect);
+	indexed.aligned = output_is_aligned (outputs[i], edges);
+
+	for (j = 0; j < index->outputs->len; ++j)
 	{
-	    if (!output_is_aligned (outputs[i], edges))
-		return FALSE;
+	    IndexedOutput *other = &(g_array_index (index->outputs, IndexedOutput, j));
 
-	    if (output_overlaps (outputs[i], config))
-		return FALSE;
+	    if (gdk_rectangle_intersect (&indexed.rect, &other->rect, NULL))
+		index->overlapping = TRUE;
 	}
+
+	g_array_append_val (index->outputs, indexed);
+
+	get_rect_edges (&indexed.rect, rect_edges);
+	g_array_append_vals (index->horizontal, &rect_edges[0], 2);
+	g_array_append_vals (index->vertical, &rect_edges[2], 2);
+
+	get_rect_corners (&indexed.rect, corners);
+	g_array_append_vals (index->corners_by_x, corners, 4);
+	g_array_append_vals (index->corners_by_y, corners, 4);
     }
 
-    return result;
+    g_array_free (edges, TRUE);
+
+    g_array_sort (index->horizontal, compare_horizontal_edges);
+    g_array_sort (index->vertical, compare_vertical_edges);
+    g_array_sort (index->corners_by_x, compare_corners_by_x);
+    g_array_sort (index->corners_by_y, compare_corners_by_y);
+
+    return index;
+}
+
+static void
+edge_index_free (EdgeIndex *index)
+{
+    g_array_free (index->outputs, TRUE);
+    g_array_free (index->horizontal, TRUE);
+    g_array_free (index->vertical, TRUE);
+    g_array_free (index->corners_by_x, TRUE);
+    g_array_free (index->corners_by_y, TRUE);
+    g_free (index);
+}
+
+/* Whether the point lies on one of the indexed edges.  The edges that can
+ * hold it are on the same line and start before it.
+ */
+static gboolean
+edge_index_point_on_edge (EdgeIndex *index, int x, int y)
+{
+    guint i;
+
+    for (i = edges_lower_bound (index->horizontal, FALSE, y, G_MININT);
+	 i < index->horizontal->len; ++i)
+    {
+	Edge *e = &(g_array_index (index->horizontal, Edge, i));
+
+	if (e->y1 != y || e->x1 > x)
+	    break;
+
+	if (corner_on_edge (x, y, e))
+	    return TRUE;
+    }
+
+    for (i = edges_lower_bound (index->vertical, TRUE, x, G_MININT);
+	 i < index->vertical->len; ++i)
+    {
+	Edge *e = &(g_array_index (index->vertical, Edge, i));
+
+	if (e->x1 != x || e->y1 > y)
+	    break;
+
+	if (corner_on_edge (x, y, e))
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Whether the first point of one of the indexed edges lies on @edge */
+static gboolean
+edge_index_edge_holds_start (EdgeIndex *index, Edge *edge)
+{
+    gboolean vertical = edge->x1 == edge->x2;
+    GArray *corners = vertical ? index->corners_by_x : index->corners_by_y;
+    guint i;
+
+    for (i = corners_lower_bound (corners, vertical,
+				  vertical ? edge->x1 : edge->y1,
+				  vertical ? edge->y1 : edge->x1);
+	 i < corners->len; ++i)
+    {
+	Corner *c = &(g_array_index (corners, Corner, i));
+
+	if (!corner_on_edge (c->x, c->y, edge))
+	    break;
+
+	if (c->is_start)
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Whether the configuration would be aligned, see output_is_aligned(),
+ * and have no overlapping outputs if the dragged output was at @rect.
+ * The other outputs must be aligned with each other or with it.
+ */
+static gboolean
+edge_index_is_aligned (EdgeIndex *index, const GdkRectangle *rect)
+{
+    Edge edges[4];
+    Corner corners[4];
+    gboolean aligned = FALSE;
+    guint i;
+
+    if (index->overlapping)
+	return FALSE;
+
+    /* The dragged output is aligned with one of the others, in the sense
+     * of edges_align() */
+    get_rect_corners (rect, corners);
+    for (i = 0; i < 4 && !aligned; ++i)
+	aligned = corners[i].is_start && edge_index_point_on_edge (index, corners[i].x, corners[i].y);
+
+    get_rect_edges (rect, edges);
+    for (i = 0; i < 4 && !aligned; ++i)
+	aligned = edge_index_edge_holds_start (index, &edges[i]);
+
+    if (!aligned)
+	return FALSE;
+
+    for (i = 0; i < index->outputs->len; ++i)
+    {
+	IndexedOutput *indexed = &(g_array_index (index->outputs, IndexedOutput, i));
+
+	if (gdk_rectangle_intersect (&indexed->rect, rect, NULL))
+	    return FALSE;
+
+	if (!indexed->aligned && !rects_align (&indexed->rect, rect))
+	    return FALSE;
+    }
+
+    return TRUE;
 }
 
 struct GrabInfo
@@ -1485,6 +1796,7 @@ struct GrabInfo
     int grab_y;
     int output_x;
     int output_y;
+    EdgeIndex *edge_index;
 };
 
 static gboolean
@@ -1530,6 +1842,154 @@ compare_snaps (gconstpointer v1, gconstpointer v2)
     }
 }
 
+typedef struct SnapSearch
+{
+    EdgeIndex *index;
+    GdkRectangle rect;		/* Where the dragged output was dropped */
+    gboolean has_candidates;	/* Some snap was tried */
+    gboolean found;		/* Some snap aligns the outputs */
+    Snap best;			/* The first of those, see compare_snaps() */
+} SnapSearch;
+
+static int
+snap_distance (const Snap *s)
+{
+    return MAX (ABS (s->dx), ABS (s->dy));
+}
+
+/* Keeps the snap if it aligns the outputs and comes before the best one */
+static void
+try_snap (SnapSearch *search, int dx, int dy)
+{
+    GdkRectangle snapped = search->rect;
+    Snap snap;
+
+    snap.dx = dx;
+    snap.dy = dy;
+
+    search->has_candidates = TRUE;
+
+    if (search->found && compare_snaps (&snap, &search->best) >= 0)
+	return;
+
+    snapped.x += dx;
+    snapped.y += dy;
+
+    if (edge_index_is_aligned (search->index, &snapped))
+    {
+	search->best = snap;
+	search->found = TRUE;
+    }
+}
+
+static int
+edge_position (const Edge *e, gboolean vertical)
+{
+    return vertical ? e->x1 : e->y1;
+}
+
+/* Tries the snaps of @snapper onto the overlapping parallel edges, at any
+ * distance, walking away from it on both sides of the sorted edges.
+ */
+static void
+search_edge_snaps (SnapSearch *search, const Edge *snapper, gboolean vertical)
+{
+    GArray *edges = vertical ? search->index->vertical : search->index->horizontal;
+    int position = edge_position (snapper, vertical);
+    guint after, before;
+
+    after = before = edges_lower_bound (edges, vertical, position, G_MININT);
+
+    while (after < edges->len || before > 0)
+    {
+	Edge *e;
+	int distance_after = G_MAXINT, distance_before = G_MAXINT;
+	int d;
+
+	if (after < edges->len)
+	    distance_after = edge_position (&(g_array_index (edges, Edge, after)), vertical) - position;
+	if (before > 0)
+	    distance_before = position - edge_position (&(g_array_index (edges, Edge, before - 1)), vertical);
+
+	if (distance_after <= distance_before)
+	    e = &(g_array_index (edges, Edge, after++));
+	else
+	    e = &(g_array_index (edges, Edge, --before));
+
+	d = edge_position (e, vertical) - position;
+
+	/* The edges further away make worse snaps */
+	if (search->found && ABS (d) > snap_distance (&search->best))
+	    break;
+
+	if (vertical && overlap (snapper->y1, snapper->y2, e->y1, e->y2))
+	    try_snap (search, d, 0);
+	else if (!vertical && overlap (snapper->x1, snapper->x2, e->x1, e->x2))
+	    try_snap (search, 0, d);
+    }
+}
+
+/* Finds the nearest way to snap the dragged output, at @rect, to the
+ * other outputs that leaves them aligned: moving one of its corners onto
+ * a corner, by at most SNAP_DISTANCE on either axis, or one of its edges
+ * onto an overlapping parallel edge.
+ */
+static gboolean
+find_snap (EdgeIndex *index, const GdkRectangle *rect, Snap *snap, gboolean *has_candidates)
+{
+    SnapSearch search;
+    Edge edges[4];
+    Corner corners[4];
+    guint i, j;
+
+    search.index = index;
+    search.rect = *rect;
+    search.has_candidates = FALSE;
+    search.found = FALSE;
+
+    /* Corners first, there are few of them and they bound the edge walks.
+     * Those close on x, then those close on y but not on x. */
+    get_rect_corners (rect, corners);
+    for (i = 0; i < 4; ++i)
+    {
+	Corner *snapper = &corners[i];
+
+	for (j = corners_lower_bound (index->corners_by_x, TRUE, snapper->x - SNAP_DISTANCE, G_MININT);
+	     j < index->corners_by_x->len; ++j)
+	{
+	    Corner *snappee = &(g_array_index (index->corners_by_x, Corner, j));
+
+	    if (snappee->x > snapper->x + SNAP_DISTANCE)
+		break;
+
+	    try_snap (&search, snappee->x - snapper->x, snappee->y - snapper->y);
+	}
+
+	for (j = corners_lower_bound (index->corners_by_y, FALSE, snapper->y - SNAP_DISTANCE, G_MININT);
+	     j < index->corners_by_y->len; ++j)
+	{
+	    Corner *snappee = &(g_array_index (index->corners_by_y, Corner, j));
+
+	    if (snappee->y > snapper->y + SNAP_DISTANCE)
+		break;
+
+	    if (ABS (snappee->x - snapper->x) > SNAP_DISTANCE)
+		try_snap (&search, snappee->x - snapper->x, snappee->y - snapper->y);
+	}
+    }
+
+    /* Top and bottom, then left and right */
+    get_rect_edges (rect, edges);
+    for (i = 0; i < 4; ++i)
+	search_edge_snaps (&search, &edges[i], i >= 2);
+
+    *has_candidates = search.has_candidates;
+    if (search.found)
+	*snap = search.best;
+
+    return search.found;
+}
+
 /* Sets a mouse cursor for a widget's window.  As a hack, you can pass
  * GDK_BLANK_CURSOR to mean "set the cursor to NULL" (i.e. reset the widget's
  * window's cursor to its default).
@@ -1603,6 +2063,7 @@ on_output_event (FooScrollArea      *area,
 	    info->grab_y = event->y;
 	    info->output_x = output_x;
 	    info->output_y = output_y;
+	    info->edge_index = edge_index_new (app->current_configuration, output);
 
 	    g_object_set_data (G_OBJECT (output), "grab-info", info);
 	}
@@ -1618,8 +2079,9 @@ on_output_event (FooScrollArea      *area,
 	    int old_x, old_y;
 	    int width, height;
 	    int new_x, new_y;
-	    guint i;
-	    GArray *edges, *snaps, *new_edges;
+	    gboolean has_candidates;
+	    Snap snap;
+	    GdkRectangle rect;
 
 	    mate_rr_output_info_get_geometry (output, &old_x, &old_y, &width, &height);
 	    new_x = info->output_x + (int) ((double)(event->x - info->grab_x) / scale);
@@ -1627,48 +2089,26 @@ on_output_event (FooScrollArea      *area,
 
 	    mate_rr_output_info_set_geometry (output, new_x, new_y, width, height);
 
-	    edges = g_array_new (TRUE, TRUE, sizeof (Edge));
-	    snaps = g_array_new (TRUE, TRUE, sizeof (Snap));
-	    new_edges = g_array_new (TRUE, TRUE, sizeof (Edge));
-
-	    list_edges (app->current_configuration, edges);
-	    list_snaps (output, edges, snaps);
+	    get_output_rect (output, &rect);
 
-	    g_array_sort (snaps, compare_snaps);
-
-	    mate_rr_output_info_set_geometry (output, new_x, new_y, width, height);
-
-	    for (i = 0; i < snaps->len; ++i)
+	    if (find_snap (info->edge_index, &rect, &snap, &has_candidates))
 	    {
-		Snap *snap = &(g_array_index (snaps, Snap, i));
-		GArray *new_edges = g_array_new (TRUE, TRUE, sizeof (Edge));
-
-		mate_rr_output_info_set_geometry (output, new_x + snap->dx, new_y + snap->dy, width, height);
-
-		g_array_set_size (new_edges, 0);
-		list_edges (app->current_configuration, new_edges);
-
-		if (mate_rr_config_is_aligned (app->current_configuration, new_edges))
-		{
-		    g_array_free (new_edges, TRUE);
-		    break;
-		}
-		else
-		{
-		    mate_rr_output_info_set_geometry (output, info->output_x, info->output_y, width, height);
-		}
+		mate_rr_output_info_set_geometry (output, new_x + snap.dx, new_y + snap.dy, width, height);
+	    }
+	    else if (has_candidates)
+	    {
+		/* No snap aligns the outputs, go back to where the drag
+		 * started.  Without any snap, stay where dropped. */
+		mate_rr_output_info_set_geometry (output, info->output_x, info->output_y, width, height);
 	    }
-
-	    g_array_free (new_edges, TRUE);
-	    g_array_free (snaps, TRUE);
-	    g_array_free (edges, TRUE);
 
 	    if (event->type == FOO_BUTTON_RELEASE)
 	    {
 		foo_scroll_area_end_grab (area);
 		set_monitors_tooltip (app, FALSE);
 
-		g_free (g_object_get_data (G_OBJECT (output), "grab-info"));
+		edge_index_free (info->edge_index);
+		g_free (info);
 		g_object_set_data (G_OBJECT (output), "grab-info", NULL);
 
 #if 0
@@ -1764,20 +2204,23 @@ paint_background (FooScrollArea *area,
 }
 
 static void
-paint_output (App     *app,
-              cairo_t *cr,
-              guint    i)
-{
-    int w, h;
-    double scale = compute_scale (app);
+paint_output (App          *app,
+              cairo_t      *cr,
+              CanvasLayout *canvas_layout,
+              OutputLayout *output_layout)
+{
+    int w = output_layout->width;
+    int h = output_layout->height;
+    double scale = canvas_layout->scale;
     double x, y;
     int output_x, output_y;
     MateRRRotation rotation;
-    int total_w, total_h;
-    GList *connected_outputs = list_connected_outputs (app, &total_w, &total_h);
-    MateRROutputInfo *output = g_list_nth_data (connected_outputs, i);
-    PangoLayout *layout = get_display_name (app, output);
-    PangoRectangle ink_extent, log_extent;
+    int total_w = canvas_layout->total_w;
+    int total_h = canvas_layout->total_h;
+    MateRROutputInfo *output = output_layout->output;
+    PangoLayout *layout = output_layout->layout;
+    PangoRectangle ink_extent = output_layout->ink_extent;
+    PangoRectangle log_extent = output_layout->log_extent;
     GdkRectangle viewport;
     GdkRGBA output_color;
     double r, g, b;
@@ -1788,8 +2231,6 @@ paint_output (App     *app,
 
     foo_scroll_area_get_viewport (FOO_SCROLL_AREA (app->area), &viewport);
 
-    get_geometry (output, &w, &h);
-
 #if 0
     g_debug ("%s (%p) geometry %d %d %d", output->name, output,
 	     w, h, output->rate);
@@ -1866,9 +2307,6 @@ paint_output (App     *app,
     cairo_stroke (cr);
     cairo_set_line_width (cr, 2);
 
-    layout_set_font (layout, "Sans 12");
-    pango_layout_get_pixel_extents (layout, &ink_extent, &log_extent);
-
     available_w = w * scale + 0.5 - 6; /* Same as the inner rectangle's width, minus 1 pixel of padding on each side */
     if (available_w < ink_extent.width)
 	factor = available_w / ink_extent.width;
@@ -1889,8 +2327,6 @@ paint_output (App     *app,
     pango_cairo_show_layout (cr, layout);
 
     cairo_restore (cr);
-
-    g_object_unref (layout);
 }
 
 static void
@@ -1899,34 +2335,40 @@ on_area_paint (FooScrollArea *area,
 	       gpointer	      data)
 {
     App *app = data;
-    GList *connected_outputs = NULL;
-    GList *list;
+    CanvasLayout *canvas_layout;
+    guint i;
 
     paint_background (area, cr);
 
     if (!app->current_configuration)
 	return;
 
-    connected_outputs = list_connected_outputs (app, NULL, NULL);
+    canvas_layout = get_canvas_layout (app);
 
 #if 0
-    double scale;
-    scale = compute_scale (app);
-    g_debug ("scale: %f", scale);
+    g_debug ("scale: %f", canvas_layout->scale);
 #endif
 
-    for (list = connected_outputs; list != NULL; list = list->next)
+    for (i = 0; i < canvas_layout->outputs->len; ++i)
     {
-        int pos;
-
-        if ((pos = g_list_position (connected_outputs, list)) != -1)
-            paint_output (app, cr, (guint) pos);
+        paint_output (app, cr, canvas_layout,
+                      &g_array_index (canvas_layout->outputs, OutputLayout, i));
 
         if (mate_rr_config_get_clone (app->current_configuration))
             break;
     }
 }
 
+static void
+on_area_style_updated (GtkWidget *widget,
+		       gpointer   data)
+{
+    App *app = data;
+
+    /* The names are laid out with the widget's Pango context */
+    invalidate_canvas_layout (app);
+}
+
 static void
 make_text_combo (GtkWidget *widget, int sort_column)
 {
@@ -2152,6 +2594,7 @@ sanitize_and_save_configuration (App *app)
 
     check_required_virtual_size (app);
 
+    invalidate_canvas_layout (app);
     foo_scroll_area_invalidate (FOO_SCROLL_AREA (app->area));
 
     ensure_current_configuration_is_saved ();
@@ -2550,6 +2993,8 @@ run_application (App *app)
 		      G_CALLBACK (on_area_paint), app);
     g_signal_connect (app->area, "viewport_changed",
 		      G_CALLBACK (on_viewport_changed), app);
+    g_signal_connect (app->area, "style-updated",
+		      G_CALLBACK (on_area_style_updated), app);
 
     align = _gtk_builder_get_widget (builder, "align");
 
@@ -2600,6 +3045,7 @@ restart:
     }
 
     gtk_widget_destroy (app->dialog);
+    invalidate_canvas_layout (app);
     g_object_unref (app->screen);
     g_object_unref (app->settings);
     g_object_unref (app->scale_settings);
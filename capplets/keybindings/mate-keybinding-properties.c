@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <gdk/gdkx.h>
 #include <X11/Xatom.h>
@@ -18,6 +19,7 @@
 #include "eggcellrendererkeys.h"
 #include "activate-settings-daemon.h"
 #include "dconf-util.h"
+#include "cache-util.h"
 
 #define GSETTINGS_KEYBINDINGS_DIR "/org/mate/desktop/keybindings/"
 #define CUSTOM_KEYBINDING_SCHEMA "org.mate.control-center.keybinding"
@@ -71,6 +73,7 @@ enum
 typedef struct
 {
   GSettings *settings;
+  char *schema;
   char *gsettings_path;
   char *gsettings_key;
   guint keyval;
@@ -94,6 +97,15 @@ static GtkWidget *custom_shortcut_dialog = NULL;
 static GtkWidget *custom_shortcut_name_entry = NULL;
 static GtkWidget *custom_shortcut_command_entry = NULL;
 
+/* The keys in the tree, by schema, path and key, and the lists of keys
+ * using each binding, by binding. See key_index_add(). */
+static GHashTable *key_index = NULL;
+static GHashTable *binding_index = NULL;
+
+/* GSettings objects shared by all the keys of a schema and path, see
+ * get_settings(). */
+static GHashTable *settings_cache = NULL;
+
 static GtkWidget* _gtk_builder_get_widget(GtkBuilder* builder, const gchar* name)
 {
     return GTK_WIDGET (gtk_builder_get_object (builder, name));
@@ -142,6 +154,191 @@ binding_from_string (const char             *str,
     return TRUE;
 }
 
+static gchar *
+key_index_get_id (const gchar *schema,
+                  const gchar *gsettings_path,
+                  const gchar *gsettings_key)
+{
+  return g_strdup_printf ("%s:%s:%s",
+                          schema ? schema : "",
+                          gsettings_path ? gsettings_path : "",
+                          gsettings_key);
+}
+
+/* Two bindings conflict when they have the same modifiers and the same
+ * keyval, or no keyval and the same keycode. Disabled keys are not
+ * indexed, any number of them can be disabled. */
+static gchar *
+binding_index_get_id (guint keyval,
+                      guint keycode,
+                      EggVirtualModifierType mask)
+{
+  if (keyval != 0)
+    return g_strdup_printf ("v%u:%u", keyval, (guint) mask);
+  else if (keycode != 0)
+    return g_strdup_printf ("c%u:%u", keycode, (guint) mask);
+  else
+    return NULL;
+}
+
+static void
+binding_index_add (KeyEntry *key_entry)
+{
+  gchar *id;
+  gchar *orig_id;
+  GList *entries = NULL;
+
+  id = binding_index_get_id (key_entry->keyval, key_entry->keycode, key_entry->mask);
+  if (id == NULL)
+    return;
+
+  if (g_hash_table_lookup_extended (binding_index, id, (gpointer *) &orig_id, (gpointer *) &entries))
+    {
+      g_hash_table_steal (binding_index, id);
+      g_free (orig_id);
+    }
+
+  g_hash_table_insert (binding_index, id, g_list_prepend (entries, key_entry));
+}
+
+static void
+binding_index_remove (KeyEntry *key_entry)
+{
+  gchar *id;
+  gchar *orig_id;
+  GList *entries;
+
+  id = binding_index_get_id (key_entry->keyval, key_entry->keycode, key_entry->mask);
+  if (id == NULL)
+    return;
+
+  if (g_hash_table_lookup_extended (binding_index, id, (gpointer *) &orig_id, (gpointer *) &entries))
+    {
+      g_hash_table_steal (binding_index, id);
+      entries = g_list_remove (entries, key_entry);
+
+      if (entries != NULL)
+        g_hash_table_insert (binding_index, orig_id, entries);
+      else
+        g_free (orig_id);
+    }
+
+  g_free (id);
+}
+
+static void
+key_index_clear (void)
+{
+  if (key_index == NULL)
+    {
+      key_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      binding_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify) g_list_free);
+    }
+  else
+    {
+      g_hash_table_remove_all (key_index);
+      g_hash_table_remove_all (binding_index);
+    }
+}
+
+static void
+key_index_add (KeyEntry *key_entry)
+{
+  g_hash_table_insert (key_index,
+                       key_index_get_id (key_entry->schema,
+                                         key_entry->gsettings_path,
+                                         key_entry->gsettings_key),
+                       key_entry);
+  binding_index_add (key_entry);
+}
+
+static void
+key_index_remove (KeyEntry *key_entry)
+{
+  gchar *id;
+
+  id = key_index_get_id (key_entry->schema,
+                         key_entry->gsettings_path,
+                         key_entry->gsettings_key);
+  if (g_hash_table_lookup (key_index, id) == key_entry)
+    g_hash_table_remove (key_index, id);
+  g_free (id);
+
+  binding_index_remove (key_entry);
+}
+
+static void
+key_entry_set_binding (KeyEntry    *key_entry,
+                       const gchar *str)
+{
+  binding_index_remove (key_entry);
+  binding_from_string (str, &key_entry->keyval, &key_entry->keycode, &key_entry->mask);
+  binding_index_add (key_entry);
+}
+
+static GSettings *
+get_settings (const gchar *schema,
+              const gchar *gsettings_path)
+{
+  GSettings *settings;
+  gchar *id;
+
+  if (settings_cache == NULL)
+    settings_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+
+  id = g_strconcat (schema, ":", gsettings_path, NULL);
+  settings = g_hash_table_lookup (settings_cache, id);
+
+  if (settings == NULL)
+    {
+      if (gsettings_path != NULL)
+        settings = g_settings_new_with_path (schema, gsettings_path);
+      else
+        settings = g_settings_new (schema);
+
+      g_hash_table_insert (settings_cache, id, settings);
+    }
+  else
+    g_free (id);
+
+  return g_object_ref (settings);
+}
+
+static void
+key_entry_disconnect (KeyEntry *key_entry)
+{
+  if (key_entry->gsettings_cnxn != 0)
+    g_signal_handler_disconnect (key_entry->settings, key_entry->gsettings_cnxn);
+  if (key_entry->gsettings_cnxn_desc != 0)
+    g_signal_handler_disconnect (key_entry->settings, key_entry->gsettings_cnxn_desc);
+  if (key_entry->gsettings_cnxn_cmd != 0)
+    g_signal_handler_disconnect (key_entry->settings, key_entry->gsettings_cnxn_cmd);
+
+  key_entry->gsettings_cnxn = 0;
+  key_entry->gsettings_cnxn_desc = 0;
+  key_entry->gsettings_cnxn_cmd = 0;
+}
+
+static void
+key_entry_free (KeyEntry *key_entry)
+{
+  if (key_entry->settings != NULL)
+    {
+      key_entry_disconnect (key_entry);
+      g_object_unref (key_entry->settings);
+    }
+
+  g_free (key_entry->schema);
+  g_free (key_entry->gsettings_path);
+  g_free (key_entry->gsettings_key);
+  g_free (key_entry->description);
+  g_free (key_entry->desc_gsettings_key);
+  g_free (key_entry->command);
+  g_free (key_entry->cmd_gsettings_key);
+  g_free (key_entry);
+}
+
 static void
 accel_set_func (GtkTreeViewColumn *tree_column,
                 GtkCellRenderer   *cell,
@@ -234,7 +431,8 @@ keybinding_key_changed (GSettings *settings,
 
   key_value = g_settings_get_string (settings, key);
 
-  binding_from_string (key_value, &key_entry->keyval, &key_entry->keycode, &key_entry->mask);
+  key_entry_set_binding (key_entry, key_value);
+  g_free (key_value);
   key_entry->editable = g_settings_is_writable (settings, key);
 
   /* update the model */
@@ -337,6 +535,24 @@ keyentry_sort_func (GtkTreeModel *model,
   return retval;
 }
 
+static gboolean
+free_key_entry_foreach (GtkTreeModel *model,
+                        GtkTreePath  *path,
+                        GtkTreeIter  *iter,
+                        gpointer      data)
+{
+  KeyEntry *key_entry;
+
+  gtk_tree_model_get (model, iter,
+                      KEYENTRY_COLUMN, &key_entry,
+                      -1);
+
+  if (key_entry != NULL)
+    key_entry_free (key_entry);
+
+  return FALSE;
+}
+
 static void
 clear_old_model (GtkBuilder *builder)
 {
@@ -363,105 +579,30 @@ clear_old_model (GtkBuilder *builder)
     }
   else
     {
-      /* clear the existing model */
-      gboolean valid;
-      GtkTreeIter iter;
-      KeyEntry *key_entry;
-
-      for (valid = gtk_tree_model_get_iter_first (model, &iter);
-           valid;
-           valid = gtk_tree_model_iter_next (model, &iter))
-        {
-          gtk_tree_model_get (model, &iter,
-                              KEYENTRY_COLUMN, &key_entry,
-                              -1);
-
-          if (key_entry != NULL)
-            {
-              g_signal_handler_disconnect (key_entry->settings, key_entry->gsettings_cnxn);
-              if (key_entry->gsettings_cnxn_desc != 0)
-                g_signal_handler_disconnect (key_entry->settings, key_entry->gsettings_cnxn_desc);
-              if (key_entry->gsettings_cnxn_cmd != 0)
-                g_signal_handler_disconnect (key_entry->settings, key_entry->gsettings_cnxn_cmd);
-
-              g_object_unref (key_entry->settings);
-              if (key_entry->gsettings_path)
-                g_free (key_entry->gsettings_path);
-              g_free (key_entry->gsettings_key);
-              g_free (key_entry->description);
-              g_free (key_entry->desc_gsettings_key);
-              g_free (key_entry->command);
-              g_free (key_entry->cmd_gsettings_key);
-              g_free (key_entry);
-            }
-        }
-
+      /* clear the existing model; the keys are in the rows below the
+       * section headers */
+      gtk_tree_model_foreach (model, free_key_entry_foreach, NULL);
       gtk_tree_store_clear (GTK_TREE_STORE (model));
     }
 
+  key_index_clear ();
+
   actions_swindow = _gtk_builder_get_widget (builder, "actions_swindow");
   gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (actions_swindow),
                   GTK_POLICY_NEVER, GTK_POLICY_NEVER);
   gtk_widget_set_size_request (actions_swindow, -1, -1);
 }
 
-typedef struct {
-  const char *key;
-  const char *path;
-  const char *schema;
-  gboolean found;
-} KeyMatchData;
-
-static gboolean
-key_match (GtkTreeModel *model,
-           GtkTreePath  *path,
-           GtkTreeIter  *iter,
-           gpointer      data)
-{
-    KeyMatchData *match_data = data;
-    KeyEntry *element;
-    gchar *element_schema = NULL;
-    gchar *element_path = NULL;
-    gboolean found = FALSE;
-
-    gtk_tree_model_get (model, iter,
-                        KEYENTRY_COLUMN, &element,
-                        -1);
-
-    if (!element)
-        return FALSE;
-
-    if (!element->settings || !G_IS_SETTINGS (element->settings))
-        return FALSE;
-
-    g_object_get (element->settings, "schema-id", &element_schema, NULL);
-    g_object_get (element->settings, "path", &element_path, NULL);
-
-    if ((g_strcmp0 (element->gsettings_key, match_data->key) == 0) &&
-        (g_strcmp0 (element_schema, match_data->schema) == 0) &&
-        (g_strcmp0 (element_path, match_data->path) == 0))
-    {
-        match_data->found = TRUE;
-        found = TRUE;
-    }
-
-    g_free (element_schema);
-    g_free (element_path);
-
-    return found;
-}
-
-static gboolean key_is_already_shown(GtkTreeModel* model, const KeyListEntry* entry)
+static gboolean key_is_already_shown(const gchar* schema, const KeyListEntry* entry)
 {
-    KeyMatchData data;
+    gchar *id;
+    gboolean found;
 
-    data.key = entry->name;
-    data.schema = entry->schema;
-    data.path = entry->gsettings_path;
-    data.found = FALSE;
-    gtk_tree_model_foreach(model, key_match, &data);
+    id = key_index_get_id (schema, entry->gsettings_path, entry->name);
+    found = g_hash_table_contains (key_index, id);
+    g_free (id);
 
-    return data.found;
+    return found;
 }
 
 static gboolean should_show_key(const KeyListEntry* entry)
@@ -477,7 +618,7 @@ static gboolean should_show_key(const KeyListEntry* entry)
     g_return_val_if_fail(entry->value_key != NULL, FALSE);
     g_return_val_if_fail(entry->value_schema != NULL, FALSE);
 
-    settings = g_settings_new (entry->value_schema);
+    settings = get_settings (entry->value_schema, NULL);
     value = g_settings_get_int (settings, entry->value_key);
     g_object_unref (settings);
 
@@ -604,21 +745,13 @@ append_keys_to_tree (GtkBuilder         *builder,
       if (!should_show_key (&keys_list[j]))
         continue;
 
-      if (key_is_already_shown (model, &keys_list[j]))
+      if (key_is_already_shown (schema, &keys_list[j]))
         continue;
 
       key_string = keys_list[j].name;
 
-      if (keys_list[j].gsettings_path != NULL)
-        {
-          settings = g_settings_new_with_path (schema, keys_list[j].gsettings_path);
-          settings_path = g_strdup(keys_list[j].gsettings_path);
-        }
-      else
-        {
-          settings = g_settings_new (schema);
-          settings_path = NULL;
-        }
+      settings = get_settings (schema, keys_list[j].gsettings_path);
+      settings_path = g_strdup (keys_list[j].gsettings_path);
 
       if (keys_list[j].description_key != NULL)
         {
@@ -632,11 +765,11 @@ append_keys_to_tree (GtkBuilder         *builder,
           if (package)
             {
               bind_textdomain_codeset (package, "UTF-8");
-              description = dgettext (package, description);
+              description = g_strdup (dgettext (package, description));
             }
           else
             {
-              description = _(description);
+              description = g_strdup (_(description));
             }
         }
 
@@ -658,6 +791,7 @@ append_keys_to_tree (GtkBuilder         *builder,
 
       key_entry = g_new0 (KeyEntry, 1);
       key_entry->settings = settings;
+      key_entry->schema = g_strdup (schema);
       key_entry->gsettings_path = settings_path;
       key_entry->gsettings_key = g_strdup (key_string);
       key_entry->editable = g_settings_is_writable (settings, key_string);
@@ -706,6 +840,7 @@ append_keys_to_tree (GtkBuilder         *builder,
       gtk_tree_store_set (GTK_TREE_STORE (model), &iter,
               KEYENTRY_COLUMN, key_entry,
               -1);
+      key_index_add (key_entry);
       gtk_tree_view_expand_all (GTK_TREE_VIEW (gtk_builder_get_object (builder, "shortcut_treeview")));
     }
 
@@ -871,85 +1006,103 @@ parse_start_tag (GMarkupParseContext *ctx,
   g_array_append_val (keylist->entries, key);
 }
 
-static gboolean
-strv_contains (char **strv,
-           char  *str)
+static void
+keylist_free (KeyList *keylist)
 {
-  char **p;
+  guint i;
 
-  for (p = strv; *p; p++)
-    if (strcmp (*p, str) == 0)
-      return TRUE;
+  for (i = 0; i < keylist->entries->len; i++)
+    {
+      KeyListEntry *entry = &g_array_index (keylist->entries, KeyListEntry, i);
+
+      g_free (entry->gsettings_path);
+      g_free (entry->schema);
+      g_free (entry->name);
+      g_free (entry->value_schema);
+      g_free (entry->value_key);
+      g_free (entry->description);
+      g_free (entry->description_key);
+      g_free (entry->cmd_key);
+    }
 
-  return FALSE;
+  g_array_free (keylist->entries, TRUE);
+  g_free (keylist->name);
+  g_free (keylist->package);
+  g_free (keylist->wm_name);
+  g_free (keylist->schema);
+  g_free (keylist);
 }
 
-static void
-append_keys_to_tree_from_file (GtkBuilder *builder,
-                   const char *filename,
-                   char      **wm_keybindings)
+/* The entries of the returned list end with an empty KeyListEntry, so
+ * they can be passed to append_keys_to_tree() as they are. */
+static KeyList *
+keylist_new_from_file (const char *filename)
 {
   GMarkupParseContext *ctx;
   GMarkupParser parser = { parse_start_tag, NULL, NULL, NULL, NULL };
   KeyList *keylist;
-  KeyListEntry key, *keys;
   GError *err = NULL;
   char *buf;
-  const char *title;
   gsize buf_len;
-  guint i;
 
   if (!g_file_get_contents (filename, &buf, &buf_len, &err))
-    return;
+    {
+      g_error_free (err);
+      return NULL;
+    }
 
   keylist = g_new0 (KeyList, 1);
-  keylist->entries = g_array_new (FALSE, TRUE, sizeof (KeyListEntry));
+  keylist->entries = g_array_new (TRUE, TRUE, sizeof (KeyListEntry));
   ctx = g_markup_parse_context_new (&parser, 0, keylist, NULL);
 
   if (!g_markup_parse_context_parse (ctx, buf, buf_len, &err))
     {
       g_warning ("Failed to parse '%s': '%s'", filename, err->message);
       g_error_free (err);
-      g_free (keylist->name);
-      g_free (keylist->package);
-      g_free (keylist->wm_name);
-      g_free (keylist->schema);
-      for (i = 0; i < keylist->entries->len; i++)
-        g_free (((KeyListEntry *) &(keylist->entries->data[i]))->name);
-      g_array_free (keylist->entries, TRUE);
-      g_free (keylist);
+      keylist_free (keylist);
       keylist = NULL;
     }
   g_markup_parse_context_free (ctx);
   g_free (buf);
 
   if (keylist == NULL)
-    return;
+    return NULL;
 
-  /* If there's no keys to add, or the settings apply to a window manager
-   * that's not the one we're running */
-  if (keylist->entries->len == 0
-      || (keylist->wm_name != NULL && !strv_contains (wm_keybindings, keylist->wm_name))
-      || keylist->name == NULL)
+  /* If there's no keys to add */
+  if (keylist->entries->len == 0 || keylist->name == NULL)
     {
-      g_free (keylist->name);
-      g_free (keylist->package);
-      g_free (keylist->wm_name);
-      g_free (keylist->schema);
-      g_array_free (keylist->entries, TRUE);
-      g_free (keylist);
-      return;
+      keylist_free (keylist);
+      return NULL;
     }
 
-  /* Empty KeyListEntry to end the array */
-  key.name = NULL;
-  key.description_key = NULL;
-  key.value_key = NULL;
-  key.value = 0;
-  key.comparison = COMPARISON_NONE;
-  g_array_append_val (keylist->entries, key);
+  return keylist;
+}
+
+static gboolean
+strv_contains (char **strv,
+           char  *str)
+{
+  char **p;
+
+  for (p = strv; *p; p++)
+    if (strcmp (*p, str) == 0)
+      return TRUE;
+
+  return FALSE;
+}
+
+static void
+append_keys_to_tree_from_keylist (GtkBuilder *builder,
+                                  KeyList    *keylist,
+                                  char      **wm_keybindings)
+{
+  const char *title;
+
+  /* The settings apply to a window manager that's not the one we're
+   * running */
+  if (keylist->wm_name != NULL && !strv_contains (wm_keybindings, keylist->wm_name))
+    return;
 
-  keys = (KeyListEntry *) g_array_free (keylist->entries, FALSE);
   if (keylist->package)
     {
       bind_textdomain_codeset (keylist->package, "UTF-8");
@@ -958,13 +1111,244 @@ append_keys_to_tree_from_file (GtkBuilder *builder,
       title = _(keylist->name);
     }
 
-  append_keys_to_tree (builder, title, keylist->schema, keylist->package, keys);
+  append_keys_to_tree (builder, title, keylist->schema, keylist->package,
+                       (KeyListEntry *) keylist->entries->data);
+}
 
-  g_free (keylist->name);
-  g_free (keylist->package);
-  for (i = 0; keys[i].name != NULL; i++)
-    g_free (keys[i].name);
-  g_free (keylist);
+/* Keybinding catalogue
+ *
+ * Parsing every keybinding file each time the dialog is opened is most of
+ * its start-up cost, so the parsed lists are kept in memory and in a
+ * cache file, and validated against the path and mtime of each file.
+ */
+#define KEYBINDING_CATALOGUE_VERSION 2
+#define KEYBINDING_CATALOGUE_ENTRY_TYPE "(smsimsmsu)"
+#define KEYBINDING_CATALOGUE_LIST_TYPE "(smsmsmsa" KEYBINDING_CATALOGUE_ENTRY_TYPE ")"
+#define KEYBINDING_CATALOGUE_TYPE "(a(sx)a" KEYBINDING_CATALOGUE_LIST_TYPE ")"
+
+/* The parsed KeyLists, in file name order, and the files they were
+ * parsed from */
+static GPtrArray *catalogue = NULL;
+static GVariant *catalogue_stamps = NULL;
+
+/* Returns the keybinding files and their mtimes, as an a(sx). When the
+ * same file name is in several data dirs, the first one wins. */
+static GVariant *
+keybinding_catalogue_list_files (void)
+{
+  GVariantBuilder builder;
+  GList *list, *l;
+  const gchar * const * data_dirs;
+  GHashTable *loaded_files;
+  guint i;
+
+  loaded_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  data_dirs = g_get_system_data_dirs ();
+  for (i = 0; data_dirs[i] != NULL; i++)
+    {
+      g_autofree gchar *dir_path = NULL;
+      GDir *dir;
+      const gchar *name;
+
+      dir_path = g_build_filename (data_dirs[i], "mate-control-center", "keybindings", NULL);
+      g_debug ("Keybinding dir: %s", dir_path);
+
+      dir = g_dir_open (dir_path, 0, NULL);
+      if (!dir)
+        continue;
+
+      for (name = g_dir_read_name (dir) ; name ; name = g_dir_read_name (dir))
+        {
+          if (g_str_has_suffix (name, ".xml") == FALSE)
+            continue;
+
+          if (g_hash_table_lookup (loaded_files, name) != NULL)
+            {
+              g_debug ("Not loading %s, it was already loaded from another directory", name);
+              continue;
+            }
+
+          g_hash_table_insert (loaded_files, g_strdup (name), g_strdup (dir_path));
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sx)"));
+
+  list = g_hash_table_get_keys (loaded_files);
+  list = g_list_sort (list, (GCompareFunc) strcmp);
+  for (l = list; l != NULL; l = l->next)
+    {
+      g_autofree gchar *path = NULL;
+      GStatBuf buf;
+
+      path = g_build_filename (g_hash_table_lookup (loaded_files, l->data), l->data, NULL);
+      if (!cache_util_string_valid (path))
+        {
+          g_debug ("Not loading %s, its path is not UTF-8", path);
+          continue;
+        }
+      if (g_stat (path, &buf) != 0)
+        continue;
+
+      g_variant_builder_add (&builder, "(sx)", path, (gint64) buf.st_mtime);
+    }
+  g_list_free (list);
+  g_hash_table_destroy (loaded_files);
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static KeyList *
+keylist_new_from_variant (GVariant *variant)
+{
+  KeyList *keylist;
+  GVariantIter *iter;
+  KeyListEntry key = { 0 };
+  guint32 comparison;
+
+  keylist = g_new0 (KeyList, 1);
+  keylist->entries = g_array_new (TRUE, TRUE, sizeof (KeyListEntry));
+
+  g_variant_get (variant, KEYBINDING_CATALOGUE_LIST_TYPE,
+                 &keylist->name, &keylist->package, &keylist->wm_name,
+                 &keylist->schema, &iter);
+
+  while (g_variant_iter_next (iter, KEYBINDING_CATALOGUE_ENTRY_TYPE,
+                              &key.name, &key.description, &key.value,
+                              &key.value_schema, &key.value_key, &comparison))
+    {
+      key.comparison = comparison <= COMPARISON_EQ ? comparison : COMPARISON_NONE;
+      g_array_append_val (keylist->entries, key);
+    }
+  g_variant_iter_free (iter);
+
+  return keylist;
+}
+
+static GVariant *
+keylist_to_variant (KeyList *keylist)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" KEYBINDING_CATALOGUE_ENTRY_TYPE));
+  for (i = 0; i < keylist->entries->len; i++)
+    {
+      KeyListEntry *entry = &g_array_index (keylist->entries, KeyListEntry, i);
+
+      g_variant_builder_add (&builder, KEYBINDING_CATALOGUE_ENTRY_TYPE,
+                             entry->name, entry->description, entry->value,
+                             entry->value_schema, entry->value_key,
+                             (guint32) entry->comparison);
+    }
+
+  return g_variant_new ("(smsmsms@a" KEYBINDING_CATALOGUE_ENTRY_TYPE ")",
+                        keylist->name, keylist->package, keylist->wm_name,
+                        keylist->schema, g_variant_builder_end (&builder));
+}
+
+static GPtrArray *
+keybinding_catalogue_load (GVariant *stamps)
+{
+  GPtrArray *lists = NULL;
+  GVariant *root, *cached_stamps, *cached_lists;
+
+  root = cache_util_load ("keybindings.cache",
+                          G_VARIANT_TYPE (KEYBINDING_CATALOGUE_TYPE),
+                          KEYBINDING_CATALOGUE_VERSION);
+  if (root == NULL)
+    return NULL;
+
+  g_variant_get (root, "(@a(sx)@a" KEYBINDING_CATALOGUE_LIST_TYPE ")",
+                 &cached_stamps, &cached_lists);
+
+  if (g_variant_equal (cached_stamps, stamps))
+    {
+      GVariantIter iter;
+      GVariant *child;
+
+      lists = g_ptr_array_new_with_free_func ((GDestroyNotify) keylist_free);
+
+      g_variant_iter_init (&iter, cached_lists);
+      while ((child = g_variant_iter_next_value (&iter)) != NULL)
+        {
+          g_ptr_array_add (lists, keylist_new_from_variant (child));
+          g_variant_unref (child);
+        }
+    }
+
+  g_variant_unref (cached_stamps);
+  g_variant_unref (cached_lists);
+  g_variant_unref (root);
+
+  return lists;
+}
+
+static void
+keybinding_catalogue_save (GVariant  *stamps,
+                           GPtrArray *lists)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" KEYBINDING_CATALOGUE_LIST_TYPE));
+  for (i = 0; i < lists->len; i++)
+    g_variant_builder_add_value (&builder, keylist_to_variant (g_ptr_array_index (lists, i)));
+
+  cache_util_save ("keybindings.cache", KEYBINDING_CATALOGUE_VERSION,
+                   g_variant_new ("(@a(sx)@a" KEYBINDING_CATALOGUE_LIST_TYPE ")",
+                                  stamps, g_variant_builder_end (&builder)));
+}
+
+/* Brings the catalogue up to date with the keybinding files, reading it
+ * from the cache file if the files didn't change since it was written,
+ * and parsing them otherwise. */
+static void
+keybinding_catalogue_update (void)
+{
+  GVariant *stamps;
+  GPtrArray *lists;
+
+  stamps = keybinding_catalogue_list_files ();
+
+  if (catalogue != NULL && g_variant_equal (stamps, catalogue_stamps))
+    {
+      g_variant_unref (stamps);
+      return;
+    }
+
+  lists = keybinding_catalogue_load (stamps);
+
+  if (lists == NULL)
+    {
+      GVariantIter iter;
+      const gchar *path;
+
+      lists = g_ptr_array_new_with_free_func ((GDestroyNotify) keylist_free);
+
+      g_variant_iter_init (&iter, stamps);
+      while (g_variant_iter_next (&iter, "(&sx)", &path, NULL))
+        {
+          KeyList *keylist;
+
+          g_debug ("Keybinding file: %s", path);
+          keylist = keylist_new_from_file (path);
+          if (keylist != NULL)
+            g_ptr_array_add (lists, keylist);
+        }
+
+      keybinding_catalogue_save (stamps, lists);
+    }
+
+  if (catalogue != NULL)
+    g_ptr_array_unref (catalogue);
+  if (catalogue_stamps != NULL)
+    g_variant_unref (catalogue_stamps);
+
+  catalogue = lists;
+  catalogue_stamps = stamps;
 }
 
 static void
@@ -1029,64 +1413,116 @@ static void
 reload_key_entries (GtkBuilder *builder)
 {
   gchar **wm_keybindings;
-  GList *list, *l;
-  const gchar * const * data_dirs;
-  GHashTable *loaded_files;
   guint i;
 
   wm_keybindings = wm_common_get_current_keybindings();
 
   clear_old_model (builder);
 
-  loaded_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
-  data_dirs = g_get_system_data_dirs ();
-  for (i = 0; data_dirs[i] != NULL; i++)
+  keybinding_catalogue_update ();
+  for (i = 0; i < catalogue->len; i++)
+    append_keys_to_tree_from_keylist (builder, g_ptr_array_index (catalogue, i), wm_keybindings);
+
+  /* Load custom shortcuts _after_ system-provided ones,
+   * since some of the custom shortcuts may also be listed
+   * in a file. Loading the custom shortcuts last makes
+   * such keys not show up in the custom section.
+   */
+  append_keys_to_tree_from_gsettings (builder, GSETTINGS_KEYBINDINGS_DIR);
+
+  g_strfreev (wm_keybindings);
+}
+
+static gboolean
+find_key_entry (GtkTreeModel *model,
+                KeyEntry     *key_entry,
+                GtkTreeIter  *iter)
+{
+  GtkTreeIter parent;
+  gboolean valid_parent, valid;
+
+  for (valid_parent = gtk_tree_model_get_iter_first (model, &parent);
+       valid_parent;
+       valid_parent = gtk_tree_model_iter_next (model, &parent))
     {
-      g_autofree gchar *dir_path = NULL;
-      GDir *dir;
-      const gchar *name;
+      for (valid = gtk_tree_model_iter_children (model, iter, &parent);
+           valid;
+           valid = gtk_tree_model_iter_next (model, iter))
+        {
+          KeyEntry *element;
 
-      dir_path = g_build_filename (data_dirs[i], "mate-control-center", "keybindings", NULL);
-      g_debug ("Keybinding dir: %s", dir_path);
+          gtk_tree_model_get (model, iter,
+                              KEYENTRY_COLUMN, &element,
+                              -1);
+          if (element == key_entry)
+            return TRUE;
+        }
+    }
 
-      dir = g_dir_open (dir_path, 0, NULL);
-      if (!dir)
-        continue;
+  return FALSE;
+}
 
-      for (name = g_dir_read_name (dir) ; name ; name = g_dir_read_name (dir))
+static void
+remove_key_entry (GtkTreeModel *model,
+                  KeyEntry     *key_entry)
+{
+  GtkTreeIter iter, parent;
+
+  if (!find_key_entry (model, key_entry, &iter))
+    return;
+
+  key_index_remove (key_entry);
+  key_entry_free (key_entry);
+
+  gtk_tree_model_iter_parent (model, &parent, &iter);
+  gtk_tree_store_remove (GTK_TREE_STORE (model), &iter);
+  if (!gtk_tree_model_iter_has_child (model, &parent))
+    gtk_tree_store_remove (GTK_TREE_STORE (model), &parent);
+}
+
+/* Only the keys with a comparison depend on a controlling key, so
+ * instead of reloading everything, hide those that shouldn't be shown any
+ * more and add those that should. */
+static void
+refresh_controlled_keys (GtkBuilder *builder)
+{
+  GtkTreeModel *model;
+  gchar **wm_keybindings;
+  guint i, j;
+
+  model = gtk_tree_view_get_model (GTK_TREE_VIEW (gtk_builder_get_object (builder, "shortcut_treeview")));
+  wm_keybindings = wm_common_get_current_keybindings();
+
+  for (i = 0; i < catalogue->len; i++)
+    {
+      KeyList *keylist = g_ptr_array_index (catalogue, i);
+      gboolean controlled = FALSE;
+
+      for (j = 0; j < keylist->entries->len; j++)
         {
-          if (g_str_has_suffix (name, ".xml") == FALSE)
+          KeyListEntry *entry = &g_array_index (keylist->entries, KeyListEntry, j);
+          KeyEntry *key_entry;
+          gchar *id;
+
+          if (entry->comparison == COMPARISON_NONE)
             continue;
 
-          if (g_hash_table_lookup (loaded_files, name) != NULL)
-            {
-              g_debug ("Not loading %s, it was already loaded from another directory", name);
-              continue;
-            }
+          controlled = TRUE;
+          if (should_show_key (entry))
+            continue;
 
-          g_hash_table_insert (loaded_files, g_strdup (name), g_strdup (dir_path));
+          id = key_index_get_id (keylist->schema, entry->gsettings_path, entry->name);
+          key_entry = g_hash_table_lookup (key_index, id);
+          g_free (id);
+
+          if (key_entry != NULL)
+            remove_key_entry (model, key_entry);
         }
 
-      g_dir_close (dir);
-    }
-  list = g_hash_table_get_keys (loaded_files);
-  list = g_list_sort(list, (GCompareFunc) g_str_equal);
-  for (l = list; l != NULL; l = l->next)
-    {
-      g_autofree gchar *path = NULL;
-      path = g_build_filename (g_hash_table_lookup (loaded_files, l->data), l->data, NULL);
-      g_debug ("Keybinding file: %s", path);
-      append_keys_to_tree_from_file (builder, path, wm_keybindings);
+      /* Keys already in the tree are skipped */
+      if (controlled)
+        append_keys_to_tree_from_keylist (builder, keylist, wm_keybindings);
     }
-  g_list_free (list);
-  g_hash_table_destroy (loaded_files);
-
-  /* Load custom shortcuts _after_ system-provided ones,
-   * since some of the custom shortcuts may also be listed
-   * in a file. Loading the custom shortcuts last makes
-   * such keys not show up in the custom section.
-   */
-  append_keys_to_tree_from_gsettings (builder, GSETTINGS_KEYBINDINGS_DIR);
 
   g_strfreev (wm_keybindings);
 }
@@ -1094,55 +1530,40 @@ reload_key_entries (GtkBuilder *builder)
 static void
 key_entry_controlling_key_changed (GSettings *settings, gchar *key, gpointer user_data)
 {
-  reload_key_entries (user_data);
+  refresh_controlled_keys (user_data);
 }
 
-static gboolean cb_check_for_uniqueness(GtkTreeModel* model, GtkTreePath* path, GtkTreeIter* iter, KeyEntry* new_key)
+static gboolean check_for_uniqueness(KeyEntry* new_key)
 {
-    KeyEntry* element;
+    KeyEntry* element = NULL;
+    GList* l;
+    gchar* binding_id;
+    gchar* new_key_id;
 
-    gtk_tree_model_get (new_key->model, iter,
-        KEYENTRY_COLUMN, &element,
-        -1);
+    binding_id = binding_index_get_id (new_key->keyval, new_key->keycode, new_key->mask);
+    new_key_id = key_index_get_id (new_key->schema, new_key->gsettings_path, new_key->gsettings_key);
 
-    /* no conflict for : blanks, different modifiers, or ourselves */
-    if (element == NULL || new_key->mask != element->mask)
+    /* no conflict for : blanks, different bindings, or ourselves */
+    for (l = binding_id ? g_hash_table_lookup (binding_index, binding_id) : NULL; l != NULL; l = l->next)
     {
-        return FALSE;
-    }
+        KeyEntry* candidate = l->data;
+        gchar* candidate_id;
 
-    gchar *new_key_schema = NULL;
-    gchar *element_schema = NULL;
-    gchar *new_key_path = NULL;
-    gchar *element_path = NULL;
+        candidate_id = key_index_get_id (candidate->schema, candidate->gsettings_path, candidate->gsettings_key);
 
-    if (new_key && new_key->settings)
-    {
-            g_object_get (new_key->settings, "schema-id", &new_key_schema, NULL);
-        g_object_get (new_key->settings, "path", &new_key_path, NULL);
-    }
+        if (g_strcmp0 (candidate_id, new_key_id) != 0)
+            element = candidate;
 
-    if (element->settings)
-    {
-            g_object_get (element->settings, "schema-id", &element_schema, NULL);
-        g_object_get (element->settings, "path", &element_path, NULL);
-    }
+        g_free (candidate_id);
 
-    if (!g_strcmp0 (new_key->gsettings_key, element->gsettings_key) &&
-        !g_strcmp0 (new_key_schema, element_schema) &&
-        !g_strcmp0 (new_key_path, element_path))
-    {
-        return FALSE;
+        if (element != NULL)
+            break;
     }
 
-    if (new_key->keyval != 0)
-    {
-        if (new_key->keyval != element->keyval)
-        {
-            return FALSE;
-        }
-    }
-    else if (element->keyval != 0 || new_key->keycode != element->keycode)
+    g_free (binding_id);
+    g_free (new_key_id);
+
+    if (element == NULL)
     {
         return FALSE;
     }
@@ -1240,13 +1661,15 @@ static void accel_edited_callback(GtkCellRendererText* cell, const char* path_st
     tmp_key.keycode = keycode;
     tmp_key.mask   = mask;
     tmp_key.settings = key_entry->settings;
+    tmp_key.schema = key_entry->schema;
+    tmp_key.gsettings_path = key_entry->gsettings_path;
     tmp_key.gsettings_key = key_entry->gsettings_key;
     tmp_key.description = NULL;
     tmp_key.editable = TRUE; /* kludge to stuff in a return flag */
 
     if (keyval != 0 || keycode != 0) /* any number of keys can be disabled */
     {
-        gtk_tree_model_foreach(model, (GtkTreeModelForeachFunc) cb_check_for_uniqueness, &tmp_key);
+        check_for_uniqueness (&tmp_key);
     }
 
     /* Check for unmodified keys */
@@ -1488,22 +1911,11 @@ remove_custom_shortcut (GtkTreeModel *model, GtkTreeIter *iter)
   if (key->command == NULL)
     return FALSE;
 
-  g_signal_handler_disconnect (key->settings, key->gsettings_cnxn);
-  if (key->gsettings_cnxn_desc != 0)
-    g_signal_handler_disconnect (key->settings, key->gsettings_cnxn_desc);
-  if (key->gsettings_cnxn_cmd != 0)
-    g_signal_handler_disconnect (key->settings, key->gsettings_cnxn_cmd);
+  key_entry_disconnect (key);
+  key_index_remove (key);
 
   dconf_util_recursive_reset (key->gsettings_path, NULL);
-  g_object_unref (key->settings);
-
-  g_free (key->gsettings_path);
-  g_free (key->gsettings_key);
-  g_free (key->description);
-  g_free (key->desc_gsettings_key);
-  g_free (key->command);
-  g_free (key->cmd_gsettings_key);
-  g_free (key);
+  key_entry_free (key);
 
   gtk_tree_model_iter_parent (model, &parent, iter);
   gtk_tree_store_remove (GTK_TREE_STORE (model), iter);
@@ -1604,6 +2016,7 @@ add_custom_shortcut (GtkTreeView  *tree_view,
     }
 
   key_entry = g_new0 (KeyEntry, 1);
+  key_entry->schema = g_strdup (CUSTOM_KEYBINDING_SCHEMA);
   key_entry->gsettings_path = g_strdup(dir);
   key_entry->gsettings_key = g_strdup("binding");
   key_entry->editable = TRUE;
@@ -1623,9 +2036,10 @@ add_custom_shortcut (GtkTreeView  *tree_view,
       parent_iter = iter;
       gtk_tree_store_append (GTK_TREE_STORE (model), &iter, &parent_iter);
       gtk_tree_store_set (GTK_TREE_STORE (model), &iter, KEYENTRY_COLUMN, key_entry, -1);
+      key_index_add (key_entry);
 
       /* store in gsettings */
-      key_entry->settings = g_settings_new_with_path (CUSTOM_KEYBINDING_SCHEMA, key_entry->gsettings_path);
+      key_entry->settings = get_settings (CUSTOM_KEYBINDING_SCHEMA, key_entry->gsettings_path);
       g_settings_set_string (key_entry->settings, key_entry->gsettings_key, "disabled");
       g_settings_set_string (key_entry->settings, key_entry->desc_gsettings_key, key_entry->description);
       g_settings_set_string (key_entry->settings, key_entry->cmd_gsettings_key, key_entry->command);
@@ -1652,13 +2066,7 @@ add_custom_shortcut (GtkTreeView  *tree_view,
     }
   else
     {
-      g_free (key_entry->gsettings_path);
-      g_free (key_entry->gsettings_key);
-      g_free (key_entry->description);
-      g_free (key_entry->desc_gsettings_key);
-      g_free (key_entry->command);
-      g_free (key_entry->cmd_gsettings_key);
-      g_free (key_entry);
+      key_entry_free (key_entry);
     }
 }
 
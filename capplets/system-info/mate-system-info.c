@@ -36,10 +36,23 @@
 #include <gdk/gdkx.h>
 #endif
 
+#include "cache-util.h"
 #include "info-cleanup.h"
 #include "mate-system-info.h"
 #include "mate-system-info-resources.h"
 
+/* What doesn't change while the machine is up, and takes long enough to
+ * find out that it is cached, and probed on worker threads where that is
+ * safe. */
+enum
+{
+    STATIC_INFO_CPU,
+    STATIC_INFO_GRAPHICS,
+    STATIC_INFO_DISK,
+    STATIC_INFO_OS_NAME,
+    N_STATIC_INFO
+};
+
 struct _MateSystemInfo
 {
     GtkDialog    parent_instance;
@@ -58,6 +71,11 @@ struct _MateSystemInfo
     GtkWidget   *mate_version_row;
     GtkWidget   *os_name_row;
     GtkWidget   *os_type_row;
+
+    GCancellable *cancellable;
+    char         *boot_id;
+    char         *static_info[N_STATIC_INFO];
+    guint         n_pending_probes;
 };
 
 G_DEFINE_TYPE (MateSystemInfo, mate_system_info, GTK_TYPE_DIALOG)
@@ -361,14 +379,7 @@ get_renderer_from_session (void)
 static gchar *
 get_graphics_hardware_string (void)
 {
-    g_autofree char *discrete_renderer = NULL;
-    g_autofree char *renderer = NULL;
-
-    renderer = get_renderer_from_session ();
-    if (!renderer)
-        return g_strdup ("Unknown");
-
-    return g_strdup (renderer);
+    return get_renderer_from_session ();
 }
 
 static char *
@@ -389,7 +400,7 @@ get_primary_disk_size (void)
     {
         g_warning ("Unable to get UDisks client: %s. Disk information will not be available.",
                    error->message);
-        return g_strdup ("Unknown");
+        return NULL;
     }
 
     manager = udisks_client_get_object_manager (client);
@@ -416,7 +427,7 @@ get_primary_disk_size (void)
     }
     else
     {
-        size = g_strdup ("Unknown");
+        size = NULL;
     }
 
     return size;
@@ -621,6 +632,204 @@ get_logo_name (void)
     return logo_name;
 }
 
+static char *
+get_boot_id (void)
+{
+    char *boot_id = NULL;
+
+    if (!g_file_get_contents ("/proc/sys/kernel/random/boot_id", &boot_id, NULL, NULL))
+        return NULL;
+
+    if (!cache_util_string_valid (boot_id))
+    {
+        g_free (boot_id);
+        return NULL;
+    }
+
+    return g_strstrip (boot_id);
+}
+
+/*
+ * The static probes are kept in the user cache dir along with the boot
+ * they were made in, so that opening the dialog again doesn't query
+ * glibtop, udisks and the session manager each time. A probe that found
+ * nothing isn't cached, and is run again the next time.
+ */
+#define SYSTEM_INFO_CACHE_VERSION 2
+#define SYSTEM_INFO_CACHE_TYPE "(smsmsmsms)"
+
+static void
+system_info_cache_load (MateSystemInfo *info)
+{
+    g_autoptr(GVariant) root = NULL;
+    const char *boot_id;
+    int i;
+
+    root = cache_util_load ("system-info.cache",
+                            G_VARIANT_TYPE (SYSTEM_INFO_CACHE_TYPE),
+                            SYSTEM_INFO_CACHE_VERSION);
+    if (root == NULL)
+        return;
+
+    g_variant_get_child (root, 0, "&s", &boot_id);
+    if (g_strcmp0 (boot_id, info->boot_id) != 0)
+        return;
+
+    for (i = 0; i < N_STATIC_INFO; i++)
+        g_variant_get_child (root, i + 1, "ms", &info->static_info[i]);
+}
+
+static void
+system_info_cache_save (MateSystemInfo *info)
+{
+    cache_util_save ("system-info.cache", SYSTEM_INFO_CACHE_VERSION,
+                     g_variant_new (SYSTEM_INFO_CACHE_TYPE,
+                                    info->boot_id,
+                                    info->static_info[STATIC_INFO_CPU],
+                                    info->static_info[STATIC_INFO_GRAPHICS],
+                                    info->static_info[STATIC_INFO_DISK],
+                                    info->static_info[STATIC_INFO_OS_NAME]));
+}
+
+static void
+mate_system_info_set_static_info (MateSystemInfo *info,
+                                  int             kind,
+                                  const char     *text)
+{
+    GtkWidget *row;
+    GtkWidget *label;
+
+    switch (kind)
+    {
+        case STATIC_INFO_CPU:
+            row = info->processor_row;
+            break;
+        case STATIC_INFO_GRAPHICS:
+            row = info->graphics_row;
+            break;
+        case STATIC_INFO_DISK:
+            row = info->disk_row;
+            break;
+        case STATIC_INFO_OS_NAME:
+            row = info->os_name_row;
+            break;
+        default:
+            g_assert_not_reached ();
+    }
+
+    label = g_object_get_data (G_OBJECT (row), "labelvalue");
+    set_lable_style (label, "gray", 12, text ? text : "Unknown", FALSE);
+}
+
+static char *
+static_info_probe (int kind)
+{
+    char *text = NULL;
+
+    switch (kind)
+    {
+        case STATIC_INFO_CPU:
+            text = get_cpu_info ();
+            break;
+        case STATIC_INFO_GRAPHICS:
+            text = get_graphics_hardware_string ();
+            break;
+        case STATIC_INFO_DISK:
+            text = get_primary_disk_size ();
+            break;
+        case STATIC_INFO_OS_NAME:
+            text = get_os_name ();
+            break;
+        default:
+            g_assert_not_reached ();
+    }
+
+    /* what the hardware reports isn't always UTF-8, which the labels
+     * and the cache need */
+    if (!cache_util_string_valid (text))
+    {
+        char *valid = g_utf8_make_valid (text, -1);
+
+        g_free (text);
+        text = valid;
+    }
+
+    return text;
+}
+
+static void
+static_info_probe_thread (GTask        *task,
+                          gpointer      source_object G_GNUC_UNUSED,
+                          gpointer      task_data,
+                          GCancellable *cancellable G_GNUC_UNUSED)
+{
+    g_task_return_pointer (task, static_info_probe (GPOINTER_TO_INT (task_data)), g_free);
+}
+
+static void
+static_info_probe_done (GObject      *source_object,
+                        GAsyncResult *result,
+                        gpointer      user_data G_GNUC_UNUSED)
+{
+    MateSystemInfo *info = MATE_SYSTEM_INFO (source_object);
+    g_autoptr(GError) error = NULL;
+    char *text;
+    int   kind;
+
+    kind = GPOINTER_TO_INT (g_task_get_task_data (G_TASK (result)));
+    text = g_task_propagate_pointer (G_TASK (result), &error);
+
+    /* the dialog is gone */
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    info->static_info[kind] = text;
+    mate_system_info_set_static_info (info, kind, text);
+
+    if (--info->n_pending_probes == 0 && info->boot_id != NULL)
+        system_info_cache_save (info);
+}
+
+static void
+mate_system_info_probe_static_info (MateSystemInfo *info)
+{
+    gboolean probed = FALSE;
+    int i;
+
+    info->boot_id = get_boot_id ();
+    if (info->boot_id != NULL)
+        system_info_cache_load (info);
+
+    for (i = 0; i < N_STATIC_INFO; i++)
+    {
+        g_autoptr(GTask) task = NULL;
+
+        if (info->static_info[i] != NULL)
+        {
+            mate_system_info_set_static_info (info, i, info->static_info[i]);
+            continue;
+        }
+
+        /* glibtop isn't thread safe, so it is only used from here */
+        if (i == STATIC_INFO_CPU)
+        {
+            info->static_info[i] = static_info_probe (i);
+            mate_system_info_set_static_info (info, i, info->static_info[i]);
+            probed = TRUE;
+            continue;
+        }
+
+        info->n_pending_probes++;
+
+        task = g_task_new (info, info->cancellable, static_info_probe_done, NULL);
+        g_task_set_task_data (task, GINT_TO_POINTER (i), NULL);
+        g_task_run_in_thread (task, static_info_probe_thread);
+    }
+
+    if (probed && info->n_pending_probes == 0 && info->boot_id != NULL)
+        system_info_cache_save (info);
+}
+
 void
 mate_system_info_setup (MateSystemInfo *info)
 {
@@ -631,14 +840,10 @@ mate_system_info_setup (MateSystemInfo *info)
     g_autofree char *virt_text = NULL;
 # endif
     g_autofree char *memory_text = NULL;
-    g_autofree char *cpu_text = NULL;
     g_autofree char *os_type_text = NULL;
-    g_autofree char *os_name_text = NULL;
-    g_autofree char *disk_text = NULL;
     g_autofree char *kernel_text = NULL;
     g_autofree char *windowing_system_text = NULL;
     g_autofree char *de_text = NULL;
-    g_autofree char *graphics_hardware_string = NULL;
 
     GtkWidget  *label;
     glibtop_mem mem;
@@ -665,17 +870,7 @@ mate_system_info_setup (MateSystemInfo *info)
     label = g_object_get_data (G_OBJECT (info->memory_row), "labelvalue");
     set_lable_style (label, "gray", 12, memory_text, FALSE);
 
-    cpu_text = get_cpu_info ();
-    label = g_object_get_data (G_OBJECT (info->processor_row), "labelvalue");
-    set_lable_style (label, "gray", 12, cpu_text, FALSE);
-
-    graphics_hardware_string = get_graphics_hardware_string ();
-    label = g_object_get_data (G_OBJECT (info->graphics_row), "labelvalue");
-    set_lable_style (label, "gray", 12, graphics_hardware_string, FALSE);
-
-    disk_text = get_primary_disk_size ();
-    label = g_object_get_data (G_OBJECT (info->disk_row), "labelvalue");
-    set_lable_style (label, "gray", 12, disk_text, FALSE);
+    mate_system_info_probe_static_info (info);
 
     kernel_text = get_kernel_vesrion ();
     label = g_object_get_data (G_OBJECT (info->kernel_row), "labelvalue");
@@ -700,23 +895,39 @@ mate_system_info_setup (MateSystemInfo *info)
     os_type_text = get_os_type ();
     label = g_object_get_data (G_OBJECT (info->os_type_row), "labelvalue");
     set_lable_style (label, "gray", 12, os_type_text, FALSE);
-
-    os_name_text = get_os_name ();
-    label = g_object_get_data (G_OBJECT (info->os_name_row), "labelvalue");
-    set_lable_style (label, "gray", 12, os_name_text, FALSE);
 }
 
 static void
 mate_system_info_destroy (GtkWidget *widget)
 {
+    MateSystemInfo *info = MATE_SYSTEM_INFO (widget);
+
+    g_cancellable_cancel (info->cancellable);
+
     GTK_WIDGET_CLASS (mate_system_info_parent_class)->destroy (widget);
 }
 
+static void
+mate_system_info_finalize (GObject *object)
+{
+    MateSystemInfo *info = MATE_SYSTEM_INFO (object);
+    int i;
+
+    g_object_unref (info->cancellable);
+    g_free (info->boot_id);
+    for (i = 0; i < N_STATIC_INFO; i++)
+        g_free (info->static_info[i]);
+
+    G_OBJECT_CLASS (mate_system_info_parent_class)->finalize (object);
+}
+
 static void
 mate_system_info_class_init (MateSystemInfoClass *klass)
 {
+    GObjectClass   *object_class = G_OBJECT_CLASS (klass);
     GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
 
+    object_class->finalize = mate_system_info_finalize;
     widget_class->destroy = mate_system_info_destroy;
     gtk_widget_class_set_template_from_resource (widget_class, "/org/mate/control-center/system-info/mate-system-info.ui");
 
@@ -742,6 +953,7 @@ mate_system_info_class_init (MateSystemInfoClass *klass)
 static void
 mate_system_info_init (MateSystemInfo *self)
 {
+    self->cancellable = g_cancellable_new ();
     gtk_widget_init_template (GTK_WIDGET (self));
     g_resources_register (mate_system_info_get_resource ());
     mate_system_info_set_row (MATE_SYSTEM_INFO (self));
@@ -29,6 +29,7 @@
 #endif
 #include "time-map.h"
 #include <math.h>
+#include <stdlib.h>
 
 #define PIN_HOT_POINT_X 8
 #define PIN_HOT_POINT_Y 15
@@ -41,6 +42,13 @@ typedef struct
     guchar blue;
     guchar alpha;
 }TimezoneMapOffset;
+
+struct TimezoneMapPoint
+{
+    gdouble x;
+    gdouble y;
+    TzLocation *location;
+};
 enum
 {
     LOCATION_CHANGED,
@@ -99,7 +107,16 @@ cc_timezone_map_dispose (GObject *object)
     g_clear_object (&self->orig_background);
     g_clear_object (&self->orig_background_dim);
     g_clear_object (&self->orig_color_map);
-    g_clear_object (&self->background);
+    g_clear_pointer (&self->background_layer, cairo_surface_destroy);
+    g_clear_pointer (&self->map_surface, cairo_surface_destroy);
+    g_clear_pointer (&self->hilight_layers, g_hash_table_destroy);
+    g_clear_pointer (&self->hilight_prefetches, g_hash_table_destroy);
+
+    if (self->prefetch_cancellable)
+    {
+        g_cancellable_cancel (self->prefetch_cancellable);
+        g_clear_object (&self->prefetch_cancellable);
+    }
     g_clear_object (&self->pin);
     g_clear_pointer (&self->bubble_text, g_free);
 
@@ -119,6 +136,7 @@ timezone_map_finalize (GObject *object)
     TimezoneMap *self = TIMEZONEMAP (object);
 
     g_clear_pointer (&self->tzdb, TimeZoneDateBaseFree);
+    g_clear_pointer (&self->points, g_free);
 
     G_OBJECT_CLASS (timezone_map_parent_class)->finalize (object);
 }
@@ -153,25 +171,146 @@ cc_timezone_map_get_preferred_height (GtkWidget *widget,
     if (natural != NULL)
         *natural = size;
 }
+static gdouble convert_longitude_to_x (gdouble longitude, gint map_width);
+static gdouble convert_latitude_to_y (gdouble latitude, gdouble map_height);
+
+static int
+compare_points_x (const void *a,
+                  const void *b)
+{
+    const TimezoneMapPoint *pa = a;
+    const TimezoneMapPoint *pb = b;
+
+    return (pa->x > pb->x) - (pa->x < pb->x);
+}
+
+static int
+compare_points_y (const void *a,
+                  const void *b)
+{
+    const TimezoneMapPoint *pa = a;
+    const TimezoneMapPoint *pb = b;
+
+    return (pa->y > pb->y) - (pa->y < pb->y);
+}
+
+/* Orders the points as an implicit k-d tree: the median of each range,
+ * split alternately on x and y, sits in its middle. */
 static void
-cc_timezone_map_size_allocate (GtkWidget     *widget,
-                               GtkAllocation *allocation)
+build_location_index (TimezoneMapPoint *points,
+                      guint             n_points,
+                      guint             depth)
 {
-    TimezoneMap *map = TIMEZONEMAP (widget);
-    GdkPixbuf *pixbuf;
+    guint median;
+
+    if (n_points <= 1)
+        return;
 
-    if (map->background)
-        g_object_unref (map->background);
+    qsort (points, n_points, sizeof (TimezoneMapPoint),
+           (depth % 2) ? compare_points_y : compare_points_x);
 
-    if (!gtk_widget_is_sensitive (widget))
-        pixbuf = map->orig_background_dim;
+    median = n_points / 2;
+    build_location_index (points, median, depth + 1);
+    build_location_index (points + median + 1, n_points - median - 1, depth + 1);
+}
+
+static void
+find_nearest_point (const TimezoneMapPoint  *points,
+                    guint                    n_points,
+                    guint                    depth,
+                    gdouble                  x,
+                    gdouble                  y,
+                    const TimezoneMapPoint **best,
+                    gdouble                 *best_dist)
+{
+    const TimezoneMapPoint *median;
+    gdouble dx, dy, dist, diff;
+    guint m;
+
+    if (n_points == 0)
+        return;
+
+    m = n_points / 2;
+    median = &points[m];
+
+    dx = median->x - x;
+    dy = median->y - y;
+    dist = dx * dx + dy * dy;
+
+    if (dist < *best_dist)
+    {
+        *best_dist = dist;
+        *best = median;
+    }
+
+    diff = (depth % 2) ? y - median->y : x - median->x;
+
+    /* search the side of the point first, the other one only if the
+     * splitting line is closer than the best match so far */
+    if (diff < 0)
+    {
+        find_nearest_point (points, m, depth + 1, x, y, best, best_dist);
+        if (diff * diff < *best_dist)
+            find_nearest_point (points + m + 1, n_points - m - 1, depth + 1, x, y, best, best_dist);
+    }
     else
-        pixbuf = map->orig_background;
+    {
+        find_nearest_point (points + m + 1, n_points - m - 1, depth + 1, x, y, best, best_dist);
+        if (diff * diff < *best_dist)
+            find_nearest_point (points, m, depth + 1, x, y, best, best_dist);
+    }
+}
+
+static void
+update_location_index (TimezoneMap *map,
+                       gint         width,
+                       gint         height)
+{
+    GPtrArray *locations;
+    guint i;
+
+    if (map->tzdb == NULL ||
+        (map->points != NULL && map->index_width == width && map->index_height == height))
+        return;
+
+    locations = tz_get_locations (map->tzdb);
+
+    g_free (map->points);
+    map->points = g_new (TimezoneMapPoint, locations->len);
+    map->n_points = locations->len;
+    map->index_width = width;
+    map->index_height = height;
+
+    for (i = 0; i < locations->len; i++)
+    {
+        TzLocation *loc = locations->pdata[i];
 
-    map->background = gdk_pixbuf_scale_simple (pixbuf,
-                                               allocation->width,
-                                               allocation->height,
-                                               GDK_INTERP_BILINEAR);
+        map->points[i].x = convert_longitude_to_x (loc->longitude, width);
+        map->points[i].y = convert_latitude_to_y (loc->latitude, height);
+        map->points[i].location = loc;
+    }
+
+    build_location_index (map->points, map->n_points, 0);
+}
+
+static TzLocation *
+find_nearest_location (TimezoneMap *map,
+                       gdouble      x,
+                       gdouble      y)
+{
+    const TimezoneMapPoint *best = NULL;
+    gdouble best_dist = G_MAXDOUBLE;
+
+    find_nearest_point (map->points, map->n_points, 0, x, y, &best, &best_dist);
+
+    return best ? best->location : NULL;
+}
+
+static void
+cc_timezone_map_size_allocate (GtkWidget     *widget,
+                               GtkAllocation *allocation)
+{
+    TimezoneMap *map = TIMEZONEMAP (widget);
 
     if (map->color_map)
         g_object_unref (map->color_map);
@@ -183,6 +322,9 @@ cc_timezone_map_size_allocate (GtkWidget     *widget,
 
     map->visible_map_pixels = gdk_pixbuf_get_pixels (map->color_map);
     map->visible_map_rowstride = gdk_pixbuf_get_rowstride (map->color_map);
+
+    update_location_index (map, allocation->width, allocation->height);
+
     GTK_WIDGET_CLASS (timezone_map_parent_class)->size_allocate (widget,
                                                                  allocation);
 }
@@ -320,56 +462,303 @@ draw_text_bubble (cairo_t *cr,
     cairo_restore (cr);
 }
 
-static gboolean
-cc_timezone_map_draw (GtkWidget *widget,
-                      cairo_t   *cr)
+/* Map layers
+ *
+ * The background and the hilight of every offset are decoded and scaled
+ * once for the current size, scale factor and sensitivity, and kept as
+ * surfaces; the hilights of the offsets next to the selected one are
+ * prepared in a thread ahead of time. The background with the selected
+ * hilight is composited into map_surface, so a redraw is a single blit
+ * plus the bubble.
+ */
+static gchar *
+get_hilight_file (gdouble  offset,
+                  gboolean sensitive)
 {
-    TimezoneMap *map = TIMEZONEMAP (widget);
-    g_autoptr(GdkPixbuf) orig_hilight = NULL;
-    GtkAllocation alloc;
-    g_autofree gchar *file = NULL;
-    g_autoptr(GError) err = NULL;
-    gdouble pointx, pointy;
     char buf[16];
 
+    return g_strdup_printf (sensitive ? TIMPZONEDIR"timezone_%s.png"
+                                      : TIMPZONEDIR"timezone_%s_dim.png",
+                            g_ascii_formatd (buf, sizeof (buf), "%g", offset));
+}
+
+static gchar *
+get_hilight_key (gdouble offset)
+{
+    char buf[16];
+
+    return g_strdup (g_ascii_formatd (buf, sizeof (buf), "%g", offset));
+}
+
+static void
+invalidate_layers (TimezoneMap *map)
+{
+    g_clear_pointer (&map->background_layer, cairo_surface_destroy);
+    g_clear_pointer (&map->map_surface, cairo_surface_destroy);
+    g_hash_table_remove_all (map->hilight_layers);
+    g_hash_table_remove_all (map->hilight_prefetches);
+
+    /* results of running prefetches are for the old size */
+    map->layers_serial++;
+}
+
+static void
+ensure_layers_valid (TimezoneMap *map)
+{
+    GtkWidget *widget = GTK_WIDGET (map);
+    GtkAllocation alloc;
+    gint scale;
+    gboolean sensitive;
+
     gtk_widget_get_allocation (widget, &alloc);
+    scale = gtk_widget_get_scale_factor (widget);
+    sensitive = gtk_widget_is_sensitive (widget);
 
-    /* paint background */
-    gdk_cairo_set_source_pixbuf (cr, map->background, 0, 0);
-    cairo_paint (cr);
+    if (map->layers_width == alloc.width &&
+        map->layers_height == alloc.height &&
+        map->layers_scale == scale &&
+        map->layers_sensitive == sensitive)
+        return;
 
-    /* paint hilight */
-    if (gtk_widget_is_sensitive (widget))
+    invalidate_layers (map);
+
+    map->layers_width = alloc.width;
+    map->layers_height = alloc.height;
+    map->layers_scale = scale;
+    map->layers_sensitive = sensitive;
+}
+
+static cairo_surface_t *
+create_layer (TimezoneMap *map,
+              GdkPixbuf   *pixbuf)
+{
+    return gdk_cairo_surface_create_from_pixbuf (pixbuf, map->layers_scale,
+                                                 gtk_widget_get_window (GTK_WIDGET (map)));
+}
+
+static cairo_surface_t *
+get_background_layer (TimezoneMap *map)
+{
+    if (map->background_layer == NULL)
     {
-        file = g_strdup_printf (TIMPZONEDIR"timezone_%s.png",
-                                g_ascii_formatd (buf, sizeof (buf),
-                               "%g", map->selected_offset));
+        g_autoptr(GdkPixbuf) background = NULL;
+        GdkPixbuf *pixbuf;
+
+        if (map->layers_sensitive)
+            pixbuf = map->orig_background;
+        else
+            pixbuf = map->orig_background_dim;
+
+        background = gdk_pixbuf_scale_simple (pixbuf,
+                                              map->layers_width * map->layers_scale,
+                                              map->layers_height * map->layers_scale,
+                                              GDK_INTERP_BILINEAR);
+        map->background_layer = create_layer (map, background);
     }
-    else
+
+    return map->background_layer;
+}
+
+static cairo_surface_t *
+get_hilight_layer (TimezoneMap *map,
+                   gdouble      offset)
+{
+    g_autofree gchar *key = NULL;
+    gpointer layer;
+
+    key = get_hilight_key (offset);
+
+    if (!g_hash_table_lookup_extended (map->hilight_layers, key, NULL, &layer))
     {
-        file = g_strdup_printf (TIMPZONEDIR"timezone_%s_dim.png",
-                                g_ascii_formatd (buf, sizeof (buf),
-                               "%g", map->selected_offset));
+        g_autofree gchar *file = NULL;
+        g_autoptr(GdkPixbuf) hilight = NULL;
+        g_autoptr(GError) err = NULL;
+
+        file = get_hilight_file (offset, map->layers_sensitive);
+        hilight = gdk_pixbuf_new_from_file_at_scale (file,
+                                                     map->layers_width * map->layers_scale,
+                                                     map->layers_height * map->layers_scale,
+                                                     FALSE, &err);
+
+        if (!hilight)
+        {
+            g_warning ("Could not load hilight: %s",
+                       (err) ? err->message : "Unknown Error");
+            layer = NULL;
+        }
+        else
+        {
+            layer = create_layer (map, hilight);
+        }
+
+        /* failures are remembered too, so they are only reported once */
+        g_hash_table_insert (map->hilight_layers, g_steal_pointer (&key), layer);
     }
 
-    orig_hilight = gdk_pixbuf_new_from_file (file, &err);
+    return layer;
+}
+
+typedef struct
+{
+    gchar *file;
+    gchar *key;
+    gint width;
+    gint height;
+    guint serial;
+} HilightPrefetch;
 
-    if (!orig_hilight)
+static void
+hilight_prefetch_free (HilightPrefetch *prefetch)
+{
+    g_free (prefetch->file);
+    g_free (prefetch->key);
+    g_free (prefetch);
+}
+
+static void
+hilight_prefetch_thread (GTask        *task,
+                         gpointer      source_object,
+                         gpointer      task_data,
+                         GCancellable *cancellable)
+{
+    HilightPrefetch *prefetch = task_data;
+    GdkPixbuf *hilight;
+    GError *err = NULL;
+
+    hilight = gdk_pixbuf_new_from_file_at_scale (prefetch->file,
+                                                 prefetch->width,
+                                                 prefetch->height,
+                                                 FALSE, &err);
+    if (hilight)
+        g_task_return_pointer (task, hilight, g_object_unref);
+    else
+        g_task_return_error (task, err);
+}
+
+static void
+hilight_prefetch_done (GObject      *source_object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+    TimezoneMap *map = TIMEZONEMAP (source_object);
+    HilightPrefetch *prefetch = g_task_get_task_data (G_TASK (result));
+    g_autoptr(GdkPixbuf) hilight = NULL;
+
+    /* errors are reported when the layer is actually needed */
+    hilight = g_task_propagate_pointer (G_TASK (result), NULL);
+
+    if (hilight == NULL ||
+        prefetch->serial != map->layers_serial ||
+        g_hash_table_contains (map->hilight_layers, prefetch->key))
+        return;
+
+    g_hash_table_insert (map->hilight_layers, g_strdup (prefetch->key),
+                         create_layer (map, hilight));
+}
+
+static void
+prefetch_hilight_layer (TimezoneMap *map,
+                        gdouble      offset)
+{
+    HilightPrefetch *prefetch;
+    GTask *task;
+    gchar *key;
+
+    key = get_hilight_key (offset);
+
+    if (g_hash_table_contains (map->hilight_layers, key) ||
+        g_hash_table_contains (map->hilight_prefetches, key))
     {
-        g_warning ("Could not load hilight: %s",
-                   (err) ? err->message : "Unknown Error");
+        g_free (key);
+        return;
     }
-    else
+
+    g_hash_table_add (map->hilight_prefetches, g_strdup (key));
+
+    prefetch = g_new0 (HilightPrefetch, 1);
+    prefetch->file = get_hilight_file (offset, map->layers_sensitive);
+    prefetch->key = key;
+    prefetch->width = map->layers_width * map->layers_scale;
+    prefetch->height = map->layers_height * map->layers_scale;
+    prefetch->serial = map->layers_serial;
+
+    task = g_task_new (map, map->prefetch_cancellable, hilight_prefetch_done, NULL);
+    g_task_set_task_data (task, prefetch, (GDestroyNotify) hilight_prefetch_free);
+    g_task_run_in_thread (task, hilight_prefetch_thread);
+    g_object_unref (task);
+}
+
+/* prepares the hilights a click next to the current zone would need */
+static void
+prefetch_adjacent_layers (TimezoneMap *map)
+{
+    guint i;
+
+    for (i = 0; color_codes[i].offset != -100; i++)
     {
-        g_autoptr(GdkPixbuf) hilight = NULL;
+        if (color_codes[i].offset != map->selected_offset)
+            continue;
+
+        if (i > 0 && color_codes[i - 1].offset != map->selected_offset)
+            prefetch_hilight_layer (map, color_codes[i - 1].offset);
+        if (color_codes[i + 1].offset != -100 &&
+            color_codes[i + 1].offset != map->selected_offset)
+            prefetch_hilight_layer (map, color_codes[i + 1].offset);
+    }
+}
 
-        hilight = gdk_pixbuf_scale_simple (orig_hilight, alloc.width,
-                                           alloc.height, GDK_INTERP_BILINEAR);
-        gdk_cairo_set_source_pixbuf (cr, hilight, 0, 0);
+static cairo_surface_t *
+get_map_surface (TimezoneMap *map)
+{
+    cairo_surface_t *hilight;
+    cairo_t *cr;
+
+    if (map->map_surface != NULL &&
+        map->map_surface_offset == map->selected_offset)
+        return map->map_surface;
+
+    g_clear_pointer (&map->map_surface, cairo_surface_destroy);
+
+    map->map_surface = gdk_window_create_similar_surface (gtk_widget_get_window (GTK_WIDGET (map)),
+                                                          CAIRO_CONTENT_COLOR_ALPHA,
+                                                          map->layers_width,
+                                                          map->layers_height);
+    map->map_surface_offset = map->selected_offset;
+
+    cr = cairo_create (map->map_surface);
+
+    /* paint background */
+    cairo_set_source_surface (cr, get_background_layer (map), 0, 0);
+    cairo_paint (cr);
 
+    /* paint hilight */
+    hilight = get_hilight_layer (map, map->selected_offset);
+    if (hilight)
+    {
+        cairo_set_source_surface (cr, hilight, 0, 0);
         cairo_paint (cr);
     }
 
+    cairo_destroy (cr);
+
+    return map->map_surface;
+}
+
+static gboolean
+cc_timezone_map_draw (GtkWidget *widget,
+                      cairo_t   *cr)
+{
+    TimezoneMap *map = TIMEZONEMAP (widget);
+    GtkAllocation alloc;
+    gdouble pointx, pointy;
+
+    gtk_widget_get_allocation (widget, &alloc);
+
+    ensure_layers_valid (map);
+
+    cairo_set_source_surface (cr, get_map_surface (map), 0, 0);
+    cairo_paint (cr);
+
     if (map->location)
     {
         pointx = convert_longitude_to_x (map->location->longitude, alloc.width);
@@ -388,6 +777,8 @@ cc_timezone_map_draw (GtkWidget *widget,
         }
     }
 
+    prefetch_adjacent_layers (map);
+
     return TRUE;
 }
 static void
@@ -419,18 +810,6 @@ cc_timezone_map_state_flags_changed (GtkWidget     *widget,
     if (GTK_WIDGET_CLASS (timezone_map_parent_class)->state_flags_changed)
         GTK_WIDGET_CLASS (timezone_map_parent_class)->state_flags_changed (widget, prev_state);
 }
-static gint sort_locations (TzLocation *a,
-                            TzLocation *b)
-{
-    if (a->dist > b->dist)
-        return 1;
-
-    if (a->dist < b->dist)
-        return -1;
-
-    return 0;
-}
-
 static void
 set_location (TimezoneMap   *map,
               TzLocation    *location)
@@ -455,11 +834,7 @@ button_press_event (TimezoneMap    *map,
     guchar *pixels;
     gint rowstride;
     guint i;
-
-    const GPtrArray *array;
-    gint width, height;
-    GList *distances = NULL;
-    GtkAllocation alloc;
+    TzLocation *location;
 
     x = event->x;
     y = event->y;
@@ -483,34 +858,9 @@ button_press_event (TimezoneMap    *map,
 
     gtk_widget_queue_draw (GTK_WIDGET (map));
 
-  /* work out the co-ordinates */
-
-    array = tz_get_locations (map->tzdb);
-
-    gtk_widget_get_allocation (GTK_WIDGET (map), &alloc);
-    width = alloc.width;
-    height = alloc.height;
-
-    for (i = 0; i < array->len; i++)
-    {
-        gdouble pointx, pointy, dx, dy;
-        TzLocation *loc = array->pdata[i];
-
-        pointx = convert_longitude_to_x (loc->longitude, width);
-        pointy = convert_latitude_to_y (loc->latitude, height);
-
-        dx = pointx - x;
-        dy = pointy - y;
-
-        loc->dist = dx * dx + dy * dy;
-        distances = g_list_prepend (distances, loc);
-
-    }
-    distances = g_list_sort (distances, (GCompareFunc) sort_locations);
-
-    set_location (map, (TzLocation*) distances->data);
-
-    g_list_free (distances);
+    location = find_nearest_location (map, x, y);
+    if (location != NULL)
+        set_location (map, location);
 
     return TRUE;
 }
@@ -580,6 +930,11 @@ timezone_map_init (TimezoneMap *map)
 
     map->tzdb = tz_load_db ();
 
+    map->hilight_layers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                 (GDestroyNotify) cairo_surface_destroy);
+    map->hilight_prefetches = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    map->prefetch_cancellable = g_cancellable_new ();
+
     g_signal_connect_object (map,
                             "button-press-event",
                              G_CALLBACK (button_press_event),
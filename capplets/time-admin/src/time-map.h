@@ -32,6 +32,7 @@ G_BEGIN_DECLS
 
 #define TYPE_TIMEZONE_MAP     (timezone_map_get_type ())
 #define TIMEZONEMAP(object)   (G_TYPE_CHECK_INSTANCE_CAST ((object), TYPE_TIMEZONE_MAP,TimezoneMap))
+typedef struct TimezoneMapPoint TimezoneMapPoint;
 typedef struct TimezoneMap
 {
     GtkWidget parent_instance;
@@ -39,7 +40,6 @@ typedef struct TimezoneMap
     GdkPixbuf *orig_background_dim;
     GdkPixbuf *orig_color_map;
 
-    GdkPixbuf *background;
     GdkPixbuf *color_map;
     GdkPixbuf *pin;
 
@@ -51,7 +51,28 @@ typedef struct TimezoneMap
     TzDB *tzdb;
     TzLocation *location;
 
+    /* k-d tree of the locations projected on the map */
+    TimezoneMapPoint *points;
+    guint n_points;
+    gint index_width;
+    gint index_height;
+
     gchar *bubble_text;
+
+    /* scaled map layers for the current size, scale and sensitivity */
+    gint layers_width;
+    gint layers_height;
+    gint layers_scale;
+    gboolean layers_sensitive;
+    guint layers_serial;
+    cairo_surface_t *background_layer;
+    GHashTable *hilight_layers;
+    GHashTable *hilight_prefetches;
+    GCancellable *prefetch_cancellable;
+
+    /* the background with the selected offset hilighted */
+    cairo_surface_t *map_surface;
+    gdouble map_surface_offset;
 }TimezoneMap;
 
 
@@ -30,6 +30,7 @@
 #include "time-zone.h"
 #include "time-map.h"
 #include "time-tool.h"
+#include "cache-util.h"
 #include  <math.h>
 #define  MATE_DESKTOP_USE_UNSTABLE_API
 
@@ -37,6 +38,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
 #include <libmate-desktop/mate-languages.h> /* mate_get_country_from_code */
 
@@ -101,12 +103,13 @@ static void sort_locations_by_country (GPtrArray *locations)
     qsort (locations->pdata, locations->len, sizeof (gpointer),
            compare_country_names);
 }
-static void load_backward_tz (TzDB *tz_db)
+static GHashTable *load_backward_tz (void)
 {
+    GHashTable *backward;
     FILE  *fp;
     char buf[128] = { 0 };
 
-    tz_db->backward = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    backward = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
     fp = fopen(BACKFILE,"r");
     if(fp == NULL)
@@ -146,16 +149,27 @@ static void load_backward_tz (TzDB *tz_db)
             g_str_equal (real, "Etc/UCT"))
             real = "Etc/GMT";
 
-        g_hash_table_insert (tz_db->backward, g_strdup (alias), g_strdup (real));
+        g_hash_table_insert (backward, g_strdup (alias), g_strdup (real));
 
     }
     fclose(fp);
+
+    return backward;
 }
 
-TzDB *tz_load_db (void)
+static void
+tz_location_free (TzLocation *loc, gpointer data)
+{
+    g_free (loc->country);
+    g_free (loc->zone);
+    g_free (loc->comment);
+    g_free (loc);
+}
+
+static GPtrArray *tz_parse_locations (void)
 {
     g_autofree gchar *tz_data_file = NULL;
-    TzDB *tz_db;
+    GPtrArray *locations;
     FILE *tzfile;
     char buf[4096];
 
@@ -172,8 +186,7 @@ TzDB *tz_load_db (void)
         return NULL;
     }
 
-    tz_db = g_new0 (TzDB, 1);
-    tz_db->locations = g_ptr_array_new ();
+    locations = g_ptr_array_new ();
 
     while (fgets (buf, sizeof(buf), tzfile))
     {
@@ -216,26 +229,490 @@ TzDB *tz_load_db (void)
             locgrp->longitude = convert_pos (lngstr, 3);
             locgrp->comment = (tmpstrarr[4]) ? g_strdup (tmpstrarr[4]) : NULL;
 
-            g_ptr_array_add (tz_db->locations, (gpointer) locgrp);
+            g_ptr_array_add (locations, (gpointer) locgrp);
         }
 #else
         loc->comment = (tmpstrarr[3]) ? g_strdup(tmpstrarr[3]) : NULL;
 #endif
 
-        g_ptr_array_add (tz_db->locations, (gpointer) loc);
+        g_ptr_array_add (locations, (gpointer) loc);
     }
 
     fclose (tzfile);
 
     /* now sort by country */
-    sort_locations_by_country (tz_db->locations);
+    sort_locations_by_country (locations);
+
+    return locations;
+}
+
+/* The parsed zone.tab and backward files are kept in a compiled form in
+ * the user cache dir, which is mapped and used as is the next time: the
+ * strings are interned in one table, the locations are stored sorted and
+ * the backward links are found through a perfect hash. It is rebuilt
+ * whenever the mtime or size of either file changes.
+ */
+#define TZ_DB_MAGIC   "MATETZDB"
+#define TZ_DB_VERSION 1
+#define TZ_DB_NONE    G_MAXUINT32
+
+typedef struct
+{
+    gchar   magic[8];
+    guint32 version;
+    guint32 n_locations;
+    guint32 n_aliases;
+    guint32 n_buckets;
+    gint64  stamps[4];      /* mtime and size of zone.tab and backward */
+    guint32 locations;      /* offsets of the tables from the file start */
+    guint32 aliases;
+    guint32 displacements;
+    guint32 slots;
+    guint32 strings;
+    guint32 strings_size;
+} TzDBHeader;
+
+typedef struct
+{
+    gdouble latitude;
+    gdouble longitude;
+    guint32 country;        /* offsets into the string table */
+    guint32 zone;
+    guint32 comment;
+    guint32 padding;
+} TzDBLocation;
+
+typedef struct
+{
+    guint32 alias;
+    guint32 real;
+} TzDBAlias;
+
+static guint32 tz_db_hash (const gchar *key, guint32 seed)
+{
+    guint32 h = 2166136261u ^ (seed * 0x9e3779b9u);
+
+    for (; *key != '\0'; key++)
+    {
+        h ^= (guchar) *key;
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+
+    return h;
+}
+
+static gboolean tz_db_get_stamps (gint64 *stamps)
+{
+    g_autofree gchar *tz_data_file = NULL;
+    GStatBuf buf;
+
+    tz_data_file = tz_data_file_get ();
+    if (!tz_data_file || g_stat (tz_data_file, &buf) != 0)
+        return FALSE;
+
+    stamps[0] = buf.st_mtime;
+    stamps[1] = buf.st_size;
+
+    if (g_stat (BACKFILE, &buf) != 0)
+        return FALSE;
+
+    stamps[2] = buf.st_mtime;
+    stamps[3] = buf.st_size;
+
+    return TRUE;
+}
+
+static guint32 tz_db_intern (GHashTable  *interned,
+                             GString     *strings,
+                             const gchar *str)
+{
+    gpointer offset;
+
+    if (str == NULL)
+        return TZ_DB_NONE;
+
+    if (!g_hash_table_lookup_extended (interned, str, NULL, &offset))
+    {
+        offset = GUINT_TO_POINTER (strings->len);
+        g_string_append_len (strings, str, strlen (str) + 1);
+        g_hash_table_insert (interned, (gpointer) str, offset);
+    }
+
+    return GPOINTER_TO_UINT (offset);
+}
+
+/* Places every alias in its own slot: the aliases are grouped in buckets,
+ * and for each bucket, biggest first, a seed is searched that hashes all
+ * of its aliases to free slots. */
+static gboolean tz_db_build_perfect_hash (gchar  **aliases,
+                                          guint32  n_aliases,
+                                          guint32  n_buckets,
+                                          guint32 *displacements,
+                                          guint32 *slots)
+{
+    GPtrArray **buckets;
+    guint32 *order;
+    guint32 i, j, k;
+    gboolean ret = TRUE;
+
+    buckets = g_new0 (GPtrArray *, n_buckets);
+    order = g_new (guint32, n_buckets);
+
+    for (i = 0; i < n_buckets; i++)
+    {
+        buckets[i] = g_ptr_array_new ();
+        order[i] = i;
+    }
+
+    for (i = 0; i < n_aliases; i++)
+        g_ptr_array_add (buckets[tz_db_hash (aliases[i], 0) % n_buckets],
+                         GUINT_TO_POINTER (i));
+
+    /* insertion sort on bucket size, there are only a few dozen buckets */
+    for (i = 1; i < n_buckets; i++)
+        for (j = i; j > 0 && buckets[order[j]]->len > buckets[order[j - 1]]->len; j--)
+        {
+            guint32 tmp = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = tmp;
+        }
+
+    for (i = 0; i < n_aliases; i++)
+        slots[i] = TZ_DB_NONE;
+
+    for (i = 0; i < n_buckets && ret; i++)
+    {
+        GPtrArray *bucket = buckets[order[i]];
+        guint32 seed;
+
+        displacements[order[i]] = 0;
+        if (bucket->len == 0)
+            continue;
+
+        for (seed = 1; seed < 1 << 16; seed++)
+        {
+            for (j = 0; j < bucket->len; j++)
+            {
+                guint32 index = GPOINTER_TO_UINT (g_ptr_array_index (bucket, j));
+                guint32 slot = tz_db_hash (aliases[index], seed) % n_aliases;
+
+                if (slots[slot] != TZ_DB_NONE)
+                    break;
+                slots[slot] = index;
+            }
+
+            if (j == bucket->len)
+                break;
+
+            /* undo the partial placement and try the next seed */
+            for (k = 0; k < j; k++)
+            {
+                guint32 index = GPOINTER_TO_UINT (g_ptr_array_index (bucket, k));
+
+                slots[tz_db_hash (aliases[index], seed) % n_aliases] = TZ_DB_NONE;
+            }
+        }
+
+        if (seed == 1 << 16)
+            ret = FALSE;
+        else
+            displacements[order[i]] = seed;
+    }
+
+    for (i = 0; i < n_buckets; i++)
+        g_ptr_array_free (buckets[i], TRUE);
+    g_free (buckets);
+    g_free (order);
+
+    return ret;
+}
+
+static GBytes *tz_db_compile (GPtrArray    *locations,
+                              GHashTable   *backward,
+                              const gint64 *stamps)
+{
+    g_autofree gchar **aliases = NULL;
+    g_autofree guint32 *displacements = NULL;
+    g_autofree guint32 *slots = NULL;
+    GHashTable *interned;
+    GString *strings;
+    GByteArray *data;
+    TzDBHeader header;
+    guint n_aliases;
+    guint32 n_buckets, i;
+
+    aliases = (gchar **) g_hash_table_get_keys_as_array (backward, &n_aliases);
+
+    n_buckets = MAX (n_aliases / 4, 1);
+    slots = g_new (guint32, MAX (n_aliases, 1));
+    for (;;)
+    {
+        g_free (displacements);
+        displacements = g_new (guint32, n_buckets);
+
+        if (tz_db_build_perfect_hash (aliases, n_aliases, n_buckets, displacements, slots))
+            break;
+        n_buckets *= 2;
+    }
+
+    interned = g_hash_table_new (g_str_hash, g_str_equal);
+    strings = g_string_new (NULL);
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, TZ_DB_MAGIC, sizeof (header.magic));
+    header.version = TZ_DB_VERSION;
+    header.n_locations = locations->len;
+    header.n_aliases = n_aliases;
+    header.n_buckets = n_buckets;
+    memcpy (header.stamps, stamps, sizeof (header.stamps));
+    header.locations = sizeof (TzDBHeader);
+    header.aliases = header.locations + locations->len * sizeof (TzDBLocation);
+    header.displacements = header.aliases + n_aliases * sizeof (TzDBAlias);
+    header.slots = header.displacements + n_buckets * sizeof (guint32);
+    header.strings = header.slots + n_aliases * sizeof (guint32);
+
+    data = g_byte_array_sized_new (header.strings);
+    g_byte_array_append (data, (guint8 *) &header, sizeof (header));
+
+    for (i = 0; i < locations->len; i++)
+    {
+        TzLocation *loc = g_ptr_array_index (locations, i);
+        TzDBLocation record;
 
-    /* Load up the hashtable of backward links */
-    load_backward_tz (tz_db);
+        memset (&record, 0, sizeof (record));
+        record.latitude = loc->latitude;
+        record.longitude = loc->longitude;
+        record.country = tz_db_intern (interned, strings, loc->country);
+        record.zone = tz_db_intern (interned, strings, loc->zone);
+        record.comment = tz_db_intern (interned, strings, loc->comment);
+
+        g_byte_array_append (data, (guint8 *) &record, sizeof (record));
+    }
+
+    for (i = 0; i < n_aliases; i++)
+    {
+        TzDBAlias record;
+
+        record.alias = tz_db_intern (interned, strings, aliases[i]);
+        record.real = tz_db_intern (interned, strings,
+                                    g_hash_table_lookup (backward, aliases[i]));
+
+        g_byte_array_append (data, (guint8 *) &record, sizeof (record));
+    }
+
+    g_byte_array_append (data, (guint8 *) displacements, n_buckets * sizeof (guint32));
+    g_byte_array_append (data, (guint8 *) slots, n_aliases * sizeof (guint32));
+    g_byte_array_append (data, (guint8 *) strings->str, strings->len);
+
+    /* the string table size is only known now */
+    ((TzDBHeader *) data->data)->strings_size = strings->len;
+
+    g_string_free (strings, TRUE);
+    g_hash_table_destroy (interned);
+
+    return g_byte_array_free_to_bytes (data);
+}
+
+static const gchar *tz_db_string (const guint8 *data, guint32 offset)
+{
+    const TzDBHeader *header = (const TzDBHeader *) data;
+
+    if (offset == TZ_DB_NONE)
+        return NULL;
+
+    return (const gchar *) data + header->strings + offset;
+}
+
+/* Checks that everything in the compiled database stays within its bounds,
+ * so that nothing has to be checked on lookup. */
+static gboolean tz_db_validate (GBytes *bytes, const gint64 *stamps)
+{
+    const guint8 *data;
+    const TzDBHeader *header;
+    const TzDBLocation *locations;
+    const TzDBAlias *aliases;
+    const guint32 *slots;
+    gsize size;
+    guint64 end;
+    guint32 i;
+
+    data = g_bytes_get_data (bytes, &size);
+    if (size < sizeof (TzDBHeader))
+        return FALSE;
+
+    header = (const TzDBHeader *) data;
+    if (memcmp (header->magic, TZ_DB_MAGIC, sizeof (header->magic)) != 0 ||
+        header->version != TZ_DB_VERSION ||
+        memcmp (header->stamps, stamps, sizeof (header->stamps)) != 0 ||
+        header->n_buckets == 0)
+        return FALSE;
+
+    end = sizeof (TzDBHeader);
+    if (header->locations != end)
+        return FALSE;
+    end += (guint64) header->n_locations * sizeof (TzDBLocation);
+    if (header->aliases != end)
+        return FALSE;
+    end += (guint64) header->n_aliases * sizeof (TzDBAlias);
+    if (header->displacements != end)
+        return FALSE;
+    end += (guint64) header->n_buckets * sizeof (guint32);
+    if (header->slots != end)
+        return FALSE;
+    end += (guint64) header->n_aliases * sizeof (guint32);
+    if (header->strings != end)
+        return FALSE;
+    end += header->strings_size;
+    if (end != size ||
+        header->strings_size == 0 ||
+        data[size - 1] != '\0')
+        return FALSE;
+
+    locations = (const TzDBLocation *) (data + header->locations);
+    for (i = 0; i < header->n_locations; i++)
+    {
+        if (locations[i].country >= header->strings_size ||
+            locations[i].zone >= header->strings_size ||
+            (locations[i].comment != TZ_DB_NONE &&
+             locations[i].comment >= header->strings_size))
+            return FALSE;
+    }
+
+    aliases = (const TzDBAlias *) (data + header->aliases);
+    for (i = 0; i < header->n_aliases; i++)
+    {
+        if (aliases[i].alias >= header->strings_size ||
+            aliases[i].real >= header->strings_size)
+            return FALSE;
+    }
+
+    slots = (const guint32 *) (data + header->slots);
+    for (i = 0; i < header->n_aliases; i++)
+    {
+        if (slots[i] >= header->n_aliases)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static GBytes *tz_db_load_compiled (const gint64 *stamps)
+{
+    GBytes *bytes;
+
+    bytes = cache_util_load_bytes ("timezones.cache");
+    if (bytes == NULL)
+        return NULL;
+
+    if (!tz_db_validate (bytes, stamps))
+        g_clear_pointer (&bytes, g_bytes_unref);
+
+    return bytes;
+}
+
+static void tz_db_save_compiled (GBytes *bytes)
+{
+    gconstpointer data;
+    gsize size;
+
+    data = g_bytes_get_data (bytes, &size);
+    cache_util_save_bytes ("timezones.cache", data, size);
+}
+
+static const gchar *tz_db_lookup_backward (TzDB *tz_db, const gchar *alias)
+{
+    const guint8 *data = g_bytes_get_data (tz_db->data, NULL);
+    const TzDBHeader *header = (const TzDBHeader *) data;
+    const TzDBAlias *record;
+    const guint32 *displacements, *slots;
+    guint32 seed;
+
+    if (header->n_aliases == 0)
+        return NULL;
+
+    displacements = (const guint32 *) (data + header->displacements);
+    slots = (const guint32 *) (data + header->slots);
+
+    seed = displacements[tz_db_hash (alias, 0) % header->n_buckets];
+    record = (const TzDBAlias *) (data + header->aliases) +
+             slots[tz_db_hash (alias, seed) % header->n_aliases];
+
+    if (strcmp (tz_db_string (data, record->alias), alias) != 0)
+        return NULL;
+
+    return tz_db_string (data, record->real);
+}
+
+static TzDB *tz_db_new_from_bytes (GBytes *bytes)
+{
+    const guint8 *data = g_bytes_get_data (bytes, NULL);
+    const TzDBHeader *header = (const TzDBHeader *) data;
+    const TzDBLocation *records;
+    TzDB *tz_db;
+    guint32 i;
+
+    tz_db = g_new0 (TzDB, 1);
+    tz_db->data = bytes;
+    tz_db->location_block = g_new0 (TzLocation, header->n_locations);
+    tz_db->locations = g_ptr_array_sized_new (header->n_locations);
+
+    records = (const TzDBLocation *) (data + header->locations);
+    for (i = 0; i < header->n_locations; i++)
+    {
+        TzLocation *loc = &tz_db->location_block[i];
+
+        /* the strings point into the database and must not be freed */
+        loc->country = (gchar *) tz_db_string (data, records[i].country);
+        loc->zone = (gchar *) tz_db_string (data, records[i].zone);
+        loc->comment = (gchar *) tz_db_string (data, records[i].comment);
+        loc->latitude = records[i].latitude;
+        loc->longitude = records[i].longitude;
+
+        g_ptr_array_add (tz_db->locations, loc);
+    }
 
     return tz_db;
 }
 
+TzDB *tz_load_db (void)
+{
+    gint64 stamps[4];
+    GBytes *bytes;
+
+    if (!tz_db_get_stamps (stamps))
+    {
+        g_warning ("Could not find the TimeZone data files");
+        return NULL;
+    }
+
+    bytes = tz_db_load_compiled (stamps);
+    if (bytes == NULL)
+    {
+        GPtrArray *locations;
+        GHashTable *backward;
+
+        locations = tz_parse_locations ();
+        if (locations == NULL)
+            return NULL;
+
+        /* Load up the hashtable of backward links */
+        backward = load_backward_tz ();
+
+        bytes = tz_db_compile (locations, backward, stamps);
+        tz_db_save_compiled (bytes);
+
+        g_ptr_array_foreach (locations, (GFunc) tz_location_free, NULL);
+        g_ptr_array_free (locations, TRUE);
+        g_hash_table_destroy (backward);
+    }
+
+    return tz_db_new_from_bytes (bytes);
+}
+
 static GtkWidget*
 GetTimeZoneMap(TimeAdmin *ta)
 {
@@ -587,7 +1064,7 @@ compare_timezones (const char *a,
 char *tz_info_get_clean_name (TzDB       *tz_db,
                               const char *tz)
 {
-    char *ret;
+    const char *ret;
     const char *timezone;
     guint i;
     gboolean replaced;
@@ -622,7 +1099,7 @@ char *tz_info_get_clean_name (TzDB       *tz_db,
     if (!replaced)
         timezone = tz;
 
-    ret = g_hash_table_lookup (tz_db->backward, timezone);
+    ret = tz_db_lookup_backward (tz_db, timezone);
     if (ret == NULL)
         return g_strdup (timezone);
     return g_strdup (ret);
@@ -694,20 +1171,11 @@ void RunTimeZoneDialog  (GtkButton *button,
     gtk_widget_show_all(GTK_WIDGET(ta->dialog));
 }
 
-static void
-tz_location_free (TzLocation *loc, gpointer data)
-{
-    g_free (loc->country);
-    g_free (loc->zone);
-    g_free (loc->comment);
-    g_free (loc);
-}
-
 void TimeZoneDateBaseFree (TzDB *db)
 {
-    g_ptr_array_foreach (db->locations, (GFunc) tz_location_free, NULL);
     g_ptr_array_free (db->locations, TRUE);
-    g_hash_table_destroy (db->backward);
+    g_free (db->location_block);
+    g_bytes_unref (db->data);
     g_free (db);
 }
 
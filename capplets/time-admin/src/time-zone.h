@@ -35,12 +35,6 @@
 #  define TZ_DATA_FILE "/usr/share/lib/zoneinfo/tab/zone_sun.tab"
 #endif
 
-typedef struct TzDB
-{
-    GPtrArray  *locations;
-    GHashTable *backward;
-}TzDB;
-
 typedef struct TzLocation
 {
     gchar *country;
@@ -52,6 +46,13 @@ typedef struct TzLocation
     gdouble dist; /* distance to clicked point for comparison */
 }TzLocation;
 
+typedef struct TzDB
+{
+    GPtrArray  *locations;
+    TzLocation *location_block;
+    GBytes     *data;      /* the compiled database, see tz_load_db() */
+}TzDB;
+
 typedef struct TzInfo
 {
     gchar *tzname_normal;
@@ -31,6 +31,7 @@
 #include <sys/types.h>
 
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -39,6 +40,7 @@
 #define MATE_DESKTOP_USE_UNSTABLE_API
 #include <libmate-desktop/mate-desktop-thumbnail.h>
 
+#include "cache-util.h"
 #include "font-model.h"
 #include "font-utils.h"
 #include "sushi-font-loader.h"
@@ -46,9 +48,18 @@
 struct _FontViewModelPrivate {
     /* list of fonts in fontconfig database */
     FcFontSet *font_list;
-    GMutex font_list_mutex;
 
-    FT_Library library;
+    /* font names by face, see font_name_cache_load() */
+    GHashTable *name_cache;
+
+    /* thumbnail requests, see font_view_model_request_thumbnails() */
+    GMutex thumbnail_mutex;
+    GQueue thumbnail_queue;
+    GList *thumbnails_done;
+    gboolean thumbnails_flush_pending;
+    gboolean thumbnail_worker_running;
+    guint thumbnail_generation;
+    GHashTable *thumbnail_rows;
 
     GList *monitors;
     GdkPixbuf *fallback_icon;
@@ -131,13 +142,13 @@ font_view_model_get_iter_for_face (FontViewModel *self,
 }
 
 typedef struct {
-    FontViewModel *self;
     GFile *font_file;
     gchar *font_path;
     gint face_index;
     gchar *uri;
     GdkPixbuf *pixbuf;
     GtkTreeIter iter;
+    guint generation;
 } ThumbInfoData;
 
 static void
@@ -145,7 +156,6 @@ thumb_info_data_free (gpointer user_data)
 {
     ThumbInfoData *thumb_info = user_data;
 
-    g_object_unref (thumb_info->self);
     g_object_unref (thumb_info->font_file);
     g_clear_object (&thumb_info->pixbuf);
     g_free (thumb_info->font_path);
@@ -154,21 +164,6 @@ thumb_info_data_free (gpointer user_data)
     g_slice_free (ThumbInfoData, thumb_info);
 }
 
-static gboolean
-one_thumbnail_done (gpointer user_data)
-{
-    ThumbInfoData *thumb_info = user_data;
-
-    if (thumb_info->pixbuf != NULL)
-        gtk_list_store_set (GTK_LIST_STORE (thumb_info->self), &(thumb_info->iter),
-                            COLUMN_ICON, thumb_info->pixbuf,
-                            -1);
-
-    thumb_info_data_free (thumb_info);
-
-    return FALSE;
-}
-
 static GdkPixbuf *
 create_thumbnail (ThumbInfoData *thumb_info)
 {
@@ -211,112 +206,423 @@ create_thumbnail (ThumbInfoData *thumb_info)
   return pixbuf;
 }
 
+/* Loads the existing thumbnail of the font, if any. Returns FALSE if it has
+ * none yet, and one should be made.
+ */
+static gboolean
+load_thumbnail (ThumbInfoData *thumb_info)
+{
+    gboolean thumb_failed, missing = FALSE;
+    gchar *thumb_path = NULL;
+
+    GError *error = NULL;
+    GFile *thumb_file = NULL;
+    GFileInputStream *is = NULL;
+    GFileInfo *info = NULL;
+
+    if (thumb_info->face_index == 0) {
+        thumb_info->uri = g_file_get_uri (thumb_info->font_file);
+        info = g_file_query_info (thumb_info->font_file,
+                                  ATTRIBUTES_FOR_EXISTING_THUMBNAIL,
+                                  G_FILE_QUERY_INFO_NONE,
+                                  NULL, &error);
+
+        if (error != NULL) {
+            gchar *font_path;
+
+            font_path = g_file_get_path (thumb_info->font_file);
+            g_debug ("Can't query info for file %s: %s\n", font_path, error->message);
+            g_free (font_path);
+
+            goto out;
+        }
+
+        thumb_failed = g_file_info_get_attribute_boolean (info, G_FILE_ATTRIBUTE_THUMBNAILING_FAILED);
+        if (thumb_failed)
+            goto out;
+
+        thumb_path = g_strdup (g_file_info_get_attribute_byte_string (info, G_FILE_ATTRIBUTE_THUMBNAIL_PATH));
+    } else {
+        gchar *file_uri;
+        gchar *checksum;
+        gchar *filename;
+
+        file_uri = g_file_get_uri (thumb_info->font_file);
+        thumb_info->uri = g_strdup_printf ("%s#0x%08X", file_uri, thumb_info->face_index);
+        g_free (file_uri);
+
+        checksum = g_compute_checksum_for_data (G_CHECKSUM_MD5,
+                                                (const guchar *) thumb_info->uri,
+                                                strlen (thumb_info->uri));
+        filename = g_strdup_printf ("%s.png", checksum);
+        g_free (checksum);
+
+        thumb_path = g_build_filename (g_get_user_cache_dir (),
+                                       "thumbnails",
+                                       "large",
+                                       filename,
+                                       NULL);
+        g_free (filename);
+
+        if (!g_file_test (thumb_path, G_FILE_TEST_IS_REGULAR)) {
+            g_clear_pointer (&thumb_path, g_free);
+        }
+    }
+
+    if (thumb_path != NULL) {
+        thumb_file = g_file_new_for_path (thumb_path);
+        is = g_file_read (thumb_file, NULL, &error);
+
+        if (error != NULL) {
+            g_debug ("Can't read file %s: %s\n", thumb_path, error->message);
+            goto out;
+        }
+
+        thumb_info->pixbuf = gdk_pixbuf_new_from_stream_at_scale (G_INPUT_STREAM (is),
+                                                                  128, 128, TRUE,
+                                                                  NULL, &error);
+
+        if (error != NULL) {
+            g_debug ("Can't read thumbnail pixbuf %s: %s\n", thumb_path, error->message);
+            goto out;
+        }
+    } else {
+        missing = TRUE;
+    }
+
+ out:
+    g_clear_error (&error);
+    g_clear_object (&is);
+    g_clear_object (&thumb_file);
+    g_clear_object (&info);
+    g_clear_pointer (&thumb_path, g_free);
+
+    return !missing;
+}
+
+/* Makes the missing thumbnails with a single mate-thumbnail-font process in
+ * batch mode, which renders them in parallel, instead of having the
+ * thumbnail factory spawn the thumbnailer once per font. The thumbnails are
+ * then saved through the factory as usual. If the thumbnailer can't be run
+ * that way, they are made one by one.
+ */
+#define THUMBNAILER_COMMAND "mate-thumbnail-font"
+#define THUMBNAILS_BATCH_SIZE 64
+#define THUMBNAIL_SIZE 128
+
+static void
+create_thumbnails (GPtrArray *missing)
+{
+    MateDesktopThumbnailFactory *factory;
+    GSubprocess *process = NULL;
+    GHashTable *created;
+    GString *jobs;
+    GBytes *input = NULL, *output = NULL;
+    GError *error = NULL;
+    gchar *tmp_dir, *report, **lines = NULL;
+    gint64 *mtimes;
+    guint i;
+
+    tmp_dir = g_dir_make_tmp ("mate-font-viewer-XXXXXX", &error);
+    if (tmp_dir == NULL) {
+        g_debug ("Can't make a directory for thumbnails: %s\n", error->message);
+        g_clear_error (&error);
+        goto fallback;
+    }
+
+    mtimes = g_new0 (gint64, missing->len);
+    jobs = g_string_new (NULL);
+
+    for (i = 0; i < missing->len; i++) {
+        ThumbInfoData *thumb_info = g_ptr_array_index (missing, i);
+        GFileInfo *info;
+
+        info = g_file_query_info (thumb_info->font_file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                  G_FILE_QUERY_INFO_NONE, NULL, NULL);
+        if (info == NULL) {
+            mtimes[i] = -1;
+            continue;
+        }
+
+        mtimes[i] = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+        g_object_unref (info);
+
+        /* URIs are escaped, so they can't hold the tabs and newlines that
+         * delimit the jobs */
+        g_string_append_printf (jobs, "%s\t%s%c%u.png\t%d\n",
+                                thumb_info->uri, tmp_dir, G_DIR_SEPARATOR, i,
+                                THUMBNAIL_SIZE);
+    }
+
+    process = g_subprocess_new (G_SUBPROCESS_FLAGS_STDIN_PIPE | G_SUBPROCESS_FLAGS_STDOUT_PIPE,
+                                &error, THUMBNAILER_COMMAND, "--batch", NULL);
+    if (process != NULL) {
+        input = g_string_free_to_bytes (jobs);
+        g_subprocess_communicate (process, input, NULL, &output, NULL, &error);
+    } else {
+        g_string_free (jobs, TRUE);
+    }
+
+    if (error != NULL) {
+        g_debug ("Can't run " THUMBNAILER_COMMAND " --batch: %s\n", error->message);
+        g_clear_error (&error);
+        g_clear_object (&process);
+        g_clear_pointer (&input, g_bytes_unref);
+        g_free (mtimes);
+        g_rmdir (tmp_dir);
+        g_free (tmp_dir);
+        goto fallback;
+    }
+
+    /* each finished job is reported as OUTPUT-FILE, a tab and "ok" or "failed" */
+    created = g_hash_table_new (g_str_hash, g_str_equal);
+    report = g_strndup (g_bytes_get_data (output, NULL), g_bytes_get_size (output));
+    lines = g_strsplit (report, "\n", -1);
+    g_free (report);
+    for (i = 0; lines[i] != NULL; i++) {
+        gchar *status = strrchr (lines[i], '\t');
+
+        if (status != NULL && strcmp (status + 1, "ok") == 0) {
+            *status = '\0';
+            g_hash_table_add (created, lines[i]);
+        }
+    }
+
+    factory = mate_desktop_thumbnail_factory_new (MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL);
+
+    for (i = 0; i < missing->len; i++) {
+        ThumbInfoData *thumb_info = g_ptr_array_index (missing, i);
+        gchar *thumb_path;
+
+        if (mtimes[i] < 0)
+            continue;
+
+        thumb_path = g_strdup_printf ("%s%c%u.png", tmp_dir, G_DIR_SEPARATOR, i);
+
+        if (g_hash_table_contains (created, thumb_path))
+            thumb_info->pixbuf = gdk_pixbuf_new_from_file (thumb_path, NULL);
+
+        if (thumb_info->pixbuf != NULL)
+            mate_desktop_thumbnail_factory_save_thumbnail (factory, thumb_info->pixbuf,
+                                                           thumb_info->uri, (time_t) mtimes[i]);
+        else
+            mate_desktop_thumbnail_factory_create_failed_thumbnail (factory,
+                                                                    thumb_info->uri, (time_t) mtimes[i]);
+
+        g_unlink (thumb_path);
+        g_free (thumb_path);
+    }
+
+    g_object_unref (factory);
+    g_hash_table_unref (created);
+    g_strfreev (lines);
+    g_bytes_unref (output);
+    g_bytes_unref (input);
+    g_object_unref (process);
+    g_free (mtimes);
+    g_rmdir (tmp_dir);
+    g_free (tmp_dir);
+
+    return;
+
+ fallback:
+    for (i = 0; i < missing->len; i++) {
+        ThumbInfoData *thumb_info = g_ptr_array_index (missing, i);
+
+        thumb_info->pixbuf = create_thumbnail (thumb_info);
+    }
+}
+
+/* Thumbnails are only made for the rows the view asks for, see
+ * font_view_model_request_thumbnails(), by a single worker that runs as
+ * long as there are requests queued. Finished thumbnails are put into the
+ * model in batches, every THUMBNAILS_FLUSH_INTERVAL ms.
+ */
+#define THUMBNAILS_FLUSH_INTERVAL 50
+
+static gboolean
+thumbnails_flush (gpointer user_data)
+{
+    FontViewModel *self = user_data;
+    GList *done, *l;
+
+    g_mutex_lock (&self->priv->thumbnail_mutex);
+    done = self->priv->thumbnails_done;
+    self->priv->thumbnails_done = NULL;
+    self->priv->thumbnails_flush_pending = FALSE;
+    g_mutex_unlock (&self->priv->thumbnail_mutex);
+
+    for (l = done; l != NULL; l = l->next) {
+        ThumbInfoData *thumb_info = l->data;
+
+        /* skip thumbnails for rows of a previous font list */
+        if (thumb_info->pixbuf != NULL &&
+            thumb_info->generation == self->priv->thumbnail_generation)
+            gtk_list_store_set (GTK_LIST_STORE (self), &(thumb_info->iter),
+                                COLUMN_ICON, thumb_info->pixbuf,
+                                -1);
+    }
+
+    g_list_free_full (done, thumb_info_data_free);
+
+    return G_SOURCE_REMOVE;
+}
+
 static void
 ensure_thumbnails_job (GTask *task,
                        gpointer source_object,
                        gpointer user_data,
                        GCancellable *cancellable)
 {
-    GList *thumb_infos = user_data, *l;
+    FontViewModel *self = source_object;
 
-    for (l = thumb_infos; l != NULL; l = l->next) {
-        gboolean thumb_failed;
-        gchar *thumb_path = NULL;
-        ThumbInfoData *thumb_info = l->data;
+    while (TRUE) {
+        ThumbInfoData *thumb_info;
+        GPtrArray *batch, *missing;
+        guint i;
+
+        batch = g_ptr_array_new ();
 
-        GError *error = NULL;
-        GFile *thumb_file = NULL;
-        GFileInputStream *is = NULL;
-        GFileInfo *info = NULL;
+        g_mutex_lock (&self->priv->thumbnail_mutex);
+        while (batch->len < THUMBNAILS_BATCH_SIZE &&
+               (thumb_info = g_queue_pop_head (&self->priv->thumbnail_queue)) != NULL)
+            g_ptr_array_add (batch, thumb_info);
+        if (batch->len == 0)
+            self->priv->thumbnail_worker_running = FALSE;
+        g_mutex_unlock (&self->priv->thumbnail_mutex);
+
+        if (batch->len == 0) {
+            g_ptr_array_unref (batch);
+            break;
+        }
 
-        if (thumb_info->face_index == 0) {
-            thumb_info->uri = g_file_get_uri (thumb_info->font_file);
-            info = g_file_query_info (thumb_info->font_file,
-                                      ATTRIBUTES_FOR_EXISTING_THUMBNAIL,
-                                      G_FILE_QUERY_INFO_NONE,
-                                      NULL, &error);
+        missing = g_ptr_array_new ();
+        for (i = 0; i < batch->len; i++) {
+            thumb_info = g_ptr_array_index (batch, i);
+            if (!load_thumbnail (thumb_info))
+                g_ptr_array_add (missing, thumb_info);
+        }
 
-            if (error != NULL) {
-                gchar *font_path;
+        if (missing->len > 0)
+            create_thumbnails (missing);
+        g_ptr_array_unref (missing);
 
-                font_path = g_file_get_path (thumb_info->font_file);
-                g_debug ("Can't query info for file %s: %s\n", font_path, error->message);
-                g_free (font_path);
+        g_mutex_lock (&self->priv->thumbnail_mutex);
+        for (i = 0; i < batch->len; i++)
+            self->priv->thumbnails_done = g_list_prepend (self->priv->thumbnails_done,
+                                                          g_ptr_array_index (batch, i));
+        g_ptr_array_unref (batch);
 
-                goto next;
-            }
+        if (!self->priv->thumbnails_flush_pending) {
+            GSource *source;
 
-            thumb_failed = g_file_info_get_attribute_boolean (info, G_FILE_ATTRIBUTE_THUMBNAILING_FAILED);
-            if (thumb_failed)
-                goto next;
+            source = g_timeout_source_new (THUMBNAILS_FLUSH_INTERVAL);
+            g_source_set_callback (source, thumbnails_flush,
+                                   g_object_ref (self), g_object_unref);
+            g_source_attach (source, NULL);
+            g_source_unref (source);
 
-            thumb_path = g_strdup (g_file_info_get_attribute_byte_string (info, G_FILE_ATTRIBUTE_THUMBNAIL_PATH));
-        } else {
-            gchar *file_uri;
-            gchar *checksum;
-            gchar *filename;
-
-            file_uri = g_file_get_uri (thumb_info->font_file);
-            thumb_info->uri = g_strdup_printf ("%s#0x%08X", file_uri, thumb_info->face_index);
-            g_free (file_uri);
-
-            checksum = g_compute_checksum_for_data (G_CHECKSUM_MD5,
-                                                    (const guchar *) thumb_info->uri,
-                                                    strlen (thumb_info->uri));
-            filename = g_strdup_printf ("%s.png", checksum);
-            g_free (checksum);
-
-            thumb_path = g_build_filename (g_get_user_cache_dir (),
-                                           "thumbnails",
-                                           "large",
-                                           filename,
-                                           NULL);
-            g_free (filename);
-
-            if (!g_file_test (thumb_path, G_FILE_TEST_IS_REGULAR)) {
-                g_clear_pointer (&thumb_path, g_free);
-            }
+            self->priv->thumbnails_flush_pending = TRUE;
         }
+        g_mutex_unlock (&self->priv->thumbnail_mutex);
+    }
 
-        if (thumb_path != NULL) {
-            thumb_file = g_file_new_for_path (thumb_path);
-            is = g_file_read (thumb_file, NULL, &error);
+    g_task_return_boolean (task, TRUE);
+}
 
-            if (error != NULL) {
-                g_debug ("Can't read file %s: %s\n", thumb_path, error->message);
-                goto next;
-            }
+/* drops all thumbnail requests, as the rows they are for are going away */
+static void
+thumbnails_reset (FontViewModel *self)
+{
+    g_mutex_lock (&self->priv->thumbnail_mutex);
+    g_queue_clear_full (&self->priv->thumbnail_queue, thumb_info_data_free);
+    self->priv->thumbnail_generation++;
+    g_mutex_unlock (&self->priv->thumbnail_mutex);
 
-            thumb_info->pixbuf = gdk_pixbuf_new_from_stream_at_scale (G_INPUT_STREAM (is),
-                                                                      128, 128, TRUE,
-                                                                      NULL, &error);
+    g_hash_table_remove_all (self->priv->thumbnail_rows);
+}
 
-            if (error != NULL) {
-                g_debug ("Can't read thumbnail pixbuf %s: %s\n", thumb_path, error->message);
-                goto next;
-            }
-        } else {
-            thumb_info->pixbuf = create_thumbnail (thumb_info);
+void
+font_view_model_request_thumbnails (FontViewModel *self,
+                                    const GtkTreeIter *iters,
+                                    guint n_iters)
+{
+    GHashTable *visible;
+    GList *l, *next, *requests = NULL;
+    guint i;
+
+    visible = g_hash_table_new (NULL, NULL);
+
+    for (i = 0; i < n_iters; i++) {
+        ThumbInfoData *thumb_info;
+        gchar *font_path;
+        gint face_index;
+
+        g_hash_table_add (visible, iters[i].user_data);
+
+        if (g_hash_table_contains (self->priv->thumbnail_rows, iters[i].user_data))
+            continue;
+
+        gtk_tree_model_get (GTK_TREE_MODEL (self), (GtkTreeIter *) &iters[i],
+                            COLUMN_PATH, &font_path,
+                            COLUMN_FACE_INDEX, &face_index,
+                            -1);
+
+        thumb_info = g_slice_new0 (ThumbInfoData);
+        thumb_info->font_file = g_file_new_for_path (font_path);
+        thumb_info->face_index = face_index;
+        thumb_info->iter = iters[i];
+        thumb_info->generation = self->priv->thumbnail_generation;
+        g_free (font_path);
+
+        g_hash_table_add (self->priv->thumbnail_rows, iters[i].user_data);
+        requests = g_list_prepend (requests, thumb_info);
+    }
+
+    requests = g_list_reverse (requests);
+
+    g_mutex_lock (&self->priv->thumbnail_mutex);
+
+    /* forget the rows that went out of view before their turn came */
+    for (l = self->priv->thumbnail_queue.head; l != NULL; l = next) {
+        ThumbInfoData *thumb_info = l->data;
+
+        next = l->next;
+
+        if (!g_hash_table_contains (visible, thumb_info->iter.user_data)) {
+            g_hash_table_remove (self->priv->thumbnail_rows, thumb_info->iter.user_data);
+            g_queue_delete_link (&self->priv->thumbnail_queue, l);
+            thumb_info_data_free (thumb_info);
         }
+    }
 
-    next:
-        g_clear_error (&error);
-        g_clear_object (&is);
-        g_clear_object (&thumb_file);
-        g_clear_object (&info);
-        g_clear_pointer (&thumb_path, g_free);
+    for (l = requests; l != NULL; l = l->next)
+        g_queue_push_tail (&self->priv->thumbnail_queue, l->data);
+
+    if (!self->priv->thumbnail_worker_running &&
+        !g_queue_is_empty (&self->priv->thumbnail_queue)) {
+        GTask *task;
 
-        g_main_context_invoke (NULL, one_thumbnail_done,
-                               thumb_info);
+        task = g_task_new (self, NULL, NULL, NULL);
+        g_task_run_in_thread (task, ensure_thumbnails_job);
+        g_object_unref (task);
+
+        self->priv->thumbnail_worker_running = TRUE;
     }
 
-    g_list_free (thumb_infos);
+    g_mutex_unlock (&self->priv->thumbnail_mutex);
+
+    g_list_free (requests);
+    g_hash_table_unref (visible);
 }
 
 typedef struct {
     gchar *font_path;
     gint face_index;
     gchar *font_name;
+    gint64 mtime;
+    gint64 size;
+    gboolean cached;
 } FontInfoData;
 
 static void
@@ -329,21 +635,200 @@ font_info_data_free (gpointer user_data)
     g_slice_free (FontInfoData, font_info);
 }
 
+/* Font name cache
+ *
+ * Opening every font with FreeType is what makes filling the model slow,
+ * so the names are kept on disk, keyed by file and face index and
+ * validated against the file's mtime and size. Faces that could not be
+ * read are remembered too, with no name. The table is never modified once
+ * built, so loader threads can share it; each load builds a new one with
+ * only the faces still installed.
+ */
+#define FONT_NAME_CACHE_VERSION 3
+#define FONT_NAME_CACHE_ENTRY_TYPE "(sixxms)"
+#define FONT_NAME_CACHE_TYPE "a" FONT_NAME_CACHE_ENTRY_TYPE
+
+static gchar *
+font_name_cache_get_key (const gchar *font_path,
+                         gint face_index)
+{
+    return g_strdup_printf ("%d:%s", face_index, font_path);
+}
+
+static GHashTable *
+font_name_cache_new (void)
+{
+    return g_hash_table_new_full (g_str_hash, g_str_equal,
+                                  g_free, font_info_data_free);
+}
+
+static void
+font_name_cache_insert (GHashTable *cache,
+                        const FontInfoData *font_info)
+{
+    FontInfoData *entry;
+
+    entry = g_slice_new0 (FontInfoData);
+    entry->font_path = g_strdup (font_info->font_path);
+    entry->face_index = font_info->face_index;
+    entry->font_name = g_strdup (font_info->font_name);
+    entry->mtime = font_info->mtime;
+    entry->size = font_info->size;
+
+    g_hash_table_insert (cache,
+                         font_name_cache_get_key (entry->font_path, entry->face_index),
+                         entry);
+}
+
+static GHashTable *
+font_name_cache_load (void)
+{
+    GHashTable *cache;
+    GVariant *entries;
+
+    cache = font_name_cache_new ();
+
+    entries = cache_util_load ("font-names.cache",
+                               G_VARIANT_TYPE (FONT_NAME_CACHE_TYPE),
+                               FONT_NAME_CACHE_VERSION);
+
+    if (entries != NULL) {
+        GVariantIter iter;
+        FontInfoData entry;
+
+        g_variant_iter_init (&iter, entries);
+        while (g_variant_iter_next (&iter, "(&sixxm&s)",
+                                    &entry.font_path, &entry.face_index,
+                                    &entry.mtime, &entry.size,
+                                    &entry.font_name))
+            font_name_cache_insert (cache, &entry);
+
+        g_variant_unref (entries);
+    }
+
+    return cache;
+}
+
+static void
+font_name_cache_save (GHashTable *cache)
+{
+    GVariantBuilder entries;
+    GHashTableIter iter;
+    gpointer value;
+
+    g_variant_builder_init (&entries, G_VARIANT_TYPE (FONT_NAME_CACHE_TYPE));
+
+    g_hash_table_iter_init (&iter, cache);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        FontInfoData *entry = value;
+
+        /* these faces are just read again the next time */
+        if (!cache_util_string_valid (entry->font_path) ||
+            !cache_util_string_valid (entry->font_name))
+            continue;
+
+        g_variant_builder_add (&entries, FONT_NAME_CACHE_ENTRY_TYPE,
+                               entry->font_path, entry->face_index,
+                               entry->mtime, entry->size,
+                               entry->font_name);
+    }
+
+    cache_util_save ("font-names.cache", FONT_NAME_CACHE_VERSION,
+                     g_variant_builder_end (&entries));
+}
+
+/* The font names are read by one task per processor, each with its own
+ * FreeType library, and handed to the main thread in batches as they
+ * come in.
+ */
+#define FONT_INFOS_BATCH_SIZE 64
+
+typedef struct {
+    FontViewModel *self;
+    GCancellable *cancellable;
+
+    /* the fonts to load, without names, and the names known from
+     * before; read-only while loading */
+    GPtrArray *fonts;
+    GHashTable *name_cache;
+    guint n_shards;
+
+    /* only touched from the main thread */
+    guint n_shards_done;
+    GHashTable *new_name_cache;
+    gboolean name_cache_dirty;
+} FontLoadData;
+
+typedef struct {
+    FontLoadData *load;
+    guint shard;
+} FontLoadShard;
+
+typedef struct {
+    FontLoadData *load;
+    GList *font_infos;
+    gboolean last;
+} FontInfosBatch;
+
+static void
+font_load_data_clear (gpointer user_data)
+{
+    FontLoadData *load = user_data;
+
+    g_object_unref (load->self);
+    g_object_unref (load->cancellable);
+    g_ptr_array_unref (load->fonts);
+    g_hash_table_unref (load->name_cache);
+    g_hash_table_unref (load->new_name_cache);
+}
+
 static void
-font_infos_loaded (GObject *source_object,
-                   GAsyncResult *result,
-                   gpointer user_data)
+font_load_shard_free (gpointer user_data)
+{
+    FontLoadShard *shard = user_data;
+
+    g_atomic_rc_box_release_full (shard->load, font_load_data_clear);
+    g_slice_free (FontLoadShard, shard);
+}
+
+static void
+font_infos_loaded (FontLoadData *load)
+{
+    FontViewModel *self = load->self;
+
+    /* faces that are gone shrink the cache without marking it dirty */
+    if (load->name_cache_dirty ||
+        g_hash_table_size (load->new_name_cache) != g_hash_table_size (load->name_cache))
+        font_name_cache_save (load->new_name_cache);
+
+    g_hash_table_unref (self->priv->name_cache);
+    self->priv->name_cache = g_hash_table_ref (load->new_name_cache);
+
+    g_signal_emit (self, signals[CONFIG_CHANGED], 0);
+}
+
+static gboolean
+font_infos_batch_loaded (gpointer user_data)
 {
-    FontViewModel *self = FONT_VIEW_MODEL (source_object);
-    GTask *task = NULL;
-    GList *l, *thumb_infos = NULL;
-    GList *font_infos = g_task_propagate_pointer (G_TASK (result), NULL);
+    FontInfosBatch *batch = user_data;
+    FontLoadData *load = batch->load;
+    FontViewModel *self = load->self;
+    GList *l;
 
-    for (l = font_infos; l != NULL; l = l->next) {
+    if (g_cancellable_is_cancelled (load->cancellable))
+        goto out;
+
+    for (l = batch->font_infos; l != NULL; l = l->next) {
         FontInfoData *font_info = l->data;
         gchar *collation_key;
         GtkTreeIter iter;
-        ThumbInfoData *thumb_info;
+
+        font_name_cache_insert (load->new_name_cache, font_info);
+        if (!font_info->cached)
+            load->name_cache_dirty = TRUE;
+
+        if (font_info->font_name == NULL)
+            continue;
 
         collation_key = g_utf8_collate_key (font_info->font_name, -1);
         gtk_list_store_insert_with_values (GTK_LIST_STORE (self), &iter, -1,
@@ -354,24 +839,32 @@ font_infos_loaded (GObject *source_object,
                                            COLUMN_COLLATION_KEY, collation_key,
                                            -1);
         g_free (collation_key);
+    }
 
-        thumb_info = g_slice_new0 (ThumbInfoData);
-        thumb_info->font_file = g_file_new_for_path (font_info->font_path);
-        thumb_info->face_index = font_info->face_index;
-        thumb_info->iter = iter;
-        thumb_info->self = g_object_ref (self);
+    if (batch->last && ++load->n_shards_done == load->n_shards)
+        font_infos_loaded (load);
 
-        font_info_data_free (font_info);
-        thumb_infos = g_list_prepend (thumb_infos, thumb_info);
-    }
+ out:
+    g_list_free_full (batch->font_infos, font_info_data_free);
+    g_atomic_rc_box_release_full (load, font_load_data_clear);
+    g_slice_free (FontInfosBatch, batch);
 
-    g_signal_emit (self, signals[CONFIG_CHANGED], 0);
-    g_list_free (font_infos);
+    return FALSE;
+}
+
+static void
+post_font_infos_batch (FontLoadData *load,
+                       GList *font_infos,
+                       gboolean last)
+{
+    FontInfosBatch *batch;
 
-    task = g_task_new (NULL, NULL, NULL, NULL);
-    g_task_set_task_data (task, thumb_infos, NULL);
-    g_task_run_in_thread (task, ensure_thumbnails_job);
-    g_object_unref (task);
+    batch = g_slice_new0 (FontInfosBatch);
+    batch->load = g_atomic_rc_box_acquire (load);
+    batch->font_infos = g_list_reverse (font_infos);
+    batch->last = last;
+
+    g_main_context_invoke (NULL, font_infos_batch_loaded, batch);
 }
 
 static void
@@ -380,42 +873,66 @@ load_font_infos (GTask *task,
                  gpointer user_data,
                  GCancellable *cancellable)
 {
-    FontViewModel *self = FONT_VIEW_MODEL (source_object);
-    gint i, n_fonts;
+    FontLoadShard *shard = user_data;
+    FontLoadData *load = shard->load;
+    FT_Library library;
     GList *font_infos = NULL;
+    guint i, n_infos = 0;
 
-    n_fonts = self->priv->font_list->nfont;
+    if (FT_Init_FreeType (&library) != FT_Err_Ok) {
+        g_critical ("Can't initialize FreeType library");
+        post_font_infos_batch (load, NULL, TRUE);
+        g_task_return_boolean (task, FALSE);
+        return;
+    }
 
-    for (i = 0; i < n_fonts; i++) {
-        FontInfoData *font_info;
-        FcChar8 *file;
-        int index;
-        gchar *font_name;
+    for (i = shard->shard; i < load->fonts->len; i += load->n_shards) {
+        FontInfoData *font, *font_info, *entry;
+        GStatBuf buf;
+        gchar *key;
 
         if (g_cancellable_is_cancelled (cancellable))
             break;
 
-        g_mutex_lock (&self->priv->font_list_mutex);
-        FcPatternGetString (self->priv->font_list->fonts[i], FC_FILE, 0, &file);
-        FcPatternGetInteger (self->priv->font_list->fonts[i], FC_INDEX, 0, &index);
-        g_mutex_unlock (&self->priv->font_list_mutex);
-
-        font_name = font_utils_get_font_name_for_file (self->priv->library,
-                                                       (const gchar *) file,
-                                                       index);
-
-        if (!font_name)
+        font = g_ptr_array_index (load->fonts, i);
+        if (g_stat (font->font_path, &buf) != 0)
             continue;
 
         font_info = g_slice_new0 (FontInfoData);
-        font_info->font_name = font_name;
-        font_info->font_path = g_strdup ((const gchar *) file);
-        font_info->face_index = index;
+        font_info->font_path = g_strdup (font->font_path);
+        font_info->face_index = font->face_index;
+        font_info->mtime = buf.st_mtime;
+        font_info->size = buf.st_size;
+
+        key = font_name_cache_get_key (font->font_path, font->face_index);
+        entry = g_hash_table_lookup (load->name_cache, key);
+        g_free (key);
+
+        if (entry != NULL &&
+            entry->mtime == font_info->mtime &&
+            entry->size == font_info->size) {
+            font_info->font_name = g_strdup (entry->font_name);
+            font_info->cached = TRUE;
+        } else {
+            font_info->font_name =
+                font_utils_get_font_name_for_file (library,
+                                                   font->font_path,
+                                                   font->face_index);
+        }
 
         font_infos = g_list_prepend (font_infos, font_info);
+
+        if (++n_infos == FONT_INFOS_BATCH_SIZE) {
+            post_font_infos_batch (load, font_infos, FALSE);
+            font_infos = NULL;
+            n_infos = 0;
+        }
     }
 
-    g_task_return_pointer (task, font_infos, NULL);
+    post_font_infos_batch (load, font_infos, TRUE);
+
+    FT_Done_FreeType (library);
+    g_task_return_boolean (task, TRUE);
 }
 
 /* make sure the font list is valid */
@@ -424,7 +941,8 @@ ensure_font_list (FontViewModel *self)
 {
     FcPattern *pat;
     FcObjectSet *os;
-    GTask *task;
+    FontLoadData *load;
+    gint i;
 
     /* always reinitialize the font database */
     if (!FcInitReinitialize())
@@ -435,13 +953,12 @@ ensure_font_list (FontViewModel *self)
         g_clear_object (&self->priv->cancellable);
     }
 
+    thumbnails_reset (self);
     gtk_list_store_clear (GTK_LIST_STORE (self));
 
     pat = FcPatternCreate ();
     os = FcObjectSetBuild (FC_FILE, FC_INDEX, FC_FAMILY, FC_WEIGHT, FC_SLANT, NULL);
 
-    g_mutex_lock (&self->priv->font_list_mutex);
-
     if (self->priv->font_list) {
         FcFontSetDestroy (self->priv->font_list);
         self->priv->font_list = NULL;
@@ -449,8 +966,6 @@ ensure_font_list (FontViewModel *self)
 
     self->priv->font_list = FcFontList (NULL, pat, os);
 
-    g_mutex_unlock (&self->priv->font_list_mutex);
-
     FcPatternDestroy (pat);
     FcObjectSetDestroy (os);
 
@@ -459,9 +974,44 @@ ensure_font_list (FontViewModel *self)
 
     self->priv->cancellable = g_cancellable_new ();
 
-    task = g_task_new (self, self->priv->cancellable, font_infos_loaded, NULL);
-    g_task_set_return_on_cancel (task, TRUE);
-    g_task_run_in_thread (task, load_font_infos);
+    load = g_atomic_rc_box_new0 (FontLoadData);
+    load->self = g_object_ref (self);
+    load->cancellable = g_object_ref (self->priv->cancellable);
+    load->name_cache = g_hash_table_ref (self->priv->name_cache);
+    load->new_name_cache = font_name_cache_new ();
+    load->fonts = g_ptr_array_new_full (self->priv->font_list->nfont,
+                                        font_info_data_free);
+    load->n_shards = CLAMP (g_get_num_processors (), 1,
+                            MAX (self->priv->font_list->nfont, 1));
+
+    for (i = 0; i < self->priv->font_list->nfont; i++) {
+        FontInfoData *font = g_slice_new0 (FontInfoData);
+        FcChar8 *file;
+        int index;
+
+        FcPatternGetString (self->priv->font_list->fonts[i], FC_FILE, 0, &file);
+        FcPatternGetInteger (self->priv->font_list->fonts[i], FC_INDEX, 0, &index);
+
+        font->font_path = g_strdup ((const gchar *) file);
+        font->face_index = index;
+        g_ptr_array_add (load->fonts, font);
+    }
+
+    for (i = 0; i < (gint) load->n_shards; i++) {
+        FontLoadShard *shard;
+        GTask *task;
+
+        shard = g_slice_new0 (FontLoadShard);
+        shard->load = g_atomic_rc_box_acquire (load);
+        shard->shard = i;
+
+        task = g_task_new (self, self->priv->cancellable, NULL, NULL);
+        g_task_set_task_data (task, shard, font_load_shard_free);
+        g_task_run_in_thread (task, load_font_infos);
+        g_object_unref (task);
+    }
+
+    g_atomic_rc_box_release_full (load, font_load_data_clear);
 }
 
 static gboolean
@@ -572,11 +1122,6 @@ font_view_model_init (FontViewModel *self)
 
     self->priv = font_view_model_get_instance_private (self);
 
-    if (FT_Init_FreeType (&self->priv->library) != FT_Err_Ok)
-        g_critical ("Can't initialize FreeType library");
-
-    g_mutex_init (&self->priv->font_list_mutex);
-
     gtk_list_store_set_column_types (GTK_LIST_STORE (self),
                                      NUM_COLUMNS, types);
 
@@ -589,6 +1134,11 @@ font_view_model_init (FontViewModel *self)
                                      NULL, NULL);
 
     self->priv->fallback_icon = get_fallback_icon ();
+    self->priv->name_cache = font_name_cache_load ();
+
+    g_mutex_init (&self->priv->thumbnail_mutex);
+    g_queue_init (&self->priv->thumbnail_queue);
+    self->priv->thumbnail_rows = g_hash_table_new (NULL, NULL);
 
     g_idle_add (ensure_font_list_idle, self);
     create_file_monitors (self);
@@ -609,13 +1159,13 @@ font_view_model_finalize (GObject *obj)
         self->priv->font_list = NULL;
     }
 
-    if (self->priv->library != NULL) {
-        FT_Done_FreeType (self->priv->library);
-        self->priv->library = NULL;
-    }
-
-    g_mutex_clear (&self->priv->font_list_mutex);
     g_clear_object (&self->priv->fallback_icon);
+    g_clear_pointer (&self->priv->name_cache, g_hash_table_unref);
+
+    g_queue_clear_full (&self->priv->thumbnail_queue, thumb_info_data_free);
+    g_list_free_full (self->priv->thumbnails_done, thumb_info_data_free);
+    g_clear_pointer (&self->priv->thumbnail_rows, g_hash_table_unref);
+    g_mutex_clear (&self->priv->thumbnail_mutex);
     g_list_free_full (self->priv->monitors, (GDestroyNotify) g_object_unref);
 
     G_OBJECT_CLASS (font_view_model_parent_class)->finalize (obj);
@@ -63,6 +63,10 @@ gboolean font_view_model_get_iter_for_face (FontViewModel *self,
                                             FT_Face face,
                                             GtkTreeIter *iter);
 
+void font_view_model_request_thumbnails (FontViewModel *self,
+                                         const GtkTreeIter *iters,
+                                         guint n_iters);
+
 G_END_DECLS
 
 #endif /* __FONT_VIEW_MODEL_H__ */
@@ -26,6 +26,8 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #ifdef ENABLE_NLS
 #include <locale.h>
 #endif /* ENABLE_NLS */
@@ -40,6 +42,7 @@
 
 #include <cairo/cairo-ft.h>
 
+#include "sushi-font-coverage.h"
 #include "sushi-font-loader.h"
 #include "totem-resources.h"
 
@@ -61,217 +64,221 @@ get_ft_error (FT_Error error)
 #define PADDING_VERTICAL 2
 #define PADDING_HORIZONTAL 4
 
-static gboolean
-check_font_contain_text (FT_Face face,
-                         const gchar *text)
-{
-  gunichar *string;
-  glong len, idx, map;
-  FT_CharMap charmap;
-  gboolean retval;
-
-  string = g_utf8_to_ucs4_fast (text, -1, &len);
-
-  for (map = 0; map < face->num_charmaps; map++) {
-    charmap = face->charmaps[map];
-    FT_Set_Charmap (face, charmap);
-
-    retval = TRUE;
-
-    for (idx = 0; idx < len; idx++) {
-      gunichar c = string[idx];
-
-      if (!FT_Get_Char_Index (face, c)) {
-        retval = FALSE;
-        break;
-      }
-    }
-
-    if (retval)
-      break;
-  }
-
-  g_free (string);
-
-  return retval;
-}
-
 static gchar *
 check_for_ascii_glyph_numbers (FT_Face face,
-                               gboolean *found_ascii)
+                               SushiFontCoverage *coverage)
 {
-    GString *ascii_string, *string;
-    gulong c;
-    guint glyph, found = 0;
+    GString *ascii_string;
+    guint n, n_chars, glyph, found = 0;
+    gunichar c;
 
-    string = g_string_new (NULL);
     ascii_string = g_string_new (NULL);
-    *found_ascii = FALSE;
+    n_chars = sushi_font_coverage_get_n_chars (coverage);
 
-    c = FT_Get_First_Char (face, &glyph);
+    for (n = 0; n < n_chars && found < 2; n++) {
+        c = sushi_font_coverage_get_nth_char (coverage, n);
+        glyph = FT_Get_Char_Index (face, c);
 
-    do {
         if (glyph == 65 || glyph == 97) {
-            g_string_append_unichar (ascii_string, (gunichar) c);
+            g_string_append_unichar (ascii_string, c);
             found++;
         }
+    }
 
-        if (found == 2)
-            break;
-
-        g_string_append_unichar (string, (gunichar) c);
-        c = FT_Get_Next_Char (face, c, &glyph);
-    } while (glyph != 0);
-
-    if (found == 2) {
-        *found_ascii = TRUE;
-        g_string_free (string, TRUE);
+    if (found == 2)
         return g_string_free (ascii_string, FALSE);
-    } else {
-        g_string_free (ascii_string, TRUE);
-        return g_string_free (string, FALSE);
-    }
+
+    g_string_free (ascii_string, TRUE);
+    return NULL;
 }
 
 static gchar *
-build_fallback_thumbstr (FT_Face face)
+build_fallback_thumbstr (FT_Face face,
+                         SushiFontCoverage *coverage)
 {
     gchar *chars;
-    gint idx, total_chars;
+    gint idx;
+    guint total_chars;
     GString *retval;
-    gchar *ptr, *end;
-    gboolean found_ascii;
 
-    chars = check_for_ascii_glyph_numbers (face, &found_ascii);
+    chars = check_for_ascii_glyph_numbers (face, coverage);
 
-    if (found_ascii)
+    if (chars)
         return chars;
 
     idx = 0;
     retval = g_string_new (NULL);
-    total_chars = g_utf8_strlen (chars, -1);
+    total_chars = sushi_font_coverage_get_n_chars (coverage);
 
-    while (idx < 2) {
+    while (idx < 2 && total_chars > 0) {
         total_chars = total_chars / 2;
-        ptr = g_utf8_offset_to_pointer (chars, total_chars);
-        end = g_utf8_find_next_char (ptr, NULL);
-
-        g_string_append_len (retval, ptr, end - ptr);
+        g_string_append_unichar (retval,
+                                 sushi_font_coverage_get_nth_char (coverage, total_chars));
         idx++;
     }
 
   return g_string_free (retval, FALSE);
 }
 
-int
-main (int argc,
-      char **argv)
-{
-    FT_Error error;
+/* FreeType state is per library and a library must not be used from two
+ * threads at once, so each thread that renders thumbnails has its own,
+ * along with a surface it reuses while the size doesn't change. Cairo may
+ * keep a face in its font caches after the thumbnail is done, and drop it
+ * later from any thread; such faces are handed back to the thread that
+ * owns their library to be freed there.
+ */
+typedef struct {
     FT_Library library;
-    FT_Face face;
-    GFile *file;
-    gint font_size, thumb_size = THUMB_SIZE;
-    gchar *thumbstr_utf8 = NULL, *help, *uri;
-    gchar **arguments = NULL;
-    GOptionContext *context;
-    GError *gerror = NULL;
-    gchar *contents = NULL;
-    gboolean retval, default_thumbstr = TRUE;
-    gint rv = 1;
-    GdkRGBA black = { 0.0, 0.0, 0.0, 1.0 };
     cairo_surface_t *surface;
-    cairo_t *cr;
-    cairo_text_extents_t text_extents;
-    cairo_font_face_t *font;
-    gchar *str = NULL;
-    gdouble scale, scale_x, scale_y;
-    gint face_index = 0;
-    gchar *fragment;
 
-    const GOptionEntry options[] = {
-	    { "text", 't', 0, G_OPTION_ARG_STRING, &thumbstr_utf8,
-	      N_("Text to thumbnail (default: Aa)"), N_("TEXT") },
-	    { "size", 's', 0, G_OPTION_ARG_INT, &thumb_size,
-	      N_("Thumbnail size (default: 128)"), N_("SIZE") },
-	    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &arguments,
-	      NULL, N_("FONT-FILE OUTPUT-FILE") },
-	    { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
-    };
+    GMutex lock;                /* guards released */
+    GSList *released;
+} ThumbnailContext;
 
-#ifdef ENABLE_NLS
-    setlocale (LC_ALL, "");
-    bindtextdomain (GETTEXT_PACKAGE, MATELOCALEDIR);
-    bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
-    textdomain (GETTEXT_PACKAGE);
-#endif /* ENABLE_NLS */
+typedef struct {
+    ThumbnailContext *context;
+    FT_Face face;
+    gchar *contents;
+} ThumbnailFace;
 
-    context = g_option_context_new (NULL);
-    g_option_context_add_main_entries (context, options, GETTEXT_PACKAGE);
+static cairo_user_data_key_t thumbnail_face_key;
 
-    retval = g_option_context_parse (context, &argc, &argv, &gerror);
-    if (!retval) {
-	g_printerr ("Error parsing arguments: %s\n", gerror->message);
+static ThumbnailContext *
+thumbnail_context_new (void)
+{
+    ThumbnailContext *context;
+    FT_Error error;
 
-	g_option_context_free  (context);
-	g_error_free (gerror);
-        return 1;
+    context = g_new0 (ThumbnailContext, 1);
+    g_mutex_init (&context->lock);
+
+    error = FT_Init_FreeType (&context->library);
+    if (error) {
+	g_printerr("Could not initialise freetype: %s\n", get_ft_error (error));
+	g_mutex_clear (&context->lock);
+	g_free (context);
+	return NULL;
     }
 
-    if (!arguments || g_strv_length (arguments) != 2) {
-	help = g_option_context_get_help (context, TRUE, NULL);
-	g_printerr ("%s", help);
+    return context;
+}
 
-	g_option_context_free (context);
-	goto out;
-    }
+static void
+thumbnail_face_release (gpointer data)
+{
+    ThumbnailFace *thumb_face = data;
+    ThumbnailContext *context = thumb_face->context;
 
-    g_option_context_free (context);
+    g_mutex_lock (&context->lock);
+    context->released = g_slist_prepend (context->released, thumb_face);
+    g_mutex_unlock (&context->lock);
+}
 
-    if (thumbstr_utf8 != NULL)
-	default_thumbstr = FALSE;
+static void
+thumbnail_context_collect (ThumbnailContext *context)
+{
+    GSList *released, *l;
+    FT_Error error;
 
-    error = FT_Init_FreeType (&library);
-    if (error) {
-	g_printerr("Could not initialise freetype: %s\n", get_ft_error (error));
-	goto out;
+    g_mutex_lock (&context->lock);
+    released = context->released;
+    context->released = NULL;
+    g_mutex_unlock (&context->lock);
+
+    for (l = released; l != NULL; l = l->next) {
+        ThumbnailFace *thumb_face = l->data;
+
+        error = FT_Done_Face (thumb_face->face);
+        if (error)
+            g_printerr("Could not unload face: %s\n", get_ft_error (error));
+
+        g_free (thumb_face->contents);
+        g_free (thumb_face);
     }
 
-    totem_resources_monitor_start (arguments[0], 30 * G_USEC_PER_SEC);
+    g_slist_free (released);
+}
 
-    fragment = strrchr (arguments[0], '#');
+static gboolean
+render_thumbnail (ThumbnailContext *context,
+                  const gchar *font_file,
+                  const gchar *output,
+                  gint thumb_size,
+                  const gchar *thumbstr_utf8)
+{
+    ThumbnailFace *thumb_face;
+    FT_Face face;
+    GFile *file;
+    GError *gerror = NULL;
+    gchar *contents = NULL;
+    gchar *str, *uri, *fragment;
+    gint font_size, face_index = 0;
+    GdkRGBA black = { 0.0, 0.0, 0.0, 1.0 };
+    cairo_t *cr;
+    cairo_text_extents_t text_extents;
+    cairo_font_face_t *font;
+    cairo_status_t status;
+    gdouble scale, scale_x, scale_y;
+    SushiFontCoverage *coverage;
+
+    thumbnail_context_collect (context);
+
+    fragment = strrchr (font_file, '#');
     if (fragment)
 	face_index = strtol (fragment + 1, NULL, 0);
 
-    file = g_file_new_for_commandline_arg (arguments[0]);
+    file = g_file_new_for_commandline_arg (font_file);
     uri = g_file_get_uri (file);
     g_object_unref (file);
 
-    face = sushi_new_ft_face_from_uri (library, uri, face_index, &contents, &gerror);
+    face = sushi_new_ft_face_from_uri (context->library, uri, face_index, &contents, &gerror);
     if (gerror) {
 	g_printerr ("Could not load face '%s': %s\n", uri,
 		    gerror->message);
         g_free (uri);
         g_error_free (gerror);
-	goto out;
+	return FALSE;
     }
 
-    g_free (uri);
+    if (thumbstr_utf8 == NULL) {
+        coverage = sushi_font_coverage_lookup (uri, face_index, face);
 
-    if (default_thumbstr) {
-        if (check_font_contain_text (face, "Aa"))
+        if (sushi_font_coverage_contains_text (coverage, "Aa"))
             str = g_strdup ("Aa");
         else
-            str = build_fallback_thumbstr (face);
+            str = build_fallback_thumbstr (face, coverage);
+
+        sushi_font_coverage_free (coverage);
     } else {
-        str = thumbstr_utf8;
+        str = g_strdup (thumbstr_utf8);
     }
 
-    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                          thumb_size, thumb_size);
-    cr = cairo_create (surface);
+    g_free (uri);
+
+    if (context->surface == NULL ||
+        cairo_image_surface_get_width (context->surface) != thumb_size) {
+        if (context->surface != NULL)
+            cairo_surface_destroy (context->surface);
+
+        context->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                       thumb_size, thumb_size);
+    }
+
+    cr = cairo_create (context->surface);
+
+    cairo_save (cr);
+    cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint (cr);
+    cairo_restore (cr);
+
+    thumb_face = g_new0 (ThumbnailFace, 1);
+    thumb_face->context = context;
+    thumb_face->face = face;
+    thumb_face->contents = contents;
 
     font = cairo_ft_font_face_create_for_ft_face (face, 0);
+    cairo_font_face_set_user_data (font, &thumbnail_face_key,
+                                   thumb_face, thumbnail_face_release);
     cairo_set_font_face (cr, font);
     cairo_font_face_destroy (font);
 
@@ -301,18 +308,199 @@ main (int argc,
     cairo_show_text (cr, str);
     cairo_destroy (cr);
 
-    cairo_surface_write_to_png (surface, arguments[1]);
-    cairo_surface_destroy (surface);
+    g_free (str);
 
-    totem_resources_monitor_stop ();
+    status = cairo_surface_write_to_png (context->surface, output);
+    if (status != CAIRO_STATUS_SUCCESS) {
+        g_printerr ("Could not write thumbnail '%s': %s\n", output,
+                    cairo_status_to_string (status));
+        return FALSE;
+    }
 
-    error = FT_Done_Face (face);
-    if (error) {
-	g_printerr("Could not unload face: %s\n", get_ft_error (error));
+    return TRUE;
+}
+
+/* Batch mode
+ *
+ * Reads one job per line from stdin, as tab-separated FONT-FILE, OUTPUT-FILE
+ * and an optional SIZE, and renders them on a pool of threads, one per
+ * processor, so that a whole directory of fonts takes a single process.
+ * For every job, the output file and "ok" or "failed" are written back on
+ * a line of their own, in the order the jobs complete.
+ */
+typedef struct {
+    gint thumb_size;
+    const gchar *thumbstr_utf8;
+    gboolean failed;
+} BatchData;
+
+static GPrivate batch_context;
+static GMutex batch_lock;
+
+static void
+batch_render_thumbnail (gpointer data,
+                        gpointer user_data)
+{
+    BatchData *batch = user_data;
+    ThumbnailContext *context;
+    gchar **job = data;
+    gint thumb_size = batch->thumb_size;
+    gboolean success = FALSE;
+
+    /* contexts are never freed, since cairo may outlive them with faces */
+    context = g_private_get (&batch_context);
+    if (context == NULL) {
+        context = thumbnail_context_new ();
+        g_private_set (&batch_context, context);
+    }
+
+    if (job[2] != NULL)
+        thumb_size = strtol (job[2], NULL, 0);
+
+    if (context != NULL && thumb_size > 0)
+        success = render_thumbnail (context, job[0], job[1], thumb_size,
+                                    batch->thumbstr_utf8);
+
+    g_mutex_lock (&batch_lock);
+    if (!success)
+        batch->failed = TRUE;
+    g_print ("%s\t%s\n", job[1], success ? "ok" : "failed");
+    fflush (stdout);
+    g_mutex_unlock (&batch_lock);
+
+    g_strfreev (job);
+}
+
+static gboolean
+run_batch (gint thumb_size,
+           const gchar *thumbstr_utf8)
+{
+    GThreadPool *pool;
+    GIOChannel *channel;
+    GIOStatus status;
+    GError *gerror = NULL;
+    BatchData batch = { thumb_size, thumbstr_utf8, FALSE };
+    gchar *line;
+    gsize terminator;
+
+    pool = g_thread_pool_new (batch_render_thumbnail, &batch,
+                              g_get_num_processors (), TRUE, &gerror);
+    if (pool == NULL) {
+        g_printerr ("Could not start the thumbnailing threads: %s\n", gerror->message);
+        g_error_free (gerror);
+        return FALSE;
+    }
+
+    channel = g_io_channel_unix_new (0);
+    g_io_channel_set_encoding (channel, NULL, NULL);
+
+    while ((status = g_io_channel_read_line (channel, &line, NULL, &terminator, &gerror)) == G_IO_STATUS_NORMAL) {
+        gchar **job;
+
+        line[terminator] = '\0';
+        job = g_strsplit (line, "\t", 3);
+        g_free (line);
+
+        if (g_strv_length (job) < 2) {
+            if (job[0] != NULL && job[0][0] != '\0')
+                g_printerr ("Invalid job '%s'\n", job[0]);
+            g_strfreev (job);
+            continue;
+        }
+
+        g_thread_pool_push (pool, job, NULL);
+    }
+
+    if (status == G_IO_STATUS_ERROR) {
+        g_printerr ("Could not read the jobs: %s\n", gerror->message);
+        g_error_free (gerror);
+        batch.failed = TRUE;
+    }
+
+    g_io_channel_unref (channel);
+    g_thread_pool_free (pool, FALSE, TRUE);
+
+    return !batch.failed;
+}
+
+int
+main (int argc,
+      char **argv)
+{
+    FT_Error error;
+    ThumbnailContext *context;
+    gint thumb_size = THUMB_SIZE;
+    gchar *thumbstr_utf8 = NULL, *help;
+    gchar **arguments = NULL;
+    GOptionContext *option_context;
+    GError *gerror = NULL;
+    gboolean retval, batch = FALSE;
+    gint rv = 1;
+
+    const GOptionEntry options[] = {
+	    { "text", 't', 0, G_OPTION_ARG_STRING, &thumbstr_utf8,
+	      N_("Text to thumbnail (default: Aa)"), N_("TEXT") },
+	    { "size", 's', 0, G_OPTION_ARG_INT, &thumb_size,
+	      N_("Thumbnail size (default: 128)"), N_("SIZE") },
+	    { "batch", 'b', 0, G_OPTION_ARG_NONE, &batch,
+	      N_("Read FONT-FILE, OUTPUT-FILE and optional SIZE from each line of standard input"), NULL },
+	    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &arguments,
+	      NULL, N_("FONT-FILE OUTPUT-FILE") },
+	    { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+    };
+
+#ifdef ENABLE_NLS
+    setlocale (LC_ALL, "");
+    bindtextdomain (GETTEXT_PACKAGE, MATELOCALEDIR);
+    bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+    textdomain (GETTEXT_PACKAGE);
+#endif /* ENABLE_NLS */
+
+    option_context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (option_context, options, GETTEXT_PACKAGE);
+
+    retval = g_option_context_parse (option_context, &argc, &argv, &gerror);
+    if (!retval) {
+	g_printerr ("Error parsing arguments: %s\n", gerror->message);
+
+	g_option_context_free  (option_context);
+	g_error_free (gerror);
+        return 1;
+    }
+
+    if (batch ? arguments != NULL : (!arguments || g_strv_length (arguments) != 2)) {
+	help = g_option_context_get_help (option_context, TRUE, NULL);
+	g_printerr ("%s", help);
+
+	g_option_context_free (option_context);
 	goto out;
     }
 
-    error = FT_Done_FreeType (library);
+    g_option_context_free (option_context);
+
+    if (batch) {
+        if (run_batch (thumb_size, thumbstr_utf8))
+            rv = 0;
+        goto out;
+    }
+
+    context = thumbnail_context_new ();
+    if (context == NULL)
+	goto out;
+
+    totem_resources_monitor_start (arguments[0], 30 * G_USEC_PER_SEC);
+
+    retval = render_thumbnail (context, arguments[0], arguments[1],
+                               thumb_size, thumbstr_utf8);
+
+    totem_resources_monitor_stop ();
+
+    if (!retval)
+	goto out;
+
+    thumbnail_context_collect (context);
+
+    error = FT_Done_FreeType (context->library);
     if (error) {
 	g_printerr ("Could not finalize freetype library: %s\n",
 		   get_ft_error (error));
@@ -324,9 +512,7 @@ main (int argc,
   out:
 
     g_strfreev (arguments);
-    g_free (str);
-    g_free (contents);
+    g_free (thumbstr_utf8);
 
     return rv;
 }
-
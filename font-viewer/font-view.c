@@ -68,6 +68,7 @@ typedef struct {
 
     GtkTreeModel *model;
     GtkTreeModel *filter_model;
+    guint thumbnails_idle_id;
 
     GFile *font_file;
 } FontViewApplication;
@@ -79,6 +80,7 @@ typedef struct {
 G_DEFINE_TYPE (FontViewApplication, font_view_application, GTK_TYPE_APPLICATION);
 
 static void font_view_application_do_overview (FontViewApplication *self);
+static void queue_update_visible_thumbnails (FontViewApplication *self);
 
 static const gchar *app_menu =
     "<interface>"
@@ -327,6 +329,8 @@ font_model_config_changed_cb (FontViewModel *model,
 
     if (self->font_file != NULL)
         install_button_refresh_appearance (self, NULL);
+
+    queue_update_visible_thumbnails (self);
 }
 
 static void
@@ -534,6 +538,70 @@ font_visible_func (GtkTreeModel *model,
   return ret;
 }
 
+static gboolean
+update_visible_thumbnails (gpointer user_data)
+{
+    FontViewApplication *self = user_data;
+    GtkTreePath *start, *end;
+    GArray *iters;
+
+    self->thumbnails_idle_id = 0;
+
+    if (self->model == NULL)
+        return FALSE;
+
+    iters = g_array_new (FALSE, FALSE, sizeof (GtkTreeIter));
+
+    if (self->icon_view != NULL &&
+        gtk_icon_view_get_visible_range (GTK_ICON_VIEW (self->icon_view), &start, &end)) {
+        GtkTreeIter filter_iter, iter;
+        gboolean valid;
+
+        valid = gtk_tree_model_get_iter (self->filter_model, &filter_iter, start);
+        while (valid) {
+            GtkTreePath *path;
+            gboolean at_end;
+
+            gtk_tree_model_filter_convert_iter_to_child_iter (GTK_TREE_MODEL_FILTER (self->filter_model),
+                                                              &iter, &filter_iter);
+            g_array_append_val (iters, iter);
+
+            path = gtk_tree_model_get_path (self->filter_model, &filter_iter);
+            at_end = gtk_tree_path_compare (path, end) >= 0;
+            gtk_tree_path_free (path);
+
+            if (at_end)
+                break;
+
+            valid = gtk_tree_model_iter_next (self->filter_model, &filter_iter);
+        }
+
+        gtk_tree_path_free (start);
+        gtk_tree_path_free (end);
+    }
+
+    /* rows that are not visible anymore lose their pending requests */
+    font_view_model_request_thumbnails (FONT_VIEW_MODEL (self->model),
+                                        (GtkTreeIter *) iters->data, iters->len);
+    g_array_free (iters, TRUE);
+
+    return FALSE;
+}
+
+static void
+queue_update_visible_thumbnails (FontViewApplication *self)
+{
+    if (self->thumbnails_idle_id == 0)
+        self->thumbnails_idle_id = g_idle_add (update_visible_thumbnails, self);
+}
+
+static void
+view_adjustment_changed_cb (GtkAdjustment *adjustment,
+                            gpointer user_data)
+{
+    queue_update_visible_thumbnails (user_data);
+}
+
 static void
 font_view_ensure_model (FontViewApplication *self)
 {
@@ -731,6 +799,7 @@ font_view_application_do_overview (FontViewApplication *self)
     if (self->icon_view == NULL) {
         GtkWidget *icon_view;
         GtkCellRenderer *cell;
+        GtkAdjustment *adjustment;
 
         self->icon_view = icon_view = gtk_icon_view_new_with_model (self->filter_model);
         g_object_set (icon_view,
@@ -765,6 +834,13 @@ font_view_application_do_overview (FontViewApplication *self)
 
         g_signal_connect (icon_view, "button-release-event",
                           G_CALLBACK (icon_view_release_cb), self);
+
+        /* thumbnails are only made for the fonts in view */
+        adjustment = gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (self->swin_view));
+        g_signal_connect (adjustment, "value-changed",
+                          G_CALLBACK (view_adjustment_changed_cb), self);
+        g_signal_connect (adjustment, "changed",
+                          G_CALLBACK (view_adjustment_changed_cb), self);
     }
 
     gtk_notebook_set_current_page (GTK_NOTEBOOK (self->notebook), 0);
@@ -850,6 +926,7 @@ search_text_changed (GtkEntry *entry,
                      FontViewApplication *self)
 {
   gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (self->filter_model));
+  queue_update_visible_thumbnails (self);
 }
 
 static void
@@ -952,6 +1029,11 @@ font_view_application_dispose (GObject *obj)
 {
     FontViewApplication *self = FONT_VIEW_APPLICATION (obj);
 
+    if (self->thumbnails_idle_id != 0) {
+        g_source_remove (self->thumbnails_idle_id);
+        self->thumbnails_idle_id = 0;
+    }
+
     g_clear_object (&self->model);
     g_clear_object (&self->filter_model);
 
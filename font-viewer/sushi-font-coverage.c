@@ -0,0 +1,470 @@
+/*
+ * Copyright (C) 2026 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sushi-font-coverage.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "cache-util.h"
+
+/* The characters a face has a glyph for, in the charmap text is rendered
+ * with, as a bitmap of 256 character blocks. Only the blocks the face has
+ * characters in are stored, so that the whole of Unicode costs a small
+ * index and a few words per block.
+ */
+#define N_BLOCKS (0x110000 >> 8)
+#define WORDS_PER_BLOCK 4
+
+struct _SushiFontCoverage {
+  guint n_blocks;
+  guint16 *blocks;          /* block numbers, ascending */
+  guint64 *bits;            /* WORDS_PER_BLOCK words per block */
+  guint *offsets;           /* characters in the blocks before each one */
+  guint n_chars;
+
+  guint16 block_index[N_BLOCKS]; /* 1 + index in blocks, or 0 */
+};
+
+static guint
+popcount64 (guint64 x)
+{
+  x = x - ((x >> 1) & G_GUINT64_CONSTANT (0x5555555555555555));
+  x = (x & G_GUINT64_CONSTANT (0x3333333333333333)) +
+    ((x >> 2) & G_GUINT64_CONSTANT (0x3333333333333333));
+  x = (x + (x >> 4)) & G_GUINT64_CONSTANT (0x0f0f0f0f0f0f0f0f);
+
+  return (guint) ((x * G_GUINT64_CONSTANT (0x0101010101010101)) >> 56);
+}
+
+static SushiFontCoverage *
+coverage_new_from_blocks (guint n_blocks,
+                          const guint16 *blocks,
+                          const guint64 *bits)
+{
+  SushiFontCoverage *coverage;
+  guint i, j;
+
+  coverage = g_new0 (SushiFontCoverage, 1);
+  coverage->n_blocks = n_blocks;
+  coverage->blocks = g_new (guint16, n_blocks);
+  memcpy (coverage->blocks, blocks, n_blocks * sizeof (guint16));
+  coverage->bits = g_new (guint64, n_blocks * WORDS_PER_BLOCK);
+  memcpy (coverage->bits, bits, n_blocks * WORDS_PER_BLOCK * sizeof (guint64));
+  coverage->offsets = g_new (guint, n_blocks);
+
+  for (i = 0; i < n_blocks; i++) {
+    if (blocks[i] >= N_BLOCKS || (i > 0 && blocks[i] <= blocks[i - 1])) {
+      sushi_font_coverage_free (coverage);
+      return NULL;
+    }
+
+    coverage->block_index[blocks[i]] = i + 1;
+    coverage->offsets[i] = coverage->n_chars;
+
+    for (j = 0; j < WORDS_PER_BLOCK; j++)
+      coverage->n_chars += popcount64 (bits[i * WORDS_PER_BLOCK + j]);
+  }
+
+  return coverage;
+}
+
+SushiFontCoverage *
+sushi_font_coverage_new_for_face (FT_Face face)
+{
+  SushiFontCoverage *coverage;
+  FT_CharMap active;
+  guint64 *all_bits;
+  guint16 *blocks;
+  guint64 *bits;
+  guint n_blocks = 0;
+  gulong c;
+  guint glyph;
+  gint block;
+
+  all_bits = g_new0 (guint64, N_BLOCKS * WORDS_PER_BLOCK);
+  active = face->charmap;
+
+  /* cairo and pango look glyphs up in the Unicode charmap; faces without
+   * one are drawn with the charmap FreeType picked when opening them */
+  if (FT_Select_Charmap (face, FT_ENCODING_UNICODE) != 0 && active != NULL)
+    FT_Set_Charmap (face, active);
+
+  if (face->charmap != NULL) {
+    c = FT_Get_First_Char (face, &glyph);
+
+    while (glyph != 0) {
+      if (c < 0x110000)
+        all_bits[c >> 6] |= G_GUINT64_CONSTANT (1) << (c & 63);
+
+      c = FT_Get_Next_Char (face, c, &glyph);
+    }
+  }
+
+  if (active != NULL)
+    FT_Set_Charmap (face, active);
+
+  blocks = g_new (guint16, N_BLOCKS);
+  bits = g_new (guint64, N_BLOCKS * WORDS_PER_BLOCK);
+
+  for (block = 0; block < N_BLOCKS; block++) {
+    guint64 *words = all_bits + block * WORDS_PER_BLOCK;
+
+    if (words[0] == 0 && words[1] == 0 && words[2] == 0 && words[3] == 0)
+      continue;
+
+    blocks[n_blocks] = block;
+    memcpy (bits + n_blocks * WORDS_PER_BLOCK, words, WORDS_PER_BLOCK * sizeof (guint64));
+    n_blocks++;
+  }
+
+  coverage = coverage_new_from_blocks (n_blocks, blocks, bits);
+
+  g_free (blocks);
+  g_free (bits);
+  g_free (all_bits);
+
+  return coverage;
+}
+
+void
+sushi_font_coverage_free (SushiFontCoverage *coverage)
+{
+  if (coverage == NULL)
+    return;
+
+  g_free (coverage->blocks);
+  g_free (coverage->bits);
+  g_free (coverage->offsets);
+  g_free (coverage);
+}
+
+gboolean
+sushi_font_coverage_contains (SushiFontCoverage *coverage,
+                              gunichar c)
+{
+  guint index;
+
+  if (c >= 0x110000)
+    return FALSE;
+
+  index = coverage->block_index[c >> 8];
+  if (index == 0)
+    return FALSE;
+
+  return (coverage->bits[(index - 1) * WORDS_PER_BLOCK + ((c & 0xff) >> 6)] >> (c & 63)) & 1;
+}
+
+gboolean
+sushi_font_coverage_contains_text (SushiFontCoverage *coverage,
+                                   const gchar *text)
+{
+  const gchar *p;
+
+  for (p = text; *p != '\0'; p = g_utf8_next_char (p)) {
+    if (!sushi_font_coverage_contains (coverage, g_utf8_get_char (p)))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+guint
+sushi_font_coverage_get_n_chars (SushiFontCoverage *coverage)
+{
+  return coverage->n_chars;
+}
+
+/* the characters are numbered in code point order */
+gunichar
+sushi_font_coverage_get_nth_char (SushiFontCoverage *coverage,
+                                  guint n)
+{
+  guint lo, hi, mid, j, bit;
+
+  g_return_val_if_fail (n < coverage->n_chars, 0);
+
+  /* the last block starting at or before n */
+  lo = 0;
+  hi = coverage->n_blocks - 1;
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+
+    if (coverage->offsets[mid] <= n)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  n -= coverage->offsets[lo];
+
+  for (j = 0; j < WORDS_PER_BLOCK; j++) {
+    guint64 word = coverage->bits[lo * WORDS_PER_BLOCK + j];
+    guint count = popcount64 (word);
+
+    if (n >= count) {
+      n -= count;
+      continue;
+    }
+
+    while (n-- > 0)
+      word &= word - 1;
+
+    for (bit = 0; !((word >> bit) & 1); bit++)
+      ;
+
+    return ((gunichar) coverage->blocks[lo] << 8) + j * 64 + bit;
+  }
+
+  g_assert_not_reached ();
+
+  return 0;
+}
+
+/* Coverage cache
+ *
+ * Walking the charmap of a big face is not free, so the coverage is kept
+ * on disk next to the other caches, one file per face, and validated
+ * against the font file's mtime and size. It is shared by the thumbnailer
+ * and the font viewer. Files are touched when used, and the first time a
+ * process adds one, the least recently used are removed if there are more
+ * than FONT_COVERAGE_CACHE_MAX_FILES, which also gets rid of those of
+ * uninstalled fonts.
+ */
+#define FONT_COVERAGE_CACHE_VERSION 3
+#define FONT_COVERAGE_CACHE_TYPE "(xxaqat)"
+#define FONT_COVERAGE_CACHE_DIR "font-coverage"
+#define FONT_COVERAGE_CACHE_MAX_FILES 512
+#define FONT_COVERAGE_CACHE_KEEP_FILES (FONT_COVERAGE_CACHE_MAX_FILES * 3 / 4)
+
+static gchar *
+coverage_cache_get_name (const gchar *uri,
+                         gint face_index)
+{
+  gchar *key, *checksum, *name;
+
+  key = g_strdup_printf ("%d:%s", face_index, uri);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, key, -1);
+  name = g_strconcat (FONT_COVERAGE_CACHE_DIR G_DIR_SEPARATOR_S, checksum, ".coverage", NULL);
+
+  g_free (checksum);
+  g_free (key);
+
+  return name;
+}
+
+static gboolean
+get_file_stamp (const gchar *uri,
+                gint64 *mtime,
+                gint64 *size)
+{
+  GFile *file;
+  GFileInfo *info;
+
+  file = g_file_new_for_uri (uri);
+  info = g_file_query_info (file,
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  g_object_unref (file);
+
+  if (info == NULL)
+    return FALSE;
+
+  *mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+  *size = g_file_info_get_size (info);
+  g_object_unref (info);
+
+  return TRUE;
+}
+
+static SushiFontCoverage *
+coverage_cache_load (const gchar *name,
+                     gint64 mtime,
+                     gint64 size)
+{
+  SushiFontCoverage *coverage = NULL;
+  GVariant *root, *blocks, *bits;
+  gint64 cached_mtime, cached_size;
+  gsize n_blocks, n_words;
+  const guint16 *block_data;
+  const guint64 *bit_data;
+
+  root = cache_util_load (name, G_VARIANT_TYPE (FONT_COVERAGE_CACHE_TYPE),
+                          FONT_COVERAGE_CACHE_VERSION);
+  if (root == NULL)
+    return NULL;
+
+  g_variant_get (root, "(xx@aq@at)", &cached_mtime, &cached_size,
+                 &blocks, &bits);
+
+  if (cached_mtime == mtime && cached_size == size) {
+    block_data = g_variant_get_fixed_array (blocks, &n_blocks, sizeof (guint16));
+    bit_data = g_variant_get_fixed_array (bits, &n_words, sizeof (guint64));
+
+    if (n_words == n_blocks * WORDS_PER_BLOCK)
+      coverage = coverage_new_from_blocks (n_blocks, block_data, bit_data);
+  }
+
+  g_variant_unref (blocks);
+  g_variant_unref (bits);
+  g_variant_unref (root);
+
+  return coverage;
+}
+
+static void
+coverage_cache_save (const gchar *name,
+                     SushiFontCoverage *coverage,
+                     gint64 mtime,
+                     gint64 size)
+{
+  GVariant *contents;
+
+  contents = g_variant_new ("(xx@aq@at)", mtime, size,
+                            g_variant_new_fixed_array (G_VARIANT_TYPE_UINT16,
+                                                       coverage->blocks,
+                                                       coverage->n_blocks,
+                                                       sizeof (guint16)),
+                            g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                       coverage->bits,
+                                                       coverage->n_blocks * WORDS_PER_BLOCK,
+                                                       sizeof (guint64)));
+
+  cache_util_save (name, FONT_COVERAGE_CACHE_VERSION, contents);
+}
+
+/* marks the cache file as recently used */
+static void
+coverage_cache_touch (const gchar *name)
+{
+  gchar *filename;
+
+  filename = cache_util_get_filename (name);
+  g_utime (filename, NULL);
+  g_free (filename);
+}
+
+typedef struct {
+  gchar *filename;
+  gint64 mtime;
+} CoverageCacheFile;
+
+static gint
+coverage_cache_file_compare (gconstpointer a,
+                             gconstpointer b)
+{
+  const CoverageCacheFile *file_a = a;
+  const CoverageCacheFile *file_b = b;
+
+  /* most recently used first */
+  if (file_a->mtime != file_b->mtime)
+    return file_a->mtime > file_b->mtime ? -1 : 1;
+
+  return 0;
+}
+
+static void
+coverage_cache_prune (void)
+{
+  static gsize pruned = 0;
+  GArray *files;
+  GDir *dir;
+  const gchar *basename;
+  gchar *dirname;
+  guint i;
+
+  if (!g_once_init_enter (&pruned))
+    return;
+
+  dirname = cache_util_get_filename (FONT_COVERAGE_CACHE_DIR);
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir == NULL) {
+    g_free (dirname);
+    g_once_init_leave (&pruned, 1);
+    return;
+  }
+
+  files = g_array_new (FALSE, FALSE, sizeof (CoverageCacheFile));
+
+  while ((basename = g_dir_read_name (dir)) != NULL) {
+    CoverageCacheFile file;
+    GStatBuf buf;
+
+    if (!g_str_has_suffix (basename, ".coverage"))
+      continue;
+
+    file.filename = g_build_filename (dirname, basename, NULL);
+    if (g_stat (file.filename, &buf) != 0) {
+      g_free (file.filename);
+      continue;
+    }
+
+    file.mtime = buf.st_mtime;
+    g_array_append_val (files, file);
+  }
+
+  g_dir_close (dir);
+
+  if (files->len > FONT_COVERAGE_CACHE_MAX_FILES) {
+    g_array_sort (files, coverage_cache_file_compare);
+
+    for (i = FONT_COVERAGE_CACHE_KEEP_FILES; i < files->len; i++)
+      g_unlink (g_array_index (files, CoverageCacheFile, i).filename);
+  }
+
+  for (i = 0; i < files->len; i++)
+    g_free (g_array_index (files, CoverageCacheFile, i).filename);
+
+  g_array_free (files, TRUE);
+  g_free (dirname);
+
+  g_once_init_leave (&pruned, 1);
+}
+
+/* Returns the coverage of the face loaded from @uri, from the cache if it
+ * is there and up to date, building and caching it otherwise.
+ */
+SushiFontCoverage *
+sushi_font_coverage_lookup (const gchar *uri,
+                            gint face_index,
+                            FT_Face face)
+{
+  SushiFontCoverage *coverage;
+  gchar *name;
+  gint64 mtime, size;
+
+  if (uri == NULL || !get_file_stamp (uri, &mtime, &size))
+    return sushi_font_coverage_new_for_face (face);
+
+  name = coverage_cache_get_name (uri, face_index);
+  coverage = coverage_cache_load (name, mtime, size);
+
+  if (coverage == NULL) {
+    coverage = sushi_font_coverage_new_for_face (face);
+    coverage_cache_save (name, coverage, mtime, size);
+    coverage_cache_prune ();
+  } else {
+    coverage_cache_touch (name);
+  }
+
+  g_free (name);
+
+  return coverage;
+}
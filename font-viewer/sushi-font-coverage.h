@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2026 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SUSHI_FONT_COVERAGE_H__
+#define __SUSHI_FONT_COVERAGE_H__
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <glib.h>
+
+typedef struct _SushiFontCoverage SushiFontCoverage;
+
+SushiFontCoverage *sushi_font_coverage_new_for_face (FT_Face face);
+
+SushiFontCoverage *sushi_font_coverage_lookup (const gchar *uri,
+                                               gint face_index,
+                                               FT_Face face);
+
+void sushi_font_coverage_free (SushiFontCoverage *coverage);
+
+gboolean sushi_font_coverage_contains (SushiFontCoverage *coverage,
+                                       gunichar c);
+
+gboolean sushi_font_coverage_contains_text (SushiFontCoverage *coverage,
+                                            const gchar *text);
+
+guint sushi_font_coverage_get_n_chars (SushiFontCoverage *coverage);
+
+gunichar sushi_font_coverage_get_nth_char (SushiFontCoverage *coverage,
+                                           guint n);
+
+#endif /* __SUSHI_FONT_COVERAGE_H__ */
@@ -26,6 +26,7 @@
  */
 
 #include "sushi-font-widget.h"
+#include "sushi-font-coverage.h"
 #include "sushi-font-loader.h"
 
 #include <math.h>
@@ -49,6 +50,7 @@ struct _SushiFontWidgetPrivate {
   FT_Library library;
   FT_Face face;
   gchar *face_contents;
+  SushiFontCoverage *coverage;
 
   const gchar *lowercase_text;
   const gchar *uppercase_text;
@@ -112,77 +114,15 @@ draw_string (SushiFontWidget *self,
   *pos_y += LINE_SPACING / 2;
 }
 
-static gboolean
-check_font_contain_text (FT_Face face,
-                         const gchar *text)
-{
-  gunichar *string;
-  glong len, idx, map;
-  FT_CharMap charmap;
-  gboolean retval = FALSE;
-
-  string = g_utf8_to_ucs4_fast (text, -1, &len);
-
-  for (map = 0; map < face->num_charmaps; map++) {
-    charmap = face->charmaps[map];
-    FT_Set_Charmap (face, charmap);
-
-    retval = TRUE;
-
-    for (idx = 0; idx < len; idx++) {
-      gunichar c = string[idx];
-
-      if (!FT_Get_Char_Index (face, c)) {
-        retval = FALSE;
-        break;
-      }
-    }
-
-    if (retval)
-      break;
-  }
-
-  g_free (string);
-
-  return retval;
-}
-
 static gchar *
-build_charlist_for_face (FT_Face face,
-                         gint *length)
-{
-  GString *string;
-  gulong c;
-  guint glyph;
-  gint total_chars = 0;
-
-  string = g_string_new (NULL);
-
-  c = FT_Get_First_Char (face, &glyph);
-
-  while (glyph != 0) {
-    g_string_append_unichar (string, (gunichar) c);
-    c = FT_Get_Next_Char (face, c, &glyph);
-    total_chars++;
-  }
-
-  if (length)
-    *length = total_chars;
-
-  return g_string_free (string, FALSE);
-}
-
-static gchar *
-random_string_from_available_chars (FT_Face face,
+random_string_from_available_chars (SushiFontCoverage *coverage,
                                     gint n_chars)
 {
-  gchar *chars;
   gint idx, rand, total_chars;
   GString *retval;
-  gchar *ptr, *end;
 
   idx = 0;
-  chars = build_charlist_for_face (face, &total_chars);
+  total_chars = sushi_font_coverage_get_n_chars (coverage);
 
   if (total_chars == 0)
     return NULL;
@@ -192,10 +132,8 @@ random_string_from_available_chars (FT_Face face,
   while (idx < n_chars) {
     rand = g_random_int_range (0, total_chars);
 
-    ptr = g_utf8_offset_to_pointer (chars, rand);
-    end = g_utf8_find_next_char (ptr, NULL);
-
-    g_string_append_len (retval, ptr, end - ptr);
+    g_string_append_unichar (retval,
+                             sushi_font_coverage_get_nth_char (coverage, rand));
     idx++;
   }
 
@@ -209,12 +147,12 @@ set_pango_sample_string (SushiFontWidget *self)
   gboolean retval = FALSE;
 
   sample_string = pango_language_get_sample_string (pango_language_from_string (NULL));
-  if (check_font_contain_text (self->priv->face, sample_string))
+  if (sushi_font_coverage_contains_text (self->priv->coverage, sample_string))
     retval = TRUE;
 
   if (!retval) {
     sample_string = pango_language_get_sample_string (pango_language_from_string ("C"));
-    if (check_font_contain_text (self->priv->face, sample_string))
+    if (sushi_font_coverage_contains_text (self->priv->coverage, sample_string))
       retval = TRUE;
   }
 
@@ -232,23 +170,23 @@ build_strings_for_face (SushiFontWidget *self)
   /* if we don't have lowercase/uppercase/punctuation text in the face,
    * we omit it directly, and render a random text below.
    */
-  if (check_font_contain_text (self->priv->face, lowercase_text_stock))
+  if (sushi_font_coverage_contains_text (self->priv->coverage, lowercase_text_stock))
     self->priv->lowercase_text = lowercase_text_stock;
   else
     self->priv->lowercase_text = NULL;
 
-  if (check_font_contain_text (self->priv->face, uppercase_text_stock))
+  if (sushi_font_coverage_contains_text (self->priv->coverage, uppercase_text_stock))
     self->priv->uppercase_text = uppercase_text_stock;
   else
     self->priv->uppercase_text = NULL;
 
-  if (check_font_contain_text (self->priv->face, punctuation_text_stock))
+  if (sushi_font_coverage_contains_text (self->priv->coverage, punctuation_text_stock))
     self->priv->punctuation_text = punctuation_text_stock;
   else
     self->priv->punctuation_text = NULL;
 
   if (!set_pango_sample_string (self))
-    self->priv->sample_string = random_string_from_available_chars (self->priv->face, 36);
+    self->priv->sample_string = random_string_from_available_chars (self->priv->coverage, 36);
 
   g_free (self->priv->font_name);
   self->priv->font_name = NULL;
@@ -258,7 +196,7 @@ build_strings_for_face (SushiFontWidget *self)
       g_strconcat (self->priv->face->family_name, " ",
                    self->priv->face->style_name, NULL);
 
-    if (check_font_contain_text (self->priv->face, font_name))
+    if (sushi_font_coverage_contains_text (self->priv->coverage, font_name))
       self->priv->font_name = font_name;
     else
       g_free (font_name);
@@ -565,6 +503,9 @@ font_face_async_ready_cb (GObject *object,
     return;
   }
 
+  self->priv->coverage = sushi_font_coverage_lookup (self->priv->uri,
+                                                     self->priv->face_index,
+                                                     self->priv->face);
   build_strings_for_face (self);
 
   gtk_widget_queue_resize (GTK_WIDGET (self));
@@ -655,6 +596,7 @@ sushi_font_widget_finalize (GObject *object)
   g_free (self->priv->font_name);
   g_free (self->priv->sample_string);
   g_free (self->priv->face_contents);
+  sushi_font_coverage_free (self->priv->coverage);
 
   if (self->priv->library != NULL) {
     FT_Done_FreeType (self->priv->library);
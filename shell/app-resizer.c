@@ -24,6 +24,9 @@
 #include "app-resizer.h"
 
 static void app_resizer_size_allocate (GtkWidget * resizer, GtkAllocation * allocation);
+static void app_resizer_destroy (GtkWidget * widget);
+static void app_resizer_queue_update_visible (AppResizer * widget);
+static void app_resizer_vadjustment_notify (GObject * object, GParamSpec * pspec, gpointer user_data);
 static gboolean app_resizer_paint_window (GtkWidget * widget, cairo_t * cr, AppShellData * app_data);
 
 G_DEFINE_TYPE (AppResizer, app_resizer, GTK_TYPE_LAYOUT);
@@ -35,6 +38,7 @@ app_resizer_class_init (AppResizerClass * klass)
 
 	widget_class = GTK_WIDGET_CLASS (klass);
 	widget_class->size_allocate = app_resizer_size_allocate;
+	widget_class->destroy = app_resizer_destroy;
 }
 
 static void
@@ -42,6 +46,35 @@ app_resizer_init (AppResizer * window)
 {
     gtk_style_context_add_class (gtk_widget_get_style_context (GTK_WIDGET (window)),
                                  GTK_STYLE_CLASS_VIEW);
+
+    g_signal_connect (window, "notify::vadjustment",
+                      G_CALLBACK (app_resizer_vadjustment_notify), NULL);
+}
+
+static void
+app_resizer_destroy (GtkWidget * widget)
+{
+	AppResizer *resizer = APP_RESIZER (widget);
+
+	if (resizer->update_visible_id)
+	{
+		g_source_remove (resizer->update_visible_id);
+		resizer->update_visible_id = 0;
+	}
+
+	GTK_WIDGET_CLASS (app_resizer_parent_class)->destroy (widget);
+}
+
+static void
+app_resizer_vadjustment_notify (GObject * object, GParamSpec * pspec, gpointer user_data)
+{
+	AppResizer *resizer = APP_RESIZER (object);
+	GtkAdjustment *adjustment;
+
+	adjustment = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (resizer));
+	if (adjustment)
+		g_signal_connect_object (adjustment, "value-changed",
+			G_CALLBACK (app_resizer_queue_update_visible), resizer, G_CONNECT_SWAPPED);
 }
 
 void
@@ -60,53 +93,412 @@ remove_container_entries (GtkContainer * widget)
 		g_list_free (children);
 }
 
+/* Only the launchers in the rows in or near the visible part of the layout
+ * are attached to their table; the rows above and below are made up for by
+ * the margins of the table. All rows get the height of the tallest launcher
+ * seen so far, so the position of a row follows from its index alone.
+ */
+#define APP_RESIZER_TABLE_KEY "App Resizer Table Data"
+
+typedef struct
+{
+	GPtrArray *launchers;
+	gint first_row;
+	gint last_row;	/* one past the last attached row */
+	gulong focus_id;
+} AppResizerTable;
+
 static void
-resize_table (AppResizer *widget, GtkGrid * table, gint columns)
+app_resizer_table_free (AppResizerTable * data)
 {
-	remove_container_entries (GTK_CONTAINER (table));
-	widget->column = columns;
+	g_ptr_array_unref (data->launchers);
+	g_free (data);
+}
+
+static AppResizerTable *
+get_table_data (GtkGrid * table)
+{
+	AppResizerTable *data;
+
+	data = g_object_get_data (G_OBJECT (table), APP_RESIZER_TABLE_KEY);
+	if (!data)
+	{
+		data = g_new0 (AppResizerTable, 1);
+		data->launchers = g_ptr_array_new ();
+		g_object_set_data_full (G_OBJECT (table), APP_RESIZER_TABLE_KEY, data,
+			(GDestroyNotify) app_resizer_table_free);
+	}
+
+	return data;
 }
 
 static void
-relayout_table (AppResizer *widget, GtkGrid * table, GList * element_list)
+get_visible_range (AppResizer * widget, gdouble * top, gdouble * bottom)
+{
+	GtkAdjustment *adjustment;
+	gdouble value, page_size;
+
+	adjustment = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (widget));
+	value = adjustment ? gtk_adjustment_get_value (adjustment) : 0;
+	page_size = adjustment ? gtk_adjustment_get_page_size (adjustment) : 0;
+
+	/* keep a page above and below ready for scrolling */
+	*top = value - page_size;
+	*bottom = value + 2 * page_size;
+}
+
+static gboolean
+attach_element (AppResizer * widget, GtkGrid * table, gint index)
+{
+	AppResizerTable *data = get_table_data (table);
+	GtkWidget *element = g_ptr_array_index (data->launchers, index);
+	gint columns = widget->column;
+	gint natural_width, height;
+
+	gtk_grid_attach (table, element, index % columns, index / columns, 1, 1);
+	if (!gtk_widget_get_visible (element))
+		gtk_widget_show_all (element);
+
+	gtk_widget_get_preferred_width (element, NULL, &natural_width);
+	gtk_widget_get_preferred_height_for_width (element, natural_width, &height, NULL);
+	if (height > widget->cached_element_height)
+	{
+		widget->cached_element_height = height;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* the y of the first row of the table, in layout coordinates */
+static gint
+get_table_y (GtkGrid * table)
 {
-	gint row = 0, col = 0;
-	do
+	GtkAllocation allocation;
+
+	gtk_widget_get_allocation (GTK_WIDGET (table), &allocation);
+	return allocation.y - gtk_widget_get_margin_top (GTK_WIDGET (table));
+}
+
+/* Attaches the rows of the table from first to last, and detaches the
+ * others. Returns TRUE if a launcher taller than the rows so far was
+ * attached, which moves all the rows.
+ */
+static gboolean
+attach_rows (AppResizer * widget, GtkGrid * table, gint first, gint last)
+{
+	AppResizerTable *data = get_table_data (table);
+	gint columns = widget->column;
+	gint n_launchers = data->launchers->len;
+	gint n_rows, row, stride, spacing, i;
+	gint margin_top, margin_bottom;
+	gboolean grew = FALSE;
+
+	n_rows = (n_launchers + columns - 1) / columns;
+	spacing = gtk_grid_get_row_spacing (table);
+
+	for (row = data->first_row; row < data->last_row; row++)
 	{
-		GtkWidget *element = GTK_WIDGET (element_list->data);
-		gtk_grid_attach (table, element, col, row, 1, 1);
-		col++;
-		if (col == widget->column)
+		if (row >= first && row < last)
+			continue;
+
+		for (i = row * columns; i < MIN ((row + 1) * columns, n_launchers); i++)
+			gtk_container_remove (GTK_CONTAINER (table), g_ptr_array_index (data->launchers, i));
+	}
+
+	for (row = first; row < last; row++)
+	{
+		if (row >= data->first_row && row < data->last_row)
+			continue;
+
+		for (i = row * columns; i < MIN ((row + 1) * columns, n_launchers); i++)
+			grew |= attach_element (widget, table, i);
+	}
+
+	data->first_row = first;
+	data->last_row = last;
+
+	for (i = first * columns; i < MIN (last * columns, n_launchers); i++)
+	{
+		GtkWidget *element = g_ptr_array_index (data->launchers, i);
+		gint width, height;
+
+		gtk_widget_get_size_request (element, &width, &height);
+		if (height != widget->cached_element_height)
+			gtk_widget_set_size_request (element, width, widget->cached_element_height);
+	}
+
+	stride = widget->cached_element_height + spacing;
+	if (first == last)
+	{
+		margin_top = n_rows > 0 ? n_rows * stride - spacing : 0;
+		margin_bottom = 0;
+	}
+	else
+	{
+		margin_top = first * stride;
+		margin_bottom = (n_rows - last) * stride;
+	}
+
+	if (gtk_widget_get_margin_top (GTK_WIDGET (table)) != margin_top)
+		gtk_widget_set_margin_top (GTK_WIDGET (table), margin_top);
+	if (gtk_widget_get_margin_bottom (GTK_WIDGET (table)) != margin_bottom)
+		gtk_widget_set_margin_bottom (GTK_WIDGET (table), margin_bottom);
+
+	return grew;
+}
+
+static gint
+get_focus_index (GtkGrid * table)
+{
+	GtkWidget *focus_child;
+	guint index;
+
+	focus_child = gtk_container_get_focus_child (GTK_CONTAINER (table));
+	if (focus_child && g_ptr_array_find (get_table_data (table)->launchers, focus_child, &index))
+		return index;
+
+	return -1;
+}
+
+/* Attaches the rows of the table between top and bottom, in layout
+ * coordinates, along with the row of the focused launcher, and detaches
+ * the others.
+ */
+static gboolean
+update_table (AppResizer * widget, GtkGrid * table, gdouble top, gdouble bottom)
+{
+	AppResizerTable *data = get_table_data (table);
+	gint columns = widget->column;
+	gint n_rows, first, last, focus_index, stride;
+
+	n_rows = (data->launchers->len + columns - 1) / columns;
+
+	if (widget->cached_element_height == -1)
+	{
+		/* nothing measured yet, so start with the first row */
+		first = 0;
+		last = MIN (1, n_rows);
+	}
+	else
+	{
+		gint table_y = get_table_y (table);
+
+		stride = MAX (1, widget->cached_element_height + gtk_grid_get_row_spacing (table));
+		first = CLAMP ((gint) ((top - table_y) / stride), 0, n_rows);
+		last = CLAMP ((gint) ((bottom - table_y) / stride) + 1, 0, n_rows);
+		if (first >= last)
+			first = last = 0;
+	}
+
+	/* a launcher loses the focus when it is detached */
+	focus_index = get_focus_index (table);
+	if (focus_index >= 0)
+	{
+		if (first == last)
+		{
+			first = focus_index / columns;
+			last = first + 1;
+		}
+		else
 		{
-			col = 0;
-			row++;
+			first = MIN (first, focus_index / columns);
+			last = MAX (last, focus_index / columns + 1);
 		}
 	}
-	while (NULL != (element_list = g_list_next (element_list)));
+
+	return attach_rows (widget, table, first, last);
+}
+
+/* Keyboard focus can only go to attached launchers, so the tables move it
+ * themselves: the launcher that gets it is attached first, and the view is
+ * scrolled to it. Moving out of the first or last launcher is left to the
+ * default handler, which takes the focus out of the table.
+ */
+static gboolean
+table_focus (GtkWidget * table_widget, GtkDirectionType direction, AppResizer * widget)
+{
+	GtkGrid *table = GTK_GRID (table_widget);
+	AppResizerTable *data = get_table_data (table);
+	GtkAdjustment *adjustment;
+	GtkWidget *target;
+	gint columns = widget->column;
+	gint n_launchers = data->launchers->len;
+	gint index, target_index = -1, row, first, last;
+
+	if (n_launchers == 0 || columns < 1)
+		return FALSE;
+
+	index = get_focus_index (table);
+	if (index < 0)
+	{
+		/* coming into the table */
+		if (gtk_widget_has_focus (table_widget))
+			return FALSE;
+
+		switch (direction)
+		{
+		case GTK_DIR_TAB_BACKWARD:
+		case GTK_DIR_UP:
+		case GTK_DIR_LEFT:
+			target_index = n_launchers - 1;
+			break;
+		default:
+			target_index = 0;
+			break;
+		}
+	}
+	else
+	{
+		switch (direction)
+		{
+		case GTK_DIR_TAB_FORWARD:
+			target_index = index + 1;
+			break;
+		case GTK_DIR_TAB_BACKWARD:
+			target_index = index - 1;
+			break;
+		case GTK_DIR_RIGHT:
+			if (index % columns < columns - 1)
+				target_index = index + 1;
+			break;
+		case GTK_DIR_LEFT:
+			if (index % columns > 0)
+				target_index = index - 1;
+			break;
+		case GTK_DIR_DOWN:
+			/* the last row may be shorter */
+			if (index / columns < (n_launchers - 1) / columns)
+				target_index = MIN (index + columns, n_launchers - 1);
+			break;
+		case GTK_DIR_UP:
+			target_index = index - columns;
+			break;
+		}
+
+		if (target_index < 0 || target_index >= n_launchers)
+			return FALSE;
+	}
+
+	row = target_index / columns;
+	first = data->first_row;
+	last = data->last_row;
+	if (first == last)
+	{
+		first = row;
+		last = row + 1;
+	}
+	else
+	{
+		first = MIN (first, row);
+		last = MAX (last, row + 1);
+	}
+
+	attach_rows (widget, table, first, last);
+
+	target = g_ptr_array_index (data->launchers, target_index);
+	gtk_widget_grab_focus (target);
+
+	/* the launcher may have just been attached and not be allocated yet,
+	 * but where its row is follows from its index */
+	adjustment = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (widget));
+	if (adjustment && widget->cached_element_height != -1)
+	{
+		gint stride = widget->cached_element_height + gtk_grid_get_row_spacing (table);
+		gint y = get_table_y (table) + row * stride;
+
+		gtk_adjustment_clamp_page (adjustment, y, y + widget->cached_element_height);
+	}
+
+	app_resizer_queue_update_visible (widget);
+
+	return TRUE;
+}
+
+static gboolean
+app_resizer_update_visible (gpointer user_data)
+{
+	AppResizer *widget = APP_RESIZER (user_data);
+	gdouble top, bottom;
+	gboolean grew = FALSE;
+	GList *table_list;
+
+	widget->update_visible_id = 0;
+
+	get_visible_range (widget, &top, &bottom);
+
+	for (table_list = widget->cached_tables_list; table_list != NULL;
+		table_list = g_list_next (table_list))
+	{
+		grew |= update_table (widget, GTK_GRID (table_list->data), top, bottom);
+	}
+
+	/* the rows moved, so what is visible has to be worked out again */
+	if (grew)
+		app_resizer_queue_update_visible (widget);
+
+	return FALSE;
+}
+
+static void
+app_resizer_queue_update_visible (AppResizer * widget)
+{
+	/* before the next frame is drawn */
+	if (!widget->update_visible_id)
+		widget->update_visible_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+			app_resizer_update_visible, widget, NULL);
+}
+
+static void
+resize_table (AppResizer *widget, GtkGrid * table, gint columns)
+{
+	AppResizerTable *data = get_table_data (table);
+
+	remove_container_entries (GTK_CONTAINER (table));
+	data->first_row = 0;
+	data->last_row = 0;
+	widget->column = columns;
+}
+
+static void
+relayout_table (AppResizer *widget, GtkGrid * table)
+{
+	gdouble top, bottom;
+
+	get_visible_range (widget, &top, &bottom);
+	update_table (widget, table, top, bottom);
+	app_resizer_queue_update_visible (widget);
 }
 
 void
 app_resizer_layout_table_default (AppResizer * widget, GtkGrid * table, GList * element_list)
 {
+	AppResizerTable *data = get_table_data (table);
+
+	if (!data->focus_id)
+		data->focus_id = g_signal_connect (table, "focus", G_CALLBACK (table_focus), widget);
+
 	resize_table (widget, table, widget->cur_num_cols);
-	relayout_table (widget, table, element_list);
+
+	g_ptr_array_set_size (data->launchers, 0);
+	for (; element_list; element_list = g_list_next (element_list))
+		g_ptr_array_add (data->launchers, element_list->data);
+
+	relayout_table (widget, table);
 }
 
 static void
 relayout_tables (AppResizer * widget, gint num_cols)
 {
 	GtkGrid *table;
-	GList *table_list, *launcher_list;
+	GList *table_list;
 
 	for (table_list = widget->cached_tables_list; table_list != NULL;
 		table_list = g_list_next (table_list))
 	{
 		table = GTK_GRID (table_list->data);
-		launcher_list = gtk_container_get_children (GTK_CONTAINER (table));
-		launcher_list = g_list_reverse (launcher_list);	/* Fixme - ugly hack because table stores prepend */
 		resize_table (widget, table, num_cols);
-		relayout_table (widget, table, launcher_list);
-		g_list_free (launcher_list);
+		relayout_table (widget, table);
 	}
 }
 
@@ -120,10 +512,8 @@ calculate_num_cols (AppResizer * resizer, gint avail_width)
 		if (resizer->cached_element_width == -1)
 		{
 			GtkGrid *table = GTK_GRID (resizer->cached_tables_list->data);
-			GList *children = gtk_container_get_children (GTK_CONTAINER (table));
-			GtkWidget *table_element = GTK_WIDGET (children->data);
+			GtkWidget *table_element = g_ptr_array_index (get_table_data (table)->launchers, 0);
 			gint natural_width;
-			g_list_free (children);
 
 			gtk_widget_get_preferred_width (table_element, NULL, &natural_width);
 			resizer->cached_element_width = natural_width;
@@ -157,10 +547,19 @@ relayout_tables_if_needed (AppResizer * widget, gint avail_width, gint current_n
 	return current_num_cols;
 }
 
+/* The caller owns the list, and has to unset it here before freeing it. */
 void
 app_resizer_set_table_cache (AppResizer * widget, GList * cache_list)
 {
 	widget->cached_tables_list = cache_list;
+
+	if (cache_list)
+		app_resizer_queue_update_visible (widget);
+	else if (widget->update_visible_id)
+	{
+		g_source_remove (widget->update_visible_id);
+		widget->update_visible_id = 0;
+	}
 }
 
 static void
@@ -174,6 +573,9 @@ app_resizer_size_allocate (GtkWidget * widget, GtkAllocation * allocation)
 	static gboolean first_time = TRUE;
 	gint new_num_cols;
 
+	/* the tables may have moved */
+	app_resizer_queue_update_visible (resizer);
+
 	if (first_time)
 	{
 		/* we are letting the first show be the "natural" size of the child widget so do nothing. */
@@ -240,6 +642,7 @@ app_resizer_new (GtkBox * child, gint initial_num_columns, gboolean homogeneous,
 
 	widget = g_object_new (APP_RESIZER_TYPE, NULL);
 	widget->cached_element_width = -1;
+	widget->cached_element_height = -1;
 	widget->cur_num_cols = initial_num_columns;
 	widget->table_elements_homogeneous = homogeneous;
 	widget->setting_style = FALSE;
@@ -46,6 +46,7 @@ struct _AppResizer
 	GtkBox *child;
 	GList *cached_tables_list;
 	gint cached_element_width;
+	gint cached_element_height;	/* height of every row, the tallest launcher seen */
 	gint cached_table_spacing;
 	gboolean table_elements_homogeneous;
 	gint cur_num_cols;
@@ -53,6 +54,8 @@ struct _AppResizer
 
 	guint column;
 	AppShellData *app_data;
+
+	guint update_visible_id;
 };
 
 struct _AppResizerClass
@@ -32,8 +32,10 @@
 #include <stdlib.h>
 
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 
 #include "app-shell.h"
+#include "cache-util.h"
 #include "shell-window.h"
 #include "app-resizer.h"
 #include "slab-section.h"
@@ -44,6 +46,8 @@
 #include "themed-icon.h"
 
 #define TILE_EXEC_NAME "Tile_desktop_exec_name"
+#define TILE_DESKTOP_SOURCE "Tile_desktop_source"
+#define TILE_SEARCH_KEY "Tile_search_key"
 #define CC_SCHEMA "org.mate.control-center"
 #define EXIT_SHELL_ON_ACTION_START "cc-exit-shell-on-action-start"
 #define EXIT_SHELL_ON_ACTION_HELP "cc-exit-shell-on-action-help"
@@ -56,11 +60,33 @@ static GtkWidget *create_groups_section (AppShellData * app_data, const gchar *
 static GtkWidget *create_actions_section (AppShellData * app_data, const gchar * title,
 	void (*actions_handler) (Tile *, TileEvent *, gpointer));
 
-static void generate_category (const char * category, MateMenuTreeDirectory * root_dir, AppShellData * app_data, gboolean recursive);
+typedef struct
+{
+	gchar *path;
+	gint64 mtime;
+	/* what the tile shows, and what check_specific_apps_hack () looks at */
+	gchar *name;
+	gchar *description;
+	gchar *comment;
+	gchar *icon;
+	gchar *exec;
+	gchar *categories;
+} LauncherSource;
+
+typedef struct
+{
+	gchar *category;
+	GPtrArray *launchers;	/* of LauncherSource, in menu order */
+} MenuSnapshotCategory;
+
+static MenuSnapshotCategory *generate_category (const char * category, MateMenuTreeDirectory * root_dir, AppShellData * app_data,
+	GHashTable * known, gboolean recursive);
 static void generate_launchers (MateMenuTreeDirectory * root_dir, AppShellData * app_data,
-	CategoryData * cat_data, gboolean recursive);
+	GHashTable * known, MenuSnapshotCategory * snap, gboolean recursive);
 static void generate_new_apps (AppShellData * app_data);
-static void insert_launcher_into_category (CategoryData * cat_data, MateDesktopItem * desktop_item,
+static GtkWidget *insert_launcher_into_category (CategoryData * cat_data, const gchar * desktop_item_id,
+	AppShellData * app_data);
+static void add_launcher_to_category (CategoryData * cat_data, GtkWidget * launcher, const gchar * exec,
 	AppShellData * app_data);
 
 static gboolean main_keypress_callback (GtkWidget * widget, GdkEventKey * event,
@@ -77,7 +103,8 @@ static gboolean handle_filter_changed (NldSearchBar * search_bar, const char *te
 static void handle_group_clicked (Tile * tile, TileEvent * event, gpointer user_data);
 static void set_state (AppShellData * app_data, GtkWidget * widget);
 static void populate_groups_section (AppShellData * app_data);
-static void generate_filtered_lists (gpointer catdata, gpointer user_data);
+static void generate_filtered_lists (AppShellData * app_data, const gchar * filter_string);
+static void build_search_index (AppShellData * app_data);
 static void show_no_results_message (AppShellData * app_data, GtkWidget * containing_vbox);
 static void populate_application_category_sections (AppShellData * app_data,
 	GtkWidget * containing_vbox);
@@ -371,6 +398,7 @@ relayout_shell_incremental (AppShellData * app_data)
 	app_data->filtered_out_everything = TRUE;
 	app_data->incremental_relayout_cat_list = app_data->categories_list;
 
+	app_resizer_set_table_cache (APP_RESIZER (app_data->category_layout), NULL);
 	if (app_data->cached_tables_list)
 		g_list_free (app_data->cached_tables_list);
 	app_data->cached_tables_list = NULL;
@@ -563,8 +591,7 @@ handle_filter_changed_delayed (gpointer user_data)
 {
 	AppShellData *app_data = (AppShellData *) user_data;
 
-	g_list_foreach (app_data->categories_list, generate_filtered_lists,
-		(gpointer) app_data->filter_string);
+	generate_filtered_lists (app_data, app_data->filter_string);
 	app_data->last_clicked_launcher = NULL;
 
 	/*  showing the updates incremtally is very visually distracting. Much worse than just blanking until
@@ -610,93 +637,227 @@ handle_filter_changed (NldSearchBar * search_bar, const char *text, gpointer dat
 	return FALSE;
 }
 
+/* The search index maps every byte trigram of the casefolded search keys of
+   the launchers to the set of launchers containing it, so that a filter only
+   has to look at the launchers sharing its rarest trigram. */
+#define SEARCH_TRIGRAM(s) \
+	GUINT_TO_POINTER (((guchar) (s)[0] << 16) | ((guchar) (s)[1] << 8) | (guchar) (s)[2])
+
+static gchar *
+get_launcher_search_key (ApplicationTile * launcher)
+{
+	const gchar *filename = g_object_get_data (G_OBJECT (launcher), TILE_EXEC_NAME);
+	gchar *text, *key;
+
+	text = g_strjoin ("\n", launcher->name ? launcher->name : "",
+		launcher->description ? launcher->description : "",
+		filename ? filename : "", NULL);
+	key = g_utf8_casefold (text, -1);
+	g_free (text);
+
+	return key;
+}
+
 static void
-generate_filtered_lists (gpointer catdata, gpointer user_data)
+build_search_index (AppShellData * app_data)
 {
-	CategoryData *data = (CategoryData *) catdata;
+	GList *cat_list;
+	GList *temp;
 
-	/* Fixme - everywhere you use ascii you need to fix up for multibyte */
-	gchar *filter_string = g_ascii_strdown (user_data, -1);
-	gchar *temp1, *temp2;
-	GList *launcher_list = data->launcher_list;
+	if (app_data->search_index)
+		g_hash_table_destroy (app_data->search_index);
+	app_data->search_index = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+		NULL, (GDestroyNotify) g_hash_table_destroy);
 
-	g_list_free (data->filtered_launcher_list);
-	data->filtered_launcher_list = NULL;
+	/* the filtered lists now hold every launcher again */
+	g_free (app_data->search_filter);
+	app_data->search_filter = NULL;
 
-	do
+	for (cat_list = app_data->categories_list; cat_list; cat_list = g_list_next (cat_list))
 	{
-		ApplicationTile *launcher = APPLICATION_TILE (launcher_list->data);
-		const gchar *filename;
-
-		temp1 = NULL;
-		temp2 = NULL;
-
-		/* Since the filter may remove this entry from the
-		   container it will not get a mouse out event */
-		gtk_widget_set_state_flags (GTK_WIDGET (launcher), GTK_STATE_FLAG_NORMAL, FALSE);
-		filename = g_object_get_data (G_OBJECT (launcher), TILE_EXEC_NAME); /* do I need to free this */
-
-		temp1 = g_ascii_strdown (launcher->name, -1);
-		if (launcher->description)
-			temp2 = g_ascii_strdown (launcher->description, -1);
-		if (g_strrstr (temp1, filter_string) || (launcher->description
-				&& g_strrstr (temp2, filter_string))
-			|| g_strrstr (filename, filter_string))
+		CategoryData *data = (CategoryData *) cat_list->data;
+
+		for (temp = data->launcher_list; temp; temp = g_list_next (temp))
 		{
-			data->filtered_launcher_list =
-				g_list_append (data->filtered_launcher_list, launcher);
+			gchar *key = get_launcher_search_key (APPLICATION_TILE (temp->data));
+			gsize len = strlen (key);
+			gsize i;
+
+			g_object_set_data_full (G_OBJECT (temp->data), TILE_SEARCH_KEY, key, g_free);
+
+			for (i = 0; i + 3 <= len; i++)
+			{
+				gpointer trigram = SEARCH_TRIGRAM (key + i);
+				GHashTable *launchers = g_hash_table_lookup (app_data->search_index, trigram);
+
+				if (!launchers)
+				{
+					launchers = g_hash_table_new (g_direct_hash, g_direct_equal);
+					g_hash_table_insert (app_data->search_index, trigram, launchers);
+				}
+				g_hash_table_add (launchers, temp->data);
+			}
 		}
-		if (temp1)
-			g_free (temp1);
-		if (temp2)
-			g_free (temp2);
 	}
-	while (NULL != (launcher_list = g_list_next (launcher_list)));
-	g_free (filter_string);
+}
+
+/* Returns FALSE if no launcher can match filter_string. Otherwise candidates is set
+   to the smallest set of launchers that may match it, or NULL if the filter is too
+   short to narrow anything down. */
+static gboolean
+lookup_search_candidates (AppShellData * app_data, const gchar * filter_string,
+	GHashTable ** candidates)
+{
+	gsize len = strlen (filter_string);
+	gsize i;
+
+	*candidates = NULL;
+
+	for (i = 0; i + 3 <= len; i++)
+	{
+		GHashTable *launchers = g_hash_table_lookup (app_data->search_index,
+			SEARCH_TRIGRAM (filter_string + i));
+
+		if (!launchers)
+			return FALSE;
+
+		if (!*candidates || g_hash_table_size (launchers) < g_hash_table_size (*candidates))
+			*candidates = launchers;
+	}
+
+	return TRUE;
 }
 
 static void
-delete_old_data (AppShellData * app_data)
+generate_filtered_lists (AppShellData * app_data, const gchar * filter_string)
 {
-	GList *temp;
+	GHashTable *candidates;
+	gboolean narrow;
+	gboolean possible;
+	gchar *key;
 	GList *cat_list;
 
-	g_assert (app_data != NULL);
-	g_assert (app_data->categories_list != NULL);
+	if (!app_data->search_index)
+		build_search_index (app_data);
 
-	cat_list = app_data->categories_list;
+	key = g_utf8_casefold (filter_string ? filter_string : "", -1);
+	possible = lookup_search_candidates (app_data, key, &candidates);
 
-	do
+	/* when the filter only got more specific the new matches are a subset of the
+	   current ones, so there is no need to look at the other launchers */
+	narrow = app_data->search_filter && strstr (key, app_data->search_filter);
+
+	for (cat_list = app_data->categories_list; cat_list; cat_list = g_list_next (cat_list))
 	{
 		CategoryData *data = (CategoryData *) cat_list->data;
-		gtk_widget_destroy (GTK_WIDGET (data->section));
-		gtk_widget_destroy (GTK_WIDGET (data->group_launcher));
-		g_object_unref (data->section);
-		g_object_unref (data->group_launcher);
-		g_free (data->category);
+		GList *filtered_list = NULL;
+		GList *temp;
 
-		for (temp = data->launcher_list; temp; temp = g_list_next (temp))
+		/* Since the filter may remove these entries from the
+		   container they will not get a mouse out event */
+		for (temp = data->filtered_launcher_list; temp; temp = g_list_next (temp))
+			if (gtk_widget_get_parent (GTK_WIDGET (temp->data)))
+				gtk_widget_set_state_flags (GTK_WIDGET (temp->data), GTK_STATE_FLAG_NORMAL, FALSE);
+
+		if (possible)
 		{
-			g_free (g_object_get_data (G_OBJECT (temp->data), TILE_EXEC_NAME));
-			g_object_unref (temp->data);
+			temp = narrow ? data->filtered_launcher_list : data->launcher_list;
+
+			for (; temp; temp = g_list_next (temp))
+			{
+				const gchar *launcher_key;
+
+				if (candidates && !g_hash_table_contains (candidates, temp->data))
+					continue;
+
+				launcher_key = g_object_get_data (G_OBJECT (temp->data), TILE_SEARCH_KEY);
+				if (strstr (launcher_key, key))
+					filtered_list = g_list_prepend (filtered_list, temp->data);
+			}
 		}
 
-		g_list_free (data->launcher_list);
 		g_list_free (data->filtered_launcher_list);
-		g_free (data);
+		data->filtered_launcher_list = g_list_reverse (filtered_list);
 	}
-	while (NULL != (cat_list = g_list_next (cat_list)));
 
-	g_list_free (app_data->categories_list);
-	app_data->categories_list = NULL;
-	app_data->selected_group = NULL;
+	g_free (app_data->search_filter);
+	app_data->search_filter = key;
+}
+
+static void
+free_launcher (GtkWidget * launcher)
+{
+	GtkWidget *parent = gtk_widget_get_parent (launcher);
+
+	if (parent)
+		gtk_container_remove (GTK_CONTAINER (parent), launcher);
+
+	g_free (g_object_get_data (G_OBJECT (launcher), TILE_EXEC_NAME));
+	g_object_unref (launcher);
+}
+
+static void
+free_category_data (CategoryData * data)
+{
+	GList *temp;
+
+	if (data->section)
+	{
+		gtk_widget_destroy (GTK_WIDGET (data->section));
+		gtk_widget_destroy (GTK_WIDGET (data->group_launcher));
+		g_object_unref (data->section);
+		g_object_unref (data->group_launcher);
+	}
+	g_free (data->category);
+
+	for (temp = data->launcher_list; temp; temp = g_list_next (temp))
+		free_launcher (GTK_WIDGET (temp->data));
+
+	g_list_free (data->launcher_list);
+	g_list_free (data->filtered_launcher_list);
+	g_free (data);
 }
 
+static void
+create_application_category_section (AppShellData * app_data, CategoryData * data)
+{
+	AtkObject *a11y_cat;
+	GtkWidget *header = gtk_label_new (data->category);
+	gchar *markup;
+	GtkWidget *hbox;
+	GtkWidget *table;
+
+	gtk_label_set_xalign (GTK_LABEL (header), 0.0);
+	data->group_launcher = TILE (nameplate_tile_new (NULL, NULL, header, NULL));
+	g_object_ref (data->group_launcher);
+
+	g_signal_connect (data->group_launcher, "tile-activated",
+		G_CALLBACK (handle_group_clicked), app_data);
+	a11y_cat = gtk_widget_get_accessible (GTK_WIDGET (data->group_launcher));
+	atk_object_set_name (a11y_cat, data->category);
+
+	markup = g_markup_printf_escaped ("<span size=\"x-large\" weight=\"bold\">%s</span>",
+		data->category);
+	data->section = SLAB_SECTION (slab_section_new_with_markup (markup, Style2));
+
+	/* as we filter these will be added/removed from parent container and we dont want them destroyed */
+	g_object_ref (data->section);
+	g_free (markup);
+
+	hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+	table = gtk_grid_new ();
+	gtk_grid_set_column_spacing (GTK_GRID (table), 5);
+	gtk_grid_set_row_spacing (GTK_GRID (table), 5);
+	gtk_box_pack_start (GTK_BOX (hbox), table, FALSE, FALSE, 15);
+	slab_section_set_contents (SLAB_SECTION (data->section), hbox);
+}
+
+/* Creates the sections of the categories that have none yet and numbers
+   the group launchers in the order of the categories */
 static void
 create_application_category_sections (AppShellData * app_data)
 {
 	GList *cat_list;
-	AtkObject *a11y_cat;
 	gint pos = 0;
 
 	g_assert (app_data != NULL);
@@ -707,37 +868,13 @@ create_application_category_sections (AppShellData * app_data)
 	do
 	{
 		CategoryData *data = (CategoryData *) cat_list->data;
-		GtkWidget *header = gtk_label_new (data->category);
-		gchar *markup;
-		GtkWidget *hbox;
-		GtkWidget *table;
 
-		gtk_label_set_xalign (GTK_LABEL (header), 0.0);
-		data->group_launcher = TILE (nameplate_tile_new (NULL, NULL, header, NULL));
-		g_object_ref (data->group_launcher);
+		if (!data->section)
+			create_application_category_section (app_data, data);
 
 		g_object_set_data (G_OBJECT (data->group_launcher), GROUP_POSITION_NUMBER_KEY,
 			GINT_TO_POINTER (pos));
 		pos++;
-		g_signal_connect (data->group_launcher, "tile-activated",
-			G_CALLBACK (handle_group_clicked), app_data);
-		a11y_cat = gtk_widget_get_accessible (GTK_WIDGET (data->group_launcher));
-		atk_object_set_name (a11y_cat, data->category);
-
-		markup = g_markup_printf_escaped ("<span size=\"x-large\" weight=\"bold\">%s</span>",
-			data->category);
-		data->section = SLAB_SECTION (slab_section_new_with_markup (markup, Style2));
-
-		/* as we filter these will be added/removed from parent container and we dont want them destroyed */
-		g_object_ref (data->section);
-		g_free (markup);
-
-		hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
-		table = gtk_grid_new ();
-		gtk_grid_set_column_spacing (GTK_GRID (table), 5);
-		gtk_grid_set_row_spacing (GTK_GRID (table), 5);
-		gtk_box_pack_start (GTK_BOX (hbox), table, FALSE, FALSE, 15);
-		slab_section_set_contents (SLAB_SECTION (data->section), hbox);
 	}
 	while (NULL != (cat_list = g_list_next (cat_list)));
 }
@@ -786,6 +923,8 @@ populate_application_category_sections (AppShellData * app_data, GtkWidget * con
 {
 	GList *cat_list = app_data->categories_list;
 	gboolean filtered_out_everything = TRUE;
+
+	app_resizer_set_table_cache (APP_RESIZER (app_data->category_layout), NULL);
 	if (app_data->cached_tables_list)
 		g_list_free (app_data->cached_tables_list);
 	app_data->cached_tables_list = NULL;
@@ -833,13 +972,517 @@ populate_application_category_section (AppShellData * app_data, SlabSection * se
 
 }
 
-gboolean
-regenerate_categories (AppShellData * app_data)
+/* A snapshot of the menu is the list of its categories, in menu order, each
+   with the desktop files of its launchers, their modification times and
+   what the tiles show. The last one is kept in the user cache dir, so that
+   at startup the shell can be put up from it and the menu tree loaded
+   afterwards. The launchers are then brought up to date with a new
+   snapshot, the same way as when the menu tree changes: only the desktop
+   files that were added or modified are read, and only their launchers
+   are touched. */
+#define MENU_SNAPSHOT_VERSION 3
+#define MENU_SNAPSHOT_LAUNCHER_TYPE "(sxmsmsmsmsmsms)"
+#define MENU_SNAPSHOT_CATEGORY_TYPE "(sa" MENU_SNAPSHOT_LAUNCHER_TYPE ")"
+#define MENU_SNAPSHOT_TYPE "(sa" MENU_SNAPSHOT_CATEGORY_TYPE ")"
+
+static LauncherSource *
+launcher_source_new (const gchar * path, gint64 mtime)
+{
+	LauncherSource *source = g_new0 (LauncherSource, 1);
+
+	source->path = g_strdup (path);
+	source->mtime = mtime;
+
+	return source;
+}
+
+static LauncherSource *
+launcher_source_new_from_item (const gchar * path, gint64 mtime, MateDesktopItem * item)
+{
+	LauncherSource *source = launcher_source_new (path, mtime);
+
+	source->name = g_strdup (mate_desktop_item_get_localestring (item, MATE_DESKTOP_ITEM_NAME));
+	source->description = g_strdup (mate_desktop_item_get_localestring (item, MATE_DESKTOP_ITEM_GENERIC_NAME));
+	source->comment = g_strdup (mate_desktop_item_get_localestring (item, MATE_DESKTOP_ITEM_COMMENT));
+	source->icon = g_strdup (mate_desktop_item_get_localestring (item, MATE_DESKTOP_ITEM_ICON));
+	source->exec = g_strdup (mate_desktop_item_get_string (item, MATE_DESKTOP_ITEM_EXEC));
+	source->categories = g_strdup (mate_desktop_item_get_string (item, MATE_DESKTOP_ITEM_CATEGORIES));
+
+	return source;
+}
+
+static LauncherSource *
+launcher_source_copy (const LauncherSource * source)
+{
+	LauncherSource *copy = launcher_source_new (source->path, source->mtime);
+
+	copy->name = g_strdup (source->name);
+	copy->description = g_strdup (source->description);
+	copy->comment = g_strdup (source->comment);
+	copy->icon = g_strdup (source->icon);
+	copy->exec = g_strdup (source->exec);
+	copy->categories = g_strdup (source->categories);
+
+	return copy;
+}
+
+static void
+launcher_source_free (LauncherSource * source)
+{
+	g_free (source->path);
+	g_free (source->name);
+	g_free (source->description);
+	g_free (source->comment);
+	g_free (source->icon);
+	g_free (source->exec);
+	g_free (source->categories);
+	g_free (source);
+}
+
+/* the snapshot's strings are GVariant strings, which must be UTF-8 */
+static gboolean
+launcher_source_is_valid (const LauncherSource * source)
+{
+	return cache_util_string_valid (source->path)
+		&& cache_util_string_valid (source->name)
+		&& cache_util_string_valid (source->description)
+		&& cache_util_string_valid (source->comment)
+		&& cache_util_string_valid (source->icon)
+		&& cache_util_string_valid (source->exec)
+		&& cache_util_string_valid (source->categories);
+}
+
+static MenuSnapshotCategory *
+menu_snapshot_category_new (const gchar * category)
+{
+	MenuSnapshotCategory *snap = g_new0 (MenuSnapshotCategory, 1);
+
+	snap->category = g_strdup (category);
+	snap->launchers = g_ptr_array_new_with_free_func ((GDestroyNotify) launcher_source_free);
+
+	return snap;
+}
+
+static void
+menu_snapshot_category_free (MenuSnapshotCategory * snap)
+{
+	g_free (snap->category);
+	g_ptr_array_unref (snap->launchers);
+	g_free (snap);
+}
+
+static void
+menu_snapshot_free (GList * snapshot)
+{
+	g_list_free_full (snapshot, (GDestroyNotify) menu_snapshot_category_free);
+}
+
+static gchar *
+menu_snapshot_get_name (AppShellData * app_data)
+{
+	return g_strconcat (app_data->menu_name, ".snapshot", NULL);
+}
+
+static GList *
+menu_snapshot_load (AppShellData * app_data)
+{
+	GList *snapshot = NULL;
+	GVariant *root;
+	gchar *name;
+	gchar *languages;
+
+	name = menu_snapshot_get_name (app_data);
+	root = cache_util_load (name, G_VARIANT_TYPE (MENU_SNAPSHOT_TYPE), MENU_SNAPSHOT_VERSION);
+	g_free (name);
+
+	if (!root)
+		return NULL;
+
+	languages = g_strjoinv (":", (gchar **) g_get_language_names ());
+
+	{
+		GVariant *categories;
+		const gchar *cached_languages;
+
+		g_variant_get (root, "(&s@a" MENU_SNAPSHOT_CATEGORY_TYPE ")",
+			&cached_languages, &categories);
+
+		/* the category names are translated */
+		if (!strcmp (cached_languages, languages))
+		{
+			GVariantIter iter, *launchers;
+			const gchar *category;
+
+			g_variant_iter_init (&iter, categories);
+			while (g_variant_iter_next (&iter, "(&sa" MENU_SNAPSHOT_LAUNCHER_TYPE ")", &category, &launchers))
+			{
+				MenuSnapshotCategory *snap = menu_snapshot_category_new (category);
+				LauncherSource *source;
+				const gchar *path;
+				gint64 mtime;
+				gchar *name, *description, *comment, *icon, *exec, *categories;
+
+				while (g_variant_iter_next (launchers, "(&sxmsmsmsmsmsms)", &path, &mtime,
+					&name, &description, &comment, &icon, &exec, &categories))
+				{
+					source = launcher_source_new (path, mtime);
+					source->name = name;
+					source->description = description;
+					source->comment = comment;
+					source->icon = icon;
+					source->exec = exec;
+					source->categories = categories;
+					g_ptr_array_add (snap->launchers, source);
+				}
+				g_variant_iter_free (launchers);
+
+				snapshot = g_list_prepend (snapshot, snap);
+			}
+		}
+
+		g_variant_unref (categories);
+		g_variant_unref (root);
+	}
+
+	g_free (languages);
+
+	return g_list_reverse (snapshot);
+}
+
+static void
+menu_snapshot_save (AppShellData * app_data, GList * snapshot)
+{
+	GVariantBuilder categories;
+	gchar *name, *languages;
+	GList *temp;
+	guint i;
+
+	g_variant_builder_init (&categories, G_VARIANT_TYPE ("a" MENU_SNAPSHOT_CATEGORY_TYPE));
+
+	/* what can't be saved is just missing until the menu tree is loaded */
+	for (temp = snapshot; temp; temp = g_list_next (temp))
+	{
+		MenuSnapshotCategory *snap = temp->data;
+
+		if (!cache_util_string_valid (snap->category))
+			continue;
+
+		g_variant_builder_open (&categories, G_VARIANT_TYPE (MENU_SNAPSHOT_CATEGORY_TYPE));
+		g_variant_builder_add (&categories, "s", snap->category);
+		g_variant_builder_open (&categories, G_VARIANT_TYPE ("a" MENU_SNAPSHOT_LAUNCHER_TYPE));
+		for (i = 0; i < snap->launchers->len; i++)
+		{
+			LauncherSource *source = g_ptr_array_index (snap->launchers, i);
+
+			if (!launcher_source_is_valid (source))
+				continue;
+
+			g_variant_builder_add (&categories, MENU_SNAPSHOT_LAUNCHER_TYPE, source->path, source->mtime,
+				source->name, source->description, source->comment, source->icon,
+				source->exec, source->categories);
+		}
+		g_variant_builder_close (&categories);
+		g_variant_builder_close (&categories);
+	}
+
+	languages = g_strjoinv (":", (gchar **) g_get_language_names ());
+	name = menu_snapshot_get_name (app_data);
+	cache_util_save (name, MENU_SNAPSHOT_VERSION,
+		g_variant_new ("(s@a" MENU_SNAPSHOT_CATEGORY_TYPE ")",
+			languages, g_variant_builder_end (&categories)));
+	g_free (name);
+	g_free (languages);
+}
+
+static GList *
+menu_snapshot_new_from_tree (AppShellData * app_data)
+{
+	MateMenuTreeDirectory *root_dir;
+	GList *snapshot = NULL;
+	gboolean need_misc = FALSE;
+	MateMenuTreeIter *iter;
+	MateMenuTreeItemType type;
+	GHashTable *known;
+	GList *temp, *launchers;
+
+	root_dir = matemenu_tree_get_root_directory (app_data->tree);
+	if (!root_dir)
+		return NULL;
+
+	/* the desktop files the launchers were made from, which needn't be read
+	   again if they are unmodified */
+	known = g_hash_table_new (g_str_hash, g_str_equal);
+	for (temp = app_data->categories_list; temp; temp = g_list_next (temp))
+	{
+		CategoryData *data = temp->data;
+
+		for (launchers = data->launcher_list; launchers; launchers = g_list_next (launchers))
+		{
+			LauncherSource *source = g_object_get_data (G_OBJECT (launchers->data), TILE_DESKTOP_SOURCE);
+
+			if (source)
+				g_hash_table_insert (known, source->path, source);
+		}
+	}
+
+	iter = matemenu_tree_directory_iter (root_dir);
+	while ((type = matemenu_tree_iter_next (iter)) != MATEMENU_TREE_ITEM_INVALID) {
+		gpointer item;
+		const char *category;
+		switch (type) {
+			case MATEMENU_TREE_ITEM_DIRECTORY:
+				item = matemenu_tree_iter_get_directory (iter);
+				category = matemenu_tree_directory_get_name (item);
+				snapshot = g_list_prepend (snapshot,
+					generate_category (category, item, app_data, known, TRUE));
+				matemenu_tree_item_unref (item);
+				break;
+			case MATEMENU_TREE_ITEM_ENTRY:
+				need_misc = TRUE;
+				break;
+			default:
+				break;
+		}
+	}
+	matemenu_tree_iter_unref(iter);
+
+	if (need_misc)
+		snapshot = g_list_prepend (snapshot,
+			generate_category (_("Other"), root_dir, app_data, known, FALSE));
+
+	if (app_data->hash)
+	{
+		g_hash_table_destroy (app_data->hash);
+		app_data->hash = NULL;
+	}
+
+	g_hash_table_destroy (known);
+
+	matemenu_tree_item_unref (root_dir);
+
+	return g_list_reverse (snapshot);
+}
+
+static gboolean
+load_menu_tree (AppShellData * app_data)
+{
+	GError *error = NULL;
+
+	if (app_data->tree)
+		return TRUE;
+
+	app_data->tree = matemenu_tree_new (app_data->menu_name, MATEMENU_TREE_FLAGS_NONE);
+	g_signal_connect (app_data->tree, "changed", G_CALLBACK (matemenu_tree_changed_callback), app_data);
+	if (! matemenu_tree_load_sync (app_data->tree, &error)) {
+		g_warning("Menu tree loading got error:%s\n", error->message);
+		g_error_free(error);
+		g_object_unref(app_data->tree);
+		app_data->tree = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+add_launcher_from_source (AppShellData * app_data, CategoryData * cat_data, LauncherSource * source)
+{
+	GtkWidget *launcher;
+
+	launcher = application_tile_new_with_info (source->path,
+		app_data->icon_size, app_data->show_tile_generic_name,
+		source->name, source->description, source->comment, source->icon);
+	if (!launcher)
+		return;
+
+	add_launcher_to_category (cat_data, launcher, source->exec, app_data);
+	g_object_set_data_full (G_OBJECT (launcher), TILE_DESKTOP_SOURCE,
+		launcher_source_copy (source), (GDestroyNotify) launcher_source_free);
+}
+
+static CategoryData *
+category_data_new_from_snapshot (AppShellData * app_data, MenuSnapshotCategory * snap)
+{
+	CategoryData *data;
+	guint i;
+
+	data = g_new0 (CategoryData, 1);
+	data->category = g_strdup (snap->category);
+
+	for (i = 0; i < snap->launchers->len; i++)
+		add_launcher_from_source (app_data, data, g_ptr_array_index (snap->launchers, i));
+
+	return data;
+}
+
+/* Keeps the launchers of the category whose desktop file is still in it and
+   unmodified, and replaces the others. Returns whether anything changed. */
+static gboolean
+update_category (AppShellData * app_data, CategoryData * data, MenuSnapshotCategory * snap)
+{
+	GHashTable *wanted;
+	GList *kept = NULL;
+	GList *temp;
+	gboolean changed = FALSE;
+	guint i;
+
+	wanted = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = 0; i < snap->launchers->len; i++)
+	{
+		LauncherSource *source = g_ptr_array_index (snap->launchers, i);
+		g_hash_table_insert (wanted, source->path, source);
+	}
+
+	/* the launcher list is sorted, and so is any part of it */
+	for (temp = data->launcher_list; temp; temp = g_list_next (temp))
+	{
+		LauncherSource *current = g_object_get_data (G_OBJECT (temp->data), TILE_DESKTOP_SOURCE);
+		LauncherSource *source = current ? g_hash_table_lookup (wanted, current->path) : NULL;
+
+		if (source && source->mtime == current->mtime)
+		{
+			g_hash_table_remove (wanted, source->path);
+			kept = g_list_prepend (kept, temp->data);
+		}
+		else
+		{
+			data->filtered_launcher_list = g_list_remove (data->filtered_launcher_list, temp->data);
+			free_launcher (GTK_WIDGET (temp->data));
+			changed = TRUE;
+		}
+	}
+
+	/* the filtered list is left as it is, and filtered again if anything changed */
+	g_list_free (data->launcher_list);
+	data->launcher_list = g_list_reverse (kept);
+
+	for (i = 0; i < snap->launchers->len; i++)
+	{
+		LauncherSource *source = g_ptr_array_index (snap->launchers, i);
+
+		if (g_hash_table_contains (wanted, source->path))
+		{
+			add_launcher_from_source (app_data, data, source);
+			changed = TRUE;
+		}
+	}
+
+	g_hash_table_destroy (wanted);
+
+	return changed;
+}
+
+static void
+update_categories (AppShellData * app_data, GList * snapshot)
 {
-	delete_old_data (app_data);
-	generate_categories (app_data);
+	GHashTable *old_categories;
+	GHashTableIter iter;
+	CategoryData *new_apps_category = NULL;
+	GList *categories = NULL;
+	GList *old_list = NULL;
+	GList *temp;
+	gpointer value;
+	gboolean changed = FALSE;
+
+	old_categories = g_hash_table_new (g_str_hash, g_str_equal);
+	for (temp = app_data->categories_list; temp; temp = g_list_next (temp))
+	{
+		CategoryData *data = temp->data;
+
+		if (data->is_new_apps)
+			new_apps_category = data;
+		else
+		{
+			g_hash_table_insert (old_categories, data->category, data);
+			old_list = g_list_prepend (old_list, data);
+		}
+	}
+	old_list = g_list_reverse (old_list);
+
+	for (temp = snapshot; temp; temp = g_list_next (temp))
+	{
+		MenuSnapshotCategory *snap = temp->data;
+		CategoryData *data = g_hash_table_lookup (old_categories, snap->category);
+
+		if (data)
+		{
+			g_hash_table_remove (old_categories, snap->category);
+			changed |= update_category (app_data, data, snap);
+		}
+		else
+		{
+			data = category_data_new_from_snapshot (app_data, snap);
+			changed = TRUE;
+		}
+
+		categories = g_list_prepend (categories, data);
+	}
+	categories = g_list_reverse (categories);
+
+	g_hash_table_iter_init (&iter, old_categories);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+	{
+		old_list = g_list_remove (old_list, value);
+		free_category_data (value);
+		changed = TRUE;
+	}
+	g_hash_table_destroy (old_categories);
+
+	/* a category may also have moved */
+	for (temp = categories; temp && old_list; temp = g_list_next (temp), old_list = g_list_delete_link (old_list, old_list))
+	{
+		if (temp->data != old_list->data)
+			changed = TRUE;
+	}
+	if (old_list)
+	{
+		g_list_free (old_list);
+		changed = TRUE;
+	}
+
+	if (!changed)
+	{
+		g_list_free (categories);
+		return;
+	}
+
+	/* the new applications are made up from all the others */
+	if (new_apps_category)
+		free_category_data (new_apps_category);
+
+	app_data->stop_incremental_relayout = TRUE;
+	app_data->incremental_relayout_cat_list = NULL;
+
+	g_list_free (app_data->categories_list);
+	app_data->categories_list = categories;
+	app_data->selected_group = NULL;
+	app_data->last_clicked_launcher = NULL;
+
+	if (app_data->new_apps && (app_data->new_apps->max_items > 0))
+		generate_new_apps (app_data);
+
+	build_search_index (app_data);
+	generate_filtered_lists (app_data, app_data->filter_string);
+
 	create_application_category_sections (app_data);
 	relayout_shell (app_data);
+}
+
+gboolean
+regenerate_categories (AppShellData * app_data)
+{
+	GList *snapshot;
+
+	if (!load_menu_tree (app_data))
+		return FALSE;
+
+	snapshot = menu_snapshot_new_from_tree (app_data);
+	if (snapshot)
+	{
+		update_categories (app_data, snapshot);
+		menu_snapshot_save (app_data, snapshot);
+		menu_snapshot_free (snapshot);
+	}
 
 	return FALSE;	/* remove this function from the list */
 }
@@ -888,108 +1531,66 @@ appshelldata_new (const gchar * menu_name, GtkIconSize icon_size, gboolean show_
 void
 generate_categories (AppShellData * app_data)
 {
-	MateMenuTreeDirectory *root_dir;
-	gboolean need_misc = FALSE;
-	MateMenuTreeIter *iter;
-	MateMenuTreeItemType type;
+	GList *snapshot;
+	GList *temp;
 
-	if (!app_data->tree)
+	snapshot = menu_snapshot_load (app_data);
+
+	if (snapshot)
 	{
-		GError *error = NULL;
-
-		app_data->tree = matemenu_tree_new (app_data->menu_name, MATEMENU_TREE_FLAGS_NONE);
-		g_signal_connect (app_data->tree, "changed", G_CALLBACK (matemenu_tree_changed_callback), app_data);
-		if (! matemenu_tree_load_sync (app_data->tree, &error)) {
-			g_warning("Menu tree loading got error:%s\n", error->message);
-			g_error_free(error);
-			g_object_unref(app_data->tree);
-			app_data->tree = NULL;
-		}
+		/* bring the launchers up to date once the shell is up */
+		g_idle_add ((GSourceFunc) regenerate_categories, app_data);
 	}
-
-	if (app_data->tree != NULL)
-		root_dir = matemenu_tree_get_root_directory (app_data->tree);
 	else
-		root_dir = NULL;
-
-	if ( app_data->tree == NULL || root_dir == NULL) {
-		GtkWidget *dialog = gtk_message_dialog_new (NULL, GTK_DIALOG_DESTROY_WITH_PARENT,
-				GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Failure loading - %s",
-				app_data->menu_name);
-		gtk_dialog_run (GTK_DIALOG (dialog));
-		gtk_widget_destroy (dialog);
-		exit (1);	/* Fixme - is there a MATE/GTK way to do this. */
-	}
-
-	iter = matemenu_tree_directory_iter (root_dir);
-	while ((type = matemenu_tree_iter_next (iter)) != MATEMENU_TREE_ITEM_INVALID) {
-		gpointer item;
-		const char *category;
-		switch (type) {
-			case MATEMENU_TREE_ITEM_DIRECTORY:
-				item = matemenu_tree_iter_get_directory (iter);
-				category = matemenu_tree_directory_get_name (item);
-				generate_category(category, item, app_data, TRUE);
-				matemenu_tree_item_unref (item);
-				break;
-			case MATEMENU_TREE_ITEM_ENTRY:
-				need_misc = TRUE;
-				break;
-			default:
-				break;
+	{
+		if (load_menu_tree (app_data))
+			snapshot = menu_snapshot_new_from_tree (app_data);
+
+		if (snapshot == NULL) {
+			GtkWidget *dialog = gtk_message_dialog_new (NULL, GTK_DIALOG_DESTROY_WITH_PARENT,
+					GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Failure loading - %s",
+					app_data->menu_name);
+			gtk_dialog_run (GTK_DIALOG (dialog));
+			gtk_widget_destroy (dialog);
+			exit (1);	/* Fixme - is there a MATE/GTK way to do this. */
 		}
-	}
-	matemenu_tree_iter_unref(iter);
-
-	if (need_misc)
-		generate_category (_("Other"), root_dir, app_data, FALSE);
 
-	if (app_data->hash)
-	{
-		g_hash_table_destroy (app_data->hash);
-		app_data->hash = NULL;
+		menu_snapshot_save (app_data, snapshot);
 	}
 
-	matemenu_tree_item_unref (root_dir);
+	for (temp = snapshot; temp; temp = g_list_next (temp))
+		app_data->categories_list = g_list_prepend (app_data->categories_list,
+			category_data_new_from_snapshot (app_data, temp->data));
+	app_data->categories_list = g_list_reverse (app_data->categories_list);
+
+	menu_snapshot_free (snapshot);
 
 	if (app_data->new_apps && (app_data->new_apps->max_items > 0))
 		generate_new_apps (app_data);
+
+	build_search_index (app_data);
 }
 
-static void
-generate_category (const char * category, MateMenuTreeDirectory * root_dir, AppShellData * app_data, gboolean recursive)
+static MenuSnapshotCategory *
+generate_category (const char * category, MateMenuTreeDirectory * root_dir, AppShellData * app_data,
+	GHashTable * known, gboolean recursive)
 {
-	CategoryData *data;
-	/* This is not needed. MateMenu already returns an ordered, non duplicate list
-	GList *list_entry;
-	list_entry =
-		g_list_find_custom (app_data->categories_list, category,
-		category_name_compare);
-	if (!list_entry)
-	{
-	*/
-		data = g_new0 (CategoryData, 1);
-		data->category = g_strdup (category);
-		app_data->categories_list =
-			/* use the matemenu order instead of alphabetical */
-			g_list_append (app_data->categories_list, data);
-			/* g_list_insert_sorted (app_data->categories_list, data, category_data_compare); */
-	/*
-	}
-	else
-	{
-		data = list_entry->data;
-	}
-	*/
+	MenuSnapshotCategory *snap;
+
+	/* MateMenu already returns an ordered, non duplicate list; use the matemenu order
+	   instead of alphabetical */
+	snap = menu_snapshot_category_new (category);
 
 	if (app_data->hash)	/* used to eliminate dups on a per category basis. */
 		g_hash_table_destroy (app_data->hash);
-	app_data->hash = g_hash_table_new (g_str_hash, g_str_equal);
-	generate_launchers (root_dir, app_data, data, recursive);
+	app_data->hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	generate_launchers (root_dir, app_data, known, snap, recursive);
+
+	return snap;
 }
 
 static gboolean
-check_specific_apps_hack (MateDesktopItem * item)
+check_specific_apps_hack (LauncherSource * source)
 {
 	static const gchar *COMMAND_LINE_LOCKDOWN_SCHEMA = "org.mate.lockdown";
 	static const gchar *COMMAND_LINE_LOCKDOWN_KEY = "disable-command-line";
@@ -999,6 +1600,7 @@ check_specific_apps_hack (MateDesktopItem * item)
 
 	gchar *path;
 	const char *exec;
+	const gchar *categories;
 
 	if (!got_lockdown_value)
 	{
@@ -1010,7 +1612,7 @@ check_specific_apps_hack (MateDesktopItem * item)
 	}
 
 	/* This seems like an ugly hack but it's the way it's currently done in the old control center */
-	exec = mate_desktop_item_get_string (item, MATE_DESKTOP_ITEM_EXEC);
+	exec = source->exec;
 
 	/* discard xscreensaver if mate-screensaver is installed */
 	if ((exec && !strcmp (exec, "xscreensaver-demo"))
@@ -1031,9 +1633,8 @@ check_specific_apps_hack (MateDesktopItem * item)
 	/* discard terminals if lockdown key is set */
 	if (command_line_lockdown)
 	{
-		const gchar *categories =
-			mate_desktop_item_get_string (item, MATE_DESKTOP_ITEM_CATEGORIES);
-		if (g_strrstr (categories, COMMAND_LINE_LOCKDOWN_DESKTOP_CATEGORY))
+		categories = source->categories;
+		if (categories && g_strrstr (categories, COMMAND_LINE_LOCKDOWN_DESKTOP_CATEGORY))
 		{
 			return TRUE;
 		}
@@ -1043,12 +1644,16 @@ check_specific_apps_hack (MateDesktopItem * item)
 }
 
 static void
-generate_launchers (MateMenuTreeDirectory * root_dir, AppShellData * app_data, CategoryData * cat_data, gboolean recursive)
+generate_launchers (MateMenuTreeDirectory * root_dir, AppShellData * app_data,
+	GHashTable * known, MenuSnapshotCategory * snap, gboolean recursive)
 {
 	MateDesktopItem *desktop_item;
+	LauncherSource *source;
 	const gchar *desktop_file;
 	MateMenuTreeIter *iter;
 	MateMenuTreeItemType type;
+	GStatBuf buf;
+	gint64 mtime;
 
 	iter = matemenu_tree_directory_iter (root_dir);
 	while ((type = matemenu_tree_iter_next (iter)) != MATEMENU_TREE_ITEM_INVALID) {
@@ -1058,36 +1663,41 @@ generate_launchers (MateMenuTreeDirectory * root_dir, AppShellData * app_data, C
 				item = matemenu_tree_iter_get_directory(iter);
 				/* g_message ("Found sub-category %s", matemenu_tree_directory_get_name (item)); */
 				if (recursive)
-					generate_launchers (item, app_data, cat_data, TRUE);
+					generate_launchers (item, app_data, known, snap, TRUE);
 				matemenu_tree_item_unref (item);
 				break;
 			case MATEMENU_TREE_ITEM_ENTRY:
 				item = matemenu_tree_iter_get_entry(iter);
 				/* g_message ("Found item name is:%s", matemenu_tree_entry_get_desktop_file_id(item)); */
 				desktop_file = matemenu_tree_entry_get_desktop_file_path (item);
-				if (desktop_file)
+				if (!desktop_file || g_hash_table_contains (app_data->hash, desktop_file))
 				{
-					if (g_hash_table_lookup (app_data->hash, desktop_file))
-					{
-						break;	/* duplicate */
-					}
-					/* Fixme - make sure it's safe to store this without duping it. As far as I can tell it is
-					   safe as long as I don't hang on to this anylonger than I hang on to the MateMenuTreeEntry*
-					   which brings up another point - am I supposed to free these or does freeing the top level recurse
-					   */
-					g_hash_table_insert (app_data->hash, (gpointer) desktop_file,
-							(gpointer) desktop_file);
+					matemenu_tree_item_unref (item);
+					break;	/* duplicate */
 				}
-				desktop_item = mate_desktop_item_new_from_file (desktop_file, 0, NULL);
-				if (!desktop_item)
+				g_hash_table_add (app_data->hash, g_strdup (desktop_file));
+
+				mtime = g_stat (desktop_file, &buf) == 0 ? (gint64) buf.st_mtime : 0;
+				source = g_hash_table_lookup (known, desktop_file);
+				if (source && source->mtime == mtime)
+					source = launcher_source_copy (source);
+				else
 				{
-					g_critical ("Failure - mate_desktop_item_new_from_file(%s)",
-							desktop_file);
-					break;
+					desktop_item = mate_desktop_item_new_from_file (desktop_file, 0, NULL);
+					if (!desktop_item)
+					{
+						g_critical ("Failure - mate_desktop_item_new_from_file(%s)",
+								desktop_file);
+						matemenu_tree_item_unref (item);
+						break;
+					}
+					source = launcher_source_new_from_item (desktop_file, mtime, desktop_item);
+					mate_desktop_item_unref (desktop_item);
 				}
-				if (!check_specific_apps_hack (desktop_item))
-					insert_launcher_into_category (cat_data, desktop_item, app_data);
-				mate_desktop_item_unref (desktop_item);
+				if (!check_specific_apps_hack (source))
+					g_ptr_array_add (snap->launchers, source);
+				else
+					launcher_source_free (source);
 				matemenu_tree_item_unref (item);
 				break;
 			default:
@@ -1134,9 +1744,7 @@ generate_new_apps (AppShellData * app_data)
 			for (launchers = data->launcher_list; launchers; launchers = launchers->next)
 			{
 				Tile *tile = TILE (launchers->data);
-				MateDesktopItem *item =
-					application_tile_get_desktop_item (APPLICATION_TILE (tile));
-				const gchar *uri = mate_desktop_item_get_location (item);
+				const gchar *uri = tile->uri;
 				g_string_append (gstr, uri);
 				g_string_append (gstr, separator);
 			}
@@ -1169,9 +1777,7 @@ generate_new_apps (AppShellData * app_data)
 		for (launchers = cat_data->launcher_list; launchers; launchers = launchers->next)
 		{
 			Tile *tile = TILE (launchers->data);
-			MateDesktopItem *item =
-				application_tile_get_desktop_item (APPLICATION_TILE (tile));
-			const gchar *uri = mate_desktop_item_get_location (item);
+			const gchar *uri = tile->uri;
 			if (!g_hash_table_lookup (all_apps_cache, uri))
 			{
 				GFile *file;
@@ -1190,6 +1796,7 @@ generate_new_apps (AppShellData * app_data)
 					new_apps_category = g_new0 (CategoryData, 1);
 					new_apps_category->category =
 						g_strdup (app_data->new_apps->name);
+					new_apps_category->is_new_apps = TRUE;
 					app_data->new_apps->garray =
 						g_array_sized_new (FALSE, TRUE,
 						sizeof (NewAppData *),
@@ -1251,8 +1858,8 @@ generate_new_apps (AppShellData * app_data)
 				NewAppData *, x);
 			if (data)
 			{
-				insert_launcher_into_category (new_apps_category, data->item,
-					app_data);
+				insert_launcher_into_category (new_apps_category,
+					mate_desktop_item_get_location (data->item), app_data);
 				g_free (data);
 			}
 			else
@@ -1268,11 +1875,30 @@ generate_new_apps (AppShellData * app_data)
 	g_strfreev (all_apps_split);
 }
 
-static void
-insert_launcher_into_category (CategoryData * cat_data, MateDesktopItem * desktop_item,
+static GtkWidget *
+insert_launcher_into_category (CategoryData * cat_data, const gchar * desktop_item_id,
 	AppShellData * app_data)
 {
 	GtkWidget *launcher;
+	MateDesktopItem *desktop_item;
+
+	launcher =
+		application_tile_new_full (desktop_item_id,
+		app_data->icon_size, app_data->show_tile_generic_name);
+	if (!launcher)
+		return NULL;
+
+	desktop_item = application_tile_get_desktop_item (APPLICATION_TILE (launcher));
+	add_launcher_to_category (cat_data, launcher,
+		mate_desktop_item_get_string (desktop_item, MATE_DESKTOP_ITEM_EXEC), app_data);
+
+	return launcher;
+}
+
+static void
+add_launcher_to_category (CategoryData * cat_data, GtkWidget * launcher, const gchar * exec,
+	AppShellData * app_data)
+{
 	static GtkSizeGroup *icon_group = NULL;
 
 	gchar *filepath;
@@ -1282,13 +1908,9 @@ insert_launcher_into_category (CategoryData * cat_data, MateDesktopItem * deskto
 	if (!icon_group)
 		icon_group = gtk_size_group_new (GTK_SIZE_GROUP_HORIZONTAL);
 
-	launcher =
-		application_tile_new_full (mate_desktop_item_get_location (desktop_item),
-		app_data->icon_size, app_data->show_tile_generic_name);
 	gtk_widget_set_size_request (launcher, SIZING_TILE_WIDTH, -1);
 
-	filepath =
-		g_strdup (mate_desktop_item_get_string (desktop_item, MATE_DESKTOP_ITEM_EXEC));
+	filepath = g_strdup (exec ? exec : "");
 	g_strdelimit (filepath, " ", '\0');	/* just want the file name - no args or replacements */
 	filename = g_strrstr (filepath, "/");
 	if (filename)
@@ -1309,9 +1931,9 @@ insert_launcher_into_category (CategoryData * cat_data, MateDesktopItem * deskto
 	g_signal_connect (launcher, "tile-action-triggered",
 		G_CALLBACK (handle_menu_action_performed), app_data);
 
-	/* These will be inserted/removed from tables as the filter changes and we dont want them */
-	/* destroyed when they are removed */
-	g_object_ref (launcher);
+	/* These will be inserted/removed from tables as the filter changes and as they scroll in and */
+	/* out of view, some maybe never inserted, and we dont want them destroyed when they are removed */
+	g_object_ref_sink (launcher);
 
 	/* use alphabetical order instead of the matemenu order. We group all sub items in each top level
 	category together, ignoring sub menus, so we also ignore sub menu layout hints */
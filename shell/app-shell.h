@@ -72,6 +72,8 @@ typedef struct _AppShellData
 
 	GtkWidget *filter_section;
 	gchar *filter_string;
+	gchar *search_filter;	/* casefolded filter the filtered launcher lists match */
+	GHashTable *search_index;	/* casefolded trigram -> set of launchers */
 	GdkCursor *busy_cursor;
 
 	GtkWidget *category_layout;
@@ -106,6 +108,7 @@ typedef struct
 	SlabSection *section;
 	GList *launcher_list;
 	GList *filtered_launcher_list;
+	gboolean is_new_apps;	/* made up from the launchers of the other categories */
 } CategoryData;
 
 typedef struct
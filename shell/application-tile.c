@@ -42,7 +42,9 @@ static void application_tile_get_property (GObject *, guint,       GValue *, GPa
 static void application_tile_set_property (GObject *, guint, const GValue *, GParamSpec *);
 static void application_tile_finalize     (GObject *);
 
-static void application_tile_setup (ApplicationTile *);
+static void application_tile_setup (ApplicationTile *, const gchar *, const gchar *,
+	const gchar *, const gchar *);
+static void application_tile_setup_from_desktop_file (ApplicationTile *);
 
 static GtkWidget *create_header    (const gchar *);
 static GtkWidget *create_subheader (const gchar *);
@@ -62,11 +64,15 @@ static void remove_from_startup_list (ApplicationTile *);
 static void update_user_list_menu_item (ApplicationTile *);
 static void agent_notify_cb (GObject *, GParamSpec *, gpointer);
 
-static StartupStatus get_desktop_item_startup_status (MateDesktopItem *);
+static StartupStatus get_startup_status (const gchar *);
 static void          update_startup_menu_item (ApplicationTile *);
 
+static MateDesktopItem *application_tile_ensure_desktop_item (ApplicationTile *);
+static void             add_help_action (ApplicationTile *);
+
 typedef struct {
 	MateDesktopItem *desktop_item;
+	gboolean         desktop_item_failed;
 
 	gchar       *image_id;
 	gboolean     image_is_broken;
@@ -119,8 +125,8 @@ application_tile_new (const gchar *desktop_item_id)
 	return application_tile_new_full (desktop_item_id, GTK_ICON_SIZE_DND, TRUE);
 }
 
-GtkWidget *
-application_tile_new_full (const gchar *desktop_item_id,
+static ApplicationTile *
+application_tile_new_for_item (const gchar *desktop_item_id,
 	GtkIconSize image_size, gboolean show_generic_name)
 {
 	ApplicationTile        *this;
@@ -152,11 +158,101 @@ application_tile_new_full (const gchar *desktop_item_id,
 	priv->desktop_item = desktop_item;
 	priv->show_generic_name = show_generic_name;
 
-	application_tile_setup (this);
+	return this;
+}
+
+GtkWidget *
+application_tile_new_full (const gchar *desktop_item_id,
+	GtkIconSize image_size, gboolean show_generic_name)
+{
+	ApplicationTile *this;
+
+	this = application_tile_new_for_item (desktop_item_id, image_size, show_generic_name);
+	if (! this)
+		return NULL;
+
+	application_tile_setup_from_desktop_file (this);
 
 	return GTK_WIDGET (this);
 }
 
+static gboolean
+lazy_tile_button_press_cb (GtkWidget *widget, GdkEventButton *event, gpointer user_data)
+{
+	application_tile_ensure_desktop_item (APPLICATION_TILE (widget));
+
+	return FALSE;
+}
+
+static gboolean
+lazy_tile_popup_menu_cb (GtkWidget *widget, gpointer user_data)
+{
+	application_tile_ensure_desktop_item (APPLICATION_TILE (widget));
+
+	return FALSE;
+}
+
+static void
+lazy_tile_activated_cb (Tile *tile, TileEvent *event, gpointer user_data)
+{
+	application_tile_ensure_desktop_item (APPLICATION_TILE (tile));
+}
+
+/* Makes a tile for the desktop file at desktop_file_path from its name,
+ * generic name, comment and icon, without reading the file. The desktop
+ * item is only loaded when the tile is used: clicked, activated, or its
+ * context menu opened. */
+GtkWidget *
+application_tile_new_with_info (const gchar *desktop_file_path,
+	GtkIconSize image_size, gboolean show_generic_name,
+	const gchar *name, const gchar *desc, const gchar *comment, const gchar *icon)
+{
+	ApplicationTile        *this;
+	ApplicationTilePrivate *priv;
+
+	gchar *uri;
+
+	uri = g_filename_to_uri (desktop_file_path, NULL, NULL);
+	if (! uri)
+		return NULL;
+
+	this = g_object_new (APPLICATION_TILE_TYPE, "tile-uri", uri, NULL);
+	priv = application_tile_get_instance_private (this);
+	g_free (uri);
+
+	priv->image_size   = image_size;
+	priv->show_generic_name = show_generic_name;
+
+	application_tile_setup (this, name, desc, comment, icon);
+
+	g_signal_connect (this, "button-press-event", G_CALLBACK (lazy_tile_button_press_cb), NULL);
+	g_signal_connect (this, "popup-menu", G_CALLBACK (lazy_tile_popup_menu_cb), NULL);
+	g_signal_connect (this, "tile-activated", G_CALLBACK (lazy_tile_activated_cb), NULL);
+
+	return GTK_WIDGET (this);
+}
+
+/* Loads the desktop item of a tile made by application_tile_new_with_info(),
+ * and adds the actions that depend on it. */
+static MateDesktopItem *
+application_tile_ensure_desktop_item (ApplicationTile *this)
+{
+	ApplicationTilePrivate *priv = application_tile_get_instance_private (this);
+
+	if (priv->desktop_item || priv->desktop_item_failed)
+		return priv->desktop_item;
+
+	priv->desktop_item = load_desktop_item_from_unknown (TILE (this)->uri);
+	if (! priv->desktop_item) {
+		priv->desktop_item_failed = TRUE;
+		return NULL;
+	}
+
+	add_help_action (this);
+
+	return priv->desktop_item;
+}
+
 static void
 application_tile_init (ApplicationTile *tile)
 {
@@ -249,29 +345,14 @@ application_tile_set_property (GObject *g_obj, guint prop_id, const GValue *valu
 }
 
 static void
-application_tile_setup (ApplicationTile *this)
+application_tile_setup_from_desktop_file (ApplicationTile *this)
 {
 	ApplicationTilePrivate *priv = application_tile_get_instance_private (this);
 
-	GtkWidget *image;
-	GtkWidget *header;
-	GtkWidget *subheader;
-	GtkMenu   *context_menu;
-	AtkObject *accessible;
-
-	TileAction  **actions;
-	TileAction   *action;
-	GtkWidget    *menu_item;
-	GtkContainer *menu_ctnr;
-
 	gchar *name;
 	gchar *desc;
-
 	gchar *comment;
 
-	gchar *markup;
-	gchar *str;
-
 	if (! priv->desktop_item) {
 		priv->desktop_item = load_desktop_item_from_unknown (TILE (this)->uri);
 
@@ -279,9 +360,6 @@ application_tile_setup (ApplicationTile *this)
 			return;
 	}
 
-	priv->image_id = g_strdup (mate_desktop_item_get_localestring (priv->desktop_item, "Icon"));
-	image = themed_icon_new (priv->image_id, priv->image_size);
-
 	gchar *filename = g_filename_from_uri (mate_desktop_item_get_location (priv->desktop_item), NULL, NULL);
 	GKeyFile *keyfile = g_key_file_new ();
 	g_key_file_load_from_file (keyfile, filename, G_KEY_FILE_KEEP_COMMENTS | G_KEY_FILE_KEEP_TRANSLATIONS, NULL);
@@ -290,6 +368,39 @@ application_tile_setup (ApplicationTile *this)
 	desc = g_key_file_get_locale_string (keyfile, G_KEY_FILE_DESKTOP_GROUP, "GenericName", NULL, NULL);
 	comment = g_key_file_get_locale_string (keyfile, G_KEY_FILE_DESKTOP_GROUP, "Comment", NULL, NULL);
 
+	application_tile_setup (this, name, desc, comment,
+		mate_desktop_item_get_localestring (priv->desktop_item, "Icon"));
+
+	g_free (name);
+	g_free (desc);
+	g_free (comment);
+	g_free (filename);
+	g_key_file_unref (keyfile);
+}
+
+static void
+application_tile_setup (ApplicationTile *this, const gchar *name, const gchar *desc,
+	const gchar *comment, const gchar *icon)
+{
+	ApplicationTilePrivate *priv = application_tile_get_instance_private (this);
+
+	GtkWidget *image;
+	GtkWidget *header;
+	GtkWidget *subheader;
+	GtkMenu   *context_menu;
+	AtkObject *accessible;
+
+	TileAction  **actions;
+	TileAction   *action;
+	GtkWidget    *menu_item;
+	GtkContainer *menu_ctnr;
+
+	gchar *markup;
+	gchar *str;
+
+	priv->image_id = g_strdup (icon);
+	image = themed_icon_new (priv->image_id, priv->image_size);
+
 	accessible = gtk_widget_get_accessible (GTK_WIDGET (this));
 	if (name)
 	  atk_object_set_name (accessible, name);
@@ -324,7 +435,7 @@ application_tile_setup (ApplicationTile *this)
 	priv->notify_signal_id = g_signal_connect (
 		G_OBJECT (priv->agent), "notify", G_CALLBACK (agent_notify_cb), this);
 
-	priv->startup_status  = get_desktop_item_startup_status (priv->desktop_item);
+	priv->startup_status  = get_startup_status (TILE (this)->uri);
 
 	actions = g_new0 (TileAction *, 6);
 
@@ -352,26 +463,10 @@ application_tile_setup (ApplicationTile *this)
 
 	gtk_container_add (menu_ctnr, gtk_separator_menu_item_new ());
 
-/* make help action */
+/* make help action, when the desktop item is loaded */
 
-	if (mate_desktop_item_get_string (priv->desktop_item, "DocPath")) {
-		action = tile_action_new (
-			TILE (this), help_trigger, _("Help"),
-			TILE_ACTION_OPENS_NEW_WINDOW | TILE_ACTION_OPENS_HELP);
-
-		menu_item = GTK_WIDGET (tile_action_get_menu_item (action));
-		gtk_container_add (menu_ctnr, menu_item);
-	}
-	else {
-		action = NULL;
-	}
-
-	actions [APPLICATION_TILE_ACTION_HELP] = action;
-
-/* insert separator */
-
-	if (action != NULL)
-		gtk_container_add (menu_ctnr, gtk_separator_menu_item_new ());
+	if (priv->desktop_item)
+		add_help_action (this);
 
 /* make "add/remove to favorites" action */
 
@@ -391,12 +486,37 @@ application_tile_setup (ApplicationTile *this)
 	}
 
 	gtk_widget_show_all (GTK_WIDGET (TILE (this)->context_menu));
+}
 
-	g_free (name);
-	g_free (desc);
-	g_free (comment);
-	g_free (filename);
-	g_key_file_unref (keyfile);
+/* The help item and its separator go after the start item and its
+ * separator. */
+static void
+add_help_action (ApplicationTile *this)
+{
+	ApplicationTilePrivate *priv = application_tile_get_instance_private (this);
+
+	TileAction *action;
+	GtkWidget  *menu_item;
+	GtkWidget  *separator;
+
+	if (TILE (this)->actions [APPLICATION_TILE_ACTION_HELP])
+		return;
+
+	if (! mate_desktop_item_get_string (priv->desktop_item, "DocPath"))
+		return;
+
+	action = tile_action_new (
+		TILE (this), help_trigger, _("Help"),
+		TILE_ACTION_OPENS_NEW_WINDOW | TILE_ACTION_OPENS_HELP);
+	TILE (this)->actions [APPLICATION_TILE_ACTION_HELP] = action;
+
+	menu_item = GTK_WIDGET (tile_action_get_menu_item (action));
+	separator = gtk_separator_menu_item_new ();
+
+	gtk_menu_shell_insert (GTK_MENU_SHELL (TILE (this)->context_menu), menu_item, 2);
+	gtk_menu_shell_insert (GTK_MENU_SHELL (TILE (this)->context_menu), separator, 3);
+	gtk_widget_show (menu_item);
+	gtk_widget_show (separator);
 }
 
 static GtkWidget *
@@ -462,16 +582,20 @@ static void
 start_trigger (Tile *tile, TileEvent *event, TileAction *action)
 {
 	ApplicationTile *this = APPLICATION_TILE (tile);
-	ApplicationTilePrivate *priv = application_tile_get_instance_private (this);
-	open_desktop_item_exec (priv->desktop_item);
+	MateDesktopItem *desktop_item = application_tile_ensure_desktop_item (this);
+
+	if (desktop_item)
+		open_desktop_item_exec (desktop_item);
 }
 
 static void
 help_trigger (Tile *tile, TileEvent *event, TileAction *action)
 {
 	ApplicationTile *this = APPLICATION_TILE (tile);
-	ApplicationTilePrivate *priv = application_tile_get_instance_private (this);
-	open_desktop_item_help (priv->desktop_item);
+	MateDesktopItem *desktop_item = application_tile_ensure_desktop_item (this);
+
+	if (desktop_item)
+		open_desktop_item_help (desktop_item);
 }
 
 static void
@@ -552,8 +676,7 @@ add_to_startup_list (ApplicationTile *this)
 	gchar *dst_uri;
 
 	desktop_item_filename =
-		g_filename_from_uri (mate_desktop_item_get_location (priv->desktop_item), NULL,
-		NULL);
+		g_filename_from_uri (TILE (this)->uri, NULL, NULL);
 
 	g_return_if_fail (desktop_item_filename != NULL);
 
@@ -566,7 +689,7 @@ add_to_startup_list (ApplicationTile *this)
 
 	dst_filename = g_build_filename (startup_dir, desktop_item_basename, NULL);
 
-	src_uri = mate_desktop_item_get_location (priv->desktop_item);
+	src_uri = TILE (this)->uri;
 	dst_uri = g_filename_to_uri (dst_filename, NULL, NULL);
 
 	copy_file (src_uri, dst_uri);
@@ -589,8 +712,7 @@ remove_from_startup_list (ApplicationTile *this)
 	gchar *src_filename;
 
 	ditem_filename =
-		g_filename_from_uri (mate_desktop_item_get_location (priv->desktop_item), NULL,
-		NULL);
+		g_filename_from_uri (TILE (this)->uri, NULL, NULL);
 
 	g_return_if_fail (ditem_filename != NULL);
 
@@ -614,10 +736,7 @@ remove_from_startup_list (ApplicationTile *this)
 MateDesktopItem *
 application_tile_get_desktop_item (ApplicationTile *tile)
 {
-        ApplicationTilePrivate *priv;
-
-        priv = application_tile_get_instance_private (tile);
-	return priv->desktop_item;
+	return application_tile_ensure_desktop_item (tile);
 }
 
 static void
@@ -673,62 +792,118 @@ update_user_list_menu_item (ApplicationTile *this)
 	gtk_widget_set_sensitive (item, (priv->agent_status != BOOKMARK_STORE_DEFAULT_ONLY));
 }
 
+/* The names of the desktop files in the autostart dirs, shared by all the
+ * tiles. A change in any of the dirs just marks the names stale, and they
+ * are read again on the next lookup.
+ */
+static GHashTable *autostart_global_names = NULL;
+static GHashTable *autostart_user_names = NULL;
+static GPtrArray  *autostart_global_dirs = NULL;
+static gchar      *autostart_user_dir = NULL;
+static gboolean    autostart_names_valid = FALSE;
+
+static void
+autostart_dir_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file,
+	GFileMonitorEvent event_type, gpointer user_data)
+{
+	autostart_names_valid = FALSE;
+}
+
+static void
+monitor_autostart_dir (const gchar *dirname)
+{
+	GFile *dir;
+	GFileMonitor *monitor;
+
+	dir = g_file_new_for_path (dirname);
+
+	/* the monitors live as long as the process */
+	monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_NONE, NULL, NULL);
+	if (monitor)
+		g_signal_connect (monitor, "changed", G_CALLBACK (autostart_dir_changed_cb), NULL);
+
+	g_object_unref (dir);
+}
+
+static void
+read_autostart_dir (GHashTable *names, const gchar *dirname)
+{
+	GDir *dir;
+	const gchar *name;
+
+	dir = g_dir_open (dirname, 0, NULL);
+	if (!dir)
+		return;
+
+	while ((name = g_dir_read_name (dir)))
+		g_hash_table_add (names, g_strdup (name));
+
+	g_dir_close (dir);
+}
+
+static void
+ensure_autostart_names (void)
+{
+	const gchar * const * global_dirs;
+	guint x;
+
+	if (!autostart_global_names) {
+		autostart_global_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		autostart_user_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		autostart_global_dirs = g_ptr_array_new_with_free_func (g_free);
+
+		global_dirs = g_get_system_config_dirs ();
+		for (x = 0; global_dirs[x]; x++)
+			g_ptr_array_add (autostart_global_dirs,
+				g_build_filename (global_dirs[x], "autostart", NULL));
+
+		/* mate-session currently checks these dirs also. see startup-programs.c */
+		global_dirs = g_get_system_data_dirs ();
+		for (x = 0; global_dirs[x]; x++)
+			g_ptr_array_add (autostart_global_dirs,
+				g_build_filename (global_dirs[x], "mate", "autostart", NULL));
+
+		autostart_user_dir = g_build_filename (g_get_user_config_dir (), "autostart", NULL);
+
+		for (x = 0; x < autostart_global_dirs->len; x++)
+			monitor_autostart_dir (g_ptr_array_index (autostart_global_dirs, x));
+		monitor_autostart_dir (autostart_user_dir);
+	}
+
+	if (autostart_names_valid)
+		return;
+
+	g_hash_table_remove_all (autostart_global_names);
+	g_hash_table_remove_all (autostart_user_names);
+
+	for (x = 0; x < autostart_global_dirs->len; x++)
+		read_autostart_dir (autostart_global_names, g_ptr_array_index (autostart_global_dirs, x));
+	read_autostart_dir (autostart_user_names, autostart_user_dir);
+
+	autostart_names_valid = TRUE;
+}
+
 static StartupStatus
-get_desktop_item_startup_status (MateDesktopItem *desktop_item)
+get_startup_status (const gchar *uri)
 {
 	gchar *filename;
 	gchar *basename;
 
-	const gchar * const * global_dirs;
-	gchar *global_target;
-	gchar *user_target;
-
 	StartupStatus retval;
-	gint x;
 
-	filename = g_filename_from_uri (mate_desktop_item_get_location (desktop_item), NULL, NULL);
+	filename = g_filename_from_uri (uri, NULL, NULL);
 	if (!filename)
 		return APP_NOT_ELIGIBLE;
 	basename = g_path_get_basename (filename);
 
-	retval = APP_NOT_IN_STARTUP_DIR;
-	global_dirs = g_get_system_config_dirs();
-	for(x=0; global_dirs[x]; x++)
-	{
-		global_target = g_build_filename (global_dirs[x], "autostart", basename, NULL);
-		if (g_file_test (global_target, G_FILE_TEST_EXISTS))
-		{
-			retval = APP_NOT_ELIGIBLE;
-			g_free (global_target);
-			break;
-		}
-		g_free (global_target);
-	}
+	ensure_autostart_names ();
 
-	/* mate-session currently checks these dirs also. see startup-programs.c */
-	if (retval != APP_NOT_ELIGIBLE)
-	{
-		global_dirs = g_get_system_data_dirs();
-		for(x=0; global_dirs[x]; x++)
-		{
-			global_target = g_build_filename (global_dirs[x], "mate", "autostart", basename, NULL);
-			if (g_file_test (global_target, G_FILE_TEST_EXISTS))
-			{
-				retval = APP_NOT_ELIGIBLE;
-				g_free (global_target);
-				break;
-			}
-			g_free (global_target);
-		}
-	}
-
-	if (retval != APP_NOT_ELIGIBLE)
-	{
-		user_target = g_build_filename (g_get_user_config_dir (), "autostart", basename, NULL);
-		if (g_file_test (user_target, G_FILE_TEST_EXISTS))
-			retval = APP_IN_USER_STARTUP_DIR;
-		g_free (user_target);
-	}
+	if (g_hash_table_contains (autostart_global_names, basename))
+		retval = APP_NOT_ELIGIBLE;
+	else if (g_hash_table_contains (autostart_user_names, basename))
+		retval = APP_IN_USER_STARTUP_DIR;
+	else
+		retval = APP_NOT_IN_STARTUP_DIR;
 
 	g_free (basename);
 	g_free (filename);
@@ -59,6 +59,9 @@ GType application_tile_get_type (void);
 GtkWidget *application_tile_new (const gchar * desktop_item_id);
 GtkWidget *application_tile_new_full (const gchar * desktop_item_id,
 	GtkIconSize icon_size, gboolean show_generic_name);
+GtkWidget *application_tile_new_with_info (const gchar * desktop_file_path,
+	GtkIconSize icon_size, gboolean show_generic_name,
+	const gchar * name, const gchar * desc, const gchar * comment, const gchar * icon);
 
 MateDesktopItem *application_tile_get_desktop_item (ApplicationTile * tile);
 
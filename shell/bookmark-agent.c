@@ -45,6 +45,9 @@
 
 #define GTK_BOOKMARKS_FILE "bookmarks"
 
+/* mutations of the store made within this many milliseconds are written out together */
+#define SAVE_STORE_DELAY 500
+
 #define TYPE_IS_RECENT(type) ((type) == BOOKMARK_STORE_RECENT_APPS || (type) == BOOKMARK_STORE_RECENT_DOCS)
 
 typedef struct {
@@ -73,8 +76,27 @@ typedef struct {
 
 	gchar                   *gtk_store_path;
 	GFileMonitor            *gtk_store_monitor;
+
+	guint                    save_id;
+	guint                    save_serial;
+	guint                    n_writes;
+	gboolean                 reload_pending;
+
+	/* guards the fields below, which are shared with the writer threads */
+	GMutex                   save_lock;
+	guint                    saved_serial;
+	gchar                   *saved_path;
+	gint64                   saved_mtime;
+	goffset                  saved_size;
 } BookmarkAgentPrivate;
 
+typedef struct {
+	gchar *path;
+	gchar *data;
+	gsize  length;
+	guint  serial;
+} SaveJob;
+
 enum {
 	PROP_0,
 	PROP_ITEMS,
@@ -108,6 +130,13 @@ static void create_app_item          (BookmarkAgent *, const gchar *);
 static void create_doc_item          (BookmarkAgent *, const gchar *);
 static void create_dir_item          (BookmarkAgent *, const gchar *);
 
+static gboolean save_store_timeout_cb (gpointer);
+static void     reload_deferred_store (BookmarkAgent *);
+static void     flush_store           (BookmarkAgent *);
+static SaveJob *save_job_new          (BookmarkAgent *);
+static void     save_job_free         (SaveJob *);
+static void     save_job_write        (BookmarkAgent *, SaveJob *);
+
 static void store_monitor_cb (GFileMonitor *, GFile *, GFile *,
                               GFileMonitorEvent, gpointer);
 static void weak_destroy_cb  (gpointer, GObject *);
@@ -472,6 +501,17 @@ bookmark_agent_init (BookmarkAgent *this)
 
 	priv->gtk_store_path      = NULL;
 	priv->gtk_store_monitor   = NULL;
+
+	priv->save_id             = 0;
+	priv->save_serial         = 0;
+	priv->n_writes            = 0;
+	priv->reload_pending      = FALSE;
+
+	g_mutex_init (& priv->save_lock);
+	priv->saved_serial        = 0;
+	priv->saved_path          = NULL;
+	priv->saved_mtime         = 0;
+	priv->saved_size          = -1;
 }
 
 static BookmarkAgent *
@@ -480,6 +520,7 @@ bookmark_agent_new (BookmarkStoreType type)
 	BookmarkAgent        *this;
 	BookmarkAgentPrivate *priv;
 	GFile *gtk_store_file;
+	GApplication *app;
 
 	this = g_object_new (BOOKMARK_AGENT_TYPE, NULL);
 	priv = bookmark_agent_get_instance_private (this);
@@ -560,6 +601,12 @@ bookmark_agent_new (BookmarkStoreType type)
 		priv->save_store  = save_xbel_store;
 	}
 
+	/* don't lose the last changes to the store if the application quits before
+	 * they are written out */
+	app = g_application_get_default ();
+	if (app)
+		g_signal_connect_object (app, "shutdown", G_CALLBACK (flush_store), this, G_CONNECT_SWAPPED);
+
 	update_agent (this);
 
 	return this;
@@ -612,6 +659,8 @@ finalize (GObject *g_obj)
 
 	gint i;
 
+	flush_store (this);
+
 	for (i = 0; priv->items && priv->items [i]; ++i)
 		bookmark_item_free (priv->items [i]);
 
@@ -640,6 +689,9 @@ finalize (GObject *g_obj)
 
 	g_bookmark_file_free (priv->store);
 
+	g_free (priv->saved_path);
+	g_mutex_clear (& priv->save_lock);
+
 	G_OBJECT_CLASS (bookmark_agent_parent_class)->finalize (g_obj);
 }
 
@@ -777,10 +829,69 @@ save_store (BookmarkAgent *this)
 	g_mkdir_with_parents (dir, 0700);
 	g_free (dir);
 
-	priv->save_store (this);
+	if (priv->save_store && ! priv->save_id)
+		priv->save_id = g_timeout_add (SAVE_STORE_DELAY, save_store_timeout_cb, this);
+
 	update_items (this);
 }
 
+static gboolean
+save_store_timeout_cb (gpointer user_data)
+{
+	BookmarkAgent *this = BOOKMARK_AGENT (user_data);
+	BookmarkAgentPrivate *priv = bookmark_agent_get_instance_private (this);
+
+	priv->save_id = 0;
+	priv->save_store (this);
+
+	reload_deferred_store (this);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Reads the store again if it changed on disk while our edits were on their
+ * way there, once they all are. */
+static void
+reload_deferred_store (BookmarkAgent *this)
+{
+	BookmarkAgentPrivate *priv = bookmark_agent_get_instance_private (this);
+
+	if (priv->reload_pending && ! priv->save_id && ! priv->n_writes) {
+		priv->reload_pending = FALSE;
+		update_agent (this);
+	}
+}
+
+static void
+flush_store (BookmarkAgent *this)
+{
+	BookmarkAgentPrivate *priv = bookmark_agent_get_instance_private (this);
+
+	SaveJob  *job;
+	gboolean  pending;
+
+	if (priv->save_id) {
+		g_source_remove (priv->save_id);
+		priv->save_id = 0;
+	}
+	else {
+		/* a write may still be running in a thread */
+		g_mutex_lock (& priv->save_lock);
+		pending = priv->saved_serial < priv->save_serial;
+		g_mutex_unlock (& priv->save_lock);
+
+		if (! pending)
+			return;
+	}
+
+	job = save_job_new (this);
+
+	if (job) {
+		save_job_write (this, job);
+		save_job_free (job);
+	}
+}
+
 static gint
 get_rank (BookmarkAgent *this, const gchar *uri)
 {
@@ -1040,22 +1151,133 @@ update_user_spec_path (BookmarkAgent *this)
 		g_free (path);
 }
 
-static void
-save_xbel_store (BookmarkAgent *this)
+static SaveJob *
+save_job_new (BookmarkAgent *this)
 {
 	BookmarkAgentPrivate *priv = bookmark_agent_get_instance_private (this);
 
-	GError *error = NULL;
+	SaveJob *job;
+	GError  *error = NULL;
 
-	if (g_bookmark_file_to_file (priv->store, priv->store_path, &error))
-		return;
+	job = g_new0 (SaveJob, 1);
+	job->data = g_bookmark_file_to_data (priv->store, & job->length, & error);
 
-	if (error) {
+	if (! job->data) {
 		g_warning ("Couldn't save bookmark file [%s]: %s", priv->store_path, error->message);
 		g_error_free (error);
-	} else {
-		g_warning ("Couldn't save bookmark file [%s]", priv->store_path);
+		g_free (job);
+
+		return NULL;
+	}
+
+	job->path   = g_strdup (priv->store_path);
+	job->serial = ++ priv->save_serial;
+
+	return job;
+}
+
+static void
+save_job_free (SaveJob *job)
+{
+	g_free (job->path);
+	g_free (job->data);
+	g_free (job);
+}
+
+static gboolean
+get_store_stamp (const gchar *path, gint64 *mtime, goffset *size)
+{
+	GFile     *file;
+	GFileInfo *info;
+
+	file = g_file_new_for_path (path);
+	info = g_file_query_info (file,
+		G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+		G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	g_object_unref (file);
+
+	if (! info)
+		return FALSE;
+
+	*mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+		g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+	*size  = g_file_info_get_size (info);
+
+	g_object_unref (info);
+
+	return TRUE;
+}
+
+/* Writes the store atomically, unless a later snapshot of it has already been
+ * written, and remembers what the file looks like afterwards so that the
+ * monitor can tell our own writes from the changes made by others. This may
+ * run in a thread. */
+static void
+save_job_write (BookmarkAgent *this, SaveJob *job)
+{
+	BookmarkAgentPrivate *priv = bookmark_agent_get_instance_private (this);
+
+	GError *error = NULL;
+
+	g_mutex_lock (& priv->save_lock);
+
+	if (job->serial > priv->saved_serial) {
+		if (g_file_set_contents (job->path, job->data, job->length, & error)) {
+			priv->saved_serial = job->serial;
+
+			g_free (priv->saved_path);
+			priv->saved_path = g_strdup (job->path);
+
+			if (! get_store_stamp (job->path, & priv->saved_mtime, & priv->saved_size))
+				priv->saved_size = -1;
+		}
+		else {
+			g_warning ("Couldn't save bookmark file [%s]: %s", job->path, error->message);
+			g_error_free (error);
+		}
 	}
+
+	g_mutex_unlock (& priv->save_lock);
+}
+
+static void
+save_xbel_store_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	save_job_write (BOOKMARK_AGENT (source_object), task_data);
+
+	g_task_return_boolean (task, TRUE);
+}
+
+static void
+save_xbel_store_done (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+	BookmarkAgent *this = BOOKMARK_AGENT (source_object);
+	BookmarkAgentPrivate *priv = bookmark_agent_get_instance_private (this);
+
+	priv->n_writes--;
+
+	reload_deferred_store (this);
+}
+
+static void
+save_xbel_store (BookmarkAgent *this)
+{
+	BookmarkAgentPrivate *priv = bookmark_agent_get_instance_private (this);
+
+	SaveJob *job;
+	GTask   *task;
+
+	job = save_job_new (this);
+
+	if (! job)
+		return;
+
+	priv->n_writes++;
+
+	task = g_task_new (this, NULL, save_xbel_store_done, NULL);
+	g_task_set_task_data (task, job, (GDestroyNotify) save_job_free);
+	g_task_run_in_thread (task, save_xbel_store_thread);
+	g_object_unref (task);
 }
 
 static void
@@ -1230,11 +1452,57 @@ create_dir_item (BookmarkAgent *this, const gchar *uri)
 	g_free (uri_new);
 }
 
+static gboolean
+is_own_write (BookmarkAgent *this, GFile *file)
+{
+	BookmarkAgentPrivate *priv = bookmark_agent_get_instance_private (this);
+
+	gchar    *path;
+	gchar    *saved_path;
+	gint64    mtime, saved_mtime;
+	goffset   size, saved_size;
+	gboolean  own = FALSE;
+
+	/* a writer thread holds the lock while it writes, only copy the stamp */
+	g_mutex_lock (& priv->save_lock);
+
+	saved_path  = g_strdup (priv->saved_path);
+	saved_mtime = priv->saved_mtime;
+	saved_size  = priv->saved_size;
+
+	g_mutex_unlock (& priv->save_lock);
+
+	path = g_file_get_path (file);
+
+	if (path && saved_path && saved_size >= 0 && ! strcmp (path, saved_path))
+		own = get_store_stamp (path, & mtime, & size) &&
+			mtime == saved_mtime && size == saved_size;
+
+	g_free (path);
+	g_free (saved_path);
+
+	return own;
+}
+
 static void
 store_monitor_cb (GFileMonitor *mon, GFile *f1, GFile *f2,
                   GFileMonitorEvent event_type, gpointer user_data)
 {
-	update_agent (BOOKMARK_AGENT (user_data));
+	BookmarkAgent *this = BOOKMARK_AGENT (user_data);
+	BookmarkAgentPrivate *priv = bookmark_agent_get_instance_private (this);
+
+	/* the store already holds what we wrote, don't read it back */
+	if (is_own_write (this, f1))
+		return;
+
+	/* reading the file now would drop the edits that aren't written yet,
+	 * read it once they are */
+	if (priv->save_id || priv->n_writes) {
+		priv->reload_pending = TRUE;
+		return;
+	}
+
+	update_agent (this);
 }
 
 static void
@@ -33,13 +33,22 @@
 #include <sys/stat.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/scrnsaver.h>
+#include <X11/extensions/sync.h>
 #include "drw-monitor.h"
 
+/* Seconds between two checks for activity while the user is active. */
+#define ACTIVITY_INTERVAL 3
+
 struct _DrwMonitorPriv {
 	XScreenSaverInfo *ss_info;
 	guint             timeout_id;
 	unsigned long     last_idle;
 
+	/* Used instead of polling when the server has an IDLETIME counter */
+	XSyncCounter      idle_counter;
+	XSyncAlarm        activity_alarm;
+	int               sync_event_base;
+
 	time_t            last_activity;
 };
 
@@ -53,6 +62,9 @@ static void     drw_monitor_class_init    (DrwMonitorClass *klass);
 static void     drw_monitor_init          (DrwMonitor      *monitor);
 static void     drw_monitor_finalize      (GObject         *object);
 static gboolean drw_monitor_setup         (DrwMonitor      *monitor);
+static GdkFilterReturn drw_monitor_event_filter (GdkXEvent  *gdk_xevent,
+						 GdkEvent   *event,
+						 gpointer    data);
 
 static GObjectClass *parent_class;
 static guint signals[LAST_SIGNAL] = { 0 };
@@ -122,8 +134,16 @@ drw_monitor_finalize (GObject *object)
 
         priv = monitor->priv;
 
-	g_source_remove (priv->timeout_id);
-	priv->timeout_id = 0;
+	if (priv->timeout_id) {
+		g_source_remove (priv->timeout_id);
+		priv->timeout_id = 0;
+	}
+
+	if (priv->activity_alarm != None) {
+		gdk_window_remove_filter (NULL, drw_monitor_event_filter, monitor);
+		XSyncDestroyAlarm (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+				   priv->activity_alarm);
+	}
 
 	if (priv->ss_info) {
 		XFree (priv->ss_info);
@@ -162,6 +182,171 @@ drw_monitor_timeout (DrwMonitor *monitor)
 	return TRUE;
 }
 
+/*
+ * With the IDLETIME counter of the SYNC extension, the server tells us
+ * when the user becomes active through an alarm, instead of us polling
+ * the idle time. Once activity is seen the alarm is left alone for
+ * ACTIVITY_INTERVAL seconds, so that typing does not wake us up on every
+ * key press, and it is only rearmed once the user has stopped.
+ */
+static gboolean
+drw_monitor_get_idle_time (DrwMonitor *monitor,
+			   gint64     *idle_time)
+{
+	XSyncValue value;
+
+	if (!XSyncQueryCounter (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+				monitor->priv->idle_counter, &value)) {
+		return FALSE;
+	}
+
+	*idle_time = ((gint64) XSyncValueHigh32 (value) << 32) | XSyncValueLow32 (value);
+
+	return TRUE;
+}
+
+static void
+drw_monitor_arm_alarm (DrwMonitor *monitor)
+{
+	DrwMonitorPriv       *priv;
+	Display              *display;
+	XSyncAlarmAttributes  attr;
+	gint64                idle_time;
+	unsigned long         flags;
+
+	priv = monitor->priv;
+	display = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+
+	if (!drw_monitor_get_idle_time (monitor, &idle_time)) {
+		return;
+	}
+
+	/* Fires as soon as the idle time drops below its current value */
+	attr.trigger.counter = priv->idle_counter;
+	attr.trigger.value_type = XSyncAbsolute;
+	attr.trigger.test_type = XSyncNegativeTransition;
+	XSyncIntsToValue (&attr.trigger.wait_value,
+			  (unsigned int) MAX (idle_time, 1),
+			  (int) (MAX (idle_time, 1) >> 32));
+	XSyncIntToValue (&attr.delta, 0);
+	attr.events = True;
+
+	flags = XSyncCACounter | XSyncCAValueType | XSyncCATestType |
+		XSyncCAValue | XSyncCADelta | XSyncCAEvents;
+
+	if (priv->activity_alarm == None) {
+		priv->activity_alarm = XSyncCreateAlarm (display, flags, &attr);
+	} else {
+		XSyncChangeAlarm (display, priv->activity_alarm, flags, &attr);
+	}
+}
+
+static gboolean drw_monitor_rearm (DrwMonitor *monitor);
+
+static void
+drw_monitor_activity (DrwMonitor *monitor)
+{
+	DrwMonitorPriv *priv;
+	time_t          now;
+
+	priv = monitor->priv;
+	now = time (NULL);
+
+	if (now - priv->last_activity < 25) {
+		g_signal_emit (monitor, signals[ACTIVITY], 0, NULL);
+	}
+
+	priv->last_activity = now;
+
+	priv->timeout_id = g_timeout_add_seconds (ACTIVITY_INTERVAL,
+						  (GSourceFunc) drw_monitor_rearm,
+						  monitor);
+}
+
+static gboolean
+drw_monitor_rearm (DrwMonitor *monitor)
+{
+	gint64 idle_time;
+
+	monitor->priv->timeout_id = 0;
+
+	if (drw_monitor_get_idle_time (monitor, &idle_time) &&
+	    idle_time < ACTIVITY_INTERVAL * 1000) {
+		/* The user kept going while the alarm was ignored */
+		drw_monitor_activity (monitor);
+	} else {
+		drw_monitor_arm_alarm (monitor);
+	}
+
+	return FALSE;
+}
+
+static GdkFilterReturn
+drw_monitor_event_filter (GdkXEvent *gdk_xevent,
+			  GdkEvent  *event,
+			  gpointer   data)
+{
+	DrwMonitor            *monitor = data;
+	DrwMonitorPriv        *priv = monitor->priv;
+	XEvent                *xevent = gdk_xevent;
+	XSyncAlarmNotifyEvent *alarm_event;
+
+	if (xevent->type != priv->sync_event_base + XSyncAlarmNotify) {
+		return GDK_FILTER_CONTINUE;
+	}
+
+	alarm_event = (XSyncAlarmNotifyEvent *) xevent;
+
+	if (alarm_event->alarm == priv->activity_alarm && priv->timeout_id == 0) {
+		drw_monitor_activity (monitor);
+	}
+
+	return GDK_FILTER_CONTINUE;
+}
+
+static gboolean
+drw_monitor_setup_alarm (DrwMonitor *monitor)
+{
+	DrwMonitorPriv     *priv;
+	Display            *display;
+	XSyncSystemCounter *counters;
+	int                 error_base;
+	int                 major, minor;
+	int                 n_counters, i;
+
+	priv = monitor->priv;
+	display = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+
+	if (!XSyncQueryExtension (display, &priv->sync_event_base, &error_base) ||
+	    !XSyncInitialize (display, &major, &minor)) {
+		return FALSE;
+	}
+
+	counters = XSyncListSystemCounters (display, &n_counters);
+	for (i = 0; i < n_counters; i++) {
+		if (g_strcmp0 (counters[i].name, "IDLETIME") == 0) {
+			priv->idle_counter = counters[i].counter;
+			break;
+		}
+	}
+	XSyncFreeSystemCounterList (counters);
+
+	if (priv->idle_counter == None) {
+		return FALSE;
+	}
+
+	priv->last_activity = time (NULL);
+
+	drw_monitor_arm_alarm (monitor);
+	if (priv->activity_alarm == None) {
+		return FALSE;
+	}
+
+	gdk_window_add_filter (NULL, drw_monitor_event_filter, monitor);
+
+	return TRUE;
+}
+
 static gboolean
 drw_monitor_setup (DrwMonitor *monitor)
 {
@@ -171,6 +356,11 @@ drw_monitor_setup (DrwMonitor *monitor)
 
 	priv = monitor->priv;
 
+	if (drw_monitor_setup_alarm (monitor)) {
+		return TRUE;
+	}
+
+	/* Fall back to polling the idle time */
 	if (!XScreenSaverQueryExtension (GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), &event_base, &error_base)) {
 		return FALSE;
 	}
@@ -179,7 +369,7 @@ drw_monitor_setup (DrwMonitor *monitor)
 
 	priv->last_activity = time (NULL);
 
-	priv->timeout_id = g_timeout_add_seconds (3, (GSourceFunc) drw_monitor_timeout, monitor);
+	priv->timeout_id = g_timeout_add_seconds (ACTIVITY_INTERVAL, (GSourceFunc) drw_monitor_timeout, monitor);
 
 	return TRUE;
 }